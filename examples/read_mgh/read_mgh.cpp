@@ -40,8 +40,7 @@ int main(int argc, char** argv) {
     std::cout << "The data type is " << mgh2.header.dtype << " and the length of mgh.data.data_mri_uchar is " << mgh2.data.data_mri_uchar.size() << ".\n";
     std::cout << "The RAS part of the header is valid: " << (mgh2.header.ras_good_flag ? "yes" : "no" ) << ".\n";
     // Optional: Put the data into an Array4D for more convenient access to the voxel indices.
-    fs::Array4D<uint8_t> ar2(&mgh2.header);
-    ar2.data = mgh2.data.data_mri_uchar;
+    fs::Array4D<uint8_t> ar2(mgh2.header, std::move(mgh2.data.data_mri_uchar));  // Takes the data without copying it.
     std::cout << "The value at voxel (99,99,99,0) is: " << (unsigned int)ar2.at(99,99,99,0) << ".\n";
 
 
@@ -56,8 +55,7 @@ int main(int argc, char** argv) {
     std::cout << "The data type is " << mgh3.header.dtype << " and the length of mgh.data.data_mri_uchar is " << mgh3.data.data_mri_uchar.size() << ".\n";
     std::cout << "The RAS part of the header is valid: " << (mgh3.header.ras_good_flag ? "yes" : "no" ) << ".\n";
     // Optional: Put the data into an Array4D for more convenient access to the voxel indices.
-    fs::Array4D<uint8_t> ar3(&mgh3.header);
-    ar3.data = mgh3.data.data_mri_uchar;
+    fs::Array4D<uint8_t> ar3(mgh3.header, std::move(mgh3.data.data_mri_uchar));  // Takes the data without copying it.
     std::cout << "The value at voxel (99,99,99,0) is: " << (unsigned int)ar3.at(99,99,99,0) << ".\n";
 
     exit(0);
@@ -57,8 +57,7 @@ int main(int argc, char** argv) {
     std::cout << "The RAS part of the header is valid: " << (mgh2.header.ras_good_flag ? "yes" : "no" ) << ".\n";
 
     // Optional: Put the data into an Array4D for more convenient access to the voxel indices.
-    fs::Array4D<uint8_t> ar2(&mgh2.header);
-    ar2.data = mgh2.data.data_mri_uchar;
+    fs::Array4D<uint8_t> ar2(mgh2.header, std::move(mgh2.data.data_mri_uchar));  // Takes the data without copying it.
     std::cout << "The value at voxel (99,99,99,0) is: " << (unsigned int)ar2.at(99,99,99,0) << ".\n";
 
 
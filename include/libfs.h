@@ -2,8 +2,10 @@
 
 #include <iostream>
 #include <climits>
+#include <limits>
 #include <stdio.h>
 #include <vector>
+#include <array>
 #include <fstream>
 #include <cassert>
 #include <sstream>
@@ -13,8 +15,50 @@
 #include <unordered_map>
 #include <cmath>
 #include <algorithm>
+#include <numeric>
 #include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <clocale>
+#include <cerrno>
+#include <memory>
+#include <new>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+
+#if (defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef LIBFS_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 
 #define LIBFS_VERSION "0.3.4"
@@ -74,6 +118,15 @@
  *   - Currently all debug output goes to `stdout`, i.e., typically to the terminal.
  *
  *
+ * \subsection instrumentation Instrumentation
+ *
+ * To find out where the time goes inside libfs calls without an external profiler, `#define LIBFS_INSTRUMENT` before including 'libfs.h',
+ * and set a sink with `fs::set_instrument_sink`. The I/O, smoothing and neighborhood functions then report scoped timers (e.g., `read_mgh`)
+ * and counters (e.g., `read_mgh.bytes`, `smooth_pvd_nn.vertex_updates`) as `fs::InstrumentEvent`s. `fs::InstrumentRecorder` is a thread-safe
+ * sink that aggregates them per name. You can use the `LIBFS_INSTRUMENT_SCOPE(name)` and `LIBFS_INSTRUMENT_COUNT(name, value)` macros in
+ * your own code as well. Without `LIBFS_INSTRUMENT`, the macros compile to nothing.
+ *
+ *
  * \subsection intro-website The libfs project website
  *
  * The project page for libfs can be found at https://github.com/dfsp-spirit/libfs. It contains information on all documentation available for libfs.
@@ -128,6 +181,28 @@
 
 // End of debug handling.
 
+// Instrumentation. Define LIBFS_INSTRUMENT before including 'libfs.h' to make libfs report timings and
+// counters to the sink set with fs::set_instrument_sink. Without it, the macros compile to nothing.
+#ifdef LIBFS_INSTRUMENT
+#define LIBFS_INSTRUMENT_CONCAT_INNER(a, b) a##b
+#define LIBFS_INSTRUMENT_CONCAT(a, b) LIBFS_INSTRUMENT_CONCAT_INNER(a, b)
+#define LIBFS_INSTRUMENT_SCOPE(name) fs::_InstrumentScope LIBFS_INSTRUMENT_CONCAT(_libfs_instrument_scope_, __LINE__)(name)
+#define LIBFS_INSTRUMENT_COUNT(name, value) fs::_instrument_emit(name, fs::INSTRUMENT_COUNTER, uint64_t(value))
+#else
+#define LIBFS_INSTRUMENT_SCOPE(name) ((void)0)
+#define LIBFS_INSTRUMENT_COUNT(name, value) ((void)0)
+#endif
+
+// Determine the byte order of the host system at compile time. Users can overwrite this by
+// defining LIBFS_HOST_BIG_ENDIAN as 0 or 1 before including 'libfs.h'.
+#ifndef LIBFS_HOST_BIG_ENDIAN
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define LIBFS_HOST_BIG_ENDIAN 1
+#else
+#define LIBFS_HOST_BIG_ENDIAN 0
+#endif
+#endif
+
 namespace fs {
 
   namespace util {
@@ -245,6 +320,95 @@ namespace fs {
       return result;
     }
 
+    /// @brief Sort 64 bit unsigned integers in place using a least significant digit radix sort with 16 bit digits.
+    /// @details Digit passes above the highest set bit of `max_value` are skipped, so sorting keys that use only the lower bits is cheaper.
+    /// @param values the values to sort, modified in place.
+    /// @param max_value an upper bound for the values.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    inline void _radix_sort_u64(std::vector<uint64_t>* values, const uint64_t max_value) {
+      const size_t n = values->size();
+      if(n < 2) {
+        return;
+      }
+      std::vector<uint64_t> tmp(n);
+      std::vector<size_t> counts(65536);
+      uint64_t* src = values->data();
+      uint64_t* dst = tmp.data();
+      for(unsigned shift = 0; shift < 64 && (max_value >> shift) != 0; shift += 16) {
+        std::fill(counts.begin(), counts.end(), 0);
+        for(size_t i = 0; i < n; i++) {
+          counts[(src[i] >> shift) & 0xFFFF]++;
+        }
+        size_t sum = 0;
+        for(size_t d = 0; d < counts.size(); d++) {
+          const size_t c = counts[d];
+          counts[d] = sum;
+          sum += c;
+        }
+        for(size_t i = 0; i < n; i++) {
+          dst[counts[(src[i] >> shift) & 0xFFFF]++] = src[i];
+        }
+        std::swap(src, dst);
+      }
+      if(src != values->data()) {
+        std::copy(src, src + n, values->data());
+      }
+    }
+
+    /// @brief Spread the lower 21 bits of a value, so that bit `i` moves to bit `3i`. Used to interleave three coordinates into a Morton code.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    inline uint64_t _spread_bits3(uint64_t v) {
+      v &= 0x1FFFFFULL;
+      v = (v | (v << 32)) & 0x1F00000000FFFFULL;
+      v = (v | (v << 16)) & 0x1F0000FF0000FFULL;
+      v = (v | (v << 8)) & 0x100F00F00F00F00FULL;
+      v = (v | (v << 4)) & 0x10C30C30C30C30C3ULL;
+      v = (v | (v << 2)) & 0x1249249249249249ULL;
+      return v;
+    }
+
+    /// @brief Compute the position of a point with integer coordinates of `bits` bits each on the 3D Morton (Z-order) or Hilbert curve.
+    /// @details The Hilbert index uses John Skilling's transform of the coordinates into the transposed Hilbert index (Skilling, 2004, AIP Conf. Proc. 707), followed by the same bit interleaving as the Morton code.
+    /// @param x the coordinates, each less than `2^bits`. Modified.
+    /// @param bits number of bits per coordinate, at most 21.
+    /// @param hilbert whether to compute the Hilbert index (`true`) or the Morton code (`false`).
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    inline uint64_t _curve_index3(uint32_t x[3], const unsigned bits, const bool hilbert) {
+      if(hilbert && bits > 0) {
+        const uint32_t m = 1u << (bits - 1);
+        for(uint32_t q = m; q > 1; q >>= 1) {
+          const uint32_t p = q - 1;
+          for(size_t i = 0; i < 3; i++) {
+            if(x[i] & q) {
+              x[0] ^= p;
+            } else {
+              const uint32_t t = (x[0] ^ x[i]) & p;
+              x[0] ^= t;
+              x[i] ^= t;
+            }
+          }
+        }
+        x[1] ^= x[0];
+        x[2] ^= x[1];
+        uint32_t t = 0;
+        for(uint32_t q = m; q > 1; q >>= 1) {
+          if(x[2] & q) {
+            t ^= q - 1;
+          }
+        }
+        for(size_t i = 0; i < 3; i++) {
+          x[i] ^= t;
+        }
+      }
+      return (_spread_bits3(x[0]) << 2) | (_spread_bits3(x[1]) << 1) | _spread_bits3(x[2]);
+    }
+
     /// @brief Flatten 2D vector.
     /// @param values the input 2D vector.
     /// @return 1D vector.
@@ -273,6 +437,65 @@ namespace fs {
       return result;
     }
 
+    /// @brief Interleave several equally long channels into one vertex-major vector.
+    /// @details For `K` channels of length `N`, the result has length `K*N`, and the value of channel `c` for element `i` is stored at index `i*K + c`. All channel values of one element are adjacent in memory, which is the layout expected by `fs::Mesh::smooth_pvd_nn_batch`.
+    /// @param channels the `K` input channels, all of the same length `N`.
+    /// @return the interleaved data.
+    /// @throws std::invalid_argument if the channels differ in length.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// std::vector<std::vector<float>> channels = { { 1.0, 2.0 }, { 10.0, 20.0 } };
+    /// std::vector<float> res = fs::util::interleave(channels); // { 1.0, 10.0, 2.0, 20.0 }
+    /// @endcode
+    template <typename T>
+    std::vector<T> interleave(const std::vector<std::vector<T>>& channels) {
+      const size_t num_channels = channels.size();
+      const size_t n = channels.empty() ? 0 : channels[0].size();
+      for(size_t c = 0; c < num_channels; c++) {
+        if(channels[c].size() != n) {
+          throw std::invalid_argument("All channels must have the same length, but channel " + std::to_string(c) + " has length " + std::to_string(channels[c].size()) + " instead of " + std::to_string(n) + ".\n");
+        }
+      }
+      std::vector<T> result(num_channels * n);
+      for(size_t c = 0; c < num_channels; c++) {
+        const T* src = channels[c].data();
+        for(size_t i = 0; i < n; i++) {
+          result[i * num_channels + c] = src[i];
+        }
+      }
+      return result;
+    }
+
+    /// @brief Split vertex-major interleaved data into separate channels, the inverse of `fs::util::interleave`.
+    /// @param values the interleaved data, its length must be a multiple of `num_channels`.
+    /// @param num_channels the number of channels `K`, must be greater than 0.
+    /// @return `K` vectors of length `values.size() / K`.
+    /// @throws std::invalid_argument if `num_channels` is 0 or does not divide the length of `values`.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// std::vector<float> values = { 1.0, 10.0, 2.0, 20.0 };
+    /// std::vector<std::vector<float>> res = fs::util::deinterleave(values, 2); // { { 1.0, 2.0 }, { 10.0, 20.0 } }
+    /// @endcode
+    template <typename T>
+    std::vector<std::vector<T>> deinterleave(const std::vector<T>& values, const size_t num_channels) {
+      if(num_channels == 0 || values.size() % num_channels != 0) {
+        throw std::invalid_argument("Length " + std::to_string(values.size()) + " of interleaved data is not a multiple of the number of channels " + std::to_string(num_channels) + ".\n");
+      }
+      const size_t n = values.size() / num_channels;
+      std::vector<std::vector<T>> channels(num_channels, std::vector<T>(n));
+      for(size_t c = 0; c < num_channels; c++) {
+        T* dst = channels[c].data();
+        for(size_t i = 0; i < n; i++) {
+          dst[i] = values[i * num_channels + c];
+        }
+      }
+      return channels;
+    }
+
     /// @brief Check whether a string starts with the given prefix.
     /// @private
     /// @note This is a private function, users should call the overloaded version that accepts
@@ -373,6 +596,115 @@ namespace fs {
       return fp;
     }
 
+    /// @brief List the entries of a single directory, split into regular files and subdirectories.
+    /// @details Symbolic links are resolved. Links to directories are not reported as subdirectories, so that a recursive walk cannot run into cycles.
+    /// @return false if the directory cannot be opened.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    bool _list_dir(const std::string& dir, std::vector<std::string>* files, std::vector<std::string>* subdirs) {
+      const std::string prefix = (dir.empty() || ends_with(dir, "/")) ? dir : dir + "/";
+      std::vector<std::string> dir_files, dir_subdirs;
+      #if (defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+      WIN32_FIND_DATAA fd;
+      HANDLE h = ::FindFirstFileA((prefix + "*").c_str(), &fd);
+      if(h == INVALID_HANDLE_VALUE) {
+        return false;
+      }
+      do {
+        const std::string name(fd.cFileName);
+        if(name == "." || name == "..") {
+          continue;
+        }
+        if(fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+          if(! (fd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)) {
+            dir_subdirs.push_back(prefix + name);
+          }
+        } else {
+          dir_files.push_back(prefix + name);
+        }
+      } while(::FindNextFileA(h, &fd));
+      ::FindClose(h);
+      #else
+      DIR* d = ::opendir(dir.c_str());
+      if(d == nullptr) {
+        return false;
+      }
+      while(struct dirent* entry = ::readdir(d)) {
+        const std::string name(entry->d_name);
+        if(name == "." || name == "..") {
+          continue;
+        }
+        const std::string path = prefix + name;
+        bool is_dir = false, is_file = false, needs_stat = true;
+        #ifdef DT_DIR
+        if(entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) {  // Avoid the stat call if the file system reports the type.
+          is_dir = entry->d_type == DT_DIR;
+          is_file = entry->d_type == DT_REG;
+          needs_stat = false;
+        }
+        #endif
+        if(needs_stat) {
+          struct stat st;
+          if(::lstat(path.c_str(), &st) == 0) {
+            is_dir = S_ISDIR(st.st_mode);
+            is_file = S_ISREG(st.st_mode) || (S_ISLNK(st.st_mode) && ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode));
+          }
+        }
+        if(is_dir) {
+          dir_subdirs.push_back(path);
+        } else if(is_file) {
+          dir_files.push_back(path);
+        }
+      }
+      ::closedir(d);
+      #endif
+      std::sort(dir_files.begin(), dir_files.end());
+      std::sort(dir_subdirs.begin(), dir_subdirs.end());
+      files->insert(files->end(), dir_files.begin(), dir_files.end());
+      subdirs->insert(subdirs->end(), dir_subdirs.begin(), dir_subdirs.end());
+      return true;
+    }
+
+    /// @brief Append the regular files in a directory and all its subdirectories to `files`, see `fs::util::list_files`. Directories that cannot be opened are skipped.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    void _walk_dir(const std::string& dir, std::vector<std::string>* files) {
+      std::vector<std::string> subdirs;
+      if(_list_dir(dir, files, &subdirs)) {
+        for(size_t i = 0; i < subdirs.size(); i++) {
+          _walk_dir(subdirs[i], files);
+        }
+      }
+    }
+
+    /// @brief List the regular files in a directory, optionally including all subdirectories.
+    /// @details Within each directory, the files are sorted by name and come before the files of its subdirectories, so the order is deterministic. Symbolic links to files are listed, symbolic links to directories are not followed.
+    /// @param dir the directory to list.
+    /// @param recursive whether to descend into subdirectories.
+    /// @return the paths of the files, each starting with `dir`.
+    /// @throws std::runtime_error if `dir` cannot be opened. Subdirectories that cannot be opened are skipped.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// std::vector<std::string> files = fs::util::list_files("./study1/subject1", true);
+    /// @endcode
+    std::vector<std::string> list_files(const std::string& dir, const bool recursive = true) {
+      std::vector<std::string> files;
+      std::vector<std::string> subdirs;
+      if(! _list_dir(dir, &files, &subdirs)) {
+        throw std::runtime_error("Unable to open directory '" + dir + "'.\n");
+      }
+      if(recursive) {
+        for(size_t i = 0; i < subdirs.size(); i++) {
+          _walk_dir(subdirs[i], &files);
+        }
+      }
+      return files;
+    }
+
     /// @brief Write the given text representation (any string) to a file.
     /// @param filename the file to which to write, will be overwritten if exists
     /// @param rep the string to write to the file
@@ -397,2168 +729,8191 @@ namespace fs {
       }
     }
 
-  }  // End namespace util.
 
+    /// @brief A read-only memory mapping of a whole file.
+    /// @details Uses POSIX `mmap` or the Windows `MapViewOfFile` API. The mapping is released when the instance is destroyed. Instances can be moved, but not copied.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::util::MappedFile mf("lh.thickness");
+    /// size_t num_bytes = mf.size();
+    /// const unsigned char* bytes = mf.data();
+    /// @endcode
+    struct MappedFile {
+      /// Construct an empty instance that maps no file.
+      MappedFile() : _data(nullptr), _size(0) {}
+
+      /// @brief Map the given file into memory.
+      /// @throws std::runtime_error if the file cannot be opened or mapped.
+      explicit MappedFile(const std::string& filename) : _data(nullptr), _size(0) {
+        _map(filename);
+      }
 
-  // MRI data types, used by the MGH functions.
+      MappedFile(const MappedFile&) = delete;
+      MappedFile& operator=(const MappedFile&) = delete;
 
-  /// MRI data type representing an 8 bit unsigned integer.
-  const int MRI_UCHAR = 0;
+      /// Move constructor, the source instance is left empty.
+      MappedFile(MappedFile&& other) : _data(other._data), _size(other._size) {
+        other._data = nullptr;
+        other._size = 0;
+      }
 
-  /// MRI data type representing a 32 bit signed integer.
-  const int MRI_INT = 1;
+      /// Move assignment, the source instance is left empty.
+      MappedFile& operator=(MappedFile&& other) {
+        if(this != &other) {
+          _unmap();
+          _data = other._data;
+          _size = other._size;
+          other._data = nullptr;
+          other._size = 0;
+        }
+        return *this;
+      }
 
-  /// MRI data type representing a 32 bit float.
-  const int MRI_FLOAT = 3;
+      ~MappedFile() {
+        _unmap();
+      }
 
-  /// MRI data type representing a 16 bit signed integer.
-  const int MRI_SHORT = 4;
+      /// Get a pointer to the first byte of the mapped file, or `nullptr` if no file is mapped.
+      const unsigned char* data() const { return _data; }
 
-  // Forward declarations.
-  int _fread3(std::istream&);
-  template <typename T> T _freadt(std::istream&);
-  std::string _freadstringnewline(std::istream&);
-  std::string _freadfixedlengthstring(std::istream&, size_t, bool);
-  bool _ends_with(std::string const &fullString, std::string const &ending);
-  size_t _vidx_2d(size_t, size_t, size_t);
-  struct MghHeader;
+      /// Get the size of the mapped file, in bytes.
+      size_t size() const { return _size; }
 
-  /// @brief Models a triangular mesh, used for brain surface meshes.
-  ///
-  /// @details Represents a vertex-indexed mesh. The `n` vertices are stored as 3D point coordinates (x,y,z) in a vector
-  /// of length `3n`, in which 3 consecutive values represent the x, y and z coordinate of the same vertex.
-  /// The `m` faces are stored as a vector of `3m` integers, where 3 consecutive values represent the 3 vertices (by index)
-  /// making up the respective face. Vertex indices are 0-based.
-  /// #### Examples
-  ///
-  /// @code
-  /// fs::Mesh surface = fs::Mesh::construct_cube();
-  /// size_t nv = surface.num_vertices(); // 8
-  /// auto first_face_verts = surface.face_vertices(0);
-  /// int first_face_third_vert = surface.fm_at(0, 2);
-  /// size_t nf = surface.num_faces();
-  /// size_t nv = surface.num_vertices();
-  /// surface.to_obj("cube_out.obj");
-  /// @endcode
-  struct Mesh {
+      /// Whether a file is currently mapped.
+      bool is_open() const { return _data != nullptr; }
 
-    /// Construct a Mesh from the given vertices and faces.
-    Mesh(std::vector<float> cvertices, std::vector<int32_t> cfaces) {
-      vertices = cvertices; faces = cfaces;
-    }
+      private:
+      const unsigned char* _data;
+      size_t _size;
 
-    // Construct from 2D vectors (Nx3).
-    Mesh(std::vector<std::vector<float>> cvertices, std::vector<std::vector<int32_t>> cfaces) {
-      vertices = util::vflatten(cvertices); faces = util::vflatten(cfaces);
-    }
+      void _map(const std::string& filename) {
+        #if (defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+          HANDLE fh = ::CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+          if(fh == INVALID_HANDLE_VALUE) {
+            throw std::runtime_error("Unable to open file '" + filename + "' for memory mapping.\n");
+          }
+          LARGE_INTEGER fsize;
+          if(! ::GetFileSizeEx(fh, &fsize) || fsize.QuadPart == 0) {
+            ::CloseHandle(fh);
+            throw std::runtime_error("Unable to memory map empty or inaccessible file '" + filename + "'.\n");
+          }
+          HANDLE mh = ::CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+          ::CloseHandle(fh);
+          if(mh == NULL) {
+            throw std::runtime_error("Unable to memory map file '" + filename + "'.\n");
+          }
+          void* addr = ::MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+          ::CloseHandle(mh);  // The view keeps the mapping alive.
+          if(addr == NULL) {
+            throw std::runtime_error("Unable to memory map file '" + filename + "'.\n");
+          }
+          _size = size_t(fsize.QuadPart);
+        #else
+          int fd = ::open(filename.c_str(), O_RDONLY);
+          if(fd < 0) {
+            throw std::runtime_error("Unable to open file '" + filename + "' for memory mapping.\n");
+          }
+          struct stat st;
+          if(::fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            throw std::runtime_error("Unable to memory map empty or inaccessible file '" + filename + "'.\n");
+          }
+          void* addr = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+          ::close(fd);  // The mapping stays valid after closing the descriptor.
+          if(addr == MAP_FAILED) {
+            throw std::runtime_error("Unable to memory map file '" + filename + "'.\n");
+          }
+          _size = size_t(st.st_size);
+        #endif
+        _data = static_cast<const unsigned char*>(addr);
+      }
 
-    /// Construct an empty Mesh.
-    Mesh() {}
+      void _unmap() {
+        if(_data != nullptr) {
+          #if (defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+            ::UnmapViewOfFile(_data);
+          #else
+            ::munmap(const_cast<unsigned char*>(_data), _size);
+          #endif
+          _data = nullptr;
+          _size = 0;
+        }
+      }
+    };
 
-    std::vector<float> vertices;  ///< *n x 3* vector of the *x*,*y*,*z* coordinates for the *n* vertices. The x,y,z coordinates for a single vertex form consecutive entries.
-    std::vector<int32_t> faces;  ///< *n x 3* vector of the 3 vertex indices for the *n* triangles or faces. The 3 vertices of a single face form consecutive entries.
 
-    /// @brief Construct and return a simple cube mesh.
-    /// @return fs::Mesh instance representing a cube.
+    /// @brief A read-only stream buffer over a memory range, which is not copied.
+    /// @details Used to parse small file headers that were read with a single call by the same code that parses streams, without constructing a file stream. Seeking is not supported.
+    class MemInBuf : public std::streambuf {
+      public:
+      /// @brief Create a stream buffer that reads the `size` bytes starting at `data`. The memory must stay valid while the buffer is in use.
+      MemInBuf(const char* data, size_t size) {
+        char* begin = const_cast<char*>(data);  // The get area is never written to.
+        setg(begin, begin, begin + size);
+      }
+    };
+
+
+    #ifdef LIBFS_WITH_ZLIB
+    /// @brief A read-only stream buffer that decompresses a gzip file in large chunks.
+    /// @details Only available if libfs is compiled with `LIBFS_WITH_ZLIB` defined. Large reads, like the bulk reads of MGH voxel data, are decompressed directly into the destination memory, bypassing the internal buffer. Seeking relative to the beginning or the current position is supported, but forward seeks have to decompress the data in between, and backward seeks beyond the buffer restart decompression at the beginning of the file.
+    class GzInBuf : public std::streambuf {
+      public:
+      /// Size of the internal buffer, in bytes.
+      static const size_t BUFSIZE = 256 * 1024;
+
+      /// @brief Open the given gzip file for reading.
+      /// @throws std::runtime_error if the file cannot be opened.
+      explicit GzInBuf(const std::string& filename) : _buf(BUFSIZE) {
+        _gzf = gzopen(filename.c_str(), "rb");
+        if(_gzf == NULL) {
+          throw std::runtime_error("Unable to open gzip file '" + filename + "'.\n");
+        }
+        gzbuffer(_gzf, static_cast<unsigned>(BUFSIZE));
+        setg(_buf.data(), _buf.data(), _buf.data());
+      }
+
+      GzInBuf(const GzInBuf&) = delete;
+      GzInBuf& operator=(const GzInBuf&) = delete;
+
+      ~GzInBuf() {
+        gzclose(_gzf);
+      }
+
+      protected:
+      int_type underflow() override {
+        if(gptr() < egptr()) {
+          return traits_type::to_int_type(*gptr());
+        }
+        int num_read = gzread(_gzf, _buf.data(), static_cast<unsigned>(_buf.size()));
+        if(num_read <= 0) {
+          return traits_type::eof();
+        }
+        setg(_buf.data(), _buf.data(), _buf.data() + num_read);
+        return traits_type::to_int_type(*gptr());
+      }
+
+      std::streamsize xsgetn(char* dest, std::streamsize count) override {
+        std::streamsize done = 0;
+        // Drain what is left in the buffer first.
+        std::streamsize num_buffered = std::min<std::streamsize>(count, egptr() - gptr());
+        if(num_buffered > 0) {
+          std::memcpy(dest, gptr(), size_t(num_buffered));
+          gbump(int(num_buffered));
+          done += num_buffered;
+        }
+        if(count - done >= std::streamsize(_buf.size())) {
+          // Large request: decompress straight into the destination.
+          while(done < count) {
+            unsigned chunk = static_cast<unsigned>(std::min<std::streamsize>(count - done, 1 << 30));
+            int num_read = gzread(_gzf, dest + done, chunk);
+            if(num_read <= 0) {
+              break;
+            }
+            done += num_read;
+          }
+          // The buffer no longer holds the data just before the current position, so seekoff must not use it.
+          setg(_buf.data(), _buf.data(), _buf.data());
+        } else {
+          while(done < count && underflow() != traits_type::eof()) {
+            std::streamsize n = std::min<std::streamsize>(count - done, egptr() - gptr());
+            std::memcpy(dest + done, gptr(), size_t(n));
+            gbump(int(n));
+            done += n;
+          }
+        }
+        return done;
+      }
+
+      pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) override {
+        if(!(which & std::ios_base::in)) {
+          return pos_type(off_type(-1));
+        }
+        // The logical position is the decompressed position of zlib, minus what is still buffered here.
+        const off_type cur = _gz_tell() - off_type(egptr() - gptr());
+        off_type target;
+        if(dir == std::ios_base::beg) {
+          target = off;
+        } else if(dir == std::ios_base::cur) {
+          target = cur + off;
+        } else {
+          return pos_type(off_type(-1));  // The end of a gzip stream is unknown without decompressing all of it.
+        }
+        if(target < 0) {
+          return pos_type(off_type(-1));
+        }
+        const off_type buffer_start = cur - off_type(gptr() - eback());
+        if(target >= buffer_start && target <= _gz_tell()) {  // Inside the buffer.
+          setg(eback(), eback() + (target - buffer_start), egptr());
+          return pos_type(target);
+        }
+        // Forward seeks decompress and discard the data in between, backward seeks restart from the beginning of the file.
+        if(! _gz_seek(target)) {
+          return pos_type(off_type(-1));
+        }
+        setg(_buf.data(), _buf.data(), _buf.data());
+        return pos_type(target);
+      }
+
+      pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+        return seekoff(off_type(pos), std::ios_base::beg, which);
+      }
+
+      private:
+      // zlib only has 64 bit offsets in its *64 functions if large file support is enabled, the z_off_t of the
+      // other functions is 32 bit on Windows and in builds without large file support.
+      #if defined(_LARGEFILE64_SOURCE) && (_LFS64_LARGEFILE-0) && ZLIB_VERNUM >= 0x1240
+      off_type _gz_tell() const {
+        return off_type(gztell64(_gzf));
+      }
+
+      bool _gz_seek(const off_type target) {
+        return gzseek64(_gzf, z_off64_t(target), SEEK_SET) >= 0;
+      }
+      #else
+      off_type _gz_tell() const {
+        return off_type(gztell(_gzf));
+      }
+
+      /// @throws std::runtime_error if the target does not fit into the `z_off_t` of this zlib build.
+      bool _gz_seek(const off_type target) {
+        if(target > off_type(std::numeric_limits<z_off_t>::max())) {
+          throw std::runtime_error("Cannot seek to offset " + std::to_string(target) + " in gzip file, it exceeds the offset range of this zlib build.\n");
+        }
+        return gzseek(_gzf, z_off_t(target), SEEK_SET) >= 0;
+      }
+      #endif
+
+      gzFile _gzf;
+      std::vector<char> _buf;
+    };
+
+    /// @brief A write-only stream buffer that compresses to a gzip file in large chunks.
+    /// @details Only available if libfs is compiled with `LIBFS_WITH_ZLIB` defined.
+    class GzOutBuf : public std::streambuf {
+      public:
+      /// Size of the internal buffer, in bytes.
+      static const size_t BUFSIZE = 256 * 1024;
+
+      /// @brief Open the given gzip file for writing, it is created or truncated.
+      /// @throws std::runtime_error if the file cannot be opened.
+      explicit GzOutBuf(const std::string& filename) : _buf(BUFSIZE) {
+        _gzf = gzopen(filename.c_str(), "wb");
+        if(_gzf == NULL) {
+          throw std::runtime_error("Unable to open gzip file '" + filename + "' for writing.\n");
+        }
+        gzbuffer(_gzf, static_cast<unsigned>(BUFSIZE));
+        setp(_buf.data(), _buf.data() + _buf.size());
+      }
+
+      GzOutBuf(const GzOutBuf&) = delete;
+      GzOutBuf& operator=(const GzOutBuf&) = delete;
+
+      /// @brief Flush all data and close the file. The final compressed data is only written on close, so this reports write errors like a full disk.
+      /// @throws std::runtime_error if writing the remaining data or closing the file fails, or the file is already closed.
+      void close() {
+        if(_gzf == NULL) {
+          throw std::runtime_error("Gzip file is already closed.\n");
+        }
+        const bool flushed = _flush_buffer();
+        const int status = gzclose(_gzf);
+        _gzf = NULL;
+        if(! flushed || status != Z_OK) {
+          throw std::runtime_error("Failed to write and close gzip file, zlib status " + std::to_string(status) + ".\n");
+        }
+      }
+
+      /// @brief Closes the file if `close` was not called. Errors cannot be reported here, so call `close` to detect them.
+      ~GzOutBuf() {
+        if(_gzf != NULL) {
+          _flush_buffer();
+          gzclose(_gzf);
+        }
+      }
+
+      protected:
+      int_type overflow(int_type ch) override {
+        if(! _flush_buffer()) {
+          return traits_type::eof();
+        }
+        if(! traits_type::eq_int_type(ch, traits_type::eof())) {
+          *pptr() = traits_type::to_char_type(ch);
+          pbump(1);
+        }
+        return traits_type::not_eof(ch);
+      }
+
+      std::streamsize xsputn(const char* src, std::streamsize count) override {
+        if(count < std::streamsize(_buf.size())) {
+          return std::streambuf::xsputn(src, count);
+        }
+        // Large request: compress straight from the source.
+        if(! _flush_buffer()) {
+          return 0;
+        }
+        std::streamsize done = 0;
+        while(done < count) {
+          unsigned chunk = static_cast<unsigned>(std::min<std::streamsize>(count - done, 1 << 30));
+          int num_written = gzwrite(_gzf, src + done, chunk);
+          if(num_written <= 0) {
+            break;
+          }
+          done += num_written;
+        }
+        return done;
+      }
+
+      int sync() override {
+        return _flush_buffer() ? 0 : -1;
+      }
+
+      private:
+      gzFile _gzf;
+      std::vector<char> _buf;
+
+      bool _flush_buffer() {
+        if(_gzf == NULL) {
+          return false;
+        }
+        std::ptrdiff_t n = pptr() - pbase();
+        if(n > 0 && gzwrite(_gzf, pbase(), static_cast<unsigned>(n)) != int(n)) {
+          return false;
+        }
+        setp(_buf.data(), _buf.data() + _buf.size());
+        return true;
+      }
+    };
+
+    /// @brief An input stream that reads the decompressed contents of a gzip file, see fs::util::GzInBuf.
     ///
     /// #### Examples
     ///
     /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// size_t nv = surface.num_vertices();  // 8
-    /// size_t nf = surface.num_faces();     // 12
+    /// fs::util::GzIfstream is("brain.mgz");
+    /// fs::Mgh mgh;
+    /// fs::read_mgh(&mgh, &is);
     /// @endcode
-    static fs::Mesh construct_cube() {
-      fs::Mesh mesh;
-      mesh.vertices = { 1.0, 1.0, 1.0,
-                        1.0, 1.0, -1.0,
-                        1.0, -1.0, 1.0,
-                        1.0, -1.0, -1.0,
-                      -1.0, 1.0, 1.0,
-                      -1.0, 1.0, -1.0,
-                      -1.0, -1.0, 1.0,
-                      -1.0, -1.0, -1.0 };
-      mesh.faces = { 0, 2, 3,
-                    3 ,1, 0,
-                    4, 6, 7,
-                    7, 5, 4,
-                    0, 4, 5,
-                    5, 1, 0,
-                    2, 6, 7,
-                    7, 3, 2,
-                    0, 4, 6,
-                    6, 2, 0,
-                    1, 5, 7,
-                    7, 3, 1 };
-      return mesh;
-    }
+    class GzIfstream : public std::istream {
+      public:
+      /// @brief Open the given gzip file for reading.
+      /// @throws std::runtime_error if the file cannot be opened.
+      explicit GzIfstream(const std::string& filename) : std::istream(nullptr), _sbuf(filename) {
+        rdbuf(&_sbuf);
+      }
 
-    /// @brief Construct and return a simple pyramidal mesh.
-    /// @details This constructs a right square pyramid with base edge length 1 and height 1. Think of the Great Pyramid of Giza.
-    /// @return fs::Mesh instance representing a 4-sided pyramid.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_pyramid();
-    /// size_t nv = surface.num_vertices();  // 5
-    /// size_t nf = surface.num_faces();     // 6
-    /// @endcode
-    static fs::Mesh construct_pyramid() {
-      fs::Mesh mesh;
-      mesh.vertices = { 0.0, 0.0, 0.0, // start with 4x base
-                        0.0, 1.0, 0.0,
-                        1.0, 1.0, 0.0,
-                        1.0, 0.0, 0.0,
-                        0.5, 0.5, 1.0 }; // apex
-      mesh.faces = { 0, 2, 1, // start with 2 base faces
-                     0, 3, 2,
-                     0, 4, 1, // now the 4 wall faces
-                     1, 4, 2,
-                     3, 2, 4,
-                     0, 3, 4 };
-      return mesh;
-    }
+      private:
+      GzInBuf _sbuf;
+    };
 
-    /// @brief Construct and return a simple planar grid mesh.
-    /// @details This is a 2D rectangular grid embedded in 3D. Each rectangular cell consists of 2 triangular faces. The height (z coordinate) for all vertices is `0.0`.
-    /// @param nx number of vertices in x direction
-    /// @param ny number of vertices in y direction
-    /// @param distx distance between vertices in x direction
-    /// @param disty distance between vertices in y direction
-    /// @return fs::Mesh instance representing a flat grid.
-    /// @throws std::invalid_argument error if `nx` or `ny` are `< 2`.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_grid(4, 5);
-    /// size_t nv = surface.num_vertices();  // 4*5 = 20
-    /// size_t nf = surface.num_faces();     // (4-1)*(5-1)*2 = 24;
-    /// @endcode
-    static fs::Mesh construct_grid(const size_t nx = 4, const size_t ny = 5, const float distx = 1.0, const float disty = 1.0) {
-      if(nx < 2 || ny < 2) {
-        throw std::runtime_error("Parameters nx and ny must be at least 2.");
+    /// @brief An output stream that writes compressed data to a gzip file, see fs::util::GzOutBuf.
+    class GzOfstream : public std::ostream {
+      public:
+      /// @brief Open the given gzip file for writing.
+      /// @throws std::runtime_error if the file cannot be opened.
+      explicit GzOfstream(const std::string& filename) : std::ostream(nullptr), _sbuf(filename) {
+        rdbuf(&_sbuf);
       }
-      fs::Mesh mesh;
-      size_t num_vertices = nx * ny;
-      size_t num_faces = ((nx - 1) * (ny - 1)) * 2;
-      std::vector<float> vertices;
-      vertices.reserve(num_vertices * 3);
-      std::vector<int> faces;
-      faces.reserve(num_faces * 3);
 
-      // Create vertices.
-      float cur_x, cur_y, cur_z;
-      cur_x = cur_y = cur_z = 0.0;
-      for(size_t i = 0; i < nx; i++) {
-        for(size_t j = 0; j < ny; j++) {
-          vertices.push_back(cur_x);
-          vertices.push_back(cur_y);
-          vertices.push_back(cur_z);
-          cur_y += disty;
-        }
-        cur_x += distx;
+      /// @brief Flush all data and close the file, see `fs::util::GzOutBuf::close`.
+      /// @throws std::runtime_error if writing the remaining data or closing the file fails.
+      void close() {
+        _sbuf.close();
       }
 
-      // Create faces.
-      for(size_t i = 0; i < num_vertices; i++) {
-        if((i+1) % ny == 0 || i >= num_vertices - ny) {
-          // Do not use the last ones in row or column as source.
-          continue;
-        }
-        // Add the upper left triangle of this grid cell.
-        faces.push_back(int(i));
-        faces.push_back(int(i + ny + 1));
-        faces.push_back(int(i + 1));
-        // Add the lower right triangle of this grid cell.
-        faces.push_back(int(i));
-        faces.push_back(int(i + ny + 1));
-        faces.push_back(int(i + ny));
-      }
+      private:
+      GzOutBuf _sbuf;
+    };
+    #endif
 
-      mesh.vertices = vertices;
-      mesh.faces = faces;
-      return mesh;
+    /// @brief Check whether the filename has the extension of a compressed MGZ file.
+    /// @details Accepts '.mgz', '.MGZ' and '.mgh.gz'.
+    inline bool is_mgz_filename(const std::string& filename) {
+      return ends_with(filename, {".mgz", ".MGZ", ".mgh.gz"});
     }
 
 
-    /// @brief Return string representing the mesh in Wavefront Object (.obj) format.
-    /// @return Wavefront Object string representation of the mesh, including vertices and faces.
-    /// @see fs::Mesh::to_obj_file is a shortcut if you want to export the string representation to a file.
-    ///
-    /// #### Examples
+    /// @brief Read the remaining contents of a stream into a string, using a single bulk read if the stream size is known.
     ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// std::str mesh_repr_off = surface.to_obj();
-    /// @endcode
-    std::string to_obj() const {
-      std::stringstream objs;
-      for(size_t vidx=0; vidx<this->vertices.size(); vidx+=3) { // vertex coords
-        objs << "v " << vertices[vidx] << " " << vertices[vidx+1] << " " << vertices[vidx+2] << "\n";
-      }
-      for(size_t fidx=0; fidx<this->faces.size(); fidx+=3) { // faces: vertex indices, 1-based
-        objs << "f " << faces[fidx]+1 << " " << faces[fidx+1]+1 << " " << faces[fidx+2]+1 << "\n";
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    inline std::string _read_stream_to_buffer(std::istream* is) {
+      std::string buf;
+      const std::istream::pos_type start = is->tellg();
+      if(start != std::istream::pos_type(-1) && is->seekg(0, std::ios::end)) {
+        const std::istream::pos_type stop = is->tellg();
+        is->seekg(start);
+        if(stop != std::istream::pos_type(-1) && stop >= start) {
+          buf.resize(size_t(stop - start));
+          is->read(&buf[0], std::streamsize(buf.size()));
+          buf.resize(size_t(is->gcount()));
+          return buf;
+        }
       }
-      return(objs.str());
+      is->clear();
+      std::ostringstream oss;
+      oss << is->rdbuf();
+      return oss.str();
     }
 
-    /// @brief Return adjacency matrix representation of this mesh.
-    /// @return boolean 2D matrix, where true means an edge between the respective vertex pair exists, and false mean it does not.
-    /// @see fs::Mesh::to_rep_adjlist gives you an adjacency list instead.
-    /// @note This requires a lot of memory for large meshes.
-    ///
-    /// #### Examples
+    /// @brief Read a whole file into a string, in binary mode.
+    /// @throws std::runtime_error if the file cannot be opened.
     ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// std::vector<std::vector<bool>> adjm = surface.as_adjmatrix();
-    /// @endcode
-    std::vector<std::vector<bool>> as_adjmatrix() const {
-      std::vector<std::vector<bool>> adjm = std::vector<std::vector<bool>>(this->num_vertices(), std::vector<bool>(this->num_vertices(), false));
-      for(size_t fidx=0; fidx<this->faces.size(); fidx+=3) { // faces: vertex indices
-        adjm[faces[fidx]][faces[fidx+1]] = true;
-        adjm[faces[fidx+1]][faces[fidx]] = true;
-        adjm[faces[fidx+1]][faces[fidx+2]] = true;
-        adjm[faces[fidx+2]][faces[fidx+1]] = true;
-        adjm[faces[fidx+2]][faces[fidx]] = true;
-        adjm[faces[fidx]][faces[fidx+2]] = true;
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    inline std::string _read_file_to_buffer(const std::string& filename, const std::string& format_desc) {
+      std::ifstream input(filename, std::ios::in | std::ios::binary);
+      if(! input.is_open()) {
+        throw std::runtime_error("Could not open " + format_desc + " mesh file '" + filename + "' for reading.\n");
       }
-      return adjm;
+      return _read_stream_to_buffer(&input);
     }
 
-    /// @brief Hash function for 2-tuples of `<size_t, sizt_t>`, used to hash an edge of a graph or mesh.
-    struct _tupleHashFunction {
-      size_t operator()(const std::tuple<size_t , size_t>&x) const {
-        return std::get<0>(x) ^ std::get<1>(x);
-      }
-    };
+    /// @brief A pointer-based scanner for ASCII text held in memory, used by the mesh file parsers.
+    /// @details Tokens are separated by blanks, lines by newlines. Numbers are parsed directly from the buffer without creating strings or streams.
+    ///
+    /// THIS STRUCT IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+    /// @private
+    struct _TextScanner {
+      const char* begin;  ///< Start of the buffer, used to compute line numbers for error messages.
+      const char* p;  ///< The current position.
+      const char* end;  ///< One past the end of the buffer.
 
-    /// @brief Datastructure for storing, and quickly querying the existence of, mesh edges.
-    /// @details This is an unordered set of 2-tuples, where each tuple represents an edge, given as a pair of vertex indices. Each edge occurs twice in the list, once as `make_tuple(i,j)` and once as `make_tuple(j,i)`. Use the API of `std::unordered_set` to interact with it.
-    typedef std::unordered_set<std::tuple<size_t, size_t>, _tupleHashFunction> edge_set;
+      _TextScanner(const char* b, const char* e) : begin(b), p(b), end(e) {}
 
-    /// @brief Return edge list representation of this mesh.
-    /// @note While this mesh or graph representation is typically known as an edge list, this function actually returns a set.
-    /// @return an `fs::Mesh::edge_set`, i.e., an unordered set of 2-tuples, where each tuple represents an edge, given as a pair of vertex indices. Each edge occurs twice in the list, once as `make_tuple(i,j)` and once as `make_tuple(j,i)`.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// edge_set edges = surface.as_edgelist();
-    /// size_t num_undirected_edges = edg es.size() / 2;
-    /// @endcode
-    edge_set as_edgelist() const {
-      edge_set edges;
-      for(size_t fidx=0; fidx<this->faces.size(); fidx+=3) { // faces: vertex indices
-        edges.insert(std::make_tuple(faces[fidx], faces[fidx+1]));
-        edges.insert(std::make_tuple(faces[fidx+1], faces[fidx]));
+      bool eof() const { return p >= end; }
 
-        edges.insert(std::make_tuple(faces[fidx+1], faces[fidx+2]));
-        edges.insert(std::make_tuple(faces[fidx+2], faces[fidx+1]));
+      /// Skip spaces, tabs and carriage returns, but not newlines.
+      void skip_blanks() {
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+          p++;
+        }
+      }
 
-        edges.insert(std::make_tuple(faces[fidx], faces[fidx+2]));
-        edges.insert(std::make_tuple(faces[fidx+2], faces[fidx]));
+      /// Whether only blanks are left on the current line.
+      bool at_eol() {
+        skip_blanks();
+        return p >= end || *p == '\n';
       }
-      return edges;
-    }
 
-    /// @brief Return adjacency list representation of this mesh.
-    /// @param via_matrix whether the computation should be done via an  step involving an adjacency matrix, or via an edge set. Leaving this at `true` temporarily requires a lot of memory for large meshes, but is faster.
-    /// @return vector of vectors, where the outer vector has size this->num_vertices. The inner vector at index N contains the M neighbors of vertex n, as vertex indices.
-    /// @see fs::Mesh::to_rep_adjmatrix gives you an adjacency matrix instead.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// std::vector<std::vector<size_t>> adjl = surface.as_adjlist();
-    /// std::vector<std::vector<size_t>> adjl1 = surface.as_adjlist(true);
-    /// @endcode
-    std::vector<std::vector<size_t>> as_adjlist(const bool via_matrix=true) const {
-      if(! via_matrix) {
-        return(this->_as_adjlist_via_edgeset());
+      /// Advance to the start of the next line.
+      void next_line() {
+        const void* nl = std::memchr(p, '\n', size_t(end - p));
+        p = nl == nullptr ? end : static_cast<const char*>(nl) + 1;
       }
-      std::vector<std::vector<bool>> adjm = this->as_adjmatrix();
-      std::vector<std::vector<size_t>> adjl = std::vector<std::vector<size_t>>(this->num_vertices(), std::vector<size_t>());
-      size_t nv = adjm.size();
-      for (size_t i = 0; i < nv; i++) {
-          for (size_t j = i+1; j < nv; j++) {
-              if (adjm[i][j] == true) {
-                  adjl[i].push_back(j);
-                  adjl[j].push_back(i);
-              }
-          }
+
+      /// Whether the text at the current position starts with the given string.
+      bool looking_at(const char* s) const {
+        const size_t n = std::strlen(s);
+        return size_t(end - p) >= n && std::memcmp(p, s, n) == 0;
       }
-      return adjl;
-    }
 
-    /// @brief Return adjacency list representation of this mesh via edge list.
-    /// @return vector of vectors, where the outer vector has size this->num_vertices. The inner vector at index N contains the M neighbors of vertex n, as vertex indices.
-    /// @see fs::Mesh::to_rep_adjmatrix gives you an adjacency matrix instead.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// std::vector<std::vector<size_t>> adjl = surface.as_adjlist();
-    /// @endcode
-    std::vector<std::vector<size_t>> _as_adjlist_via_edgeset() const {
-      edge_set edges = this->as_edgelist();
-      std::vector<std::vector<size_t>> adjl = std::vector<std::vector<size_t>>(this->num_vertices(), std::vector<size_t>());
-      for (const std::tuple<size_t, size_t> &e: edges) {
-        adjl[std::get<0>(e)].push_back(std::get<1>(e));
+      /// Skip the next token, i.e., blanks followed by non-blank characters.
+      void skip_token() {
+        skip_blanks();
+        skip_rest_of_token();
       }
-      return adjl;
-    }
 
-    /// @brief Smooth given per-vertex data using nearest neighbor smoothing.
-    /// @param pvd vector of per-vertex data values, one value per mesh vertex.
-    /// @param num_iter number of iterations of smoothing to perform.
-    /// @param via_matrix passed on to `this->as_asjlist()`, whether to construct the adjacency list of the mesh using an intermediate step involving an adjacency matrix, as opposed to using an edge set. The latter is slower but requires less memory.
-    /// @param with_nan whether you need support for NAN values in `pvd`. A bit slower if active. Ignored if `detectnan` is `true`.
-    /// @param detect_nan whether to auto-detect presence of NAN values, ignoring the setting of `with_nan`.
-    /// @return vector of smoothed per-vertex data values, same length as `pvd` param.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// std::vector<float> pvd = {1.0, 1.1, 1.2, 1.3, 1.4, 1.5, 1.6, 1.7};
-    /// std::vector<float> pvd_smooth = surface.smooth_pvd_nn(pvd, 2);
-    /// @endcode
-    std::vector<float> smooth_pvd_nn(const std::vector<float> pvd, const size_t num_iter=1, const bool via_matrix=true, const bool with_nan=true, const bool detect_nan=true) const {
+      /// Skip the non-blank characters at the current position, e.g., the `/1/2` after a parsed OBJ vertex index.
+      void skip_rest_of_token() {
+        while(p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+          p++;
+        }
+      }
 
-      const std::vector<std::vector<size_t>> adjlist = this->as_adjlist(via_matrix);
-      return fs::Mesh::smooth_pvd_nn(adjlist, pvd, num_iter, with_nan, detect_nan);
-    }
+      /// Return the next token as a string.
+      std::string token() {
+        skip_blanks();
+        const char* start = p;
+        skip_token();
+        return std::string(start, size_t(p - start));
+      }
 
-    /// @brief Smooth given per-vertex data using nearest neighbor smoothing based on adjacency list mesh represenation.
-    /// @param mesh_adj the mesh, given as an adjacency list. The outer vector has size num_vertices, and the inner vectors sizes are the number of neighbors of the respective vertex.
-    /// @param pvd vector of per-vertex data values, one value per mesh vertex. Must not include NAN values. See `smooth_pvd_nn_nan` if you need support for NAN values.
-    /// @param num_iter number of iterations of smoothing to perform.
-    /// @param with_nan whether you need support for NAN values in `pvd`. A bit slower if active. Ignored if `detectnan` is `true`.
-    /// @param detect_nan whether to auto-detect presence of NAN values, ignoring the setting of `with_nan`.
-    /// @return vector of smoothed per-vertex data values, same length as `pvd` param.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// std::vector<std::vector<size_t>> mesh_adj = surface.as_adjlist();
-    /// std::vector<float> pvd = {1.0, 1.1, 1.2, 1.3, 1.4, 1.5, 1.6, 1.7};
-    /// std::vector<float> pvd_smooth = fs::Mesh::smooth_pvd_nn(mesh_adj, pvd, 2);
-    /// @endcode
-    static std::vector<float> smooth_pvd_nn(const std::vector<std::vector<size_t>> mesh_adj, const std::vector<float> pvd, const size_t num_iter=1, const bool with_nan=true, const bool detect_nan=true) {
-      assert(pvd.size() == mesh_adj.size());
-      bool final_with_nan = with_nan;
-      if (detect_nan) {
-        final_with_nan = false;
-        for(size_t i=0; i<pvd.size(); i++) {
-          if(std::isnan(pvd[i])) {
-            final_with_nan = true;
-            break;
-          }
+      /// Return the rest of the current line, without trailing blanks, and advance to the next line.
+      std::string rest_of_line() {
+        const char* start = p;
+        const void* nl = std::memchr(p, '\n', size_t(end - p));
+        const char* stop = nl == nullptr ? end : static_cast<const char*>(nl);
+        p = nl == nullptr ? end : stop + 1;
+        while(stop > start && (stop[-1] == '\r' || stop[-1] == ' ' || stop[-1] == '\t')) {
+          stop--;
         }
+        return std::string(start, size_t(stop - start));
       }
-      if (final_with_nan) {
-        return fs::Mesh::_smooth_pvd_nn_nan(mesh_adj, pvd, num_iter);
+
+      /// Get the 1-based line number of the current position.
+      size_t line_number() const {
+        return size_t(1 + std::count(begin, p, '\n'));
       }
-      std::vector<float> current_pvd_source;
-      std::vector<float> current_pvd_smoothed = std::vector<float>(pvd.size());
 
-      float val_sum;
-      size_t num_neigh;
-      for(size_t i = 0; i < num_iter; i++) {
-        if(i == 0) {
-          current_pvd_source = pvd;
-        } else {
-          current_pvd_source = current_pvd_smoothed;
+      /// @brief Parse a signed integer. Stops at the first non-digit, e.g., at the slash in an OBJ face token like `3/1/2`.
+      /// @return whether a number was found. If not, the position is unspecified.
+      bool parse_int(int32_t* out) {
+        skip_blanks();
+        bool neg = false;
+        if(p < end && (*p == '-' || *p == '+')) {
+          neg = *p == '-';
+          p++;
+        }
+        if(p >= end || *p < '0' || *p > '9') {
+          return false;
         }
-        for(size_t v_idx = 0; v_idx < mesh_adj.size(); v_idx++) {
-          num_neigh = mesh_adj[v_idx].size();
-          val_sum = current_pvd_source[v_idx] / (num_neigh+1);
-          for(size_t neigh_rel_idx = 0; neigh_rel_idx < num_neigh; neigh_rel_idx++) {
-            val_sum += current_pvd_source[mesh_adj[v_idx][neigh_rel_idx]] / (num_neigh+1);
+        int64_t v = 0;
+        while(p < end && *p >= '0' && *p <= '9') {
+          v = v * 10 + (*p - '0');
+          if(v > int64_t(INT32_MAX) + 1) {
+            return false;
           }
-          current_pvd_smoothed[v_idx] = val_sum;
+          p++;
+        }
+        v = neg ? -v : v;
+        if(v > INT32_MAX || v < INT32_MIN) {
+          return false;
         }
+        *out = int32_t(v);
+        return true;
       }
-      return current_pvd_smoothed;
-    }
 
-    /// @brief Smooth given per-vertex data including NAN values using nearest neighbor smoothing based on adjacency list mesh representation.
-    /// @private
-    /// @param mesh_adj the mesh, given as an adjacency list. The outer vector has size num_vertices, and the inner vectors sizes are the number of neighbors of the respective vertex.
-    /// @param pvd vector of per-vertex data values, one value per mesh vertex. Must not include NAN values. See `smooth_pvd_nn_nan` if you need support for NAN values.
-    /// @param num_iter number of iterations of smoothing to perform.
-    /// @return vector of smoothed per-vertex data values, same length as `pvd` param.
-    /// @note This function is private, users should call `fs::Mesh::smooth_pvd_nn` instead.
-    ///
-    /// #### Examples
+      /// @brief Parse a float. The result is identical to `strtof` in the "C" locale, the decimal point is always '.', independent of `LC_NUMERIC`.
+      /// @details Short decimal numbers, which is what mesh exporters typically write, take an exact fast path: if the digits form an integer `m <= 2^24` and the decimal exponent `e` satisfies `|e| <= 10`, both `m` and `10^|e|` are exactly representable as floats, so a single correctly rounded float multiplication or division gives the correctly rounded result. Everything else (long mantissas, large exponents, nan, inf) falls back to `strtof`.
+      /// @return whether a number was found.
+      bool parse_float(float* out) {
+        static const float POW10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+        skip_blanks();
+        const char* start = p;
+        const char* q = p;
+        bool neg = false;
+        if(q < end && (*q == '-' || *q == '+')) {
+          neg = *q == '-';
+          q++;
+        }
+        uint64_t m = 0;
+        int num_digits = 0;
+        int exp10 = 0;
+        bool any_digit = false;
+        while(q < end && *q >= '0' && *q <= '9') {
+          if(num_digits < 19) {
+            m = m * 10 + uint64_t(*q - '0');
+            if(m > 0) {
+              num_digits++;
+            }
+          } else {
+            exp10++;  // Too many digits for the fast path, but keep scanning.
+            num_digits++;
+          }
+          any_digit = true;
+          q++;
+        }
+        if(q < end && *q == '.') {
+          q++;
+          while(q < end && *q >= '0' && *q <= '9') {
+            if(num_digits < 19) {
+              m = m * 10 + uint64_t(*q - '0');
+              if(m > 0) {
+                num_digits++;
+              }
+              exp10--;
+            } else {
+              num_digits++;
+            }
+            any_digit = true;
+            q++;
+          }
+        }
+        if(any_digit && q < end && (*q == 'e' || *q == 'E')) {
+          const char* r = q + 1;
+          bool eneg = false;
+          if(r < end && (*r == '-' || *r == '+')) {
+            eneg = *r == '-';
+            r++;
+          }
+          if(r < end && *r >= '0' && *r <= '9') {
+            int e = 0;
+            while(r < end && *r >= '0' && *r <= '9') {
+              if(e < 100000) {
+                e = e * 10 + (*r - '0');
+              }
+              r++;
+            }
+            exp10 += eneg ? -e : e;
+            q = r;
+          }
+        }
+        const bool at_token_end = q >= end || *q == ' ' || *q == '\t' || *q == '\r' || *q == '\n';
+        if(any_digit && at_token_end && num_digits <= 19 && m <= (uint64_t(1) << 24) && exp10 >= -10 && exp10 <= 10) {
+          float v = float(m);
+          v = exp10 < 0 ? v / POW10[-exp10] : v * POW10[exp10];
+          *out = neg ? -v : v;
+          p = q;
+          return true;
+        }
+        // Slow path: let strtof handle it, on a NUL-terminated copy of the token.
+        p = start;
+        skip_token();
+        const size_t len = size_t(p - start);
+        if(len == 0) {
+          return false;
+        }
+        std::string tok(start, len);
+        // strtof expects the decimal point of the current LC_NUMERIC locale, but mesh files always use '.'. Translate it, and reject tokens using the locale decimal point, which the fast path would reject as well.
+        const char* dp = std::localeconv()->decimal_point;
+        if(dp != nullptr && std::strcmp(dp, ".") != 0 && dp[0] != '\0') {
+          const std::string locale_dp(dp);
+          if(tok.find(locale_dp) != std::string::npos) {
+            return false;
+          }
+          const size_t dot = tok.find('.');
+          if(dot != std::string::npos) {
+            tok.replace(dot, 1, locale_dp);
+          }
+        }
+        char* parse_end = nullptr;
+        *out = std::strtof(tok.c_str(), &parse_end);
+        return parse_end == tok.c_str() + tok.size();
+      }
+    };
+
+    /// @brief Formats text and binary data into a fixed size buffer, and writes it to a stream whenever the buffer is full. Used by the mesh exporters.
+    /// @details Integers are formatted directly into the buffer. Floats are formatted with `snprintf` and `%g`, which gives the same text as `std::ostream::operator<<` with the default precision of 6. The decimal point is always written as '.', independent of `LC_NUMERIC`. Call `flush` when done, the destructor does not flush.
     ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// std::vector<std::vector<size_t>> mesh_adj = surface.as_adjlist();
-    /// std::vector<float> pvd = {1.0, 1.1, 1.2, NAN, 1.4, 1.5, 1.6, 1.7};
-    /// std::vector<float> pvd_smooth = fs::Mesh::smooth_pvd_nn(mesh_adj, pvd, 2);
-    /// @endcode
-    static std::vector<float> _smooth_pvd_nn_nan(const std::vector<std::vector<size_t>> mesh_adj, const std::vector<float> pvd, const size_t num_iter=1) {
-      std::vector<float> current_pvd_source;
-      std::vector<float> current_pvd_smoothed = std::vector<float>(pvd.size());
+    /// THIS CLASS IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+    /// @private
+    class _BufferedWriter {
+      public:
+        explicit _BufferedWriter(std::ostream& os, size_t buffer_size = 256 * 1024) : _os(os), _buf(std::max(buffer_size, size_t(64))), _used(0) {
+          const char* dp = std::localeconv()->decimal_point;
+          _locale_decimal_point = (dp != nullptr && std::strcmp(dp, ".") != 0) ? std::string(dp) : std::string();
+        }
 
-      float val_sum;
-      size_t num_neigh;
-      size_t num_non_nan_values;
-      float neigh_val;
-      for(size_t i = 0; i < num_iter; i++) {
+        /// Write raw bytes.
+        void write(const char* data, size_t num_bytes) {
+          if(num_bytes > _buf.size() - _used) {
+            flush();
+            if(num_bytes > _buf.size()) {
+              _os.write(data, std::streamsize(num_bytes));
+              return;
+            }
+          }
+          std::memcpy(&_buf[_used], data, num_bytes);
+          _used += num_bytes;
+        }
 
-        if(i == 0) {
-          current_pvd_source = pvd;
-        } else {
-          current_pvd_source = current_pvd_smoothed;
+        /// Write a string literal or other NUL-terminated string.
+        void write(const char* str) {
+          write(str, std::strlen(str));
         }
 
-        for(size_t v_idx = 0; v_idx < mesh_adj.size(); v_idx++) {
-          if(std::isnan(current_pvd_source[v_idx])) {
-            current_pvd_smoothed[v_idx] = NAN;
-            continue;
+        /// Write a single character.
+        void put(char c) {
+          if(_used == _buf.size()) {
+            flush();
           }
-          val_sum = current_pvd_source[v_idx];
-          num_non_nan_values = 1;  // If we get here, the source vertex value is not NAN.
-          num_neigh = mesh_adj[v_idx].size();
-          for(size_t neigh_rel_idx = 0; neigh_rel_idx < num_neigh; neigh_rel_idx++) {
-            neigh_val = current_pvd_source[mesh_adj[v_idx][neigh_rel_idx]];
-            if(std::isnan(neigh_val)) {
-              continue;
-            } else {
-              val_sum += neigh_val;
-              num_non_nan_values++;
-            }
+          _buf[_used++] = c;
+        }
+
+        /// Write an integer in decimal notation.
+        void put_int(int64_t value) {
+          ensure(24);
+          uint64_t u = uint64_t(value);
+          if(value < 0) {
+            _buf[_used++] = '-';
+            u = ~u + 1;
+          }
+          char digits[20];
+          int n = 0;
+          do {
+            digits[n++] = char('0' + (u % 10));
+            u /= 10;
+          } while(u > 0);
+          while(n > 0) {
+            _buf[_used++] = digits[--n];
           }
-          current_pvd_smoothed[v_idx] = val_sum / (float)num_non_nan_values;
         }
-      }
-      return current_pvd_smoothed;
-    }
 
-    /// @brief Extend mesh neighborhoods based on mesh adjacency representation.
-    /// @details This function is mainly extended to extend a source neighborhood representation (typically the mesh's `k=1` neighborhood, i.e., the adjacency list of the mesh) to a higher `k`. In a `k=3` neighborhood, the neighorhood around a source vertex includes all vertices in edge distance up to 3 from the source vertex (but not the source vertex itself).
-    /// @param mesh_adj The adjacency list representation of the underlying mesh, the outer vector must have size `N` for a mesh with `N` vertices.
-    /// @param extend_by the number of edges to hop to extend the neighborhoods.
-    /// @param mesh_adj_ext the starting neighborhoods to extend, same representation as `mesh_adj`. The outer vector must have size `N` or `0`. If passed as an empty vector, this will be ignored and a copy of the `mesh_adj` is used as the `start_neighborhoods`.
-    /// @return extended neighborhoods
-    static std::vector<std::vector<size_t>> extend_adj(const std::vector<std::vector<size_t>> mesh_adj, const size_t extend_by=1, std::vector<std::vector<size_t>> mesh_adj_ext=std::vector<std::vector<size_t>>()) {
-      size_t num_vertices = mesh_adj.size();
-      if(mesh_adj_ext.size() == 0) {
-        mesh_adj_ext = mesh_adj;
-      }
-      std::vector<size_t> neighborhood;
-      std::vector<size_t> ext_neighborhood;
-      for(size_t ext_idx = 0; ext_idx < extend_by; ext_idx++) {
-        for(size_t source_vert_idx = 0; source_vert_idx < num_vertices; source_vert_idx++) {
-          neighborhood = mesh_adj_ext[source_vert_idx]; // copy needed so we do not modify during iteration.
-          // Extension: add all neighbors in distance one for all vertices in the neighborhood.
-          for(size_t neigh_vert_rel_idx = 0; neigh_vert_rel_idx < neighborhood.size(); neigh_vert_rel_idx++) {
-            for(size_t canidate_rel_idx = 0; canidate_rel_idx < mesh_adj[neighborhood[neigh_vert_rel_idx]].size(); canidate_rel_idx++) {
-              if(mesh_adj[neighborhood[neigh_vert_rel_idx]][canidate_rel_idx] != source_vert_idx) {
-                mesh_adj_ext[source_vert_idx].push_back(mesh_adj[neighborhood[neigh_vert_rel_idx]][canidate_rel_idx]);
-              }
+        /// Write a float in the same notation as `std::ostream::operator<<` with default settings and the classic locale.
+        void put_float(float value) {
+          ensure(32);
+          char* const start = &_buf[_used];
+          int n = std::snprintf(start, 32, "%g", double(value));
+          if(n > 0 && ! _locale_decimal_point.empty()) {  // snprintf follows LC_NUMERIC, replace its decimal point with '.'.
+            char* const end = start + n;
+            char* const dp = std::search(start, end, _locale_decimal_point.begin(), _locale_decimal_point.end());
+            if(dp != end) {
+              *dp = '.';
+              const size_t dp_len = _locale_decimal_point.size();
+              std::memmove(dp + 1, dp + dp_len, size_t(end - dp) - dp_len);
+              n -= int(dp_len - 1);
             }
           }
-          // We need to remove duplicates.
-          std::sort(mesh_adj_ext[source_vert_idx].begin(), mesh_adj_ext[source_vert_idx].end());
-          mesh_adj_ext[source_vert_idx].erase(std::unique(mesh_adj_ext[source_vert_idx].begin(), mesh_adj_ext[source_vert_idx].end()), mesh_adj_ext[source_vert_idx].end());
+          _used += size_t(n > 0 ? n : 0);
         }
-      }
-      return mesh_adj_ext;
-    }
 
+        /// Write the buffered data to the stream.
+        void flush() {
+          if(_used > 0) {
+            _os.write(_buf.data(), std::streamsize(_used));
+            _used = 0;
+          }
+        }
 
-    /// @brief Export this mesh to a file in Wavefront OBJ format.
-    /// @param filename path to the output file, will be overwritten if existing.
-    /// @throws std::runtime_error if the target file cannot be opened.
-    /// @see fs::Mesh::to_obj if you want the string representation (without writing it to a file).
-    ///
-    /// #### Examples
+      private:
+        /// Make sure that at least `num_bytes` bytes are free in the buffer.
+        void ensure(size_t num_bytes) {
+          if(_buf.size() - _used < num_bytes) {
+            flush();
+          }
+        }
+
+        std::ostream& _os;
+        std::vector<char> _buf;
+        size_t _used;
+        std::string _locale_decimal_point;  ///< The decimal point of the C locale if it is not ".", empty otherwise.
+    };
+
+    /// @brief Open a file for writing, pass the stream to a function that writes the contents, and check that all writes succeeded.
+    /// @param filename the file to which to write, will be overwritten if it exists.
+    /// @param binary whether to open the file in binary mode.
+    /// @param write_fn a function or lambda that takes a `std::ostream&` and writes to it.
+    /// @throws std::runtime_error if the file cannot be opened or writing fails.
     ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// const std::string out_path = fs::util::fullpath({"/tmp", "mesh.obj"});
-    /// surface.to_obj_file(out_path);
-    /// @endcode
-    void to_obj_file(const std::string& filename) const {
-      fs::util::str_to_file(filename, this->to_obj());
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    template <typename F>
+    void _write_to_file(const std::string& filename, bool binary, F write_fn) {
+      std::ofstream ofs(filename, binary ? (std::ofstream::out | std::ofstream::binary) : std::ofstream::out);
+      #ifdef LIBFS_DBG_VERBOSE
+      std::cout << LIBFS_APPTAG << "Opening file '" << filename << "' for writing.\n";
+      #endif
+      if(! ofs.is_open()) {
+        throw std::runtime_error("Unable to open file '" + filename + "' for writing.\n");
+      }
+      write_fn(ofs);
+      ofs.close();
+      if(ofs.fail()) {
+        throw std::runtime_error("Writing to file '" + filename + "' failed.\n");
+      }
     }
 
-    /// @brief Compute a new mesh that is a submesh of this mesh, based on a subset of the vertices of this mesh.
-    /// @param old_vertex_indices vector of vertex indices of this mesh, which should be included in the submesh.
-    /// @param mapdir_fulltosubmesh whether to return a map from the old (full mesh) to the new (submesh)  vertex indices (`true`), or the other way around (`false`, the default) as the first element of the returned pair.
-    /// @return a pair of the vertex index map (direction 'fullmesh to submesh' by default, but see 'mapdir_fulltosubmesh' parameter) and the submesh.
+
+    /// @brief A standard library compatible allocator that returns memory aligned to `Alignment` bytes, e.g., for use with `std::vector`.
+    /// @details Alignment to the 64 byte cache line size allows aligned SIMD loads and avoids that a single vector register load touches two cache lines. Uses `posix_memalign`, or `_aligned_malloc` under Windows.
+    /// @throws std::bad_alloc if the allocation fails.
     ///
     /// #### Examples
     ///
     /// @code
-    /// fs::Mesh surface;
-    /// fs::read_surf(&surface, "examples/read_surf/lh.white");
-    /// fs::Label label;
-    /// fs::read_label(&label, "examples/read_label/lh.cortex.label");
-    /// std::pair <std::unordered_map<int32_t, int32_t>, fs::Mesh> result = surface.submesh_vertex(label.vertex);
-    /// fs::Mesh patch = result.second;
-    /// auto vertexindexmap_submesh2full = result.first; // or '<std::unordered_map<int32_t, int32_t>' instead of 'auto'.
+    /// std::vector<float, fs::util::AlignedAllocator<float, 64>> v(1000);
     /// @endcode
-    std::pair <std::unordered_map<int32_t, int32_t>, fs::Mesh> submesh_vertex(const std::vector<int32_t> &old_vertex_indices, const bool mapdir_fulltosubmesh = false) const {
-      fs::Mesh submesh;
-      std::vector<float> new_vertices;
-      std::vector<int> new_faces;
-      std::unordered_map<int32_t, int32_t> vertex_index_map_full2submesh;
-      int32_t new_vertex_idx = 0;
-      for(size_t i = 0; i < old_vertex_indices.size(); i++) {
-        vertex_index_map_full2submesh[old_vertex_indices[i]] = new_vertex_idx;
-        new_vertices.push_back(this->vertices[size_t(old_vertex_indices[i])*3]);
-        new_vertices.push_back(this->vertices[size_t(old_vertex_indices[i])*3+1]);
-        new_vertices.push_back(this->vertices[size_t(old_vertex_indices[i])*3+2]);
-        new_vertex_idx++;
-      }
-      int face_v0;
-      int face_v1;
-      int face_v2;
-      for(size_t i = 0; i < this->num_faces(); i++) {
-        face_v0 = this->faces[i*3];
-        face_v1 = this->faces[i*3+1];
-        face_v2 = this->faces[i*3+2];
-        if((vertex_index_map_full2submesh.find(face_v0) != vertex_index_map_full2submesh.end()) && (vertex_index_map_full2submesh.find(face_v1) != vertex_index_map_full2submesh.end()) && (vertex_index_map_full2submesh.find(face_v2) != vertex_index_map_full2submesh.end())) {
-          new_faces.push_back(vertex_index_map_full2submesh[face_v0]);
-          new_faces.push_back(vertex_index_map_full2submesh[face_v1]);
-          new_faces.push_back(vertex_index_map_full2submesh[face_v2]);
-        }
-      }
-      submesh.vertices = new_vertices;
-      submesh.faces = new_faces;
-
-      std::pair <std::unordered_map<int32_t, int32_t>, fs::Mesh> result;
-      if(! mapdir_fulltosubmesh) {  // Compute the new2old (reverse) vertex index map:
-        std::unordered_map<int32_t, int32_t> vertex_index_map_submesh2full;
-        for (auto const& pair: vertex_index_map_full2submesh) {
-          vertex_index_map_submesh2full[pair.second] = pair.first;
-        }
-        result = std::pair <std::unordered_map<int32_t, int32_t>, fs::Mesh>(vertex_index_map_submesh2full, submesh);
-      } else {
-        result = std::pair <std::unordered_map<int32_t, int32_t>, fs::Mesh>(vertex_index_map_full2submesh, submesh);
+    template <typename T, size_t Alignment = 64>
+    struct AlignedAllocator {
+      static_assert(Alignment >= sizeof(void*) && (Alignment & (Alignment - 1)) == 0, "Alignment must be a power of 2 and at least the pointer size.");
+      typedef T value_type;
+      template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+      AlignedAllocator() noexcept {}
+      template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+      T* allocate(size_t n) {
+        if(n == 0) {
+          return nullptr;
+        }
+        if(n > SIZE_MAX / sizeof(T) - Alignment) {
+          throw std::bad_alloc();
+        }
+        const size_t num_bytes = (n * sizeof(T) + Alignment - 1) / Alignment * Alignment;
+        void* p = nullptr;
+        #if (defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+        p = _aligned_malloc(num_bytes, Alignment);
+        #else
+        if(posix_memalign(&p, Alignment, num_bytes) != 0) {
+          p = nullptr;
+        }
+        #endif
+        if(p == nullptr) {
+          throw std::bad_alloc();
+        }
+        return static_cast<T*>(p);
       }
 
-      return result;
-    }
+      void deallocate(T* p, size_t) noexcept {
+        #if (defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+        _aligned_free(p);
+        #else
+        std::free(p);
+        #endif
+      }
+    };
 
-    /// @brief Given per-vertex data for a submesh, add NAN values inbetween to restore the original mesh size.
-    /// @param data_submesh vector of per-vertex data values, one value per mesh vertex of the submesh.
-    /// @param submesh_to_orig_mapping map<int, int>, mapping vertex indices of the submesh to vertex indices of the original, full mesh.
-    /// @param orig_mesh_num_vertices number of vertices of the original, full mesh.
-    /// @see `fs::Mesh::submesh_vertex` for how to get the `submesh_to_orig_mapping` parameter.
-    /// @return vector of per-vertex data values, one value per mesh vertex of the original mesh. Values for vertices that are not part of the submesh are set to NAN.
-    static std::vector<float> curv_data_for_orig_mesh(const std::vector<float> data_submesh, const std::unordered_map<int32_t, int32_t> submesh_to_orig_mapping, const int32_t orig_mesh_num_vertices, const float fill_value=std::numeric_limits<float>::quiet_NaN()) {
+    /// All instances of `fs::util::AlignedAllocator` are interchangeable.
+    template <typename T, typename U, size_t A>
+    bool operator==(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) noexcept { return true; }
 
-      if(submesh_to_orig_mapping.size() != data_submesh.size()) {
-        throw std::domain_error("The number of vertices of the submesh and the number of values in the submesh_to_orig_mapping do not match: got " + std::to_string(data_submesh.size()) + " and " + std::to_string(submesh_to_orig_mapping.size()) + ".");
-      }
+    /// All instances of `fs::util::AlignedAllocator` are interchangeable.
+    template <typename T, typename U, size_t A>
+    bool operator!=(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) noexcept { return false; }
 
-      std::vector<float> data_orig_mesh(orig_mesh_num_vertices, fill_value);
-      for(size_t i=0; i<data_submesh.size(); i++) {
-          auto got = submesh_to_orig_mapping.find(int(i));
-          if (got != submesh_to_orig_mapping.end()) {
-            data_orig_mesh[got->second] = data_submesh[i];
-          }
-      }
-      return(data_orig_mesh);
+    /// @brief Count the set bits of a 64 bit word.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    inline int _popcount64(uint64_t x) {
+      #if defined(__GNUC__) || defined(__clang__)
+      return __builtin_popcountll(x);
+      #else
+      x = x - ((x >> 1) & 0x5555555555555555ULL);
+      x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+      x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+      return int((x * 0x0101010101010101ULL) >> 56);
+      #endif
     }
 
+    /// @brief Get the index of the lowest set bit of a non-zero 64 bit word.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    inline int _ctz64(uint64_t x) {
+      #if defined(__GNUC__) || defined(__clang__)
+      return __builtin_ctzll(x);
+      #else
+      return _popcount64((x & (~x + 1)) - 1);
+      #endif
+    }
 
+  }  // End namespace util.
 
-    /// @brief Read a brainmesh from a Wavefront object format stream.
-    /// @details This only reads the geometry, optional format extensions like materials are ignored (but files including them should parse fine).
-    /// @param mesh pointer to fs:Mesh instance to be filled.
-    /// @param is stream holding a text representation of a mesh in Wavefront object format.
-    /// @see There exists an overloaded version that reads from a file.
-    /// @throws std::domain_error if the file format is invalid.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface;
-    /// const std::string in_path = fs::util::fullpath({"/tmp", "mesh.obj"});
-    /// fs::Mesh::from_obj(&surface, in_path);
-    /// @endcode
-    static void from_obj(Mesh* mesh, std::istream* is) {
-      std::string line;
-      int line_idx = -1;
 
-      std::vector<float> vertices;
-      std::vector<int> faces;
+  // Instrumentation, see the LIBFS_INSTRUMENT macros.
 
-      #ifdef LIBFS_DBG_INFO
-      size_t num_lines_ignored = 0; // Not comments, but custom extensions or material data lines which are ignored by libfs.
-      #endif
+  /// Instrumentation event kind: a timed scope, the value is the duration in nanoseconds.
+  const int INSTRUMENT_TIMER = 0;
 
-      while (std::getline(*is, line)) {
-        line_idx += 1;
-        std::istringstream iss(line);
-        if(fs::util::starts_with(line, "#")) {
-          continue; // skip comment.
-        } else {
-          if(fs::util::starts_with(line, "v ")) {
-            std::string elem_type_identifier; float x, y, z;
-            if (!(iss >> elem_type_identifier >> x >> y >> z)) {
-              throw std::domain_error("Could not parse vertex line " + std::to_string(line_idx+1) + " of OBJ data, invalid format.\n");
-            }
-            assert(elem_type_identifier == "v");
-            vertices.push_back(x);
-            vertices.push_back(y);
-            vertices.push_back(z);
-          } else if(fs::util::starts_with(line, "f ")) {
-            std::string elem_type_identifier, v0raw, v1raw, v2raw; int v0, v1, v2;
-            if (!(iss >> elem_type_identifier >> v0raw >> v1raw >> v2raw)) {
-              throw std::domain_error("Could not parse face line " + std::to_string(line_idx+1) + " of OBJ data, invalid format.\n");
-            }
-            assert(elem_type_identifier == "f");
-
-            // The OBJ format allows to specifiy face indices with slashes to also set normal and material indices.
-            // So instead of a line like 'f 22 34 45', we could get 'f 3/1 4/2 5/3' or 'f 6/4/1 3/5/3 7/6/5' or 'f 7//1 8//2 9//3'.
-            // We need to extract the stuff before the first slash and interprete it as int to get the vertex index we are looking for.
-            std::size_t found_v0 = v0raw.find("/");
-            std::size_t found_v1 = v1raw.find("/");
-            std::size_t found_v2 = v2raw.find("/");
-            if (found_v0 != std::string::npos) {
-              v0raw = v0raw.substr(0, found_v0);
-            }
-            if (found_v1 != std::string::npos) {
-              v1raw = v1raw.substr(0, found_v1);
-            }
-            if (found_v2 != std::string::npos) {
-              v2raw = v0raw.substr(0, found_v2);
-            }
-            v0 = std::stoi(v0raw);
-            v1 = std::stoi(v1raw);
-            v2 = std::stoi(v2raw);
+  /// Instrumentation event kind: a counter increment, e.g., bytes read or vertices processed.
+  const int INSTRUMENT_COUNTER = 1;
 
-            // The vertex indices in Wavefront OBJ files are 1-based, so we have to substract 1 here.
-            faces.push_back(v0 - 1);
-            faces.push_back(v1 - 1);
-            faces.push_back(v2 - 1);
+  /// @brief An instrumentation event, passed to the sink set with `fs::set_instrument_sink`.
+  struct InstrumentEvent {
+    const char* name;  ///< The event name, a string literal like `read_mgh` or `read_mgh.bytes`. The pointer stays valid for the lifetime of the program.
+    int kind;  ///< `fs::INSTRUMENT_TIMER` or `fs::INSTRUMENT_COUNTER`.
+    uint64_t value;  ///< The duration in nanoseconds for timers, the increment for counters.
+  };
 
-          } else {
-            #ifdef LIBFS_DBG_INFO
-            num_lines_ignored++;
-            #endif
+  /// @brief The type of an instrumentation sink. It is called with each event and the `user_data` given to `fs::set_instrument_sink`.
+  /// @details Events are emitted from the calling thread, i.e., from all threads that call libfs functions, and from OpenMP worker threads. The sink must be thread-safe and should be fast.
+  typedef void (*InstrumentSink)(const InstrumentEvent& event, void* user_data);
 
-            continue;
-          }
+  /// @brief The global instrumentation sink and its user data.
+  /// THIS STRUCT IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+  /// @private
+  struct _InstrumentState {
+    std::atomic<InstrumentSink> sink;
+    std::atomic<void*> user_data;
+  };
 
-        }
+  /// @brief Get the global instrumentation state.
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  inline _InstrumentState& _instrument_state() {
+    static _InstrumentState state;  // Zero-initialized, i.e., no sink.
+    return state;
+  }
+
+  /// @brief Set the sink that receives the instrumentation events of libfs.
+  /// @details Events are only emitted if libfs is compiled with `LIBFS_INSTRUMENT` defined, otherwise the instrumentation compiles to nothing and the sink is never called. With a sink set, each instrumented call costs a few clock reads and sink calls. Without a sink, it costs one atomic load per instrumentation point. Set the sink before starting instrumented work in other threads: a call that runs concurrently with the change may still use the old sink.
+  /// @param sink the sink, or `nullptr` to stop receiving events.
+  /// @param user_data a pointer passed to each sink call, e.g., a `fs::InstrumentRecorder`.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// #define LIBFS_INSTRUMENT
+  /// #include "libfs.h"
+  /// fs::InstrumentRecorder recorder;
+  /// fs::set_instrument_sink(&fs::InstrumentRecorder::sink, &recorder);
+  /// fs::Mgh mgh;
+  /// fs::read_mgh(&mgh, "brain.mgh");
+  /// std::cout << recorder.report();
+  /// fs::set_instrument_sink(nullptr);
+  /// @endcode
+  inline void set_instrument_sink(InstrumentSink sink, void* user_data = nullptr) {
+    _InstrumentState& state = _instrument_state();
+    state.sink.store(nullptr);
+    state.user_data.store(user_data);
+    state.sink.store(sink);
+  }
+
+  /// @brief Send an instrumentation event to the sink, if any.
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS. Use the `LIBFS_INSTRUMENT_*` macros.
+  /// @private
+  inline void _instrument_emit(const char* name, const int kind, const uint64_t value) {
+    _InstrumentState& state = _instrument_state();
+    const InstrumentSink sink = state.sink.load(std::memory_order_acquire);
+    if(sink != nullptr) {
+      const InstrumentEvent event = { name, kind, value };
+      sink(event, state.user_data.load(std::memory_order_relaxed));
+    }
+  }
+
+  /// @brief Measures the time from its construction to its destruction and reports it as an `fs::INSTRUMENT_TIMER` event. Does not read the clock if no sink is set at construction.
+  /// THIS CLASS IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS. Use `LIBFS_INSTRUMENT_SCOPE`.
+  /// @private
+  class _InstrumentScope {
+    public:
+    explicit _InstrumentScope(const char* name) : _name(name), _active(_instrument_state().sink.load(std::memory_order_acquire) != nullptr) {
+      if(_active) {
+        _start = std::chrono::steady_clock::now();
       }
-      #ifdef LIBFS_DBG_INFO
-      if(num_lines_ignored > 0) {
-        std::cout << LIBFS_APPTAG << "Ignored " << num_lines_ignored << " lines in Wavefront OBJ format mesh file.\n";
+    }
+
+    ~_InstrumentScope() {
+      if(_active) {
+        const std::chrono::steady_clock::duration d = std::chrono::steady_clock::now() - _start;
+        _instrument_emit(_name, INSTRUMENT_TIMER, uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
       }
-      #endif
-      mesh->vertices = vertices;
-      mesh->faces = faces;
     }
 
+    private:
+    _InstrumentScope(const _InstrumentScope&);
+    _InstrumentScope& operator=(const _InstrumentScope&);
+    const char* _name;
+    const bool _active;
+    std::chrono::steady_clock::time_point _start;
+  };
 
-    /// @brief Read a brainmesh from a Wavefront object format mesh file.
-    /// @details This only reads the geometry, optional format extensions like materials are ignored (but files including them should parse fine).
-    /// @see There exists an overloaded version that reads from a stream.
-    /// @param mesh pointer to fs:Mesh instance to be filled.
-    /// @param filename path to input wavefront obj mesh to be read.
-    /// @throws std::runtime_error if the file cannot be read.
-    /// @throws std::domain_error if the file format is invalid.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface;
-    /// fs::Mesh::from_obj(&surface, "mesh.obj");
-    /// @endcode
-    static void from_obj(Mesh* mesh, const std::string& filename) {
-      #ifdef LIBFS_DBG_INFO
-      std::cout << LIBFS_APPTAG << "Reading brain mesh from Wavefront object format file " << filename << ".\n";
-      #endif
-      std::ifstream input(filename, std::fstream::in);
-      if(input.is_open()) {
-        Mesh::from_obj(mesh, &input);
-        input.close();
-      } else {
-        throw std::runtime_error("Could not open Wavefront object format mesh file '" + filename + "' for reading.\n");
-      }
+  /// @brief A thread-safe instrumentation sink that aggregates the events per name, e.g., to attribute the latency of a service.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::InstrumentRecorder recorder;
+  /// fs::set_instrument_sink(&fs::InstrumentRecorder::sink, &recorder);
+  /// // ... call libfs functions, from any number of threads ...
+  /// fs::InstrumentRecorder::Entry e = recorder.get("smooth_pvd_nn");
+  /// std::cout << "Smoothing took " << e.total * 1e-6 << " ms in " << e.events << " calls.\n";
+  /// @endcode
+  class InstrumentRecorder {
+    public:
+
+    /// Aggregated events of one name.
+    struct Entry {
+      Entry() : kind(INSTRUMENT_COUNTER), events(0), total(0), max(0) {}
+      int kind;  ///< `fs::INSTRUMENT_TIMER` or `fs::INSTRUMENT_COUNTER`.
+      uint64_t events;  ///< The number of events, i.e., timed calls or counter increments.
+      uint64_t total;  ///< The sum of the values: total nanoseconds for timers, the count for counters.
+      uint64_t max;  ///< The largest single value.
+    };
+
+    /// The sink function to pass to `fs::set_instrument_sink`, with a pointer to the recorder as the user data.
+    static void sink(const InstrumentEvent& event, void* recorder) {
+      static_cast<InstrumentRecorder*>(recorder)->record(event);
     }
 
+    /// Add an event.
+    void record(const InstrumentEvent& event) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      Entry& e = _entries[event.name];
+      e.kind = event.kind;
+      e.events++;
+      e.total += event.value;
+      e.max = std::max(e.max, event.value);
+    }
 
-    /// @brief Read a brainmesh from an Object File format (OFF) stream.
-    /// @param mesh pointer to fs:Mesh instance to be filled.
-    /// @param is An open std::istream or derived class stream from which to read the data, e.g., std::ifstream or std::istringstream.
-    /// @param source_filename optional, used in error messages only. The source file name, if any.
-    /// @see There exists an overloaded version that reads from a file.
-    /// @throws std::domain_error if the file format is invalid.
-    static void from_off(Mesh* mesh, std::istream* is, const std::string& source_filename="") {
+    /// Get the aggregated events of the given name. Returns an entry with zero events if there were none.
+    Entry get(const std::string& name) const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      std::map<std::string, Entry>::const_iterator it = _entries.find(name);
+      return it == _entries.end() ? Entry() : it->second;
+    }
 
-      std::string msg_source_file_part = source_filename.empty() ? "" : "'" + source_filename + "'";
+    /// Get a copy of all entries, by name.
+    std::map<std::string, Entry> entries() const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _entries;
+    }
 
-      std::string line;
-      int line_idx = -1;
-      int noncomment_line_idx = -1;
+    /// Remove all entries.
+    void clear() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _entries.clear();
+    }
 
-      std::vector<float> vertices;
-      std::vector<int> faces;
-      size_t num_vertices = 0;
-      size_t num_faces = 0;
-      size_t num_edges = 0;
-      size_t num_verts_parsed = 0;
-      size_t num_faces_parsed = 0;
-      float x, y, z;    // vertex xyz coords
-      //bool has_color;
-      //int r, g, b, a;   // vertex colors
-      int num_verts_this_face, v0, v1, v2;   // face, defined by number of vertices and vertex indices.
-
-      while (std::getline(*is, line)) {
-        line_idx++;
-        std::istringstream iss(line);
-        if(fs::util::starts_with(line, "#")) {
-          continue; // skip comment.
+    /// Format all entries as a text table, one line per name. Times are given in milliseconds.
+    std::string report() const {
+      const std::map<std::string, Entry> all = this->entries();
+      std::ostringstream os;
+      for(std::map<std::string, Entry>::const_iterator it = all.begin(); it != all.end(); ++it) {
+        const Entry& e = it->second;
+        if(e.kind == INSTRUMENT_TIMER) {
+          os << it->first << ": " << e.events << " calls, total " << double(e.total) * 1e-6 << " ms, max " << double(e.max) * 1e-6 << " ms\n";
         } else {
-          noncomment_line_idx++;
-          if(noncomment_line_idx == 0) {
-            std::string off_header_magic;
-            if (!(iss >> off_header_magic)) {
-              throw std::domain_error("Could not parse first header line " + std::to_string(line_idx+1) + " of OFF data, invalid format.\n");
-            }
-            if(!(off_header_magic == "OFF" || off_header_magic == "COFF")) {
-              throw std::domain_error("OFF magic string invalid, file " + msg_source_file_part + " not in OFF format.\n");
-            }
-            //has_color = off_header_magic == "COFF";
-          } else if (noncomment_line_idx == 1) {
-            if (!(iss >> num_vertices >> num_faces >> num_edges)) {
-              throw std::domain_error("Could not parse element count header line " + std::to_string(line_idx+1) + " of OFF data " + msg_source_file_part + ", invalid format.\n");
-            }
-          } else {
-
-            if(num_verts_parsed < num_vertices) {
-              if (!(iss >> x >> y >> z)) {
-                throw std::domain_error("Could not parse vertex coordinate line " + std::to_string(line_idx+1) + " of OFF data " + msg_source_file_part + ", invalid format.\n");
-              }
-              vertices.push_back(x);
-              vertices.push_back(y);
-              vertices.push_back(z);
-              num_verts_parsed++;
-            } else {
-              if(num_faces_parsed < num_faces) {
-                if (!(iss >> num_verts_this_face >> v0 >> v1 >> v2)) {
-                  throw std::domain_error("Could not parse face line " + std::to_string(line_idx+1) + " of OFF data " + msg_source_file_part + ", invalid format.\n");
-                }
-                if(num_verts_this_face != 3) {
-                  throw std::domain_error("At OFF data " + msg_source_file_part + " line " + std::to_string(line_idx+1) + ": only triangular meshes supported.\n");
-                }
-                faces.push_back(v0);
-                faces.push_back(v1);
-                faces.push_back(v2);
-                num_faces_parsed++;
-              }
-            }
-          }
+          os << it->first << ": " << e.total << " in " << e.events << " increments\n";
         }
       }
-      if(num_verts_parsed < num_vertices) {
-        throw std::domain_error("Vertex count mismatch between OFF data " + msg_source_file_part + " header (" + std::to_string(num_vertices) + ") and data (" + std::to_string(num_verts_parsed) + ").\n");
-      }
-      if(num_faces_parsed < num_faces) {
-        throw std::domain_error("Face count mismatch between OFF data " + msg_source_file_part + " header  (" + std::to_string(num_faces) + ") and data (" + std::to_string(num_faces_parsed) + ").\n");
-      }
-      mesh->vertices = vertices;
-      mesh->faces = faces;
+      return os.str();
     }
 
+    private:
+    mutable std::mutex _mutex;
+    std::map<std::string, Entry> _entries;
+  };
 
-    /// @brief Read a brainmesh from an OFF format mesh file.
-    /// @see There exists an overloaded version that reads from a stream.
-    /// @details The OFF is the Object File Format (file extension .off) is a simple text-based mesh file format. Not to be confused with the Wavefront Object format (.obj).
-    /// @param mesh pointer to fs:Mesh instance to be filled.
-    /// @param filename path to input wavefront obj mesh to be read.
-    /// @throws std::runtime_error if the file cannot be read.
-    /// @throws std::domain_error if the file format is invalid.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface;
-    /// fs::Mesh::from_off(&surface, "mesh.off");
-    /// @endcode
-    static void from_off(Mesh* mesh, const std::string& filename) {
-      #ifdef LIBFS_DBG_INFO
-      std::cout << LIBFS_APPTAG << "Reading brain mesh from OFF format file " << filename << ".\n";
-      #endif
-      std::ifstream input(filename, std::fstream::in);
-      if(input.is_open()) {
-        Mesh::from_off(mesh, &input);
-        input.close();
-      } else {
-        throw std::runtime_error("Could not open Object file format (OFF) mesh file '" + filename + "' for reading.\n");
-      }
+
+  // MRI data types, used by the MGH functions.
+
+  /// MRI data type representing an 8 bit unsigned integer.
+  const int MRI_UCHAR = 0;
+
+  /// MRI data type representing a 32 bit signed integer.
+  const int MRI_INT = 1;
+
+  /// MRI data type representing a 32 bit float.
+  const int MRI_FLOAT = 3;
+
+  /// MRI data type representing a 16 bit signed integer.
+  const int MRI_SHORT = 4;
+
+  /// @brief Maps a value type to its MRI data type at compile time, e.g., `fs::mri_dtype_of<float>::value` is `fs::MRI_FLOAT`. Only defined for the 4 types supported in MGH files.
+  template <typename T> struct mri_dtype_of;
+  /// @private
+  template <> struct mri_dtype_of<uint8_t> { static const int value = MRI_UCHAR; };
+  /// @private
+  template <> struct mri_dtype_of<int32_t> { static const int value = MRI_INT; };
+  /// @private
+  template <> struct mri_dtype_of<float> { static const int value = MRI_FLOAT; };
+  /// @private
+  template <> struct mri_dtype_of<short> { static const int value = MRI_SHORT; };
+
+  /// @brief Call the member template `f.template apply<T>()` with the value type `T` of the given MRI data type.
+  /// @details This replaces if/else chains over the data types with a single switch, and the code in `apply` is compiled once per type, so it can be written generically.
+  /// @return false if the data type is not supported, in which case `f` is not called.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename F>
+  bool _dispatch_mri_dtype(const int32_t dtype, F& f) {
+    switch(dtype) {
+      case MRI_UCHAR: f.template apply<uint8_t>(); return true;
+      case MRI_INT: f.template apply<int32_t>(); return true;
+      case MRI_FLOAT: f.template apply<float>(); return true;
+      case MRI_SHORT: f.template apply<short>(); return true;
+      default: return false;
     }
+  }
 
+  /// Volume sampling method: use the value of the nearest voxel, see `fs::vol2surf`.
+  const int INTERP_NEAREST = 0;
 
-    /// @brief Read a brainmesh from a Stanford PLY format stream.
-    /// @param mesh pointer to fs:Mesh instance to be filled.
-    /// @param is An open std::istream or derived class stream from which to read the data, e.g., std::ifstream or std::istringstream.
-    /// @see There exists an overloaded version that reads from a file.
-    /// @throws std::domain_error if the file format is invalid.
-    static void from_ply(Mesh* mesh, std::istream* is) {
-      std::string line;
-      int line_idx = -1;
-      int noncomment_line_idx = -1;
+  /// Volume sampling method: trilinear interpolation between the 8 surrounding voxels, see `fs::vol2surf`.
+  const int INTERP_TRILINEAR = 1;
 
-      std::vector<float> vertices;
-      std::vector<int> faces;
+  /// Geodesic distance method: Dijkstra's algorithm on the mesh edges, weighted by edge length. Overestimates distances that do not follow edges, e.g., by 8% for straight lines at 22.5 degrees to the edges of a regular grid.
+  const int GEODESIC_DIJKSTRA = 0;
 
-      bool in_header = true; // current status
-      int num_verts = -1;
-      int num_faces = -1;
-      while (std::getline(*is, line)) {
-        line_idx += 1;
-        std::istringstream iss(line);
-        if(fs::util::starts_with(line, "comment")) {
-          continue; // skip comment.
-        } else {
-          noncomment_line_idx++;
-          if(in_header) {
-            if(noncomment_line_idx == 0) {
-              if(line != "ply") throw std::domain_error("Invalid PLY file");
-            } else if(noncomment_line_idx == 1) {
-              if(line != "format ascii 1.0") throw std::domain_error("Unsupported PLY file format, only format 'format ascii 1.0' is supported.");
-            }
+  /// Geodesic distance method: fast marching on the triangles, which lets fronts pass through faces and is much closer to the true geodesic distance.
+  const int GEODESIC_FMM = 1;
 
-            if(line == "end_header") {
-              in_header = false;
-            } else if(fs::util::starts_with(line, "element vertex")) {
-              std::string elem, elem_type_identifier;
-              if (!(iss >> elem >> elem_type_identifier >> num_verts)) {
-                throw std::domain_error("Could not parse element vertex line of PLY header, invalid format.\n");
-              }
-            } else if(fs::util::starts_with(line, "element face")) {
-              std::string elem, elem_type_identifier;
-              if (!(iss >> elem >> elem_type_identifier >> num_faces)) {
-                throw std::domain_error("Could not parse element face line of PLY header, invalid format.\n");
-              }
-            } // Other properties like vertex colors and normals are ignored for now.
+  /// Vertex reordering method: sort the vertices along a 3D Morton (Z-order) curve through their coordinates, see `fs::Mesh::vertex_order`.
+  const int REORDER_MORTON = 0;
 
-          } else {  // in data part.
-            if(num_verts < 1 || num_faces < 1) {
-              throw std::domain_error("Invalid PLY file: missing element count lines of header.");
-            }
-            // Read vertices
-            if(vertices.size() < (size_t)num_verts * 3) {
-              float x,y,z;
-              if (!(iss >> x >> y >> z)) {
-                throw std::domain_error("Could not parse vertex line " + std::to_string(line_idx) + " of PLY data, invalid format.\n");
-              }
-              vertices.push_back(x);
-              vertices.push_back(y);
-              vertices.push_back(z);
-            } else {
-              if(faces.size() < (size_t)num_faces * 3) {
-                int verts_per_face, v0, v1, v2;
-                if (!(iss >> verts_per_face >> v0 >> v1 >> v2)) {
-                  throw std::domain_error("Could not parse face line " + std::to_string(line_idx) + " of PLY data, invalid format.\n");
-                }
-                if(verts_per_face != 3) {
-                  throw std::domain_error("Only triangular meshes are supported: PLY faces lines must contain exactly 3 vertex indices.\n");
-                }
-                faces.push_back(v0);
-                faces.push_back(v1);
-                faces.push_back(v2);
-              }
-            }
+  /// Vertex reordering method: sort the vertices along a 3D Hilbert curve through their coordinates. Gives slightly better locality than the Morton order.
+  const int REORDER_HILBERT = 1;
+
+  /// Vertex reordering method: reverse Cuthill-McKee on the mesh adjacency, which minimizes the bandwidth of the adjacency matrix and ignores the coordinates.
+  const int REORDER_RCM = 2;
+
+  /// File format: unknown or not a FreeSurfer file, see `fs::FileInfo`.
+  const int FILEFORMAT_UNKNOWN = 0;
+
+  /// File format: FreeSurfer binary curv file with per-vertex data.
+  const int FILEFORMAT_CURV = 1;
+
+  /// File format: FreeSurfer binary surf file with a triangular mesh.
+  const int FILEFORMAT_SURF = 2;
+
+  /// File format: FreeSurfer annotation (parcellation) file.
+  const int FILEFORMAT_ANNOT = 3;
+
+  /// File format: FreeSurfer MGH or MGZ volume file.
+  const int FILEFORMAT_MGH = 4;
+
+  // Forward declarations.
+  int _fread3(std::istream&);
+  template <typename T> T _freadt(std::istream&);
+  template <typename T> void _freadt_bulk(std::istream&, T*, size_t);
+  template <typename T> T _swap_endian(T);
+  std::string _freadstringnewline(std::istream&);
+  std::string _freadfixedlengthstring(std::istream&, size_t, bool);
+  bool _ends_with(std::string const &fullString, std::string const &ending);
+  size_t _vidx_2d(size_t, size_t, size_t);
+  size_t mri_dtype_size(const int32_t);
+  struct MghHeader;
+
+  /// @brief Compressed sparse row (CSR) representation of the vertex adjacency of a mesh or graph.
+  /// @details The neighbors of vertex `i` are stored in `neighbors[offsets[i]]` to `neighbors[offsets[i+1]-1]`, sorted ascending. Compared to an adjacency list, this needs only two allocations and stores the neighbors of all vertices in one contiguous array. Use `fs::Mesh::as_adjcsr` to compute it for a mesh.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::Mesh surface = fs::Mesh::construct_cube();
+  /// fs::AdjacencyCSR adj = surface.as_adjcsr();
+  /// for(uint32_t k = adj.offsets[0]; k < adj.offsets[1]; k++) {
+  ///   std::cout << "Vertex 0 has neighbor " << adj.neighbors[k] << ".\n";
+  /// }
+  /// @endcode
+  struct AdjacencyCSR {
+    std::vector<uint32_t> offsets;  ///< Row offsets into `neighbors`, length `num_vertices + 1`.
+    std::vector<uint32_t> neighbors;  ///< Neighbor vertex indices of all vertices, concatenated.
+
+    /// Get the number of vertices.
+    size_t num_vertices() const {
+      return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+    /// Get the number of neighbors of the given vertex.
+    size_t degree(const size_t vertex) const {
+      return offsets[vertex + 1] - offsets[vertex];
+    }
+
+    /// Get the number of directed edges, i.e., twice the number of undirected edges.
+    size_t num_directed_edges() const {
+      return neighbors.size();
+    }
+
+    /// Get a pointer to the first neighbor of the given vertex.
+    const uint32_t* neighbors_begin(const size_t vertex) const {
+      return neighbors.data() + offsets[vertex];
+    }
+
+    /// Get a pointer one past the last neighbor of the given vertex.
+    const uint32_t* neighbors_end(const size_t vertex) const {
+      return neighbors.data() + offsets[vertex + 1];
+    }
+
+    /// @brief Convert to an adjacency list.
+    /// @return vector of vectors, where the outer vector has size num_vertices. The inner vector at index N contains the neighbors of vertex N.
+    std::vector<std::vector<size_t>> to_adjlist() const {
+      const size_t nv = num_vertices();
+      std::vector<std::vector<size_t>> adjl(nv);
+      for(size_t i = 0; i < nv; i++) {
+        adjl[i].assign(neighbors_begin(i), neighbors_end(i));
+      }
+      return adjl;
+    }
+
+    /// @brief Construct from an adjacency list. The neighbors of each vertex are sorted and duplicates are removed.
+    /// @throws std::invalid_argument if the adjacency list contains a vertex index that does not fit into 32 bits.
+    static AdjacencyCSR from_adjlist(const std::vector<std::vector<size_t>>& adjl) {
+      AdjacencyCSR adj;
+      adj.offsets.resize(adjl.size() + 1);
+      adj.offsets[0] = 0;
+      for(size_t i = 0; i < adjl.size(); i++) {
+        adj.offsets[i + 1] = adj.offsets[i] + uint32_t(adjl[i].size());
+      }
+      adj.neighbors.resize(adj.offsets.back());
+      for(size_t i = 0; i < adjl.size(); i++) {
+        for(size_t j = 0; j < adjl[i].size(); j++) {
+          if(adjl[i][j] > UINT32_MAX) {
+            throw std::invalid_argument("Vertex index " + std::to_string(adjl[i][j]) + " does not fit into the 32 bit indices of AdjacencyCSR.\n");
           }
+          adj.neighbors[adj.offsets[i] + j] = uint32_t(adjl[i][j]);
         }
       }
-      if(vertices.size() != (size_t)num_verts * 3) {
-        std::cerr << "PLY header mentions " << num_verts << " vertices, but found " << vertices.size() / 3 << ".\n";
+      adj._sort_unique_rows();
+      return adj;
+    }
+
+    /// @brief Construct from the faces of a triangular mesh in O(F) time, by counting degrees and computing a prefix sum.
+    /// @param faces vertex indices of the faces, 3 consecutive values per face.
+    /// @param num_vertices the number of vertices of the mesh.
+    /// @throws std::invalid_argument if the faces contain a vertex index outside of `[0, num_vertices)`.
+    static AdjacencyCSR from_faces(const std::vector<int32_t>& faces, const size_t num_vertices) {
+      AdjacencyCSR adj;
+      adj.offsets.assign(num_vertices + 1, 0);
+      const size_t num_face_indices = (faces.size() / 3) * 3;
+      for(size_t i = 0; i < num_face_indices; i++) {
+        if(faces[i] < 0 || size_t(faces[i]) >= num_vertices) {
+          throw std::invalid_argument("Face vertex index " + std::to_string(faces[i]) + " invalid for mesh with " + std::to_string(num_vertices) + " vertices.\n");
+        }
+        adj.offsets[size_t(faces[i]) + 1] += 2;  // Each face adds 2 (possibly duplicate) neighbors to each of its vertices.
       }
-      if(faces.size() != (size_t)num_faces * 3) {
-        std::cerr << "PLY header mentions " << num_faces << " faces, but found " << faces.size() / 3 << ".\n";
+      for(size_t i = 0; i < num_vertices; i++) {
+        adj.offsets[i + 1] += adj.offsets[i];
+      }
+      adj.neighbors.resize(adj.offsets.back());
+      std::vector<uint32_t> fill_pos(adj.offsets.begin(), adj.offsets.end() - 1);
+      for(size_t fidx = 0; fidx + 2 < faces.size(); fidx += 3) {
+        const uint32_t v0 = uint32_t(faces[fidx]), v1 = uint32_t(faces[fidx+1]), v2 = uint32_t(faces[fidx+2]);
+        adj.neighbors[fill_pos[v0]++] = v1;
+        adj.neighbors[fill_pos[v0]++] = v2;
+        adj.neighbors[fill_pos[v1]++] = v0;
+        adj.neighbors[fill_pos[v1]++] = v2;
+        adj.neighbors[fill_pos[v2]++] = v0;
+        adj.neighbors[fill_pos[v2]++] = v1;
       }
-      mesh->vertices = vertices;
-      mesh->faces = faces;
+      adj._sort_unique_rows();
+      return adj;
     }
 
-    /// @brief Read a brainmesh from a Stanford PLY format mesh file.
-    /// @details The PLY format exists in text and binary forms, and the binary form can be little endian or big endian. This file reads the ASCII text format version.
-    /// @param mesh pointer to fs:Mesh instance to be filled.
-    /// @param filename path to input wavefront obj mesh to be read.
-    /// @throws std::runtime_error if the file cannot be read.
-    /// @throws std::domain_error if the file format is invalid.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface;
-    /// fs::Mesh::from_ply(&surface, "mesh.ply");
-    /// @endcode
-    static void from_ply(Mesh* mesh, const std::string& filename) {
-      #ifdef LIBFS_DBG_INFO
-      std::cout << LIBFS_APPTAG << "Reading brain mesh from PLY format file " << filename << ".\n";
-      #endif
-      std::ifstream input(filename, std::fstream::in);
-      if(input.is_open()) {
-        Mesh::from_ply(mesh, &input);
-        input.close();
-      } else {
-        throw std::runtime_error("Could not open Stanford PLY format mesh file '" + filename + "' for reading.\n");
+    /// Sort the neighbors of each vertex and remove duplicates, compacting the neighbor array in place.
+    /// @private
+    void _sort_unique_rows() {
+      const size_t nv = num_vertices();
+      uint32_t write_pos = 0;
+      for(size_t i = 0; i < nv; i++) {
+        uint32_t* row_begin = neighbors.data() + offsets[i];
+        uint32_t* row_end = neighbors.data() + offsets[i + 1];
+        std::sort(row_begin, row_end);
+        uint32_t* row_unique_end = std::unique(row_begin, row_end);
+        offsets[i] = write_pos;
+        for(uint32_t* it = row_begin; it != row_unique_end; ++it) {
+          neighbors[write_pos++] = *it;
+        }
+      }
+      if(nv > 0) {
+        offsets[nv] = write_pos;
+      }
+      neighbors.resize(write_pos);
+    }
+  };
+
+  /// @brief A set of vertices of a mesh, stored as a packed bitset with one bit per vertex.
+  /// @details Uses 64 times less memory than a vector of indices over all vertices, and set operations work on whole 64 bit words. Create one from a label with `fs::Label::vertex_mask`. Use `fs::Mesh::submesh_vertex_mask` to extract the masked part of a mesh, `fs::VertexMask::indices` to get the vertex indices, and `fs::VertexMask::apply` to set the data of vertices outside of the mask to NAN, e.g., before NAN-aware smoothing with `fs::Mesh::smooth_pvd_nn`.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::Label cortex, roi;
+  /// fs::read_label(&cortex, "subject1/label/lh.cortex.label");
+  /// fs::read_label(&roi, "subject1/label/lh.roi.label");
+  /// fs::VertexMask mask = cortex.vertex_mask(surface.num_vertices()) - roi.vertex_mask(surface.num_vertices());
+  /// std::vector<float> masked_thickness = mask.apply(thickness);
+  /// @endcode
+  struct VertexMask {
+
+    /// Construct an empty mask for zero vertices.
+    VertexMask() : num_bits(0) {}
+
+    /// Construct a mask for the given number of vertices, with all vertices inside (`value = true`) or outside of it.
+    explicit VertexMask(size_t num_vertices, bool value = false) : words((num_vertices + 63) / 64, value ? ~uint64_t(0) : uint64_t(0)), num_bits(num_vertices) {
+      this->_clear_tail();
+    }
+
+    /// @brief Construct a mask from vertex indices. Duplicate indices are allowed.
+    /// @throws std::invalid_argument if an index is outside of `[0, num_vertices)`.
+    static VertexMask from_indices(const std::vector<int32_t>& indices, size_t num_vertices) {
+      VertexMask mask(num_vertices);
+      for(size_t i = 0; i < indices.size(); i++) {
+        if(indices[i] < 0 || size_t(indices[i]) >= num_vertices) {
+          throw std::invalid_argument("Vertex index " + std::to_string(indices[i]) + " invalid for mask with " + std::to_string(num_vertices) + " vertices.\n");
+        }
+        mask.words[size_t(indices[i]) / 64] |= uint64_t(1) << (size_t(indices[i]) % 64);
       }
+      return mask;
     }
 
+    /// Construct a mask from a boolean vector, as returned by `fs::Label::vert_in_label`.
+    static VertexMask from_bools(const std::vector<bool>& is_in) {
+      VertexMask mask(is_in.size());
+      for(size_t v = 0; v < is_in.size(); v++) {
+        if(is_in[v]) {
+          mask.words[v / 64] |= uint64_t(1) << (v % 64);
+        }
+      }
+      return mask;
+    }
 
-    /// @brief Return the number of vertices in this mesh.
-    /// @return the vertex count
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// size_t nv = surface.num_vertices();
-    /// @endcode
+    std::vector<uint64_t> words;  ///< The bits, vertex `v` is bit `v % 64` of word `v / 64`. Bits after the last vertex are always zero.
+    size_t num_bits;  ///< The number of vertices.
+
+    /// Return the number of vertices of the mesh, i.e., the size of the mask.
     size_t num_vertices() const {
-      return(this->vertices.size() / 3);
+      return num_bits;
     }
 
-    /// @brief Return the number of faces in this mesh.
-    /// @return the face count
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// size_t nv = surface.num_faces();
-    /// @endcode
-    size_t num_faces() const {
-      return(this->faces.size() / 3);
+    /// Whether vertex `v` is inside the mask.
+    bool test(size_t v) const {
+      assert(v < num_bits);
+      return (words[v / 64] >> (v % 64)) & 1;
     }
 
-    /// @brief Retrieve a vertex index of a face, treating the faces vector as an nx3 matrix.
-    /// @param i the row index, valid values are 0..num_faces-1.
-    /// @param j the column index, valid values are 0..2 (for the 3 vertices of a face).
-    /// @throws std::range_error on invalid index
-    /// @return vertex index of vertex `j` of face `i`
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// int first_face_third_vert = surface.fm_at(0, 2);
-    /// @endcode
-    const int32_t& fm_at(const size_t i, const size_t j) const {
-      size_t idx = _vidx_2d(i, j, 3);
-      if(idx > this->faces.size()-1) {
-        throw std::range_error("Indices (" + std::to_string(i) + "," + std::to_string(j) + ") into Mesh.faces out of bounds. Hit " + std::to_string(idx) + " with max valid index " + std::to_string(this->faces.size()-1) + ".\n");
+    /// Add vertex `v` to the mask (`value = true`) or remove it.
+    void set(size_t v, bool value = true) {
+      assert(v < num_bits);
+      const uint64_t bit = uint64_t(1) << (v % 64);
+      words[v / 64] = value ? (words[v / 64] | bit) : (words[v / 64] & ~bit);
+    }
+
+    /// Return the number of vertices inside the mask.
+    size_t count() const {
+      size_t n = 0;
+      for(size_t w = 0; w < words.size(); w++) {
+        n += size_t(util::_popcount64(words[w]));
       }
-      return(this->faces[idx]);
+      return n;
     }
 
+    /// Whether the mask contains no vertex.
+    bool none() const {
+      for(size_t w = 0; w < words.size(); w++) {
+        if(words[w] != 0) {
+          return false;
+        }
+      }
+      return true;
+    }
 
-    /// @brief Get all vertex indices of the face, given by its index.
-    /// @param face the face index
-    /// @returns vector of length 3, the vertex indices of the face.
-    /// @throws std::range_error on invalid index
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// auto first_face_verts = surface.face_vertices(0);
-    /// @endcode
-    std::vector<int32_t> face_vertices(const size_t face) const {
-      if(face > this->num_faces()-1) {
-        throw std::range_error("Index " + std::to_string(face) + " into Mesh.faces out of bounds, max valid index is " + std::to_string(this->num_faces()-1) + ".\n");
+    /// Return the indices of the vertices inside the mask, in increasing order.
+    std::vector<int32_t> indices() const {
+      std::vector<int32_t> idx;
+      idx.reserve(this->count());
+      for(size_t w = 0; w < words.size(); w++) {
+        uint64_t bits = words[w];
+        while(bits != 0) {
+          idx.push_back(int32_t(w * 64 + size_t(util::_ctz64(bits))));
+          bits &= bits - 1;
+        }
       }
-      std::vector<int32_t> fv(3);
-      fv[0] = this->fm_at(face, 0);
-      fv[1] = this->fm_at(face, 1);
-      fv[2] = this->fm_at(face, 2);
-      return(fv);
+      return idx;
     }
 
-    /// @brief Get all coordinates of the vertex, given by its index.
-    /// @param vertex the vertex index
-    /// @returns vector of length 3, the x,y,z coordinates of the vertex.
-    /// @throws std::range_error on invalid index
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// auto coords = surface.vertex_coords(0);
-    /// @endcode
-    std::vector<float> vertex_coords(const size_t vertex) const {
-      if(vertex > this->num_vertices()-1) {
-        throw std::range_error("Index " + std::to_string(vertex) + " into Mesh.vertices out of bounds, max valid index is " + std::to_string(this->num_vertices()-1) + ".\n");
+    /// Return the mask as a boolean vector, like `fs::Label::vert_in_label`.
+    std::vector<bool> to_bools() const {
+      std::vector<bool> is_in(num_bits);
+      for(size_t v = 0; v < num_bits; v++) {
+        is_in[v] = this->test(v);
       }
-      std::vector<float> vc(3);
-      vc[0] = this->vm_at(vertex, 0);
-      vc[1] = this->vm_at(vertex, 1);
-      vc[2] = this->vm_at(vertex, 2);
-      return(vc);
+      return is_in;
     }
 
-    /// @brief Retrieve a single (x, y, or z) coordinate of a vertex, treating the vertices vector as an nx3 matrix.
-    /// @param i the row index, valid values are 0..num_vertices.
-    /// @param j the column index, valid values are 0..2 (for the x,y,z coordinates).
-    /// @throws std::range_error on invalid index
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// float v5_x = surface.vm_at(5, 0);
-    /// float v5_y = surface.vm_at(5, 1);
-    /// float v5_z = surface.vm_at(5, 2);
-    /// @endcode
-    const float& vm_at(const size_t i, const size_t j) const {
-      size_t idx = _vidx_2d(i, j, 3);
-      if(idx > this->vertices.size()-1) {
-        throw std::range_error("Indices (" + std::to_string(i) + "," + std::to_string(j) + ") into Mesh.vertices out of bounds. Hit " + std::to_string(idx) + " with max valid index " + std::to_string(this->vertices.size()-1) + ".\n");
+    /// @brief Return a copy of the per-vertex data in which the values of vertices outside of the mask are replaced by `fill_value`.
+    /// @throws std::invalid_argument if the data size does not match the number of vertices.
+    std::vector<float> apply(const std::vector<float>& data, float fill_value = std::numeric_limits<float>::quiet_NaN()) const {
+      this->_check_size(data.size());
+      std::vector<float> out(data.size());
+      const std::ptrdiff_t n = std::ptrdiff_t(data.size());
+      const uint64_t* wp = words.data();
+      #ifdef _OPENMP
+      #pragma omp simd
+      #endif
+      for(std::ptrdiff_t v = 0; v < n; v++) {
+        out[size_t(v)] = ((wp[v / 64] >> (v % 64)) & 1) ? data[size_t(v)] : fill_value;
       }
-      return(this->vertices[idx]);
-    }
-
-    /// @brief Return string representing the mesh in PLY format. Overload that works without passing a color vector.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// std::string ply_rep = surface.to_ply();
-    /// @endcode
-    std::string to_ply() const {
-      std::vector<uint8_t> empty_col;
-      return(this->to_ply(empty_col));
+      return out;
     }
 
-    /// @brief Return string representing the mesh in PLY format.
-    /// @param col u_char vector of RGB color values, 3 per vertex. They must appear by vertex, i.e. in order v0_red, v0_green, v0_blue, v1_red, v1_green, v1_blue. Leave empty if you do not want colors.
-    /// @throws std::invalid_argument if the number of vertex colors does not match the number of vertices.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// std::string ply_rep = surface.to_ply();
-    /// @endcode
-    std::string to_ply(const std::vector<uint8_t> col) const {
-      bool use_vertex_colors = col.size() != 0;
-      std::stringstream plys;
-      plys << "ply\nformat ascii 1.0\n";
-      plys << "element vertex " << this->num_vertices() << "\n";
-      plys << "property float x\nproperty float y\nproperty float z\n";
-      if(use_vertex_colors) {
-        if(col.size() != this->vertices.size()) {
-          throw std::invalid_argument("Number of vertex coordinates and vertex colors must match when writing PLY file, but got " + std::to_string(this->vertices.size()) + " and " + std::to_string(col.size()) + ".");
+    /// @brief Return the values of the per-vertex data for the vertices inside the mask, in vertex order, e.g., the data for a submesh.
+    /// @throws std::invalid_argument if the data size does not match the number of vertices.
+    std::vector<float> select(const std::vector<float>& data) const {
+      this->_check_size(data.size());
+      std::vector<float> out;
+      out.reserve(this->count());
+      for(size_t w = 0; w < words.size(); w++) {
+        uint64_t bits = words[w];
+        while(bits != 0) {
+          out.push_back(data[w * 64 + size_t(util::_ctz64(bits))]);
+          bits &= bits - 1;
         }
-        plys << "property uchar red\nproperty uchar green\nproperty uchar blue\n";
       }
-      plys << "element face " << this->num_faces() << "\n";
-      plys << "property list uchar int vertex_index\n";
-      plys << "end_header\n";
+      return out;
+    }
 
-      #ifdef LIBFS_DBG_DEBUG
-      fs::util::log("Writing " + std::to_string(this->vertices.size()/3) + " PLY format vertices.", "INFO");
+    /// @brief Add all vertices of the other mask to this mask (union).
+    /// @throws std::invalid_argument if the masks have different sizes.
+    VertexMask& operator|=(const VertexMask& other) {
+      this->_check_size(other.num_bits);
+      const std::ptrdiff_t nw = std::ptrdiff_t(words.size());
+      uint64_t* a = words.data();
+      const uint64_t* b = other.words.data();
+      #ifdef _OPENMP
+      #pragma omp simd
       #endif
+      for(std::ptrdiff_t w = 0; w < nw; w++) {
+        a[w] |= b[w];
+      }
+      return *this;
+    }
 
-      for(size_t vidx=0; vidx<this->vertices.size();vidx+=3) {  // vertex coords
-        plys << vertices[vidx] << " " << vertices[vidx+1] << " " << vertices[vidx+2];
-        if(use_vertex_colors) {
-          plys << " " << (int)col[vidx] << " " << (int)col[vidx+1] << " " << (int)col[vidx+2];
-        }
-        plys << "\n";
+    /// @brief Keep only the vertices that are also in the other mask (intersection).
+    /// @throws std::invalid_argument if the masks have different sizes.
+    VertexMask& operator&=(const VertexMask& other) {
+      this->_check_size(other.num_bits);
+      const std::ptrdiff_t nw = std::ptrdiff_t(words.size());
+      uint64_t* a = words.data();
+      const uint64_t* b = other.words.data();
+      #ifdef _OPENMP
+      #pragma omp simd
+      #endif
+      for(std::ptrdiff_t w = 0; w < nw; w++) {
+        a[w] &= b[w];
       }
+      return *this;
+    }
 
-      #ifdef LIBFS_DBG_DEBUG
-      fs::util::log("Writing " + std::to_string(this->faces.size()/3) + " PLY format faces.", "INFO");
+    /// @brief Remove all vertices of the other mask from this mask (difference).
+    /// @throws std::invalid_argument if the masks have different sizes.
+    VertexMask& operator-=(const VertexMask& other) {
+      this->_check_size(other.num_bits);
+      const std::ptrdiff_t nw = std::ptrdiff_t(words.size());
+      uint64_t* a = words.data();
+      const uint64_t* b = other.words.data();
+      #ifdef _OPENMP
+      #pragma omp simd
       #endif
+      for(std::ptrdiff_t w = 0; w < nw; w++) {
+        a[w] &= ~b[w];
+      }
+      return *this;
+    }
 
-      const int num_vertices_per_face = 3;
-      for(size_t fidx=0; fidx<this->faces.size();fidx+=3) { // faces: vertex indices, 0-based
-        plys << num_vertices_per_face << " " << faces[fidx] << " " << faces[fidx+1] << " " << faces[fidx+2] << "\n";
+    /// Return the union of this mask and the other mask.
+    VertexMask operator|(const VertexMask& other) const {
+      VertexMask res(*this);
+      res |= other;
+      return res;
+    }
+
+    /// Return the intersection of this mask and the other mask.
+    VertexMask operator&(const VertexMask& other) const {
+      VertexMask res(*this);
+      res &= other;
+      return res;
+    }
+
+    /// Return the vertices of this mask that are not in the other mask.
+    VertexMask operator-(const VertexMask& other) const {
+      VertexMask res(*this);
+      res -= other;
+      return res;
+    }
+
+    /// Return the complement of this mask, i.e., all vertices that are not in this mask.
+    VertexMask operator~() const {
+      VertexMask res(*this);
+      for(size_t w = 0; w < res.words.size(); w++) {
+        res.words[w] = ~res.words[w];
       }
-      return(plys.str());
+      res._clear_tail();
+      return res;
     }
 
-    /// @brief Export this mesh to a file in Stanford PLY format.
-    /// @throws std::runtime_error if the target file cannot be opened.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// surface.to_ply_file("mesh.ply");
-    /// @endcode
-    void to_ply_file(const std::string& filename) const {
-      #ifdef LIBFS_DBG_INFO
-      fs::util::log("Writing mesh to PLY file '" + filename + "'.", "INFO");
-      #endif
-      fs::util::str_to_file(filename, this->to_ply());
+    /// Whether both masks have the same size and contain the same vertices.
+    bool operator==(const VertexMask& other) const {
+      return num_bits == other.num_bits && words == other.words;
     }
 
-    /// @brief Export this mesh to a file in Stanford PLY format with vertex colors.
-    /// @throws std::runtime_error if the target file cannot be opened, std::invalid_argument if the number of vertex colors does not match the number of vertices.
-    void to_ply_file(const std::string& filename, const std::vector<uint8_t> col) const {
-      fs::util::str_to_file(filename, this->to_ply(col));
+    /// Whether the masks differ in size or vertices.
+    bool operator!=(const VertexMask& other) const {
+      return !(*this == other);
     }
 
-    /// @brief Return string representing the mesh in OFF format. Overload that works without passing a color vector.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// std::string off_rep = surface.to_off();
-    /// @endcode
-    std::string to_off() const {
-      std::vector<uint8_t> empty_col;
-      return(this->to_off(empty_col));
+    /// Zero the unused bits of the last word.
+    /// @private
+    void _clear_tail() {
+      if(num_bits % 64 != 0) {
+        words.back() &= (uint64_t(1) << (num_bits % 64)) - 1;
+      }
     }
 
-    /// @brief Return string representing the mesh in PLY format.
-    /// @param col u_char vector of RGB color values, 3 per vertex. They must appear by vertex, i.e. in order v0_red, v0_green, v0_blue, v1_red, v1_green, v1_blue. Leave empty if you do not want colors.
-    /// @throws std::invalid_argument if the number of vertex colors does not match the number of vertices.
-    std::string to_off(const std::vector<uint8_t> col) const {
-      bool use_vertex_colors = col.size() != 0;
-      std::stringstream offs;
-      if(use_vertex_colors) {
-        #ifdef LIBFS_DBG_INFO
-        fs::util::log("Writing OFF representation of mesh with vertex colors.", "INFO");
-        #endif
-        if(col.size() != this->vertices.size()) {
-          throw std::invalid_argument("Number of vertex coordinates and vertex colors must match when writing OFF file but got " + std::to_string(this->vertices.size()) + " and " + std::to_string(col.size()) + ".");
-        }
-        offs << "COFF\n";
-      } else {
-        #ifdef LIBFS_DBG_INFO
-        fs::util::log("Writing OFF representation of mesh without vertex colors.", "INFO");
-        #endif
-        offs << "OFF\n";
+    /// @private
+    void _check_size(size_t n) const {
+      if(n != num_bits) {
+        throw std::invalid_argument("Size " + std::to_string(n) + " does not match the " + std::to_string(num_bits) + " vertices of the mask.\n");
+      }
+    }
+  };
+
+  /// @brief Lazily computed data derived from the vertices and faces of a mesh, see `fs::Mesh::invalidate_cache`.
+  /// @details Each entry is computed at most once and shared via `std::shared_ptr`, so copies of a mesh share the computed entries without copying them. All access is serialized by the mutex: a thread that needs an entry which another thread is computing waits for it, like with `std::call_once`. Checking whether the entries are current is O(1): they are stamped with the generation they were computed for, which `fs::Mesh::invalidate_cache` bumps, and with the sizes of the vertex and face vectors. Each instance has its own mutex, copying takes the entries of the source.
+  ///
+  /// THIS STRUCT IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+  /// @private
+  struct _MeshDerivedCache {
+    _MeshDerivedCache() {}
+
+    _MeshDerivedCache(const _MeshDerivedCache& other) {
+      std::lock_guard<std::mutex> lock(other.mutex);
+      this->_copy_entries(other);
+    }
+
+    _MeshDerivedCache& operator=(const _MeshDerivedCache& other) {
+      if(this != &other) {
+        std::unique_lock<std::mutex> lock_this(this->mutex, std::defer_lock), lock_other(other.mutex, std::defer_lock);
+        std::lock(lock_this, lock_other);
+        this->_copy_entries(other);
       }
-      offs << this->num_vertices() << " " << this->num_faces() << " 0\n";
+      return *this;
+    }
 
-      for(size_t vidx=0; vidx<this->vertices.size();vidx+=3) {  // vertex coords
-        offs << vertices[vidx] << " " << vertices[vidx+1] << " " << vertices[vidx+2];
-        if(use_vertex_colors) {
-          offs << " " << (int)col[vidx] << " " << (int)col[vidx+1] << " " << (int)col[vidx+2] << " 255";
+    /// Drop all entries. The caller must hold the mutex.
+    void clear() {
+      adjcsr.reset();
+      vertex_faces.reset();
+      edges.reset();
+      vertex_normals.reset();
+    }
+
+    mutable std::mutex mutex;  ///< Guards all other members.
+    uint64_t generation = 0;  ///< The current generation of the mesh data, bumped by `fs::Mesh::invalidate_cache`.
+    uint64_t entries_generation = 0;  ///< The generation the entries were computed for.
+    size_t num_vertex_coords = 0;  ///< The size of the vertex vector the entries were computed for.
+    size_t num_face_indices = 0;  ///< The size of the face vector the entries were computed for.
+    std::shared_ptr<const fs::AdjacencyCSR> adjcsr;  ///< see `fs::Mesh::cached_adjcsr`
+    std::shared_ptr<const fs::AdjacencyCSR> vertex_faces;  ///< see `fs::Mesh::vertex_faces`
+    std::shared_ptr<const std::vector<uint32_t>> edges;  ///< see `fs::Mesh::cached_edges`
+    std::shared_ptr<const std::vector<float>> vertex_normals;  ///< see `fs::Mesh::cached_vertex_normals`
+
+    private:
+    void _copy_entries(const _MeshDerivedCache& other) {
+      generation = other.generation;
+      entries_generation = other.entries_generation;
+      num_vertex_coords = other.num_vertex_coords;
+      num_face_indices = other.num_face_indices;
+      adjcsr = other.adjcsr;
+      vertex_faces = other.vertex_faces;
+      edges = other.edges;
+      vertex_normals = other.vertex_normals;
+    }
+  };
+
+  /// @brief A monotone radix heap for non-negative float keys, used by the geodesic distance engine.
+  /// @details Keys are ordered by their IEEE bit patterns, which for non-negative floats is the same as their numeric order. Entries live in 33 buckets by the highest bit in which they differ from the last popped key, so push is O(1) and pop is amortized O(32). Keys pushed must not be smaller than the last popped key, which holds for Dijkstra and fast marching. There is no decrease-key: push the vertex again and skip stale entries when popping. The bucket memory is kept between uses.
+  ///
+  /// THIS STRUCT IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+  /// @private
+  struct _RadixHeap {
+    _RadixHeap() : _last(0), _size(0) {}
+
+    /// Remove all entries, but keep the memory.
+    void clear() {
+      for(size_t i = 0; i < 33; i++) {
+        _buckets[i].clear();
+      }
+      _last = 0;
+      _size = 0;
+    }
+
+    bool empty() const { return _size == 0; }
+
+    void push(float key, uint32_t value) {
+      const uint32_t k = _key_bits(key);
+      assert(k >= _last);
+      _buckets[_bucket(k)].push_back(std::make_pair(k, value));
+      _size++;
+    }
+
+    /// Remove an entry with the smallest key. The heap must not be empty.
+    void pop(float* key, uint32_t* value) {
+      assert(_size > 0);
+      if(_buckets[0].empty()) {
+        size_t i = 1;
+        while(_buckets[i].empty()) {
+          i++;
+        }
+        uint32_t new_last = _buckets[i][0].first;
+        for(size_t j = 1; j < _buckets[i].size(); j++) {
+          new_last = std::min(new_last, _buckets[i][j].first);
         }
-        offs << "\n";
+        _last = new_last;
+        for(size_t j = 0; j < _buckets[i].size(); j++) {
+          _buckets[_bucket(_buckets[i][j].first)].push_back(_buckets[i][j]);
+        }
+        _buckets[i].clear();
       }
+      const std::pair<uint32_t, uint32_t> e = _buckets[0].back();
+      _buckets[0].pop_back();
+      _size--;
+      std::memcpy(key, &e.first, sizeof(float));
+      *value = e.second;
+    }
 
-      const int num_vertices_per_face = 3;
-      for(size_t fidx=0; fidx<this->faces.size();fidx+=3) { // faces: vertex indices, 0-based
-        offs << num_vertices_per_face << " " << faces[fidx] << " " << faces[fidx+1] << " " << faces[fidx+2] << "\n";
+    private:
+    std::vector<std::pair<uint32_t, uint32_t>> _buckets[33];
+    uint32_t _last;
+    size_t _size;
+
+    static uint32_t _key_bits(float key) {
+      uint32_t k;
+      std::memcpy(&k, &key, sizeof(k));
+      return k;
+    }
+
+    size_t _bucket(uint32_t k) const {
+      const uint32_t diff = k ^ _last;
+      size_t b = 0;
+      for(uint32_t d = diff; d != 0; d >>= 1) {
+        b++;
       }
-      return(offs.str());
+      return b;
     }
+  };
 
-    /// @brief Export this mesh to a file in OFF format.
-    /// @throws std::runtime_error if the target file cannot be opened.
-    ///
-    /// #### Examples
-    ///
-    /// @code
-    /// fs::Mesh surface = fs::Mesh::construct_cube();
-    /// surface.to_off_file("mesh.off");
-    /// @endcode
-    void to_off_file(const std::string& filename) const {
-      fs::util::str_to_file(filename, this->to_off());
+  /// @brief Convert the full width at half maximum (FWHM) of a Gaussian kernel to its standard deviation.
+  /// @param fwhm the full width at half maximum, e.g., in mm.
+  /// @return the standard deviation sigma, which is `fwhm / (2 * sqrt(2 * ln(2)))`, about `fwhm / 2.3548`.
+  float fwhm_to_sigma(const float fwhm) {
+    return fwhm / (2.0f * std::sqrt(2.0f * std::log(2.0f)));
+  }
+
+  /// @brief A precomputed sparse linear smoothing operator for per-vertex data, stored in compressed sparse row (CSR) format with float weights.
+  /// @details Row `i` holds the weights with which the values of the vertices `columns[offsets[i]]` to `columns[offsets[i+1]-1]` contribute to the smoothed value of vertex `i`. The weights of each row sum to 1. Applying the operator is a single sparse matrix-vector product, which replaces many iterations of nearest neighbor smoothing and can be reused for all overlays on the same mesh, e.g., for all subjects mapped to fsaverage. Use `fs::Mesh::gaussian_smoothing_operator` to build it, and `fs::CacheWriter::add_smoothing_operator` to store it.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::Mesh surface;
+  /// fs::read_surf(&surface, "lh.white");
+  /// fs::SmoothingOperator op = surface.gaussian_smoothing_operator(5.0f);
+  /// std::vector<float> thickness_smooth = op.apply(thickness);
+  /// @endcode
+  struct SmoothingOperator {
+    SmoothingOperator() : fwhm(0.0f) {}
+
+    std::vector<uint32_t> offsets;  ///< Row offsets into `columns` and `weights`, length `num_vertices + 1`.
+    std::vector<uint32_t> columns;  ///< Column (source vertex) indices of all rows, concatenated, sorted ascending within each row.
+    std::vector<float> weights;  ///< Weights of all rows, parallel to `columns`.
+    float fwhm;  ///< The full width at half maximum the operator was built for, informational only.
+
+    /// Get the number of vertices.
+    size_t num_vertices() const {
+      return offsets.empty() ? 0 : offsets.size() - 1;
     }
 
-    /// @brief Export this mesh to a file in OFF format with vertex colors (COFF).
-    /// @throws std::runtime_error if the target file cannot be opened, std::invalid_argument if the number of vertex colors does not match the number of vertices.
-    void to_off_file(const std::string& filename, const std::vector<uint8_t> col) const {
-      fs::util::str_to_file(filename, this->to_off(col));
+    /// Get the number of stored weights, i.e., the number of non-zero entries of the matrix.
+    size_t num_nonzeros() const {
+      return weights.size();
+    }
+
+    /// @brief Apply the operator to per-vertex data.
+    /// @details Computes all rows in parallel if libfs is compiled with OpenMP. If the data contains no NAN values, each row is a plain weighted sum that the compiler can vectorize.
+    /// @param data the per-vertex data, length `num_vertices`.
+    /// @param with_nan how to handle NAN values in `data`. If `true`, NAN entries are skipped and the weights of the remaining entries of the row are renormalized, so a vertex is only NAN if all values in its neighborhood are NAN. If `false`, NAN values are included and propagate to all rows they occur in.
+    /// @return the smoothed data, length `num_vertices`.
+    /// @throws std::invalid_argument if the data length does not match the number of vertices.
+    std::vector<float> apply(const std::vector<float>& data, const bool with_nan = true) const {
+      LIBFS_INSTRUMENT_SCOPE("smoothing_operator.apply");
+      LIBFS_INSTRUMENT_COUNT("smoothing_operator.nonzeros", weights.size());
+      const std::ptrdiff_t nv = std::ptrdiff_t(this->num_vertices());
+      if(data.size() != size_t(nv)) {
+        throw std::invalid_argument("Data has length " + std::to_string(data.size()) + ", but the smoothing operator is for " + std::to_string(nv) + " vertices.\n");
+      }
+      const bool has_nan = with_nan && std::find_if(data.begin(), data.end(), [](float v) { return std::isnan(v); }) != data.end();
+      std::vector<float> smoothed(data.size());
+      const uint32_t* off = offsets.data();
+      const uint32_t* col = columns.data();
+      const float* w = weights.data();
+      const float* src = data.data();
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static)
+      #endif
+      for(std::ptrdiff_t i = 0; i < nv; i++) {
+        const uint32_t begin = off[i], end = off[i + 1];
+        if(! has_nan) {
+          float sum = 0.0f;
+          #ifdef _OPENMP
+          #pragma omp simd reduction(+:sum)
+          #endif
+          for(uint32_t k = begin; k < end; k++) {
+            sum += w[k] * src[col[k]];
+          }
+          smoothed[size_t(i)] = sum;
+        } else {
+          float sum = 0.0f, weight_sum = 0.0f;
+          for(uint32_t k = begin; k < end; k++) {
+            const float v = src[col[k]];
+            if(! std::isnan(v)) {
+              sum += w[k] * v;
+              weight_sum += w[k];
+            }
+          }
+          smoothed[size_t(i)] = weight_sum > 0.0f ? sum / weight_sum : std::numeric_limits<float>::quiet_NaN();
+        }
+      }
+      return smoothed;
+    }
+
+    /// @brief Apply the operator to several channels of per-vertex data at once, reading the operator only once.
+    /// @details The data must be interleaved in vertex-major order, see `fs::util::interleave`, so that the inner loop over the channels runs over contiguous memory. The result for each channel is the same as calling `fs::SmoothingOperator::apply` for that channel alone, up to floating point rounding.
+    /// @param data_interleaved the per-vertex data of all channels, length `num_vertices * num_channels`. The value of channel `c` for vertex `v` is at index `v * num_channels + c`.
+    /// @param num_channels the number of channels.
+    /// @param with_nan how to handle NAN values, see `fs::SmoothingOperator::apply`.
+    /// @return the smoothed data, in the same interleaved layout as `data_interleaved`.
+    /// @throws std::invalid_argument if the data length does not match the number of vertices and channels.
+    std::vector<float> apply_batch(const std::vector<float>& data_interleaved, const size_t num_channels, const bool with_nan = true) const {
+      LIBFS_INSTRUMENT_SCOPE("smoothing_operator.apply_batch");
+      LIBFS_INSTRUMENT_COUNT("smoothing_operator.nonzeros", weights.size() * num_channels);
+      const size_t K = num_channels;
+      const std::ptrdiff_t nv = std::ptrdiff_t(this->num_vertices());
+      if(data_interleaved.size() != size_t(nv) * K) {
+        throw std::invalid_argument("Interleaved data has length " + std::to_string(data_interleaved.size()) + ", expected " + std::to_string(nv) + " vertices times " + std::to_string(K) + " channels.\n");
+      }
+      const bool has_nan = with_nan && std::find_if(data_interleaved.begin(), data_interleaved.end(), [](float v) { return std::isnan(v); }) != data_interleaved.end();
+      std::vector<float> smoothed(data_interleaved.size(), 0.0f);
+      const uint32_t* off = offsets.data();
+      const uint32_t* col = columns.data();
+      const float* w = weights.data();
+      const float* src = data_interleaved.data();
+      float* dst = smoothed.data();
+      #ifdef _OPENMP
+      #pragma omp parallel
+      #endif
+      {
+        std::vector<float> weight_sums(has_nan ? K : 0);
+        #ifdef _OPENMP
+        #pragma omp for schedule(static)
+        #endif
+        for(std::ptrdiff_t i = 0; i < nv; i++) {
+          float* out = dst + size_t(i) * K;
+          if(! has_nan) {
+            for(uint32_t k = off[i]; k < off[i + 1]; k++) {
+              const float wk = w[k];
+              const float* in = src + size_t(col[k]) * K;
+              #ifdef _OPENMP
+              #pragma omp simd
+              #endif
+              for(size_t c = 0; c < K; c++) {
+                out[c] += wk * in[c];
+              }
+            }
+          } else {
+            std::fill(weight_sums.begin(), weight_sums.end(), 0.0f);
+            for(uint32_t k = off[i]; k < off[i + 1]; k++) {
+              const float wk = w[k];
+              const float* in = src + size_t(col[k]) * K;
+              for(size_t c = 0; c < K; c++) {
+                if(! std::isnan(in[c])) {
+                  out[c] += wk * in[c];
+                  weight_sums[c] += wk;
+                }
+              }
+            }
+            for(size_t c = 0; c < K; c++) {
+              out[c] = weight_sums[c] > 0.0f ? out[c] / weight_sums[c] : std::numeric_limits<float>::quiet_NaN();
+            }
+          }
+        }
+      }
+      return smoothed;
     }
   };
 
+  /// @brief Models a triangular mesh, used for brain surface meshes.
+  ///
+  /// @details Represents a vertex-indexed mesh. The `n` vertices are stored as 3D point coordinates (x,y,z) in a vector
+  /// of length `3n`, in which 3 consecutive values represent the x, y and z coordinate of the same vertex.
+  /// The `m` faces are stored as a vector of `3m` integers, where 3 consecutive values represent the 3 vertices (by index)
+  /// making up the respective face. Vertex indices are 0-based.
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::Mesh surface = fs::Mesh::construct_cube();
+  /// size_t nv = surface.num_vertices(); // 8
+  /// auto first_face_verts = surface.face_vertices(0);
+  /// int first_face_third_vert = surface.fm_at(0, 2);
+  /// size_t nf = surface.num_faces();
+  /// size_t nv = surface.num_vertices();
+  /// surface.to_obj("cube_out.obj");
+  /// @endcode
+  struct Mesh {
 
-  /// Models a FreeSurfer curv file that contains per-vertex float data.
-  struct Curv {
+    /// Construct a Mesh from the given vertices and faces.
+    Mesh(std::vector<float> cvertices, std::vector<int32_t> cfaces) {
+      vertices = std::move(cvertices); faces = std::move(cfaces);
+    }
 
-    /// Construct a Curv instance from the given per-vertex data.
-    Curv(std::vector<float> curv_data) :
-      num_faces(100000), num_vertices(0), num_values_per_vertex(1) { data = curv_data; num_vertices = int(data.size()); }
+    // Construct from 2D vectors (Nx3).
+    Mesh(std::vector<std::vector<float>> cvertices, std::vector<std::vector<int32_t>> cfaces) {
+      vertices = util::vflatten(cvertices); faces = util::vflatten(cfaces);
+    }
 
-    /// Construct an empty Curv instance.
-    Curv() :
-      num_faces(100000), num_vertices(0), num_values_per_vertex(1) {}
+    /// Construct an empty Mesh.
+    Mesh() {}
 
-    /// The number of faces of the mesh to which this belongs, typically irrelevant and ignored.
-    int32_t num_faces;
+    std::vector<float> vertices;  ///< *n x 3* vector of the *x*,*y*,*z* coordinates for the *n* vertices. The x,y,z coordinates for a single vertex form consecutive entries.
+    std::vector<int32_t> faces;  ///< *n x 3* vector of the 3 vertex indices for the *n* triangles or faces. The 3 vertices of a single face form consecutive entries.
 
-    /// The curvature data, one value per vertex. Something like the cortical thickness at each vertex.
+    /// @brief Construct and return a simple cube mesh.
+    /// @return fs::Mesh instance representing a cube.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// size_t nv = surface.num_vertices();  // 8
+    /// size_t nf = surface.num_faces();     // 12
+    /// @endcode
+    static fs::Mesh construct_cube() {
+      fs::Mesh mesh;
+      mesh.vertices = { 1.0, 1.0, 1.0,
+                        1.0, 1.0, -1.0,
+                        1.0, -1.0, 1.0,
+                        1.0, -1.0, -1.0,
+                      -1.0, 1.0, 1.0,
+                      -1.0, 1.0, -1.0,
+                      -1.0, -1.0, 1.0,
+                      -1.0, -1.0, -1.0 };
+      mesh.faces = { 0, 2, 3,
+                    3 ,1, 0,
+                    4, 6, 7,
+                    7, 5, 4,
+                    0, 4, 5,
+                    5, 1, 0,
+                    2, 6, 7,
+                    7, 3, 2,
+                    0, 4, 6,
+                    6, 2, 0,
+                    1, 5, 7,
+                    7, 3, 1 };
+      return mesh;
+    }
+
+    /// @brief Construct and return a simple pyramidal mesh.
+    /// @details This constructs a right square pyramid with base edge length 1 and height 1. Think of the Great Pyramid of Giza.
+    /// @return fs::Mesh instance representing a 4-sided pyramid.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_pyramid();
+    /// size_t nv = surface.num_vertices();  // 5
+    /// size_t nf = surface.num_faces();     // 6
+    /// @endcode
+    static fs::Mesh construct_pyramid() {
+      fs::Mesh mesh;
+      mesh.vertices = { 0.0, 0.0, 0.0, // start with 4x base
+                        0.0, 1.0, 0.0,
+                        1.0, 1.0, 0.0,
+                        1.0, 0.0, 0.0,
+                        0.5, 0.5, 1.0 }; // apex
+      mesh.faces = { 0, 2, 1, // start with 2 base faces
+                     0, 3, 2,
+                     0, 4, 1, // now the 4 wall faces
+                     1, 4, 2,
+                     3, 2, 4,
+                     0, 3, 4 };
+      return mesh;
+    }
+
+    /// @brief Construct and return a simple planar grid mesh.
+    /// @details This is a 2D rectangular grid embedded in 3D. Each rectangular cell consists of 2 triangular faces. The height (z coordinate) for all vertices is `0.0`.
+    /// @param nx number of vertices in x direction
+    /// @param ny number of vertices in y direction
+    /// @param distx distance between vertices in x direction
+    /// @param disty distance between vertices in y direction
+    /// @return fs::Mesh instance representing a flat grid.
+    /// @throws std::invalid_argument error if `nx` or `ny` are `< 2`.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_grid(4, 5);
+    /// size_t nv = surface.num_vertices();  // 4*5 = 20
+    /// size_t nf = surface.num_faces();     // (4-1)*(5-1)*2 = 24;
+    /// @endcode
+    static fs::Mesh construct_grid(const size_t nx = 4, const size_t ny = 5, const float distx = 1.0, const float disty = 1.0) {
+      if(nx < 2 || ny < 2) {
+        throw std::runtime_error("Parameters nx and ny must be at least 2.");
+      }
+      fs::Mesh mesh;
+      size_t num_vertices = nx * ny;
+      size_t num_faces = ((nx - 1) * (ny - 1)) * 2;
+      std::vector<float> vertices;
+      vertices.reserve(num_vertices * 3);
+      std::vector<int> faces;
+      faces.reserve(num_faces * 3);
+
+      // Create vertices.
+      float cur_x, cur_y, cur_z;
+      cur_x = cur_y = cur_z = 0.0;
+      for(size_t i = 0; i < nx; i++) {
+        for(size_t j = 0; j < ny; j++) {
+          vertices.push_back(cur_x);
+          vertices.push_back(cur_y);
+          vertices.push_back(cur_z);
+          cur_y += disty;
+        }
+        cur_x += distx;
+      }
+
+      // Create faces.
+      for(size_t i = 0; i < num_vertices; i++) {
+        if((i+1) % ny == 0 || i >= num_vertices - ny) {
+          // Do not use the last ones in row or column as source.
+          continue;
+        }
+        // Add the upper left triangle of this grid cell.
+        faces.push_back(int(i));
+        faces.push_back(int(i + ny + 1));
+        faces.push_back(int(i + 1));
+        // Add the lower right triangle of this grid cell.
+        faces.push_back(int(i));
+        faces.push_back(int(i + ny + 1));
+        faces.push_back(int(i + ny));
+      }
+
+      mesh.vertices = vertices;
+      mesh.faces = faces;
+      return mesh;
+    }
+
+
+    /// @brief Return string representing the mesh in Wavefront Object (.obj) format.
+    /// @return Wavefront Object string representation of the mesh, including vertices and faces.
+    /// @see fs::Mesh::to_obj_file is a shortcut if you want to export the string representation to a file.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::str mesh_repr_off = surface.to_obj();
+    /// @endcode
+    std::string to_obj() const {
+      std::ostringstream objs;
+      this->to_obj(objs);
+      return(objs.str());
+    }
+
+    /// @brief Write the mesh in Wavefront Object (.obj) format to a stream.
+    /// @details The text is formatted into a fixed size buffer that is written to the stream whenever it is full, so no copy of the whole output is held in memory.
+    /// @param os the stream to which to write.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// surface.to_obj(std::cout);
+    /// @endcode
+    void to_obj(std::ostream& os) const {
+      fs::util::_BufferedWriter w(os);
+      for(size_t vidx=0; vidx<this->vertices.size(); vidx+=3) { // vertex coords
+        w.write("v ", 2);
+        w.put_float(vertices[vidx]);
+        w.put(' ');
+        w.put_float(vertices[vidx+1]);
+        w.put(' ');
+        w.put_float(vertices[vidx+2]);
+        w.put('\n');
+      }
+      for(size_t fidx=0; fidx<this->faces.size(); fidx+=3) { // faces: vertex indices, 1-based
+        w.write("f ", 2);
+        w.put_int(int64_t(faces[fidx]) + 1);
+        w.put(' ');
+        w.put_int(int64_t(faces[fidx+1]) + 1);
+        w.put(' ');
+        w.put_int(int64_t(faces[fidx+2]) + 1);
+        w.put('\n');
+      }
+      w.flush();
+    }
+
+    /// @brief Return adjacency matrix representation of this mesh.
+    /// @return boolean 2D matrix, where true means an edge between the respective vertex pair exists, and false mean it does not.
+    /// @see fs::Mesh::to_rep_adjlist gives you an adjacency list instead.
+    /// @note This requires a lot of memory for large meshes.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::vector<std::vector<bool>> adjm = surface.as_adjmatrix();
+    /// @endcode
+    std::vector<std::vector<bool>> as_adjmatrix() const {
+      std::vector<std::vector<bool>> adjm = std::vector<std::vector<bool>>(this->num_vertices(), std::vector<bool>(this->num_vertices(), false));
+      for(size_t fidx=0; fidx<this->faces.size(); fidx+=3) { // faces: vertex indices
+        adjm[faces[fidx]][faces[fidx+1]] = true;
+        adjm[faces[fidx+1]][faces[fidx]] = true;
+        adjm[faces[fidx+1]][faces[fidx+2]] = true;
+        adjm[faces[fidx+2]][faces[fidx+1]] = true;
+        adjm[faces[fidx+2]][faces[fidx]] = true;
+        adjm[faces[fidx]][faces[fidx+2]] = true;
+      }
+      return adjm;
+    }
+
+    /// @brief Hash function for 2-tuples of `<size_t, sizt_t>`, used to hash an edge of a graph or mesh.
+    /// @details Mixes both vertex indices with the splitmix64 finalizer, so that `(i,j)` and `(j,i)` get different hashes and neighboring edges spread over the buckets.
+    struct _tupleHashFunction {
+      size_t operator()(const std::tuple<size_t , size_t>&x) const {
+        uint64_t h = _mix64(uint64_t(std::get<0>(x)));
+        h ^= _mix64(uint64_t(std::get<1>(x)) + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2));
+        return size_t(h);
+      }
+
+      /// The splitmix64 finalizer.
+      static uint64_t _mix64(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+      }
+    };
+
+    /// @brief Datastructure for storing, and quickly querying the existence of, mesh edges.
+    /// @details This is an unordered set of 2-tuples, where each tuple represents an edge, given as a pair of vertex indices. Each edge occurs twice in the list, once as `make_tuple(i,j)` and once as `make_tuple(j,i)`. Use the API of `std::unordered_set` to interact with it.
+    typedef std::unordered_set<std::tuple<size_t, size_t>, _tupleHashFunction> edge_set;
+
+    /// @brief Return edge list representation of this mesh.
+    /// @note While this mesh or graph representation is typically known as an edge list, this function actually returns a set.
+    /// @return an `fs::Mesh::edge_set`, i.e., an unordered set of 2-tuples, where each tuple represents an edge, given as a pair of vertex indices. Each edge occurs twice in the list, once as `make_tuple(i,j)` and once as `make_tuple(j,i)`.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// edge_set edges = surface.as_edgelist();
+    /// size_t num_undirected_edges = edg es.size() / 2;
+    /// @endcode
+    edge_set as_edgelist() const {
+      const std::vector<uint32_t>& flat_edges = this->cached_edges();
+      edge_set edges;
+      edges.reserve(flat_edges.size());
+      for(size_t i = 0; i < flat_edges.size(); i += 2) {
+        edges.insert(std::make_tuple(size_t(flat_edges[i]), size_t(flat_edges[i+1])));
+        edges.insert(std::make_tuple(size_t(flat_edges[i+1]), size_t(flat_edges[i])));
+      }
+      return edges;
+    }
+
+    /// @brief Return the undirected edges of this mesh as a sorted, flat vector of vertex index pairs.
+    /// @details Each edge occurs once, as the pair `(i,j)` with `i < j`, stored at indices `2k` and `2k+1`. The pairs are sorted by `i`, then `j`. This is computed with a radix sort over 64 bit edge keys, without any hashing or per-edge allocations, and is the recommended edge representation for large meshes.
+    /// @return flat vector of length `2E` for a mesh with `E` edges.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::vector<uint32_t> edges = surface.as_edges();
+    /// size_t num_edges = edges.size() / 2;  // 18
+    /// @endcode
+    std::vector<uint32_t> as_edges() const {
+      const size_t num_faces = this->faces.size() / 3;
+      std::vector<uint64_t> keys(num_faces * 3);
+      uint64_t max_key = 0;
+      for(size_t f = 0; f < num_faces; f++) {
+        for(size_t e = 0; e < 3; e++) {
+          uint32_t a = uint32_t(this->faces[f*3 + e]);
+          uint32_t b = uint32_t(this->faces[f*3 + (e+1) % 3]);
+          if(a > b) {
+            std::swap(a, b);
+          }
+          const uint64_t key = (uint64_t(a) << 32) | b;
+          keys[f*3 + e] = key;
+          max_key = std::max(max_key, key);
+        }
+      }
+      fs::util::_radix_sort_u64(&keys, max_key);
+      keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+      std::vector<uint32_t> edges(keys.size() * 2);
+      for(size_t i = 0; i < keys.size(); i++) {
+        edges[2*i] = uint32_t(keys[i] >> 32);
+        edges[2*i + 1] = uint32_t(keys[i] & 0xFFFFFFFFULL);
+      }
+      return edges;
+    }
+
+    /// @brief Return compressed sparse row (CSR) adjacency representation of this mesh.
+    /// @details This is computed from the faces in O(F) time and memory, and is the recommended adjacency representation for large meshes.
+    /// @return the adjacency, the neighbors of each vertex are sorted ascending.
+    /// @throws std::invalid_argument if the faces reference vertex indices outside the valid range.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// fs::AdjacencyCSR adj = surface.as_adjcsr();
+    /// size_t num_neighbors_v0 = adj.degree(0);
+    /// @endcode
+    fs::AdjacencyCSR as_adjcsr() const {
+      return fs::AdjacencyCSR::from_faces(this->faces, this->num_vertices());
+    }
+
+    /// @brief Return adjacency list representation of this mesh.
+    /// @param via_matrix whether the computation should be done via the fast CSR path (`true`), or via an edge set (`false`). The name is kept for backwards compatibility: this no longer builds a dense adjacency matrix, but gives identical results (neighbors sorted ascending).
+    /// @return vector of vectors, where the outer vector has size this->num_vertices. The inner vector at index N contains the M neighbors of vertex n, as vertex indices.
+    /// @see fs::Mesh::as_adjcsr gives you a more compact CSR representation, fs::Mesh::as_adjmatrix gives you an adjacency matrix.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::vector<std::vector<size_t>> adjl = surface.as_adjlist();
+    /// std::vector<std::vector<size_t>> adjl1 = surface.as_adjlist(true);
+    /// @endcode
+    std::vector<std::vector<size_t>> as_adjlist(const bool via_matrix=true) const {
+      if(! via_matrix) {
+        return(this->_as_adjlist_via_edgeset());
+      }
+      return this->cached_adjcsr().to_adjlist();
+    }
+
+    /// @brief Return adjacency list representation of this mesh via edge list.
+    /// @return vector of vectors, where the outer vector has size this->num_vertices. The inner vector at index N contains the M neighbors of vertex n, as vertex indices.
+    /// @see fs::Mesh::to_rep_adjmatrix gives you an adjacency matrix instead.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::vector<std::vector<size_t>> adjl = surface.as_adjlist();
+    /// @endcode
+    std::vector<std::vector<size_t>> _as_adjlist_via_edgeset() const {
+      const std::vector<uint32_t>& edges = this->cached_edges();
+      std::vector<size_t> degree(this->num_vertices(), 0);
+      for(size_t i = 0; i < edges.size(); i++) {
+        degree[edges[i]]++;
+      }
+      std::vector<std::vector<size_t>> adjl = std::vector<std::vector<size_t>>(this->num_vertices(), std::vector<size_t>());
+      for(size_t v = 0; v < adjl.size(); v++) {
+        adjl[v].reserve(degree[v]);
+      }
+      // The edges are sorted by (min, max), so all rows come out sorted ascending.
+      for(size_t i = 0; i < edges.size(); i += 2) {
+        adjl[edges[i]].push_back(edges[i+1]);
+        adjl[edges[i+1]].push_back(edges[i]);
+      }
+      return adjl;
+    }
+
+    /// @brief Smooth given per-vertex data using nearest neighbor smoothing.
+    /// @param pvd vector of per-vertex data values, one value per mesh vertex.
+    /// @param num_iter number of iterations of smoothing to perform.
+    /// @param via_matrix whether to use the CSR adjacency of the mesh (`true`), or an adjacency list computed via an edge set (`false`). See `fs::Mesh::as_adjlist`.
+    /// @param with_nan whether you need support for NAN values in `pvd`. A bit slower if active. Ignored if `detectnan` is `true`.
+    /// @param detect_nan whether to auto-detect presence of NAN values, ignoring the setting of `with_nan`.
+    /// @return vector of smoothed per-vertex data values, same length as `pvd` param.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::vector<float> pvd = {1.0, 1.1, 1.2, 1.3, 1.4, 1.5, 1.6, 1.7};
+    /// std::vector<float> pvd_smooth = surface.smooth_pvd_nn(pvd, 2);
+    /// @endcode
+    std::vector<float> smooth_pvd_nn(const std::vector<float>& pvd, const size_t num_iter=1, const bool via_matrix=true, const bool with_nan=true, const bool detect_nan=true) const {
+      if(via_matrix) {
+        return fs::Mesh::smooth_pvd_nn(this->cached_adjcsr(), pvd, num_iter, with_nan, detect_nan);
+      }
+      const std::vector<std::vector<size_t>> adjlist = this->as_adjlist(via_matrix);
+      return fs::Mesh::smooth_pvd_nn(adjlist, pvd, num_iter, with_nan, detect_nan);
+    }
+
+
+    /// @brief Detect whether the given per-vertex data contains NAN values, honoring the `with_nan` and `detect_nan` options of `fs::Mesh::smooth_pvd_nn`.
+    /// @private
+    static bool _smooth_needs_nan_support(const std::vector<float>& pvd, const bool with_nan, const bool detect_nan) {
+      if(! detect_nan) {
+        return with_nan;
+      }
+      for(size_t i=0; i<pvd.size(); i++) {
+        if(std::isnan(pvd[i])) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /// @private
+    static size_t _adj_num_vertices(const fs::AdjacencyCSR& adj) { return adj.num_vertices(); }
+    /// @private
+    static size_t _adj_num_vertices(const std::vector<std::vector<size_t>>& adj) { return adj.size(); }
+    /// @private
+    static const uint32_t* _adj_row_begin(const fs::AdjacencyCSR& adj, const size_t v) { return adj.neighbors_begin(v); }
+    /// @private
+    static const uint32_t* _adj_row_end(const fs::AdjacencyCSR& adj, const size_t v) { return adj.neighbors_end(v); }
+    /// @private
+    static const size_t* _adj_row_begin(const std::vector<std::vector<size_t>>& adj, const size_t v) { return adj[v].data(); }
+    /// @private
+    static const size_t* _adj_row_end(const std::vector<std::vector<size_t>>& adj, const size_t v) { return adj[v].data() + adj[v].size(); }
+
+    /// @brief Nearest neighbor smoothing kernel shared by the adjacency list and CSR versions.
+    /// @details Uses two preallocated buffers that are swapped between iterations, and splits the vertex loop across threads if OpenMP is enabled. The per-vertex arithmetic is identical to the serial version, so results do not depend on the number of threads.
+    /// @private
+    template <typename AdjT>
+    static std::vector<float> _smooth_pvd_nn_impl(const AdjT& mesh_adj, const std::vector<float>& pvd, const size_t num_iter, const bool with_nan) {
+      LIBFS_INSTRUMENT_SCOPE("smooth_pvd_nn");
+      const std::ptrdiff_t nv = std::ptrdiff_t(_adj_num_vertices(mesh_adj));
+      LIBFS_INSTRUMENT_COUNT("smooth_pvd_nn.vertex_updates", size_t(nv) * num_iter);
+      LIBFS_INSTRUMENT_COUNT("smooth_pvd_nn.alloc_bytes", 2 * pvd.size() * sizeof(float));
+      std::vector<float> source = pvd;
+      std::vector<float> smoothed(pvd.size());
+      for(size_t i = 0; i < num_iter; i++) {
+        const float* src = source.data();
+        float* dst = smoothed.data();
+        if(with_nan) {
+          #ifdef _OPENMP
+          #pragma omp parallel for schedule(static)
+          #endif
+          for(std::ptrdiff_t v_idx = 0; v_idx < nv; v_idx++) {
+            if(std::isnan(src[v_idx])) {
+              dst[v_idx] = NAN;
+              continue;
+            }
+            float val_sum = src[v_idx];
+            size_t num_non_nan_values = 1;  // If we get here, the source vertex value is not NAN.
+            const auto row_end = _adj_row_end(mesh_adj, size_t(v_idx));
+            for(auto it = _adj_row_begin(mesh_adj, size_t(v_idx)); it != row_end; ++it) {
+              const float neigh_val = src[*it];
+              if(! std::isnan(neigh_val)) {
+                val_sum += neigh_val;
+                num_non_nan_values++;
+              }
+            }
+            dst[v_idx] = val_sum / (float)num_non_nan_values;
+          }
+        } else {
+          #ifdef _OPENMP
+          #pragma omp parallel for schedule(static)
+          #endif
+          for(std::ptrdiff_t v_idx = 0; v_idx < nv; v_idx++) {
+            const auto row_begin = _adj_row_begin(mesh_adj, size_t(v_idx));
+            const auto row_end = _adj_row_end(mesh_adj, size_t(v_idx));
+            const size_t num_neigh = size_t(row_end - row_begin);
+            float val_sum = src[v_idx] / (num_neigh+1);
+            for(auto it = row_begin; it != row_end; ++it) {
+              val_sum += src[*it] / (num_neigh+1);
+            }
+            dst[v_idx] = val_sum;
+          }
+        }
+        source.swap(smoothed);
+      }
+      return source;
+    }
+
+    /// @brief Smooth given per-vertex data using nearest neighbor smoothing based on CSR mesh representation.
+    /// @param mesh_adj the mesh adjacency, see `fs::Mesh::as_adjcsr`.
+    /// @param pvd vector of per-vertex data values, one value per mesh vertex.
+    /// @param num_iter number of iterations of smoothing to perform.
+    /// @param with_nan whether you need support for NAN values in `pvd`. A bit slower if active. Ignored if `detectnan` is `true`.
+    /// @param detect_nan whether to auto-detect presence of NAN values, ignoring the setting of `with_nan`.
+    /// @return vector of smoothed per-vertex data values, same length as `pvd` param. Identical to the result of the adjacency list version for the same mesh.
+    /// @note The vertex loop runs in parallel if libfs is compiled with OpenMP support.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// fs::AdjacencyCSR mesh_adj = surface.as_adjcsr();
+    /// std::vector<float> pvd = {1.0, 1.1, 1.2, 1.3, 1.4, 1.5, 1.6, 1.7};
+    /// std::vector<float> pvd_smooth = fs::Mesh::smooth_pvd_nn(mesh_adj, pvd, 2);
+    /// @endcode
+    static std::vector<float> smooth_pvd_nn(const fs::AdjacencyCSR& mesh_adj, const std::vector<float>& pvd, const size_t num_iter=1, const bool with_nan=true, const bool detect_nan=true) {
+      assert(pvd.size() == mesh_adj.num_vertices());
+      return fs::Mesh::_smooth_pvd_nn_impl(mesh_adj, pvd, num_iter, _smooth_needs_nan_support(pvd, with_nan, detect_nan));
+    }
+
+    /// @brief Smooth given per-vertex data using nearest neighbor smoothing based on adjacency list mesh represenation.
+    /// @param mesh_adj the mesh, given as an adjacency list. The outer vector has size num_vertices, and the inner vectors sizes are the number of neighbors of the respective vertex.
+    /// @param pvd vector of per-vertex data values, one value per mesh vertex.
+    /// @param num_iter number of iterations of smoothing to perform.
+    /// @param with_nan whether you need support for NAN values in `pvd`. A bit slower if active. Ignored if `detectnan` is `true`.
+    /// @param detect_nan whether to auto-detect presence of NAN values, ignoring the setting of `with_nan`.
+    /// @return vector of smoothed per-vertex data values, same length as `pvd` param.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::vector<std::vector<size_t>> mesh_adj = surface.as_adjlist();
+    /// std::vector<float> pvd = {1.0, 1.1, 1.2, 1.3, 1.4, 1.5, 1.6, 1.7};
+    /// std::vector<float> pvd_smooth = fs::Mesh::smooth_pvd_nn(mesh_adj, pvd, 2);
+    /// @endcode
+    static std::vector<float> smooth_pvd_nn(const std::vector<std::vector<size_t>>& mesh_adj, const std::vector<float>& pvd, const size_t num_iter=1, const bool with_nan=true, const bool detect_nan=true) {
+      assert(pvd.size() == mesh_adj.size());
+      return fs::Mesh::_smooth_pvd_nn_impl(mesh_adj, pvd, num_iter, _smooth_needs_nan_support(pvd, with_nan, detect_nan));
+    }
+
+    /// @brief Smooth given per-vertex data including NAN values using nearest neighbor smoothing based on adjacency list mesh representation.
+    /// @private
+    /// @param mesh_adj the mesh, given as an adjacency list. The outer vector has size num_vertices, and the inner vectors sizes are the number of neighbors of the respective vertex.
+    /// @param pvd vector of per-vertex data values, one value per mesh vertex. May include NAN values.
+    /// @param num_iter number of iterations of smoothing to perform.
+    /// @return vector of smoothed per-vertex data values, same length as `pvd` param.
+    /// @note This function is private, users should call `fs::Mesh::smooth_pvd_nn` instead.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::vector<std::vector<size_t>> mesh_adj = surface.as_adjlist();
+    /// std::vector<float> pvd = {1.0, 1.1, 1.2, NAN, 1.4, 1.5, 1.6, 1.7};
+    /// std::vector<float> pvd_smooth = fs::Mesh::smooth_pvd_nn(mesh_adj, pvd, 2);
+    /// @endcode
+    static std::vector<float> _smooth_pvd_nn_nan(const std::vector<std::vector<size_t>>& mesh_adj, const std::vector<float>& pvd, const size_t num_iter=1) {
+      return fs::Mesh::_smooth_pvd_nn_impl(mesh_adj, pvd, num_iter, true);
+    }
+
+    /// @brief Smooth given per-vertex data including NAN values using nearest neighbor smoothing based on CSR mesh representation.
+    /// @private
+    /// @note This function is private, users should call `fs::Mesh::smooth_pvd_nn` instead.
+    static std::vector<float> _smooth_pvd_nn_nan(const fs::AdjacencyCSR& mesh_adj, const std::vector<float>& pvd, const size_t num_iter=1) {
+      return fs::Mesh::_smooth_pvd_nn_impl(mesh_adj, pvd, num_iter, true);
+    }
+
+    /// @brief Smooth several per-vertex descriptors at once using nearest neighbor smoothing based on CSR mesh representation.
+    /// @details All `K` channels are smoothed during a single traversal of the neighbor lists, which reads the adjacency only once per iteration instead of `K` times. The data must be interleaved in vertex-major order, see `fs::util::interleave`, so that the inner loop over the channels runs over contiguous memory and can be vectorized by the compiler. The result for each channel is identical to calling `fs::Mesh::smooth_pvd_nn` for that channel alone.
+    /// @param mesh_adj the mesh adjacency, see `fs::Mesh::as_adjcsr`.
+    /// @param pvd_interleaved the per-vertex data of all channels, length `num_vertices * num_channels`. The value of channel `c` for vertex `v` is at index `v * num_channels + c`.
+    /// @param num_channels the number of channels `K`.
+    /// @param num_iter number of iterations of smoothing to perform.
+    /// @param with_nan whether you need support for NAN values in `pvd_interleaved`. A bit slower if active. Ignored if `detectnan` is `true`.
+    /// @param detect_nan whether to auto-detect presence of NAN values, ignoring the setting of `with_nan`.
+    /// @return smoothed data, in the same interleaved layout as `pvd_interleaved`.
+    /// @throws std::invalid_argument if the data length does not match the number of vertices and channels.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::vector<float> thickness = {1.0, 1.1, 1.2, 1.3, 1.4, 1.5, 1.6, 1.7};
+    /// std::vector<float> area = {0.5, 0.6, 0.7, 0.8, 0.9, 1.0, 1.1, 1.2};
+    /// std::vector<float> both = fs::util::interleave(std::vector<std::vector<float>>({ thickness, area }));
+    /// std::vector<float> both_smooth = fs::Mesh::smooth_pvd_nn_batch(surface.as_adjcsr(), both, 2, 5);
+    /// std::vector<std::vector<float>> res = fs::util::deinterleave(both_smooth, 2);
+    /// @endcode
+    static std::vector<float> smooth_pvd_nn_batch(const fs::AdjacencyCSR& mesh_adj, const std::vector<float>& pvd_interleaved, const size_t num_channels, const size_t num_iter=1, const bool with_nan=true, const bool detect_nan=true) {
+      LIBFS_INSTRUMENT_SCOPE("smooth_pvd_nn_batch");
+      const size_t K = num_channels;
+      const std::ptrdiff_t nv = std::ptrdiff_t(mesh_adj.num_vertices());
+      LIBFS_INSTRUMENT_COUNT("smooth_pvd_nn_batch.vertex_updates", size_t(nv) * K * num_iter);
+      if(pvd_interleaved.size() != size_t(nv) * K) {
+        throw std::invalid_argument("Interleaved data has length " + std::to_string(pvd_interleaved.size()) + ", expected " + std::to_string(nv) + " vertices times " + std::to_string(K) + " channels.\n");
+      }
+      // Decide per channel, so that each channel gets exactly the arithmetic of the single channel version.
+      std::vector<char> channel_with_nan(K, with_nan ? 1 : 0);
+      if(detect_nan) {
+        std::fill(channel_with_nan.begin(), channel_with_nan.end(), 0);
+        for(size_t j = 0; j < pvd_interleaved.size(); j++) {
+          if(std::isnan(pvd_interleaved[j])) {
+            channel_with_nan[j % K] = 1;
+          }
+        }
+      }
+      const bool final_with_nan = std::find(channel_with_nan.begin(), channel_with_nan.end(), 1) != channel_with_nan.end();
+      std::vector<float> source = pvd_interleaved;
+      std::vector<float> smoothed(pvd_interleaved.size());
+      for(size_t i = 0; i < num_iter; i++) {
+        const float* src = source.data();
+        float* dst_all = smoothed.data();
+        #ifdef _OPENMP
+        #pragma omp parallel
+        #endif
+        {
+          std::vector<uint32_t> num_non_nan_values(final_with_nan ? K : 0);
+          #ifdef _OPENMP
+          #pragma omp for schedule(static)
+          #endif
+          for(std::ptrdiff_t v_idx = 0; v_idx < nv; v_idx++) {
+            const uint32_t* row_begin = mesh_adj.neighbors_begin(size_t(v_idx));
+            const uint32_t* row_end = mesh_adj.neighbors_end(size_t(v_idx));
+            const float* src_v = src + size_t(v_idx) * K;
+            float* dst = dst_all + size_t(v_idx) * K;
+            const size_t num_neigh = size_t(row_end - row_begin);
+            if(final_with_nan) {
+              for(size_t c = 0; c < K; c++) {
+                dst[c] = channel_with_nan[c] ? src_v[c] : src_v[c] / (num_neigh+1);
+                num_non_nan_values[c] = 1;
+              }
+              for(const uint32_t* it = row_begin; it != row_end; ++it) {
+                const float* src_n = src + size_t(*it) * K;
+                for(size_t c = 0; c < K; c++) {
+                  if(! channel_with_nan[c]) {
+                    dst[c] += src_n[c] / (num_neigh+1);
+                  } else if(! std::isnan(src_n[c])) {
+                    dst[c] += src_n[c];
+                    num_non_nan_values[c]++;
+                  }
+                }
+              }
+              for(size_t c = 0; c < K; c++) {
+                if(channel_with_nan[c]) {
+                  dst[c] = std::isnan(src_v[c]) ? NAN : dst[c] / (float)num_non_nan_values[c];
+                }
+              }
+            } else {
+              for(size_t c = 0; c < K; c++) {
+                dst[c] = src_v[c] / (num_neigh+1);
+              }
+              for(const uint32_t* it = row_begin; it != row_end; ++it) {
+                const float* src_n = src + size_t(*it) * K;
+                for(size_t c = 0; c < K; c++) {
+                  dst[c] += src_n[c] / (num_neigh+1);
+                }
+              }
+            }
+          }
+        }
+        source.swap(smoothed);
+      }
+      return source;
+    }
+
+    /// @brief Smooth several per-vertex descriptors at once, given as separate vectors. Convenience wrapper around `fs::Mesh::smooth_pvd_nn_batch`.
+    /// @param mesh_adj the mesh adjacency, see `fs::Mesh::as_adjcsr`.
+    /// @param pvds the `K` per-vertex descriptors, each with one value per mesh vertex.
+    /// @param num_iter number of iterations of smoothing to perform.
+    /// @param with_nan whether you need support for NAN values. Ignored if `detectnan` is `true`.
+    /// @param detect_nan whether to auto-detect presence of NAN values, ignoring the setting of `with_nan`.
+    /// @return the `K` smoothed descriptors.
+    static std::vector<std::vector<float>> smooth_pvd_nn_batch(const fs::AdjacencyCSR& mesh_adj, const std::vector<std::vector<float>>& pvds, const size_t num_iter=1, const bool with_nan=true, const bool detect_nan=true) {
+      if(pvds.empty()) {
+        return std::vector<std::vector<float>>();
+      }
+      return fs::util::deinterleave(fs::Mesh::smooth_pvd_nn_batch(mesh_adj, fs::util::interleave(pvds), pvds.size(), num_iter, with_nan, detect_nan), pvds.size());
+    }
+
+    /// @brief Extend mesh neighborhoods based on mesh adjacency representation.
+    /// @details This function is mainly extended to extend a source neighborhood representation (typically the mesh's `k=1` neighborhood, i.e., the adjacency list of the mesh) to a higher `k`. In a `k=3` neighborhood, the neighorhood around a source vertex includes all vertices in edge distance up to 3 from the source vertex (but not the source vertex itself).
+    /// @param mesh_adj The adjacency list representation of the underlying mesh, the outer vector must have size `N` for a mesh with `N` vertices.
+    /// @param extend_by the number of edges to hop to extend the neighborhoods.
+    /// @param mesh_adj_ext the starting neighborhoods to extend, same representation as `mesh_adj`. The outer vector must have size `N` or `0`. If passed as an empty vector, this will be ignored and a copy of the `mesh_adj` is used as the `start_neighborhoods`.
+    /// @return extended neighborhoods
+    /// @note If `mesh_adj_ext` is empty and `extend_by > 0`, this is computed as a k-ring via `fs::Mesh::kring`, which is a lot faster than the iterative extension.
+    /// @see There is an overload for `fs::AdjacencyCSR`, which avoids the conversions from and to adjacency lists.
+    static std::vector<std::vector<size_t>> extend_adj(const std::vector<std::vector<size_t>>& mesh_adj, const size_t extend_by=1, std::vector<std::vector<size_t>> mesh_adj_ext=std::vector<std::vector<size_t>>()) {
+      size_t num_vertices = mesh_adj.size();
+      if(mesh_adj_ext.size() == 0) {
+        if(extend_by > 0) {  // Starting from the k=1 neighborhood, this is a k-ring.
+          return fs::Mesh::kring(fs::AdjacencyCSR::from_adjlist(mesh_adj), extend_by + 1).to_adjlist();
+        }
+        mesh_adj_ext = mesh_adj;
+      }
+      std::vector<size_t> neighborhood;
+      std::vector<size_t> ext_neighborhood;
+      for(size_t ext_idx = 0; ext_idx < extend_by; ext_idx++) {
+        for(size_t source_vert_idx = 0; source_vert_idx < num_vertices; source_vert_idx++) {
+          neighborhood = mesh_adj_ext[source_vert_idx]; // copy needed so we do not modify during iteration.
+          // Extension: add all neighbors in distance one for all vertices in the neighborhood.
+          for(size_t neigh_vert_rel_idx = 0; neigh_vert_rel_idx < neighborhood.size(); neigh_vert_rel_idx++) {
+            for(size_t canidate_rel_idx = 0; canidate_rel_idx < mesh_adj[neighborhood[neigh_vert_rel_idx]].size(); canidate_rel_idx++) {
+              if(mesh_adj[neighborhood[neigh_vert_rel_idx]][canidate_rel_idx] != source_vert_idx) {
+                mesh_adj_ext[source_vert_idx].push_back(mesh_adj[neighborhood[neigh_vert_rel_idx]][canidate_rel_idx]);
+              }
+            }
+          }
+          // We need to remove duplicates.
+          std::sort(mesh_adj_ext[source_vert_idx].begin(), mesh_adj_ext[source_vert_idx].end());
+          mesh_adj_ext[source_vert_idx].erase(std::unique(mesh_adj_ext[source_vert_idx].begin(), mesh_adj_ext[source_vert_idx].end()), mesh_adj_ext[source_vert_idx].end());
+        }
+      }
+      return mesh_adj_ext;
+    }
+
+    /// @brief Reusable per-thread buffers for the bounded breadth-first searches of `fs::Mesh::kring`.
+    /// @private
+    struct _KRingWorkspace {
+      std::vector<uint32_t> stamp;  ///< `stamp[v] == source + 1` iff vertex `v` was reached from `source`. Never needs clearing.
+      std::vector<uint16_t> dist;  ///< Hop distance of `v` from the current source, valid iff `stamp[v]` matches.
+      std::vector<uint32_t> frontier;
+      std::vector<uint32_t> next_frontier;
+      std::vector<uint32_t> found;  ///< Vertices reached from the current source, excluding the source itself.
+
+      explicit _KRingWorkspace(const size_t num_vertices) : stamp(num_vertices, 0), dist(num_vertices, 0) {}
+    };
+
+    /// @brief Run a breadth-first search from `source` up to `k` hops, leaving the reached vertices in `ws->found`, in BFS order.
+    /// @private
+    static void _kring_bfs(const fs::AdjacencyCSR& mesh_adj, const size_t source, const size_t k, _KRingWorkspace* ws) {
+      const uint32_t stamp = uint32_t(source) + 1;
+      ws->stamp[source] = stamp;
+      ws->found.clear();
+      ws->frontier.assign(1, uint32_t(source));
+      for(size_t hop = 1; hop <= k && ! ws->frontier.empty(); hop++) {
+        ws->next_frontier.clear();
+        for(size_t f = 0; f < ws->frontier.size(); f++) {
+          const uint32_t* row_end = mesh_adj.neighbors_end(ws->frontier[f]);
+          for(const uint32_t* it = mesh_adj.neighbors_begin(ws->frontier[f]); it != row_end; ++it) {
+            if(ws->stamp[*it] != stamp) {
+              ws->stamp[*it] = stamp;
+              ws->dist[*it] = uint16_t(hop);
+              ws->next_frontier.push_back(*it);
+            }
+          }
+        }
+        ws->found.insert(ws->found.end(), ws->next_frontier.begin(), ws->next_frontier.end());
+        ws->frontier.swap(ws->next_frontier);
+      }
+    }
+
+    /// @brief Compute the k-ring neighborhood of every vertex, i.e., all vertices in edge distance of up to `k`, excluding the vertex itself.
+    /// @details Runs a bounded breadth-first search from each vertex, using a visited stamp array that never needs clearing. The work is split across source vertices if libfs is compiled with OpenMP, with one workspace per thread. The searches are run twice: once to count the neighborhood sizes and once to fill the output, so no intermediate per-vertex vectors are needed.
+    /// @param mesh_adj The CSR adjacency of the underlying mesh, see `fs::Mesh::as_adjcsr`.
+    /// @param k the ring size, i.e., the maximal edge distance. Must be smaller than 65536.
+    /// @param hop_distances optional output, if not `nullptr`, it is filled with the edge distance of each neighbor from its source vertex, in the same order as the `neighbors` of the returned adjacency.
+    /// @return the k-ring neighborhoods, the neighbors of each vertex are sorted ascending.
+    /// @throws std::invalid_argument if `k` is too large, std::runtime_error if the total size of all neighborhoods does not fit into 32 bit offsets.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface;
+    /// fs::read_surf(&surface, "lh.white");
+    /// std::vector<uint16_t> hops;
+    /// fs::AdjacencyCSR ring5 = fs::Mesh::kring(surface.as_adjcsr(), 5, &hops);
+    /// @endcode
+    static fs::AdjacencyCSR kring(const fs::AdjacencyCSR& mesh_adj, const size_t k, std::vector<uint16_t>* hop_distances=nullptr) {
+      LIBFS_INSTRUMENT_SCOPE("kring");
+      LIBFS_INSTRUMENT_COUNT("kring.vertices", mesh_adj.num_vertices());
+      if(k > 65535) {
+        throw std::invalid_argument("Ring size k=" + std::to_string(k) + " too large, must be smaller than 65536.\n");
+      }
+      const std::ptrdiff_t nv = std::ptrdiff_t(mesh_adj.num_vertices());
+      fs::AdjacencyCSR ring;
+      ring.offsets.assign(size_t(nv) + 1, 0);
+
+      // Pass 1: count the neighborhood sizes.
+      #ifdef _OPENMP
+      #pragma omp parallel
+      #endif
+      {
+        _KRingWorkspace ws(mesh_adj.num_vertices());
+        #ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 256)
+        #endif
+        for(std::ptrdiff_t source = 0; source < nv; source++) {
+          _kring_bfs(mesh_adj, size_t(source), k, &ws);
+          ring.offsets[size_t(source) + 1] = uint32_t(ws.found.size());
+        }
+      }
+      uint64_t total = 0;
+      for(std::ptrdiff_t i = 0; i < nv; i++) {
+        total += ring.offsets[size_t(i) + 1];
+        if(total > UINT32_MAX) {
+          throw std::runtime_error("The k-ring neighborhoods for k=" + std::to_string(k) + " are too large for 32 bit offsets.\n");
+        }
+        ring.offsets[size_t(i) + 1] = uint32_t(total);
+      }
+      ring.neighbors.resize(size_t(total));
+      if(hop_distances != nullptr) {
+        hop_distances->resize(size_t(total));
+      }
+
+      // Pass 2: fill the sorted neighborhoods.
+      #ifdef _OPENMP
+      #pragma omp parallel
+      #endif
+      {
+        _KRingWorkspace ws(mesh_adj.num_vertices());
+        #ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 256)
+        #endif
+        for(std::ptrdiff_t source = 0; source < nv; source++) {
+          _kring_bfs(mesh_adj, size_t(source), k, &ws);
+          std::sort(ws.found.begin(), ws.found.end());
+          const size_t row_begin = ring.offsets[size_t(source)];
+          std::copy(ws.found.begin(), ws.found.end(), ring.neighbors.begin() + std::ptrdiff_t(row_begin));
+          if(hop_distances != nullptr) {
+            for(size_t j = 0; j < ws.found.size(); j++) {
+              (*hop_distances)[row_begin + j] = ws.dist[ws.found[j]];
+            }
+          }
+        }
+      }
+      return ring;
+    }
+
+    /// @brief Extend mesh neighborhoods based on CSR mesh adjacency representation.
+    /// @details Computes, for each vertex, all vertices in edge distance up to `extend_by + 1`, excluding the vertex itself. This matches the result of the adjacency list version started from the `k=1` neighborhood. This is a shortcut for `fs::Mesh::kring(mesh_adj, extend_by + 1)`.
+    /// @param mesh_adj The CSR adjacency of the underlying mesh, see `fs::Mesh::as_adjcsr`.
+    /// @param extend_by the number of edges to hop to extend the neighborhoods.
+    /// @return extended neighborhoods, the neighbors of each vertex are sorted ascending.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// fs::AdjacencyCSR adj2 = fs::Mesh::extend_adj(surface.as_adjcsr(), 1);
+    /// @endcode
+    static fs::AdjacencyCSR extend_adj(const fs::AdjacencyCSR& mesh_adj, const size_t extend_by=1) {
+      return fs::Mesh::kring(mesh_adj, extend_by + 1);
+    }
+
+    /// @brief Per-thread state for the geodesic distance engine, reused across sources.
+    /// @private
+    struct _GeodesicWorkspace {
+      std::vector<uint32_t> stamp;  ///< `stamp[v] == run` iff `dist[v]` is valid for the current run. Only needs clearing when the run counter wraps.
+      std::vector<uint32_t> done;  ///< `done[v] == run` iff the distance of `v` is final for the current run.
+      std::vector<float> dist;  ///< Tentative or final distance, valid iff `stamp[v]` matches.
+      std::vector<uint32_t> found;  ///< Vertices with final distances, in order of increasing distance.
+      fs::_RadixHeap heap;
+      uint32_t run;
+
+      explicit _GeodesicWorkspace(const size_t num_vertices) : stamp(num_vertices, 0), done(num_vertices, 0), dist(num_vertices, 0.0f), run(0) {}
+
+      /// Start a new run, invalidating all distances.
+      void next_run() {
+        if(++run == 0) {
+          std::fill(stamp.begin(), stamp.end(), 0);
+          std::fill(done.begin(), done.end(), 0);
+          run = 1;
+        }
+        found.clear();
+        heap.clear();
+      }
+    };
+
+    /// @brief Compute the arrival time at `C` of a planar front passing through `A` at time `ta` and `B` at time `tb`, within the triangle `ABC`.
+    /// @details Unfolds the triangle into the plane and places a virtual point source on the far side of `AB`, at distances `ta` and `tb` from `A` and `B`. The update is only valid if the straight line from that source to `C` passes through the edge `AB`. Otherwise, or if no such source exists, infinity is returned and the caller falls back to the edge updates.
+    /// @private
+    static float _fmm_triangle_update(const float* A, const float ta, const float* B, const float tb, const float* C) {
+      const double abx = B[0] - A[0], aby = B[1] - A[1], abz = B[2] - A[2];
+      const double acx = C[0] - A[0], acy = C[1] - A[1], acz = C[2] - A[2];
+      const double c2 = abx * abx + aby * aby + abz * abz;
+      if(c2 <= 0.0) {
+        return std::numeric_limits<float>::infinity();
+      }
+      const double c = std::sqrt(c2);
+      // C in the local frame with A at the origin and B at (c, 0).
+      const double cx = (abx * acx + aby * acy + abz * acz) / c;
+      const double cy = std::sqrt(std::max(acx * acx + acy * acy + acz * acz - cx * cx, 0.0));
+      // The virtual source, below the x axis.
+      const double sx = (double(ta) * ta - double(tb) * tb + c2) / (2.0 * c);
+      const double sy2 = double(ta) * ta - sx * sx;
+      if(sy2 < 0.0 || cy <= 0.0) {
+        return std::numeric_limits<float>::infinity();
+      }
+      const double sy = -std::sqrt(sy2);
+      const double xi = sx + (cx - sx) * (-sy) / (cy - sy);  // Where the ray from the source to C crosses AB.
+      if(xi < 0.0 || xi > c) {
+        return std::numeric_limits<float>::infinity();
+      }
+      const double t = std::sqrt((cx - sx) * (cx - sx) + (cy - sy) * (cy - sy));
+      return float(std::max(t, double(std::max(ta, tb))));  // Keep the update causal, so the heap stays monotone.
+    }
+
+    /// @brief Euclidean distance between vertices `a` and `b`.
+    /// @private
+    float _edge_length(const uint32_t a, const uint32_t b) const {
+      const float* pa = &this->vertices[3 * size_t(a)];
+      const float* pb = &this->vertices[3 * size_t(b)];
+      const float dx = pa[0] - pb[0], dy = pa[1] - pb[1], dz = pa[2] - pb[2];
+      return std::sqrt(dx * dx + dy * dy + dz * dz);
+    }
+
+    /// @brief Set the tentative distance of `v` to `d` if that is an improvement and within `max_dist`.
+    /// @private
+    static void _geodesic_relax(const uint32_t v, const float d, const float max_dist, _GeodesicWorkspace* ws) {
+      if(d <= max_dist && (ws->stamp[v] != ws->run || d < ws->dist[v])) {
+        ws->stamp[v] = ws->run;
+        ws->dist[v] = d;
+        ws->heap.push(d, v);
+      }
+    }
+
+    /// @brief Run Dijkstra or fast marching from the given sources up to `max_dist`, leaving the reached vertices in `ws->found` and their distances in `ws->dist`.
+    /// @private
+    void _geodesic_run(const fs::AdjacencyCSR& adj, const fs::AdjacencyCSR& vf, const int32_t* sources, const size_t num_sources, const float max_dist, const int method, _GeodesicWorkspace* ws) const {
+      ws->next_run();
+      for(size_t i = 0; i < num_sources; i++) {
+        fs::Mesh::_geodesic_relax(uint32_t(sources[i]), 0.0f, max_dist, ws);
+      }
+      const uint32_t run = ws->run;
+      while(! ws->heap.empty()) {
+        float d;
+        uint32_t v;
+        ws->heap.pop(&d, &v);
+        if(ws->done[v] == run || d > ws->dist[v]) {
+          continue;  // Stale entry.
+        }
+        ws->done[v] = run;
+        ws->found.push_back(v);
+        if(method == GEODESIC_DIJKSTRA) {
+          for(const uint32_t* it = adj.neighbors_begin(v); it != adj.neighbors_end(v); ++it) {
+            if(ws->done[*it] != run) {
+              fs::Mesh::_geodesic_relax(*it, d + this->_edge_length(v, *it), max_dist, ws);
+            }
+          }
+        } else {
+          for(const uint32_t* it = vf.neighbors_begin(v); it != vf.neighbors_end(v); ++it) {
+            const int32_t* fv = &this->faces[3 * size_t(*it)];
+            const uint32_t other[2] = { uint32_t(fv[0]) == v ? uint32_t(fv[1]) : uint32_t(fv[0]), uint32_t(fv[2]) == v ? uint32_t(fv[1]) : uint32_t(fv[2]) };
+            for(size_t k = 0; k < 2; k++) {
+              const uint32_t c = other[k], w = other[1 - k];
+              if(ws->done[c] == run) {
+                continue;
+              }
+              float t = d + this->_edge_length(v, c);
+              if(ws->done[w] == run) {
+                t = std::min(t, fs::Mesh::_fmm_triangle_update(&this->vertices[3 * size_t(v)], d, &this->vertices[3 * size_t(w)], ws->dist[w], &this->vertices[3 * size_t(c)]));
+              }
+              fs::Mesh::_geodesic_relax(c, t, max_dist, ws);
+            }
+          }
+        }
+      }
+    }
+
+    /// @private
+    void _check_geodesic_args(const std::vector<int32_t>& sources, const float max_dist, const int method) const {
+      if(method != GEODESIC_DIJKSTRA && method != GEODESIC_FMM) {
+        throw std::invalid_argument("Invalid geodesic method " + std::to_string(method) + ", use fs::GEODESIC_DIJKSTRA or fs::GEODESIC_FMM.\n");
+      }
+      if(!(max_dist >= 0.0f)) {
+        throw std::invalid_argument("The maximal distance must not be negative.\n");
+      }
+      for(size_t i = 0; i < sources.size(); i++) {
+        if(sources[i] < 0 || size_t(sources[i]) >= this->num_vertices()) {
+          throw std::invalid_argument("Source vertex index " + std::to_string(sources[i]) + " invalid for mesh with " + std::to_string(this->num_vertices()) + " vertices.\n");
+        }
+      }
+    }
+
+    /// @brief Compute the geodesic distance of every vertex to the nearest of the source vertices.
+    /// @details Uses fast marching on the triangles (`fs::GEODESIC_FMM`, the default) or Dijkstra's algorithm on the edges (`fs::GEODESIC_DIJKSTRA`), both with a radix heap. The search stops at `max_dist`, which makes small neighborhoods cheap to compute on large meshes. Uses the cached adjacency and vertex-face incidence of the mesh, see `fs::Mesh::cached_adjcsr`.
+    /// @param sources the source vertex indices. Use a single vertex for single-source distances.
+    /// @param max_dist the maximal distance to compute. Vertices further away, or unreachable, get infinity.
+    /// @param method `fs::GEODESIC_FMM` or `fs::GEODESIC_DIJKSTRA`.
+    /// @return the distance of each vertex, in mesh units (mm for brain surfaces).
+    /// @throws std::invalid_argument if a source index or the method is invalid, or `max_dist` is negative.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface;
+    /// fs::read_surf(&surface, "lh.white");
+    /// std::vector<float> dist = surface.geodesic_distances({ 0 });
+    /// std::vector<float> near = surface.geodesic_distances({ 0, 500 }, 10.0f);
+    /// @endcode
+    std::vector<float> geodesic_distances(const std::vector<int32_t>& sources, const float max_dist = std::numeric_limits<float>::infinity(), const int method = GEODESIC_FMM) const {
+      this->_check_geodesic_args(sources, max_dist, method);
+      const fs::AdjacencyCSR& adj = this->cached_adjcsr();
+      const fs::AdjacencyCSR& vf = this->vertex_faces();
+      _GeodesicWorkspace ws(this->num_vertices());
+      this->_geodesic_run(adj, vf, sources.data(), sources.size(), max_dist, method, &ws);
+      std::vector<float> dist(this->num_vertices(), std::numeric_limits<float>::infinity());
+      for(size_t i = 0; i < ws.found.size(); i++) {
+        dist[ws.found[i]] = ws.dist[ws.found[i]];
+      }
+      return dist;
+    }
+
+    /// @brief Compute the geodesic ball of a given radius around each of the center vertices, e.g., for searchlights or Gaussian smoothing kernels.
+    /// @details Runs one bounded search per center, see `fs::Mesh::geodesic_distances`. The centers are processed in parallel if libfs is compiled with OpenMP, with one reusable workspace per thread, so the cost per center depends on the size of its ball, not on the size of the mesh.
+    /// @param centers the center vertex indices.
+    /// @param radius the radius of the balls.
+    /// @param distances optional output, if not `nullptr`, it is filled with the geodesic distance of each ball vertex from its center, in the same order as the `neighbors` of the returned structure.
+    /// @param method `fs::GEODESIC_FMM` or `fs::GEODESIC_DIJKSTRA`.
+    /// @return the balls in CSR layout: row `i` holds the vertices within `radius` of `centers[i]`, including the center itself, sorted ascending.
+    /// @throws std::invalid_argument if an index or the method is invalid, or the radius is negative. std::runtime_error if the total size of all balls does not fit into 32 bit offsets.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// std::vector<int32_t> all(surface.num_vertices());
+    /// std::iota(all.begin(), all.end(), 0);
+    /// std::vector<float> dist;
+    /// fs::AdjacencyCSR balls = surface.geodesic_balls(all, 5.0f, &dist);
+    /// @endcode
+    fs::AdjacencyCSR geodesic_balls(const std::vector<int32_t>& centers, const float radius, std::vector<float>* distances = nullptr, const int method = GEODESIC_FMM) const {
+      LIBFS_INSTRUMENT_SCOPE("geodesic_balls");
+      LIBFS_INSTRUMENT_COUNT("geodesic_balls.centers", centers.size());
+      this->_check_geodesic_args(centers, radius, method);
+      const fs::AdjacencyCSR& adj = this->cached_adjcsr();
+      const fs::AdjacencyCSR& vf = this->vertex_faces();
+      const size_t nc = centers.size();
+      // Centers are processed in blocks. Each block collects its rows in local flat storage, which is concatenated afterwards.
+      const size_t block_size = 64;
+      const std::ptrdiff_t num_blocks = std::ptrdiff_t((nc + block_size - 1) / block_size);
+      std::vector<std::vector<uint32_t>> block_vertices(static_cast<size_t>(num_blocks));
+      std::vector<std::vector<float>> block_dists(static_cast<size_t>(num_blocks));
+      std::vector<uint32_t> row_sizes(nc, 0);
+      #ifdef _OPENMP
+      #pragma omp parallel
+      #endif
+      {
+        _GeodesicWorkspace ws(this->num_vertices());
+        #ifdef _OPENMP
+        #pragma omp for schedule(dynamic, 1)
+        #endif
+        for(std::ptrdiff_t b = 0; b < num_blocks; b++) {
+          const size_t begin = size_t(b) * block_size, end = std::min(nc, begin + block_size);
+          for(size_t i = begin; i < end; i++) {
+            this->_geodesic_run(adj, vf, &centers[i], 1, radius, method, &ws);
+            std::sort(ws.found.begin(), ws.found.end());
+            row_sizes[i] = uint32_t(ws.found.size());
+            block_vertices[size_t(b)].insert(block_vertices[size_t(b)].end(), ws.found.begin(), ws.found.end());
+            if(distances != nullptr) {
+              for(size_t j = 0; j < ws.found.size(); j++) {
+                block_dists[size_t(b)].push_back(ws.dist[ws.found[j]]);
+              }
+            }
+          }
+        }
+      }
+      fs::AdjacencyCSR balls;
+      balls.offsets.assign(nc + 1, 0);
+      uint64_t total = 0;
+      for(size_t i = 0; i < nc; i++) {
+        total += row_sizes[i];
+        if(total > UINT32_MAX) {
+          throw std::runtime_error("The geodesic balls of radius " + std::to_string(radius) + " are too large for 32 bit offsets.\n");
+        }
+        balls.offsets[i + 1] = uint32_t(total);
+      }
+      balls.neighbors.resize(size_t(total));
+      if(distances != nullptr) {
+        distances->resize(size_t(total));
+      }
+      for(std::ptrdiff_t b = 0; b < num_blocks; b++) {
+        const size_t row_begin = balls.offsets[size_t(b) * block_size];
+        std::copy(block_vertices[size_t(b)].begin(), block_vertices[size_t(b)].end(), balls.neighbors.begin() + std::ptrdiff_t(row_begin));
+        if(distances != nullptr) {
+          std::copy(block_dists[size_t(b)].begin(), block_dists[size_t(b)].end(), distances->begin() + std::ptrdiff_t(row_begin));
+        }
+      }
+      return balls;
+    }
+
+    /// @brief Build a sparse Gaussian smoothing operator for this mesh with the given full width at half maximum, like FreeSurfer's `mris_fwhm`.
+    /// @details The weight of vertex `j` for vertex `i` is `exp(-d^2 / (2 sigma^2))`, where `d` is the geodesic distance between them and `sigma` is computed from `fwhm` with `fs::fwhm_to_sigma`. The kernel is truncated at `cutoff * sigma` and the weights of each row are normalized to sum to 1. Building the operator runs one bounded geodesic search per vertex, see `fs::Mesh::geodesic_balls`, so the cost and the memory grow with the square of `fwhm`. Build it once and apply it to all overlays on this mesh.
+    /// @param fwhm the full width at half maximum of the kernel, in mesh units (mm for brain surfaces).
+    /// @param method how to compute the distances: `fs::GEODESIC_FMM` for geodesic distances, or `fs::GEODESIC_DIJKSTRA` for distances along the edges, which is faster but overestimates the distances.
+    /// @param cutoff the kernel radius, in multiples of sigma. The default of 3 keeps about 99% of the kernel mass.
+    /// @return the smoothing operator.
+    /// @throws std::invalid_argument if `fwhm` or `cutoff` is not positive, or the method is invalid.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface;
+    /// fs::read_surf(&surface, "lh.white");
+    /// fs::SmoothingOperator op = surface.gaussian_smoothing_operator(5.0f);
+    /// std::vector<float> thickness_smooth = op.apply(thickness);
+    /// @endcode
+    fs::SmoothingOperator gaussian_smoothing_operator(const float fwhm, const int method = GEODESIC_FMM, const float cutoff = 3.0f) const {
+      if(! (fwhm > 0.0f) || ! (cutoff > 0.0f)) {
+        throw std::invalid_argument("The fwhm and cutoff of the smoothing kernel must be positive, but are " + std::to_string(fwhm) + " and " + std::to_string(cutoff) + ".\n");
+      }
+      LIBFS_INSTRUMENT_SCOPE("gaussian_smoothing_operator");
+      const float sigma = fs::fwhm_to_sigma(fwhm);
+      std::vector<int32_t> all(this->num_vertices());
+      std::iota(all.begin(), all.end(), 0);
+      std::vector<float> dist;
+      fs::AdjacencyCSR balls = this->geodesic_balls(all, cutoff * sigma, &dist, method);
+      fs::SmoothingOperator op;
+      op.fwhm = fwhm;
+      op.offsets = std::move(balls.offsets);
+      op.columns = std::move(balls.neighbors);
+      op.weights = std::move(dist);
+      const float scale = -1.0f / (2.0f * sigma * sigma);
+      const std::ptrdiff_t nv = std::ptrdiff_t(op.num_vertices());
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static)
+      #endif
+      for(std::ptrdiff_t i = 0; i < nv; i++) {
+        float* w = op.weights.data();
+        const uint32_t begin = op.offsets[size_t(i)], end = op.offsets[size_t(i) + 1];
+        float sum = 0.0f;
+        for(uint32_t k = begin; k < end; k++) {
+          w[k] = std::exp(w[k] * w[k] * scale);
+          sum += w[k];
+        }
+        for(uint32_t k = begin; k < end; k++) {
+          w[k] /= sum;  // The center has weight 1 before normalization, so the sum is positive.
+        }
+      }
+      return op;
+    }
+
+    /// @brief Compute a vertex order with better memory locality, for use with `fs::Mesh::permute_vertices`.
+    /// @details The vertex order of FreeSurfer surfaces comes from the tessellation, so the neighbors of a vertex are often far apart in memory. Renumbering the vertices so that nearby vertices get nearby indices makes all adjacency based algorithms (smoothing, k-rings, geodesics, ...) more cache friendly, without changing their results. The space filling curve methods quantize the vertex coordinates to a grid over the bounding box and sort by the curve index with a radix sort. Reverse Cuthill-McKee runs a breadth-first search from a pseudo-peripheral vertex of each connected component, visiting neighbors by increasing degree, and reverses the result.
+    /// @param method `fs::REORDER_HILBERT` (the default), `fs::REORDER_MORTON` or `fs::REORDER_RCM`.
+    /// @return the new vertex order: new vertex `i` is the old vertex `order[i]`.
+    /// @throws std::invalid_argument if the method is invalid.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface;
+    /// fs::read_surf(&surface, "lh.white");
+    /// std::vector<int32_t> order = surface.vertex_order(fs::REORDER_RCM);
+    /// @endcode
+    std::vector<int32_t> vertex_order(const int method = REORDER_HILBERT) const {
+      if(method == REORDER_MORTON || method == REORDER_HILBERT) {
+        return this->_space_filling_curve_order(method == REORDER_HILBERT);
+      } else if(method == REORDER_RCM) {
+        return this->_rcm_order();
+      }
+      throw std::invalid_argument("Invalid vertex reordering method " + std::to_string(method) + ".\n");
+    }
+
+    /// @brief Renumber the vertices of this mesh in the given order. The vertex coordinates are permuted and the faces are updated, so the mesh is the same but its vertices have new indices.
+    /// @param order the new vertex order: new vertex `i` is the old vertex `order[i]`. Must be a permutation of `0` to `num_vertices - 1`, e.g., from `fs::Mesh::vertex_order`.
+    /// @throws std::invalid_argument if `order` is not a permutation of the vertices, or the faces reference invalid vertices.
+    /// @see fs::Mesh::permute_vertex_data and fs::Mesh::unpermute_vertex_data to map per-vertex data between the orders, and `fs::permute_vertices` for `fs::Curv`, `fs::Annot` and `fs::Label`.
+    void permute_vertices(const std::vector<int32_t>& order) {
+      const std::vector<int32_t> old2new = fs::Mesh::invert_permutation(order, this->num_vertices());
+      std::vector<float> new_vertices(this->vertices.size());
+      for(size_t i = 0; i < order.size(); i++) {
+        const size_t o = size_t(order[i]);
+        new_vertices[3 * i] = this->vertices[3 * o];
+        new_vertices[3 * i + 1] = this->vertices[3 * o + 1];
+        new_vertices[3 * i + 2] = this->vertices[3 * o + 2];
+      }
+      std::vector<int32_t> new_faces(this->faces.size());
+      for(size_t k = 0; k < this->faces.size(); k++) {
+        const int32_t v = this->faces[k];
+        if(v < 0 || size_t(v) >= old2new.size()) {
+          throw std::invalid_argument("Face vertex index " + std::to_string(v) + " is out of range for a mesh with " + std::to_string(old2new.size()) + " vertices.\n");
+        }
+        new_faces[k] = old2new[size_t(v)];
+      }
+      this->vertices = std::move(new_vertices);
+      this->faces = std::move(new_faces);
+      this->invalidate_cache();
+    }
+
+    /// @brief Renumber the vertices of this mesh for better memory locality, see `fs::Mesh::vertex_order` and `fs::Mesh::permute_vertices`.
+    /// @param method `fs::REORDER_HILBERT` (the default), `fs::REORDER_MORTON` or `fs::REORDER_RCM`.
+    /// @return the applied vertex order: new vertex `i` is the old vertex `order[i]`. Keep it to map per-vertex data, see `fs::Mesh::permute_vertex_data`.
+    /// @throws std::invalid_argument if the method is invalid.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface;
+    /// fs::read_surf(&surface, "lh.white");
+    /// std::vector<float> thickness = fs::read_curv_data("lh.thickness");
+    /// std::vector<int32_t> order = surface.reorder_vertices();
+    /// std::vector<float> smooth = fs::Mesh::smooth_pvd_nn(surface.cached_adjcsr(), fs::Mesh::permute_vertex_data(thickness, order), 10);
+    /// std::vector<float> smooth_orig_order = fs::Mesh::unpermute_vertex_data(smooth, order);
+    /// @endcode
+    std::vector<int32_t> reorder_vertices(const int method = REORDER_HILBERT) {
+      std::vector<int32_t> order = this->vertex_order(method);
+      this->permute_vertices(order);
+      return order;
+    }
+
+    /// @brief Invert a vertex order, i.e., compute the map from old to new vertex indices.
+    /// @param order the vertex order: new vertex `i` is the old vertex `order[i]`.
+    /// @param num_vertices the expected number of vertices.
+    /// @return the inverse: old vertex `j` is the new vertex `inverse[j]`.
+    /// @throws std::invalid_argument if `order` is not a permutation of `0` to `num_vertices - 1`.
+    static std::vector<int32_t> invert_permutation(const std::vector<int32_t>& order, const size_t num_vertices) {
+      if(order.size() != num_vertices) {
+        throw std::invalid_argument("Vertex order has length " + std::to_string(order.size()) + ", expected " + std::to_string(num_vertices) + ".\n");
+      }
+      std::vector<int32_t> inverse(num_vertices, -1);
+      for(size_t i = 0; i < order.size(); i++) {
+        const int32_t o = order[i];
+        if(o < 0 || size_t(o) >= num_vertices || inverse[size_t(o)] != -1) {
+          throw std::invalid_argument("Vertex order is not a permutation: invalid or repeated index " + std::to_string(o) + " at position " + std::to_string(i) + ".\n");
+        }
+        inverse[size_t(o)] = int32_t(i);
+      }
+      return inverse;
+    }
+
+    /// @brief Map per-vertex data from the old to the new vertex order, after `fs::Mesh::permute_vertices` or `fs::Mesh::reorder_vertices`.
+    /// @param data per-vertex data in the old vertex order.
+    /// @param order the vertex order: new vertex `i` is the old vertex `order[i]`.
+    /// @return the data in the new vertex order: `result[i] = data[order[i]]`.
+    /// @throws std::invalid_argument if `order` is not a permutation of the indices of `data`.
+    template <typename T>
+    static std::vector<T> permute_vertex_data(const std::vector<T>& data, const std::vector<int32_t>& order) {
+      fs::Mesh::invert_permutation(order, data.size());
+      std::vector<T> result(data.size());
+      for(size_t i = 0; i < order.size(); i++) {
+        result[i] = data[size_t(order[i])];
+      }
+      return result;
+    }
+
+    /// @brief Map per-vertex data from the new back to the old vertex order, the inverse of `fs::Mesh::permute_vertex_data`.
+    /// @param data per-vertex data in the new vertex order.
+    /// @param order the vertex order: new vertex `i` is the old vertex `order[i]`.
+    /// @return the data in the old vertex order: `result[order[i]] = data[i]`.
+    /// @throws std::invalid_argument if `order` is not a permutation of the indices of `data`.
+    template <typename T>
+    static std::vector<T> unpermute_vertex_data(const std::vector<T>& data, const std::vector<int32_t>& order) {
+      fs::Mesh::invert_permutation(order, data.size());
+      std::vector<T> result(data.size());
+      for(size_t i = 0; i < order.size(); i++) {
+        result[size_t(order[i])] = data[i];
+      }
+      return result;
+    }
+
+    /// @brief Compute the vertex order along a Morton or Hilbert curve, see `fs::Mesh::vertex_order`.
+    /// @private
+    std::vector<int32_t> _space_filling_curve_order(const bool hilbert) const {
+      const size_t nv = this->num_vertices();
+      if(nv == 0) {
+        return std::vector<int32_t>();
+      }
+      float lo[3], hi[3];
+      for(size_t d = 0; d < 3; d++) {
+        lo[d] = hi[d] = this->vertices[d];
+      }
+      for(size_t i = 0; i < nv; i++) {
+        for(size_t d = 0; d < 3; d++) {
+          lo[d] = std::min(lo[d], this->vertices[3 * i + d]);
+          hi[d] = std::max(hi[d], this->vertices[3 * i + d]);
+        }
+      }
+      // The curve index and the vertex index are packed into one 64 bit key, so radix sorting the keys sorts by curve index and keeps ties in vertex order.
+      unsigned index_bits = 1;
+      while((uint64_t(1) << index_bits) < nv) {
+        index_bits++;
+      }
+      const unsigned bits = std::min(21u, (64u - index_bits) / 3u);
+      const float extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+      const float max_cell = float((1u << bits) - 1u);
+      const float scale = extent > 0.0f ? max_cell / extent : 0.0f;  // The same scale for all axes, so the grid cells are cubes.
+      std::vector<uint64_t> keys(nv);
+      const std::ptrdiff_t n = std::ptrdiff_t(nv);
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static)
+      #endif
+      for(std::ptrdiff_t i = 0; i < n; i++) {
+        uint32_t cell[3];
+        for(size_t d = 0; d < 3; d++) {
+          const float c = (this->vertices[3 * size_t(i) + d] - lo[d]) * scale;
+          cell[d] = uint32_t(std::min(max_cell, std::max(0.0f, c)));
+        }
+        keys[size_t(i)] = (fs::util::_curve_index3(cell, bits, hilbert) << index_bits) | uint64_t(i);
+      }
+      const unsigned key_bits = 3 * bits + index_bits;
+      fs::util::_radix_sort_u64(&keys, key_bits >= 64 ? std::numeric_limits<uint64_t>::max() : (uint64_t(1) << key_bits) - 1);
+      std::vector<int32_t> order(nv);
+      const uint64_t index_mask = (uint64_t(1) << index_bits) - 1;
+      for(size_t i = 0; i < nv; i++) {
+        order[i] = int32_t(keys[i] & index_mask);
+      }
+      return order;
+    }
+
+    /// @brief Compute the reverse Cuthill-McKee vertex order, see `fs::Mesh::vertex_order`.
+    /// @private
+    std::vector<int32_t> _rcm_order() const {
+      const fs::AdjacencyCSR& adj = this->cached_adjcsr();
+      const size_t nv = adj.num_vertices();
+      std::vector<int32_t> order;
+      order.reserve(nv);
+      std::vector<char> placed(nv, 0);
+      std::vector<uint32_t> level(nv, 0), queue;
+      uint32_t stamp = 0;  // level[v] - stamp is the BFS level of v in the current search, if level[v] > stamp.
+      // Breadth-first search within the component of start, returns the eccentricity of start and a vertex of minimal degree in the last level.
+      auto bfs = [&adj, &level, &queue, &stamp](uint32_t start, uint32_t* last) {
+        queue.clear();
+        queue.push_back(start);
+        level[start] = stamp + 1;
+        for(size_t head = 0; head < queue.size(); head++) {
+          const uint32_t v = queue[head];
+          for(uint32_t k = adj.offsets[v]; k < adj.offsets[v + 1]; k++) {
+            const uint32_t u = adj.neighbors[k];
+            if(level[u] <= stamp) {
+              level[u] = level[v] + 1;
+              queue.push_back(u);
+            }
+          }
+        }
+        const uint32_t max_level = level[queue.back()];
+        *last = queue.back();
+        for(size_t i = queue.size(); i-- > 0 && level[queue[i]] == max_level; ) {
+          if(adj.degree(queue[i]) < adj.degree(*last)) {
+            *last = queue[i];
+          }
+        }
+        const uint32_t eccentricity = max_level - stamp - 1;
+        stamp = max_level;
+        return eccentricity;
+      };
+      std::vector<uint32_t> by_degree(nv);
+      std::iota(by_degree.begin(), by_degree.end(), 0);
+      std::stable_sort(by_degree.begin(), by_degree.end(), [&adj](uint32_t a, uint32_t b) { return adj.degree(a) < adj.degree(b); });
+      std::vector<uint32_t> next;
+      for(size_t s = 0; s < nv; s++) {
+        if(placed[by_degree[s]]) {
+          continue;
+        }
+        // Find a pseudo-peripheral start vertex (George and Liu, 1979): move to the far end of the BFS level structure while its depth grows.
+        uint32_t start = by_degree[s], candidate;
+        uint32_t eccentricity = bfs(start, &candidate);
+        for(size_t iter = 0; iter < 8 && candidate != start; iter++) {
+          uint32_t far;
+          const uint32_t e = bfs(candidate, &far);
+          if(e <= eccentricity) {
+            break;
+          }
+          start = candidate;
+          eccentricity = e;
+          candidate = far;
+        }
+        // Cuthill-McKee: breadth-first from start, adding the unplaced neighbors of each vertex by increasing degree.
+        size_t head = order.size();
+        order.push_back(int32_t(start));
+        placed[start] = 1;
+        for(; head < order.size(); head++) {
+          const uint32_t v = uint32_t(order[head]);
+          next.clear();
+          for(uint32_t k = adj.offsets[v]; k < adj.offsets[v + 1]; k++) {
+            const uint32_t u = adj.neighbors[k];
+            if(! placed[u]) {
+              placed[u] = 1;
+              next.push_back(u);
+            }
+          }
+          std::stable_sort(next.begin(), next.end(), [&adj](uint32_t a, uint32_t b) { return adj.degree(a) < adj.degree(b); });
+          for(size_t i = 0; i < next.size(); i++) {
+            order.push_back(int32_t(next[i]));
+          }
+        }
+      }
+      std::reverse(order.begin(), order.end());
+      return order;
+    }
+
+
+    /// @brief Export this mesh to a file in Wavefront OBJ format.
+    /// @param filename path to the output file, will be overwritten if existing.
+    /// @throws std::runtime_error if the target file cannot be opened.
+    /// @see fs::Mesh::to_obj if you want the string representation (without writing it to a file).
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// const std::string out_path = fs::util::fullpath({"/tmp", "mesh.obj"});
+    /// surface.to_obj_file(out_path);
+    /// @endcode
+    void to_obj_file(const std::string& filename) const {
+      fs::util::_write_to_file(filename, false, [this](std::ostream& os) { this->to_obj(os); });
+    }
+
+    /// @brief Compute a new mesh that is a submesh of this mesh, based on a subset of the vertices of this mesh.
+    /// @param old_vertex_indices vector of vertex indices of this mesh, which should be included in the submesh.
+    /// @param mapdir_fulltosubmesh whether to return a map from the old (full mesh) to the new (submesh)  vertex indices (`true`), or the other way around (`false`, the default) as the first element of the returned pair.
+    /// @return a pair of the vertex index map (direction 'fullmesh to submesh' by default, but see 'mapdir_fulltosubmesh' parameter) and the submesh.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface;
+    /// fs::read_surf(&surface, "examples/read_surf/lh.white");
+    /// fs::Label label;
+    /// fs::read_label(&label, "examples/read_label/lh.cortex.label");
+    /// std::pair <std::unordered_map<int32_t, int32_t>, fs::Mesh> result = surface.submesh_vertex(label.vertex);
+    /// fs::Mesh patch = result.second;
+    /// auto vertexindexmap_submesh2full = result.first; // or '<std::unordered_map<int32_t, int32_t>' instead of 'auto'.
+    /// @endcode
+    std::pair <std::unordered_map<int32_t, int32_t>, fs::Mesh> submesh_vertex(const std::vector<int32_t> &old_vertex_indices, const bool mapdir_fulltosubmesh = false) const {
+      std::vector<int32_t> full2sub, sub2full;
+      fs::Mesh submesh = this->submesh_vertex_flat(old_vertex_indices, &full2sub, &sub2full);
+
+      std::unordered_map<int32_t, int32_t> vertex_index_map;
+      vertex_index_map.reserve(sub2full.size());
+      for(size_t i = 0; i < sub2full.size(); i++) {
+        const int32_t full_idx = sub2full[i];
+        if(full2sub[size_t(full_idx)] == int32_t(i)) {  // For duplicate input indices, only the last occurrence is mapped.
+          if(mapdir_fulltosubmesh) {
+            vertex_index_map[full_idx] = int32_t(i);
+          } else {
+            vertex_index_map[int32_t(i)] = full_idx;
+          }
+        }
+      }
+      return std::pair <std::unordered_map<int32_t, int32_t>, fs::Mesh>(vertex_index_map, submesh);
+    }
+
+    /// @brief Compute a new mesh that is a submesh of this mesh, based on a subset of the vertices of this mesh. Returns the vertex index maps as flat vectors.
+    /// @details This is a faster version of `fs::Mesh::submesh_vertex`, which uses dense index vectors instead of hash maps. The faces are filtered in a single pass (in parallel if compiled with OpenMP), and their order is preserved.
+    /// @param old_vertex_indices vector of vertex indices of this mesh, which should be included in the submesh. The vertex at position `i` becomes vertex `i` of the submesh.
+    /// @param full2sub optional output, may be `nullptr`. Resized to the number of vertices of this mesh, and set to the submesh index of each vertex, or to -1 for vertices that are not part of the submesh.
+    /// @param sub2full optional output, may be `nullptr`. Set to the full mesh index of each submesh vertex, i.e., it is a copy of `old_vertex_indices`.
+    /// @return the submesh
+    /// @throws std::invalid_argument if a vertex index, or a vertex index in the faces of this mesh, is out of range.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface;
+    /// fs::read_surf(&surface, "examples/read_surf/lh.white");
+    /// fs::Label label;
+    /// fs::read_label(&label, "examples/read_label/lh.cortex.label");
+    /// std::vector<int32_t> full2sub, sub2full;
+    /// fs::Mesh patch = surface.submesh_vertex_flat(label.vertex, &full2sub, &sub2full);
+    /// @endcode
+    fs::Mesh submesh_vertex_flat(const std::vector<int32_t>& old_vertex_indices, std::vector<int32_t>* full2sub = nullptr, std::vector<int32_t>* sub2full = nullptr) const {
+      const size_t nv = this->num_vertices();
+      const size_t nsub = old_vertex_indices.size();
+      std::vector<int32_t> map_full2sub(nv, -1);
+      fs::Mesh submesh;
+      submesh.vertices.resize(nsub * 3);
+      for(size_t i = 0; i < nsub; i++) {
+        const int32_t full_idx = old_vertex_indices[i];
+        if(full_idx < 0 || size_t(full_idx) >= nv) {
+          throw std::invalid_argument("Vertex index " + std::to_string(full_idx) + " at position " + std::to_string(i) + " is out of range for mesh with " + std::to_string(nv) + " vertices.\n");
+        }
+        map_full2sub[size_t(full_idx)] = int32_t(i);
+        std::memcpy(&submesh.vertices[i * 3], &this->vertices[size_t(full_idx) * 3], 3 * sizeof(float));
+      }
+
+      // The face filter below indexes the vertex map with the face indices, so check them first.
+      const size_t num_face_indices = this->num_faces() * 3;
+      for(size_t i = 0; i < num_face_indices; i++) {
+        if(this->faces[i] < 0 || size_t(this->faces[i]) >= nv) {
+          throw std::invalid_argument("Face vertex index " + std::to_string(this->faces[i]) + " invalid for mesh with " + std::to_string(nv) + " vertices.\n");
+        }
+      }
+
+      // Keep the faces of which all 3 vertices are part of the submesh. The faces are split into one contiguous block per thread. Each thread counts the faces it keeps, and then writes them at the offset given by the counts of the blocks before it.
+      const size_t nf = this->num_faces();
+      const int* f = this->faces.data();
+      const int32_t* m = map_full2sub.data();
+      int num_blocks = 1;
+      #ifdef _OPENMP
+      num_blocks = nf > 100000 ? omp_get_max_threads() : 1;
+      #endif
+      std::vector<size_t> block_kept(size_t(num_blocks) + 1, 0);
+      int* out = nullptr;
+      #ifdef _OPENMP
+      #pragma omp parallel num_threads(num_blocks)
+      #endif
+      {
+        int block = 0;
+        #ifdef _OPENMP
+        block = omp_get_thread_num();
+        const int actual_blocks = omp_get_num_threads();
+        #else
+        const int actual_blocks = 1;
+        #endif
+        const size_t start = nf * size_t(block) / size_t(actual_blocks);
+        const size_t stop = nf * size_t(block + 1) / size_t(actual_blocks);
+        size_t kept = 0;
+        for(size_t i = start; i < stop; i++) {
+          kept += (m[f[3*i]] >= 0 && m[f[3*i + 1]] >= 0 && m[f[3*i + 2]] >= 0) ? 1 : 0;
+        }
+        block_kept[size_t(block) + 1] = kept;
+        #ifdef _OPENMP
+        #pragma omp barrier
+        #pragma omp single
+        #endif
+        {
+          for(int b = 0; b < actual_blocks; b++) {
+            block_kept[size_t(b) + 1] += block_kept[size_t(b)];
+          }
+          submesh.faces.resize(block_kept[size_t(actual_blocks)] * 3);
+          out = submesh.faces.data();
+        }
+        size_t pos = block_kept[size_t(block)] * 3;
+        for(size_t i = start; i < stop; i++) {
+          const int32_t v0 = m[f[3*i]], v1 = m[f[3*i + 1]], v2 = m[f[3*i + 2]];
+          if(v0 >= 0 && v1 >= 0 && v2 >= 0) {
+            out[pos] = v0;
+            out[pos + 1] = v1;
+            out[pos + 2] = v2;
+            pos += 3;
+          }
+        }
+      }
+
+      if(sub2full != nullptr) {
+        *sub2full = old_vertex_indices;
+      }
+      if(full2sub != nullptr) {
+        full2sub->swap(map_full2sub);
+      }
+      return submesh;
+    }
+
+    /// @brief Compute a new mesh that is a submesh of this mesh, containing the vertices inside a mask.
+    /// @details The submesh vertices are in increasing order of their full mesh index. See `fs::Mesh::submesh_vertex_flat` for the index maps.
+    /// @throws std::invalid_argument if the mask size does not match the number of vertices.
+    fs::Mesh submesh_vertex_mask(const fs::VertexMask& mask, std::vector<int32_t>* full2sub = nullptr, std::vector<int32_t>* sub2full = nullptr) const {
+      mask._check_size(this->num_vertices());
+      return this->submesh_vertex_flat(mask.indices(), full2sub, sub2full);
+    }
+
+    /// @brief Given per-vertex data for a submesh, add NAN values inbetween to restore the original mesh size.
+    /// @param data_submesh vector of per-vertex data values, one value per mesh vertex of the submesh.
+    /// @param submesh_to_orig_mapping map<int, int>, mapping vertex indices of the submesh to vertex indices of the original, full mesh.
+    /// @param orig_mesh_num_vertices number of vertices of the original, full mesh.
+    /// @see `fs::Mesh::submesh_vertex` for how to get the `submesh_to_orig_mapping` parameter.
+    /// @return vector of per-vertex data values, one value per mesh vertex of the original mesh. Values for vertices that are not part of the submesh are set to NAN.
+    static std::vector<float> curv_data_for_orig_mesh(const std::vector<float>& data_submesh, const std::unordered_map<int32_t, int32_t>& submesh_to_orig_mapping, const int32_t orig_mesh_num_vertices, const float fill_value=std::numeric_limits<float>::quiet_NaN()) {
+
+      if(submesh_to_orig_mapping.size() != data_submesh.size()) {
+        throw std::domain_error("The number of vertices of the submesh and the number of values in the submesh_to_orig_mapping do not match: got " + std::to_string(data_submesh.size()) + " and " + std::to_string(submesh_to_orig_mapping.size()) + ".");
+      }
+
+      std::vector<float> data_orig_mesh(orig_mesh_num_vertices, fill_value);
+      for(size_t i=0; i<data_submesh.size(); i++) {
+          auto got = submesh_to_orig_mapping.find(int(i));
+          if (got != submesh_to_orig_mapping.end()) {
+            data_orig_mesh[got->second] = data_submesh[i];
+          }
+      }
+      return(data_orig_mesh);
+    }
+
+    /// @brief Given per-vertex data for a submesh, add NAN values inbetween to restore the original mesh size. Overload for the flat submesh to full mesh vertex index map.
+    /// @param data_submesh vector of per-vertex data values, one value per mesh vertex of the submesh.
+    /// @param sub2full the full mesh vertex index of each submesh vertex.
+    /// @param orig_mesh_num_vertices number of vertices of the original, full mesh.
+    /// @param fill_value the value for vertices that are not part of the submesh.
+    /// @see `fs::Mesh::submesh_vertex_flat` for how to get the `sub2full` parameter.
+    /// @return vector of per-vertex data values, one value per mesh vertex of the original mesh.
+    /// @throws std::domain_error if the sizes of `data_submesh` and `sub2full` differ, std::invalid_argument if a vertex index is out of range.
+    static std::vector<float> curv_data_for_orig_mesh(const std::vector<float>& data_submesh, const std::vector<int32_t>& sub2full, const int32_t orig_mesh_num_vertices, const float fill_value=std::numeric_limits<float>::quiet_NaN()) {
+      if(sub2full.size() != data_submesh.size()) {
+        throw std::domain_error("The number of vertices of the submesh and the number of values in the sub2full mapping do not match: got " + std::to_string(data_submesh.size()) + " and " + std::to_string(sub2full.size()) + ".");
+      }
+      std::vector<float> data_orig_mesh(size_t(std::max(orig_mesh_num_vertices, int32_t(0))), fill_value);
+      for(size_t i = 0; i < data_submesh.size(); i++) {
+        if(sub2full[i] < 0 || sub2full[i] >= orig_mesh_num_vertices) {
+          throw std::invalid_argument("Vertex index " + std::to_string(sub2full[i]) + " in sub2full mapping is out of range for mesh with " + std::to_string(orig_mesh_num_vertices) + " vertices.\n");
+        }
+        data_orig_mesh[size_t(sub2full[i])] = data_submesh[i];
+      }
+      return(data_orig_mesh);
+    }
+
+    /// @brief Read a brainmesh from a Wavefront object format stream.
+    /// @details This only reads the geometry, optional format extensions like materials are ignored (but files including them should parse fine).
+    /// @param mesh pointer to fs:Mesh instance to be filled.
+    /// @param is stream holding a text representation of a mesh in Wavefront object format.
+    /// @see There exists an overloaded version that reads from a file.
+    /// @throws std::domain_error if the file format is invalid.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface;
+    /// const std::string in_path = fs::util::fullpath({"/tmp", "mesh.obj"});
+    /// fs::Mesh::from_obj(&surface, in_path);
+    /// @endcode
+    static void from_obj(Mesh* mesh, std::istream* is) {
+      const std::string buf = fs::util::_read_stream_to_buffer(is);
+      Mesh::_from_obj_buffer(mesh, buf.data(), buf.data() + buf.size());
+    }
+
+
+    /// @brief Read a brainmesh from a Wavefront object format mesh file.
+    /// @details This only reads the geometry, optional format extensions like materials are ignored (but files including them should parse fine).
+    /// @see There exists an overloaded version that reads from a stream.
+    /// @param mesh pointer to fs:Mesh instance to be filled.
+    /// @param filename path to input wavefront obj mesh to be read.
+    /// @throws std::runtime_error if the file cannot be read.
+    /// @throws std::domain_error if the file format is invalid.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface;
+    /// fs::Mesh::from_obj(&surface, "mesh.obj");
+    /// @endcode
+    static void from_obj(Mesh* mesh, const std::string& filename) {
+      #ifdef LIBFS_DBG_INFO
+      std::cout << LIBFS_APPTAG << "Reading brain mesh from Wavefront object format file " << filename << ".\n";
+      #endif
+      const std::string buf = fs::util::_read_file_to_buffer(filename, "Wavefront object format");
+      Mesh::_from_obj_buffer(mesh, buf.data(), buf.data() + buf.size());
+    }
+
+
+    /// @brief Read a brainmesh from an Object File format (OFF) stream.
+    /// @param mesh pointer to fs:Mesh instance to be filled.
+    /// @param is An open std::istream or derived class stream from which to read the data, e.g., std::ifstream or std::istringstream.
+    /// @param source_filename optional, used in error messages only. The source file name, if any.
+    /// @see There exists an overloaded version that reads from a file.
+    /// @throws std::domain_error if the file format is invalid.
+    static void from_off(Mesh* mesh, std::istream* is, const std::string& source_filename="") {
+      const std::string buf = fs::util::_read_stream_to_buffer(is);
+      Mesh::_from_off_buffer(mesh, buf.data(), buf.data() + buf.size(), source_filename);
+    }
+
+
+    /// @brief Read a brainmesh from an OFF format mesh file.
+    /// @see There exists an overloaded version that reads from a stream.
+    /// @details The OFF is the Object File Format (file extension .off) is a simple text-based mesh file format. Not to be confused with the Wavefront Object format (.obj).
+    /// @param mesh pointer to fs:Mesh instance to be filled.
+    /// @param filename path to input wavefront obj mesh to be read.
+    /// @throws std::runtime_error if the file cannot be read.
+    /// @throws std::domain_error if the file format is invalid.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface;
+    /// fs::Mesh::from_off(&surface, "mesh.off");
+    /// @endcode
+    static void from_off(Mesh* mesh, const std::string& filename) {
+      #ifdef LIBFS_DBG_INFO
+      std::cout << LIBFS_APPTAG << "Reading brain mesh from OFF format file " << filename << ".\n";
+      #endif
+      const std::string buf = fs::util::_read_file_to_buffer(filename, "Object file format (OFF)");
+      Mesh::_from_off_buffer(mesh, buf.data(), buf.data() + buf.size(), filename);
+    }
+
+
+    /// @brief Read a brainmesh from a Stanford PLY format stream.
+    /// @details Supports the `ascii`, `binary_little_endian` and `binary_big_endian` formats. Only the x, y and z properties of the vertex element and the vertex index list of the face element are read, all other elements and properties are skipped.
+    /// @param mesh pointer to fs:Mesh instance to be filled.
+    /// @param is An open std::istream or derived class stream from which to read the data, e.g., std::ifstream or std::istringstream. For binary PLY data, it must be opened in binary mode.
+    /// @see There exists an overloaded version that reads from a file.
+    /// @throws std::domain_error if the file format is invalid.
+    static void from_ply(Mesh* mesh, std::istream* is) {
+      const std::string buf = fs::util::_read_stream_to_buffer(is);
+      Mesh::_from_ply_buffer(mesh, buf.data(), buf.data() + buf.size());
+    }
+
+    /// @brief Read a brainmesh from a Stanford PLY format mesh file.
+    /// @details The PLY format exists in text and binary forms, and the binary form can be little endian or big endian. All three variants are supported.
+    /// @param mesh pointer to fs:Mesh instance to be filled.
+    /// @param filename path to input wavefront obj mesh to be read.
+    /// @throws std::runtime_error if the file cannot be read.
+    /// @throws std::domain_error if the file format is invalid.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface;
+    /// fs::Mesh::from_ply(&surface, "mesh.ply");
+    /// @endcode
+    static void from_ply(Mesh* mesh, const std::string& filename) {
+      #ifdef LIBFS_DBG_INFO
+      std::cout << LIBFS_APPTAG << "Reading brain mesh from PLY format file " << filename << ".\n";
+      #endif
+      const std::string buf = fs::util::_read_file_to_buffer(filename, "Stanford PLY format");
+      Mesh::_from_ply_buffer(mesh, buf.data(), buf.data() + buf.size());
+    }
+
+
+    /// @brief Parse Wavefront OBJ data held in memory. See `fs::Mesh::from_obj`.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    static void _from_obj_buffer(Mesh* mesh, const char* begin, const char* end) {
+      // Count vertex and face lines first, so the output vectors can be allocated once.
+      size_t num_v_lines = 0, num_f_lines = 0;
+      fs::util::_TextScanner sc(begin, end);
+      while(! sc.eof()) {
+        sc.skip_blanks();
+        if(sc.looking_at("v ") || sc.looking_at("v\t")) {
+          num_v_lines++;
+        } else if(sc.looking_at("f ") || sc.looking_at("f\t")) {
+          num_f_lines++;
+        }
+        sc.next_line();
+      }
+
+      std::vector<float> vertices;
+      std::vector<int> faces;
+      vertices.reserve(num_v_lines * 3);
+      faces.reserve(num_f_lines * 3);
+
+      #ifdef LIBFS_DBG_INFO
+      size_t num_lines_ignored = 0; // Not comments, but custom extensions or material data lines which are ignored by libfs.
+      #endif
+
+      sc = fs::util::_TextScanner(begin, end);
+      while(! sc.eof()) {
+        sc.skip_blanks();
+        if(sc.looking_at("v ") || sc.looking_at("v\t")) {
+          sc.p++;
+          float x, y, z;
+          if(!(sc.parse_float(&x) && sc.parse_float(&y) && sc.parse_float(&z))) {
+            throw std::domain_error("Could not parse vertex line " + std::to_string(sc.line_number()) + " of OBJ data, invalid format.\n");
+          }
+          vertices.push_back(x);
+          vertices.push_back(y);
+          vertices.push_back(z);
+        } else if(sc.looking_at("f ") || sc.looking_at("f\t")) {
+          sc.p++;
+          // The OBJ format allows to specifiy face indices with slashes to also set normal and material indices.
+          // So instead of a line like 'f 22 34 45', we could get 'f 3/1 4/2 5/3' or 'f 6/4/1 3/5/3 7/6/5' or 'f 7//1 8//2 9//3'.
+          // We parse the integer before the first slash and skip the rest of the token.
+          for(int i = 0; i < 3; i++) {
+            int32_t v;
+            if(! sc.parse_int(&v)) {
+              throw std::domain_error("Could not parse face line " + std::to_string(sc.line_number()) + " of OBJ data, invalid format.\n");
+            }
+            sc.skip_rest_of_token();
+            // The vertex indices in Wavefront OBJ files are 1-based, so we have to substract 1 here.
+            faces.push_back(v - 1);
+          }
+        } else {
+          #ifdef LIBFS_DBG_INFO
+          if(! (sc.at_eol() || sc.looking_at("#"))) {
+            num_lines_ignored++;
+          }
+          #endif
+        }
+        sc.next_line();
+      }
+      #ifdef LIBFS_DBG_INFO
+      if(num_lines_ignored > 0) {
+        std::cout << LIBFS_APPTAG << "Ignored " << num_lines_ignored << " lines in Wavefront OBJ format mesh file.\n";
+      }
+      #endif
+      mesh->vertices.swap(vertices);
+      mesh->faces.swap(faces);
+      mesh->invalidate_cache();
+    }
+
+
+    /// @brief Parse OFF data held in memory. See `fs::Mesh::from_off`.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    static void _from_off_buffer(Mesh* mesh, const char* begin, const char* end, const std::string& source_filename) {
+      std::string msg_source_file_part = source_filename.empty() ? "" : "'" + source_filename + "'";
+
+      fs::util::_TextScanner sc(begin, end);
+      // Position the scanner at the start of the next line that is neither empty nor a comment. Returns false at end of data.
+      auto next_content_line = [&sc]() {
+        while(! sc.eof()) {
+          if(sc.at_eol() || sc.looking_at("#")) {
+            sc.next_line();
+          } else {
+            return true;
+          }
+        }
+        return false;
+      };
+
+      if(! next_content_line()) {
+        throw std::domain_error("Could not parse first header line of OFF data, invalid format.\n");
+      }
+      const std::string off_header_magic = sc.token();
+      if(!(off_header_magic == "OFF" || off_header_magic == "COFF")) {
+        throw std::domain_error("OFF magic string invalid, file " + msg_source_file_part + " not in OFF format.\n");
+      }
+      sc.next_line();
+
+      int32_t num_vertices = 0, num_faces = 0, num_edges = 0;
+      if(!(next_content_line() && sc.parse_int(&num_vertices) && sc.parse_int(&num_faces) && sc.parse_int(&num_edges) && num_vertices >= 0 && num_faces >= 0)) {
+        throw std::domain_error("Could not parse element count header line " + std::to_string(sc.line_number()) + " of OFF data " + msg_source_file_part + ", invalid format.\n");
+      }
+      sc.next_line();
+
+      std::vector<float> vertices;
+      std::vector<int> faces;
+      // The counts come from the header and are not validated yet. Every record takes at least one byte, so do not reserve more than the data can hold.
+      const size_t max_records = size_t(end - sc.p);
+      vertices.reserve(std::min(size_t(num_vertices), max_records) * 3);
+      faces.reserve(std::min(size_t(num_faces), max_records) * 3);
+
+      size_t num_verts_parsed = 0;
+      while(num_verts_parsed < size_t(num_vertices) && next_content_line()) {
+        float x, y, z;
+        if(!(sc.parse_float(&x) && sc.parse_float(&y) && sc.parse_float(&z))) {
+          throw std::domain_error("Could not parse vertex coordinate line " + std::to_string(sc.line_number()) + " of OFF data " + msg_source_file_part + ", invalid format.\n");
+        }
+        vertices.push_back(x);
+        vertices.push_back(y);
+        vertices.push_back(z);
+        num_verts_parsed++;
+        sc.next_line();
+      }
+      if(num_verts_parsed < size_t(num_vertices)) {
+        throw std::domain_error("Vertex count mismatch between OFF data " + msg_source_file_part + " header (" + std::to_string(num_vertices) + ") and data (" + std::to_string(num_verts_parsed) + ").\n");
+      }
+
+      size_t num_faces_parsed = 0;
+      while(num_faces_parsed < size_t(num_faces) && next_content_line()) {
+        int32_t num_verts_this_face, v0, v1, v2;
+        if(!(sc.parse_int(&num_verts_this_face) && sc.parse_int(&v0) && sc.parse_int(&v1) && sc.parse_int(&v2))) {
+          throw std::domain_error("Could not parse face line " + std::to_string(sc.line_number()) + " of OFF data " + msg_source_file_part + ", invalid format.\n");
+        }
+        if(num_verts_this_face != 3) {
+          throw std::domain_error("At OFF data " + msg_source_file_part + " line " + std::to_string(sc.line_number()) + ": only triangular meshes supported.\n");
+        }
+        faces.push_back(v0);
+        faces.push_back(v1);
+        faces.push_back(v2);
+        num_faces_parsed++;
+        sc.next_line();
+      }
+      if(num_faces_parsed < size_t(num_faces)) {
+        throw std::domain_error("Face count mismatch between OFF data " + msg_source_file_part + " header  (" + std::to_string(num_faces) + ") and data (" + std::to_string(num_faces_parsed) + ").\n");
+      }
+      mesh->vertices.swap(vertices);
+      mesh->faces.swap(faces);
+      mesh->invalidate_cache();
+    }
+
+
+    /// @brief A scalar property type of the PLY format, see `fs::Mesh::_ply_type_from_name`.
+    ///
+    /// THIS ENUM IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+    /// @private
+    enum _PlyType { _PLY_INVALID = 0, _PLY_INT8, _PLY_UINT8, _PLY_INT16, _PLY_UINT16, _PLY_INT32, _PLY_UINT32, _PLY_FLOAT32, _PLY_FLOAT64 };
+
+    /// @brief A property of an element in a PLY header. For list properties, `count_type` is the type of the length prefix.
+    ///
+    /// THIS STRUCT IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+    /// @private
+    struct _PlyProperty {
+      std::string name;
+      _PlyType type;
+      bool is_list;
+      _PlyType count_type;
+    };
+
+    /// @brief An element with its count and properties in a PLY header.
+    ///
+    /// THIS STRUCT IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+    /// @private
+    struct _PlyElement {
+      std::string name;
+      size_t count;
+      std::vector<_PlyProperty> properties;
+    };
+
+    /// @brief Map a PLY type name, in the old (`uchar`) or new (`uint8`) spelling, to the type.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    static _PlyType _ply_type_from_name(const std::string& n) {
+      if(n == "char" || n == "int8") return _PLY_INT8;
+      if(n == "uchar" || n == "uint8") return _PLY_UINT8;
+      if(n == "short" || n == "int16") return _PLY_INT16;
+      if(n == "ushort" || n == "uint16") return _PLY_UINT16;
+      if(n == "int" || n == "int32") return _PLY_INT32;
+      if(n == "uint" || n == "uint32") return _PLY_UINT32;
+      if(n == "float" || n == "float32") return _PLY_FLOAT32;
+      if(n == "double" || n == "float64") return _PLY_FLOAT64;
+      return _PLY_INVALID;
+    }
+
+    /// @brief Get the size in bytes of a PLY type in binary PLY data.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    static size_t _ply_type_size(_PlyType t) {
+      switch(t) {
+        case _PLY_INT8: case _PLY_UINT8: return 1;
+        case _PLY_INT16: case _PLY_UINT16: return 2;
+        case _PLY_INT32: case _PLY_UINT32: case _PLY_FLOAT32: return 4;
+        case _PLY_FLOAT64: return 8;
+        default: return 0;
+      }
+    }
+
+    /// @brief Decode a value of a PLY type from binary PLY data, which need not be aligned.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    template <typename T>
+    static T _ply_decode(const unsigned char* src, bool swap) {
+      T t;
+      std::memcpy(&t, src, sizeof(T));
+      return swap ? fs::_swap_endian<T>(t) : t;
+    }
+
+    /// @brief Decode a value of any PLY type from binary PLY data as a double.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    static double _ply_decode_as_double(const unsigned char* src, _PlyType t, bool swap) {
+      switch(t) {
+        case _PLY_INT8: return double(_ply_decode<int8_t>(src, false));
+        case _PLY_UINT8: return double(_ply_decode<uint8_t>(src, false));
+        case _PLY_INT16: return double(_ply_decode<int16_t>(src, swap));
+        case _PLY_UINT16: return double(_ply_decode<uint16_t>(src, swap));
+        case _PLY_INT32: return double(_ply_decode<int32_t>(src, swap));
+        case _PLY_UINT32: return double(_ply_decode<uint32_t>(src, swap));
+        case _PLY_FLOAT32: return double(_ply_decode<float>(src, swap));
+        case _PLY_FLOAT64: return _ply_decode<double>(src, swap);
+        default: return 0.0;
+      }
+    }
+
+
+    /// @brief Parse PLY data held in memory. See `fs::Mesh::from_ply`.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    static void _from_ply_buffer(Mesh* mesh, const char* begin, const char* end) {
+      fs::util::_TextScanner sc(begin, end);
+
+      // Parse the header.
+      if(sc.rest_of_line() != "ply") {
+        throw std::domain_error("Invalid PLY file");
+      }
+      int format = -1;  // 0 = ascii, 1 = binary little endian, 2 = binary big endian.
+      std::vector<_PlyElement> elements;
+      bool header_complete = false;
+      while(! sc.eof()) {
+        sc.skip_blanks();
+        const std::string keyword = sc.token();
+        if(keyword == "comment" || keyword == "obj_info" || keyword.empty()) {
+          sc.next_line();
+          continue;
+        }
+        if(keyword == "end_header") {
+          sc.next_line();
+          header_complete = true;
+          break;
+        }
+        if(keyword == "format") {
+          const std::string fmt = sc.token();
+          const std::string version = sc.token();
+          if(fmt == "ascii") format = 0;
+          else if(fmt == "binary_little_endian") format = 1;
+          else if(fmt == "binary_big_endian") format = 2;
+          if(format < 0 || version != "1.0") {
+            throw std::domain_error("Unsupported PLY file format '" + fmt + " " + version + "', supported are 'ascii', 'binary_little_endian' and 'binary_big_endian' in version 1.0.");
+          }
+        } else if(keyword == "element") {
+          _PlyElement el;
+          el.name = sc.token();
+          int32_t count;
+          if(! (sc.parse_int(&count) && count >= 0)) {
+            throw std::domain_error("Could not parse element " + el.name + " line of PLY header, invalid format.\n");
+          }
+          el.count = size_t(count);
+          elements.push_back(el);
+        } else if(keyword == "property") {
+          if(elements.empty()) {
+            throw std::domain_error("Invalid PLY header: property line " + std::to_string(sc.line_number()) + " before first element line.\n");
+          }
+          _PlyProperty prop;
+          std::string type_name = sc.token();
+          prop.is_list = type_name == "list";
+          prop.count_type = _PLY_INVALID;
+          if(prop.is_list) {
+            prop.count_type = _ply_type_from_name(sc.token());
+            type_name = sc.token();
+          }
+          prop.type = _ply_type_from_name(type_name);
+          prop.name = sc.token();
+          if(prop.type == _PLY_INVALID || (prop.is_list && (prop.count_type == _PLY_INVALID || prop.count_type == _PLY_FLOAT32 || prop.count_type == _PLY_FLOAT64))) {
+            throw std::domain_error("Invalid PLY header: could not parse property line " + std::to_string(sc.line_number()) + ".\n");
+          }
+          elements.back().properties.push_back(prop);
+        }  // Unknown keywords are ignored.
+        sc.next_line();
+      }
+      if(! header_complete || format < 0) {
+        throw std::domain_error("Invalid PLY file: incomplete header.\n");
+      }
+
+      // Locate the vertex coordinates and face vertex indices.
+      int num_verts = -1;
+      int num_faces = -1;
+      for(size_t e = 0; e < elements.size(); e++) {
+        const _PlyElement& el = elements[e];
+        if(el.name == "vertex") {
+          num_verts = int(el.count);
+        } else if(el.name == "face") {
+          num_faces = int(el.count);
+        }
+      }
+      if(num_verts < 1 || num_faces < 1) {
+        throw std::domain_error("Invalid PLY file: missing element count lines of header.");
+      }
+
+      std::vector<float> vertices;
+      std::vector<int> faces;
+      // The counts come from the header and are not validated yet. Every record takes at least one byte, so do not reserve more than the data can hold.
+      const size_t max_records = size_t(end - sc.p);
+      vertices.reserve(std::min(size_t(num_verts), max_records) * 3);
+      faces.reserve(std::min(size_t(num_faces), max_records) * 3);
+
+      const bool swap = (format == 2) != (LIBFS_HOST_BIG_ENDIAN != 0);
+      const unsigned char* bp = reinterpret_cast<const unsigned char*>(sc.p);
+      const unsigned char* const bend = reinterpret_cast<const unsigned char*>(end);
+
+      for(size_t e = 0; e < elements.size(); e++) {
+        const _PlyElement& el = elements[e];
+        const bool is_vertex = el.name == "vertex";
+        const bool is_face = el.name == "face";
+        // Map property index to destination: 0..2 for x/y/z in vertex elements, 0 for the vertex index list in faces. -1 means skip.
+        std::vector<int> dest(el.properties.size(), -1);
+        bool has_dest = false;
+        for(size_t pi = 0; pi < el.properties.size(); pi++) {
+          const _PlyProperty& prop = el.properties[pi];
+          if(is_vertex && ! prop.is_list) {
+            if(prop.name == "x") dest[pi] = 0;
+            else if(prop.name == "y") dest[pi] = 1;
+            else if(prop.name == "z") dest[pi] = 2;
+          } else if(is_face && prop.is_list && (prop.name == "vertex_indices" || prop.name == "vertex_index")) {
+            dest[pi] = 0;
+          }
+          has_dest = has_dest || dest[pi] >= 0;
+        }
+        if(is_vertex && std::count_if(dest.begin(), dest.end(), [](int d) { return d >= 0; }) != 3) {
+          throw std::domain_error("Invalid PLY header: vertex element must have x, y and z properties.\n");
+        }
+        if(is_face && ! has_dest) {
+          throw std::domain_error("Invalid PLY header: face element must have a vertex_indices list property.\n");
+        }
+
+        if(format == 0) {  // ASCII: one line per element instance.
+          for(size_t i = 0; i < el.count; i++) {
+            if(! has_dest) {  // Not needed, skip the line.
+              if(sc.eof()) break;
+              sc.next_line();
+              continue;
+            }
+            while(! sc.eof() && sc.at_eol()) {  // Skip empty lines.
+              sc.next_line();
+            }
+            if(sc.eof()) break;
+            float xyz[3] = { 0.0f, 0.0f, 0.0f };
+            for(size_t pi = 0; pi < el.properties.size(); pi++) {
+              const _PlyProperty& prop = el.properties[pi];
+              if(prop.is_list) {
+                int32_t len;
+                if(! sc.parse_int(&len)) {
+                  throw std::domain_error("Could not parse " + el.name + " line " + std::to_string(sc.line_number()) + " of PLY data, invalid format.\n");
+                }
+                if(dest[pi] >= 0) {
+                  if(len != 3) {
+                    throw std::domain_error("Only triangular meshes are supported: PLY faces lines must contain exactly 3 vertex indices.\n");
+                  }
+                  for(int k = 0; k < 3; k++) {
+                    int32_t v;
+                    if(! sc.parse_int(&v)) {
+                      throw std::domain_error("Could not parse face line " + std::to_string(sc.line_number()) + " of PLY data, invalid format.\n");
+                    }
+                    faces.push_back(v);
+                  }
+                } else {
+                  for(int32_t k = 0; k < len; k++) {
+                    sc.skip_token();
+                  }
+                }
+              } else if(dest[pi] >= 0) {
+                if(! sc.parse_float(&xyz[dest[pi]])) {
+                  throw std::domain_error("Could not parse vertex line " + std::to_string(sc.line_number()) + " of PLY data, invalid format.\n");
+                }
+              } else {
+                sc.skip_token();
+              }
+            }
+            if(is_vertex) {
+              vertices.push_back(xyz[0]);
+              vertices.push_back(xyz[1]);
+              vertices.push_back(xyz[2]);
+            }
+            sc.next_line();
+          }
+        } else {  // Binary: packed values in file order.
+          for(size_t i = 0; i < el.count; i++) {
+            float xyz[3] = { 0.0f, 0.0f, 0.0f };
+            for(size_t pi = 0; pi < el.properties.size(); pi++) {
+              const _PlyProperty& prop = el.properties[pi];
+              const size_t tsize = _ply_type_size(prop.type);
+              if(prop.is_list) {
+                const size_t csize = _ply_type_size(prop.count_type);
+                if(size_t(bend - bp) < csize) {
+                  throw std::domain_error("Invalid PLY file: binary " + el.name + " data truncated.\n");
+                }
+                const double len_d = _ply_decode_as_double(bp, prop.count_type, swap);
+                bp += csize;
+                const size_t len = len_d > 0.0 ? size_t(len_d) : 0;
+                if(size_t(bend - bp) / tsize < len) {
+                  throw std::domain_error("Invalid PLY file: binary " + el.name + " data truncated.\n");
+                }
+                if(dest[pi] >= 0) {
+                  if(len != 3) {
+                    throw std::domain_error("Only triangular meshes are supported: PLY faces lines must contain exactly 3 vertex indices.\n");
+                  }
+                  for(size_t k = 0; k < 3; k++) {
+                    faces.push_back(int(_ply_decode_as_double(bp + k * tsize, prop.type, swap)));
+                  }
+                }
+                bp += len * tsize;
+              } else {
+                if(size_t(bend - bp) < tsize) {
+                  throw std::domain_error("Invalid PLY file: binary " + el.name + " data truncated.\n");
+                }
+                if(dest[pi] >= 0) {
+                  xyz[dest[pi]] = float(_ply_decode_as_double(bp, prop.type, swap));
+                }
+                bp += tsize;
+              }
+            }
+            if(is_vertex) {
+              vertices.push_back(xyz[0]);
+              vertices.push_back(xyz[1]);
+              vertices.push_back(xyz[2]);
+            }
+          }
+        }
+      }
+
+      if(vertices.size() != (size_t)num_verts * 3) {
+        std::cerr << "PLY header mentions " << num_verts << " vertices, but found " << vertices.size() / 3 << ".\n";
+      }
+      if(faces.size() != (size_t)num_faces * 3) {
+        std::cerr << "PLY header mentions " << num_faces << " faces, but found " << faces.size() / 3 << ".\n";
+      }
+      mesh->vertices.swap(vertices);
+      mesh->faces.swap(faces);
+      mesh->invalidate_cache();
+    }
+
+
+    /// @brief Return the number of vertices in this mesh.
+    /// @return the vertex count
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// size_t nv = surface.num_vertices();
+    /// @endcode
+    size_t num_vertices() const {
+      return(this->vertices.size() / 3);
+    }
+
+    /// @brief Return the number of faces in this mesh.
+    /// @return the face count
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// size_t nv = surface.num_faces();
+    /// @endcode
+    size_t num_faces() const {
+      return(this->faces.size() / 3);
+    }
+
+    /// @brief Retrieve a vertex index of a face, treating the faces vector as an nx3 matrix.
+    /// @param i the row index, valid values are 0..num_faces-1.
+    /// @param j the column index, valid values are 0..2 (for the 3 vertices of a face).
+    /// @throws std::range_error on invalid index
+    /// @return vertex index of vertex `j` of face `i`
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// int first_face_third_vert = surface.fm_at(0, 2);
+    /// @endcode
+    const int32_t& fm_at(const size_t i, const size_t j) const {
+      size_t idx = _vidx_2d(i, j, 3);
+      if(idx > this->faces.size()-1) {
+        throw std::range_error("Indices (" + std::to_string(i) + "," + std::to_string(j) + ") into Mesh.faces out of bounds. Hit " + std::to_string(idx) + " with max valid index " + std::to_string(this->faces.size()-1) + ".\n");
+      }
+      return(this->faces[idx]);
+    }
+
+
+    /// @brief Get all vertex indices of the face, given by its index.
+    /// @param face the face index
+    /// @returns vector of length 3, the vertex indices of the face.
+    /// @throws std::range_error on invalid index
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// auto first_face_verts = surface.face_vertices(0);
+    /// @endcode
+    std::vector<int32_t> face_vertices(const size_t face) const {
+      if(face > this->num_faces()-1) {
+        throw std::range_error("Index " + std::to_string(face) + " into Mesh.faces out of bounds, max valid index is " + std::to_string(this->num_faces()-1) + ".\n");
+      }
+      std::vector<int32_t> fv(3);
+      fv[0] = this->fm_at(face, 0);
+      fv[1] = this->fm_at(face, 1);
+      fv[2] = this->fm_at(face, 2);
+      return(fv);
+    }
+
+    /// @brief Get all coordinates of the vertex, given by its index.
+    /// @param vertex the vertex index
+    /// @returns vector of length 3, the x,y,z coordinates of the vertex.
+    /// @throws std::range_error on invalid index
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// auto coords = surface.vertex_coords(0);
+    /// @endcode
+    std::vector<float> vertex_coords(const size_t vertex) const {
+      if(vertex > this->num_vertices()-1) {
+        throw std::range_error("Index " + std::to_string(vertex) + " into Mesh.vertices out of bounds, max valid index is " + std::to_string(this->num_vertices()-1) + ".\n");
+      }
+      std::vector<float> vc(3);
+      vc[0] = this->vm_at(vertex, 0);
+      vc[1] = this->vm_at(vertex, 1);
+      vc[2] = this->vm_at(vertex, 2);
+      return(vc);
+    }
+
+    /// @brief Retrieve a single (x, y, or z) coordinate of a vertex, treating the vertices vector as an nx3 matrix.
+    /// @param i the row index, valid values are 0..num_vertices.
+    /// @param j the column index, valid values are 0..2 (for the x,y,z coordinates).
+    /// @throws std::range_error on invalid index
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// float v5_x = surface.vm_at(5, 0);
+    /// float v5_y = surface.vm_at(5, 1);
+    /// float v5_z = surface.vm_at(5, 2);
+    /// @endcode
+    const float& vm_at(const size_t i, const size_t j) const {
+      size_t idx = _vidx_2d(i, j, 3);
+      if(idx > this->vertices.size()-1) {
+        throw std::range_error("Indices (" + std::to_string(i) + "," + std::to_string(j) + ") into Mesh.vertices out of bounds. Hit " + std::to_string(idx) + " with max valid index " + std::to_string(this->vertices.size()-1) + ".\n");
+      }
+      return(this->vertices[idx]);
+    }
+
+    /// @brief Return the vertex-to-face incidence of this mesh: for each vertex, the indices of the faces it is part of.
+    /// @details The result is stored in CSR layout, where the `neighbors` field of the returned structure holds face indices (not vertex indices), sorted ascending. It is computed on first use and cached, see `fs::Mesh::invalidate_cache`.
+    /// @return reference to the cached incidence structure. It stays valid until the faces of this mesh change, or `fs::Mesh::invalidate_cache` is called.
+    /// @note This is thread-safe, concurrent callers wait for the first one to compute the result.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// const fs::AdjacencyCSR& vf = surface.vertex_faces();
+    /// size_t num_faces_of_v0 = vf.degree(0);
+    /// @endcode
+    const fs::AdjacencyCSR& vertex_faces() const {
+      std::lock_guard<std::mutex> lock(this->_cache.mutex);
+      return *this->_cached_vertex_faces_locked();
+    }
+
+    /// @brief Return the CSR adjacency of this mesh, see `fs::Mesh::as_adjcsr`, computed on first use and cached.
+    /// @details Use this instead of `fs::Mesh::as_adjcsr` if you need the adjacency several times, e.g., for smoothing several overlays. See `fs::Mesh::invalidate_cache` for when the cached result is recomputed.
+    /// @return reference to the cached adjacency. It stays valid until the faces of this mesh change, or `fs::Mesh::invalidate_cache` is called.
+    /// @note This is thread-safe, concurrent callers wait for the first one to compute the result.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// const fs::AdjacencyCSR& adj = surface.cached_adjcsr();
+    /// @endcode
+    const fs::AdjacencyCSR& cached_adjcsr() const {
+      std::lock_guard<std::mutex> lock(this->_cache.mutex);
+      this->_validate_cache_locked();
+      if(! this->_cache.adjcsr) {
+        this->_cache.adjcsr = std::make_shared<const fs::AdjacencyCSR>(this->as_adjcsr());
+      }
+      return *this->_cache.adjcsr;
+    }
+
+    /// @brief Return the sorted flat edge list of this mesh, see `fs::Mesh::as_edges`, computed on first use and cached.
+    /// @return reference to the cached edges. It stays valid until the faces of this mesh change, or `fs::Mesh::invalidate_cache` is called.
+    /// @note This is thread-safe, concurrent callers wait for the first one to compute the result.
+    const std::vector<uint32_t>& cached_edges() const {
+      std::lock_guard<std::mutex> lock(this->_cache.mutex);
+      this->_validate_cache_locked();
+      if(! this->_cache.edges) {
+        this->_cache.edges = std::make_shared<const std::vector<uint32_t>>(this->as_edges());
+      }
+      return *this->_cache.edges;
+    }
+
+    /// @brief Return the area-weighted unit vertex normals of this mesh, see `fs::Mesh::vertex_normals`, computed on first use and cached.
+    /// @details See `fs::Mesh::invalidate_cache` for when the cached result is recomputed.
+    /// @return reference to the cached normals. It stays valid until the mesh changes, or `fs::Mesh::invalidate_cache` is called.
+    /// @note This is thread-safe, concurrent callers wait for the first one to compute the result.
+    const std::vector<float>& cached_vertex_normals() const {
+      std::lock_guard<std::mutex> lock(this->_cache.mutex);
+      this->_validate_cache_locked();
+      if(! this->_cache.vertex_normals) {
+        this->_cache.vertex_normals = std::make_shared<const std::vector<float>>(this->_compute_vertex_normals(*this->_cached_vertex_faces_locked()));
+      }
+      return *this->_cache.vertex_normals;
+    }
+
+    /// @brief Drop all cached derived data, i.e., the results of `fs::Mesh::cached_adjcsr`, `fs::Mesh::cached_edges`, `fs::Mesh::vertex_faces` and `fs::Mesh::cached_vertex_normals`.
+    /// @details The functions of this library that modify a mesh call this. If you modify the `vertices` or `faces` of a mesh directly, call this before using the cached accessors again. Changes to the sizes of the vectors are detected automatically, changes of values in place are not: checking them would cost a pass over the mesh on every access. References returned earlier by the cached accessors become invalid.
+    void invalidate_cache() {
+      std::lock_guard<std::mutex> lock(this->_cache.mutex);
+      this->_cache.clear();
+      this->_cache.generation++;
+    }
+
+    /// @brief Drop cached entries that were computed for an earlier generation or for vectors of different sizes. This is O(1). The caller must hold the cache mutex.
+    /// @private
+    void _validate_cache_locked() const {
+      if(this->_cache.entries_generation != this->_cache.generation || this->_cache.num_vertex_coords != this->vertices.size() || this->_cache.num_face_indices != this->faces.size()) {
+        this->_cache.clear();
+        this->_cache.entries_generation = this->_cache.generation;
+        this->_cache.num_vertex_coords = this->vertices.size();
+        this->_cache.num_face_indices = this->faces.size();
+      }
+    }
+
+    /// @brief Get the cached vertex-to-face incidence, computing it if needed. The caller must hold the cache mutex.
+    /// @private
+    const std::shared_ptr<const fs::AdjacencyCSR>& _cached_vertex_faces_locked() const {
+      this->_validate_cache_locked();
+      if(! this->_cache.vertex_faces) {
+        this->_cache.vertex_faces = std::make_shared<const fs::AdjacencyCSR>(fs::Mesh::_compute_vertex_faces(this->faces, this->num_vertices()));
+      }
+      return this->_cache.vertex_faces;
+    }
+
+    /// @brief Store a precomputed CSR adjacency in the cache, e.g., one read from a cache file. The adjacency must match the current faces.
+    /// @private
+    void _set_cached_adjcsr(fs::AdjacencyCSR&& adj) const {
+      std::lock_guard<std::mutex> lock(this->_cache.mutex);
+      this->_validate_cache_locked();
+      this->_cache.adjcsr = std::make_shared<const fs::AdjacencyCSR>(std::move(adj));
+    }
+
+    /// @brief Compute the vertex-to-face incidence in CSR layout, see `fs::Mesh::vertex_faces`.
+    /// @private
+    static fs::AdjacencyCSR _compute_vertex_faces(const std::vector<int32_t>& faces, const size_t num_vertices) {
+      fs::AdjacencyCSR vf;
+      vf.offsets.assign(num_vertices + 1, 0);
+      const size_t num_face_indices = (faces.size() / 3) * 3;
+      for(size_t i = 0; i < num_face_indices; i++) {
+        if(faces[i] < 0 || size_t(faces[i]) >= num_vertices) {
+          throw std::invalid_argument("Face vertex index " + std::to_string(faces[i]) + " invalid for mesh with " + std::to_string(num_vertices) + " vertices.\n");
+        }
+        vf.offsets[size_t(faces[i]) + 1]++;
+      }
+      for(size_t i = 0; i < num_vertices; i++) {
+        vf.offsets[i + 1] += vf.offsets[i];
+      }
+      vf.neighbors.resize(vf.offsets.back());
+      std::vector<uint32_t> fill_pos(vf.offsets.begin(), vf.offsets.end() - 1);
+      for(size_t i = 0; i < num_face_indices; i++) {  // Faces are visited in order, so rows come out sorted.
+        vf.neighbors[fill_pos[size_t(faces[i])]++] = uint32_t(i / 3);
+      }
+      return vf;
+    }
+
+    /// @brief Compute the (unnormalized) cross product of the two edges of each face that start at its first vertex.
+    /// @details The length of the result for a face is twice its area, and its direction is the face normal, following the right-hand rule for the vertex order of the face.
+    /// @private
+    std::vector<float> _face_cross_products() const {
+      const std::ptrdiff_t nf = std::ptrdiff_t(this->num_faces());
+      std::vector<float> cross(size_t(nf) * 3);
+      const float* vc = this->vertices.data();
+      const int32_t* fv = this->faces.data();
+      float* out = cross.data();
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static)
+      #endif
+      for(std::ptrdiff_t f = 0; f < nf; f++) {
+        const float* p0 = vc + 3 * size_t(fv[3*f]);
+        const float* p1 = vc + 3 * size_t(fv[3*f + 1]);
+        const float* p2 = vc + 3 * size_t(fv[3*f + 2]);
+        const float e1x = p1[0] - p0[0], e1y = p1[1] - p0[1], e1z = p1[2] - p0[2];
+        const float e2x = p2[0] - p0[0], e2y = p2[1] - p0[1], e2z = p2[2] - p0[2];
+        out[3*f] = e1y * e2z - e1z * e2y;
+        out[3*f + 1] = e1z * e2x - e1x * e2z;
+        out[3*f + 2] = e1x * e2y - e1y * e2x;
+      }
+      return cross;
+    }
+
+    /// @brief Compute the unit normal of each face.
+    /// @details The normal follows the right-hand rule for the vertex order of the face. Degenerate faces with zero area get a zero normal.
+    /// @return vector of length `3 * num_faces`, the x,y,z components of the normal of each face.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::vector<float> fn = surface.face_normals();
+    /// @endcode
+    std::vector<float> face_normals() const {
+      std::vector<float> normals = this->_face_cross_products();
+      fs::Mesh::_normalize_vec3s(&normals);
+      return normals;
+    }
+
+    /// @brief Compute the area of each face.
+    /// @return vector of length `num_faces`.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::vector<float> areas = surface.face_areas();  // all 2.0
+    /// @endcode
+    std::vector<float> face_areas() const {
+      const std::vector<float> cross = this->_face_cross_products();
+      const std::ptrdiff_t nf = std::ptrdiff_t(this->num_faces());
+      std::vector<float> areas(this->num_faces());
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static)
+      #endif
+      for(std::ptrdiff_t f = 0; f < nf; f++) {
+        areas[size_t(f)] = 0.5f * std::sqrt(cross[3*f] * cross[3*f] + cross[3*f + 1] * cross[3*f + 1] + cross[3*f + 2] * cross[3*f + 2]);
+      }
+      return areas;
+    }
+
+    /// @brief Compute the total surface area of this mesh, i.e., the sum of all face areas.
+    /// @details The sum is accumulated in double precision.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// double area = surface.total_area();  // 24.0
+    /// @endcode
+    double total_area() const {
+      const std::vector<float> areas = this->face_areas();
+      double sum = 0.0;
+      for(size_t f = 0; f < areas.size(); f++) {
+        sum += areas[f];
+      }
+      return sum;
+    }
+
+    /// @brief Compute area-weighted unit vertex normals.
+    /// @details The normal of a vertex is the normalized sum of the normals of all faces it is part of, weighted by face area. Uses the cached vertex-to-face incidence, see `fs::Mesh::vertex_faces`, so each vertex gathers its value and no atomics are needed in the parallel loop. Vertices that are not part of any face get a zero normal.
+    /// @return vector of length `3 * num_vertices`, the x,y,z components of the normal of each vertex.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::vector<float> vn = surface.vertex_normals();
+    /// @endcode
+    std::vector<float> vertex_normals() const {
+      return this->_compute_vertex_normals(this->vertex_faces());
+    }
+
+    /// @brief Compute area-weighted unit vertex normals from the given vertex-to-face incidence, see `fs::Mesh::vertex_normals`.
+    /// @private
+    std::vector<float> _compute_vertex_normals(const fs::AdjacencyCSR& vf) const {
+      const std::vector<float> cross = this->_face_cross_products();  // Length is 2 * area, so summing these weights by area.
+      const std::ptrdiff_t nv = std::ptrdiff_t(this->num_vertices());
+      std::vector<float> normals(size_t(nv) * 3);
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static)
+      #endif
+      for(std::ptrdiff_t v = 0; v < nv; v++) {
+        float nx = 0.0f, ny = 0.0f, nz = 0.0f;
+        for(const uint32_t* it = vf.neighbors_begin(size_t(v)); it != vf.neighbors_end(size_t(v)); ++it) {
+          nx += cross[3 * size_t(*it)];
+          ny += cross[3 * size_t(*it) + 1];
+          nz += cross[3 * size_t(*it) + 2];
+        }
+        normals[3*v] = nx;
+        normals[3*v + 1] = ny;
+        normals[3*v + 2] = nz;
+      }
+      fs::Mesh::_normalize_vec3s(&normals);
+      return normals;
+    }
+
+    /// @brief Normalize consecutive 3D vectors in place, zero vectors are left unchanged.
+    /// @private
+    static void _normalize_vec3s(std::vector<float>* vecs) {
+      const std::ptrdiff_t n = std::ptrdiff_t(vecs->size() / 3);
+      float* d = vecs->data();
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static)
+      #endif
+      for(std::ptrdiff_t i = 0; i < n; i++) {
+        const float len = std::sqrt(d[3*i] * d[3*i] + d[3*i + 1] * d[3*i + 1] + d[3*i + 2] * d[3*i + 2]);
+        if(len > 0.0f) {
+          const float inv_len = 1.0f / len;
+          d[3*i] *= inv_len;
+          d[3*i + 1] *= inv_len;
+          d[3*i + 2] *= inv_len;
+        }
+      }
+    }
+
+    /// @brief Return string representing the mesh in PLY format. Overload that works without passing a color vector.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::string ply_rep = surface.to_ply();
+    /// @endcode
+    std::string to_ply() const {
+      std::vector<uint8_t> empty_col;
+      return(this->to_ply(empty_col));
+    }
+
+    /// @brief Return string representing the mesh in PLY format.
+    /// @param col u_char vector of RGB color values, 3 per vertex. They must appear by vertex, i.e. in order v0_red, v0_green, v0_blue, v1_red, v1_green, v1_blue. Leave empty if you do not want colors.
+    /// @throws std::invalid_argument if the number of vertex colors does not match the number of vertices.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::string ply_rep = surface.to_ply();
+    /// @endcode
+    std::string to_ply(const std::vector<uint8_t> col) const {
+      std::ostringstream plys;
+      this->to_ply(plys, col);
+      return(plys.str());
+    }
+
+    /// @brief Write the mesh in ASCII PLY format to a stream. Overload that works without passing a color vector.
+    /// @param os the stream to which to write.
+    void to_ply(std::ostream& os) const {
+      this->to_ply(os, std::vector<uint8_t>());
+    }
+
+    /// @brief Write the mesh in ASCII PLY format to a stream.
+    /// @details The text is formatted into a fixed size buffer that is written to the stream whenever it is full, so no copy of the whole output is held in memory.
+    /// @param os the stream to which to write.
+    /// @param col u_char vector of RGB color values, 3 per vertex. They must appear by vertex, i.e. in order v0_red, v0_green, v0_blue, v1_red, v1_green, v1_blue. Leave empty if you do not want colors.
+    /// @throws std::invalid_argument if the number of vertex colors does not match the number of vertices.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::ofstream ofs("mesh.ply");
+    /// surface.to_ply(ofs, std::vector<uint8_t>());
+    /// @endcode
+    void to_ply(std::ostream& os, const std::vector<uint8_t>& col) const {
+      const bool use_vertex_colors = col.size() != 0;
+      fs::util::_BufferedWriter w(os);
+      this->_write_ply_header(&w, "ascii", use_vertex_colors, col.size());
+
+      #ifdef LIBFS_DBG_DEBUG
+      fs::util::log("Writing " + std::to_string(this->vertices.size()/3) + " PLY format vertices.", "INFO");
+      #endif
+
+      for(size_t vidx=0; vidx<this->vertices.size();vidx+=3) {  // vertex coords
+        w.put_float(vertices[vidx]);
+        w.put(' ');
+        w.put_float(vertices[vidx+1]);
+        w.put(' ');
+        w.put_float(vertices[vidx+2]);
+        if(use_vertex_colors) {
+          w.put(' ');
+          w.put_int(col[vidx]);
+          w.put(' ');
+          w.put_int(col[vidx+1]);
+          w.put(' ');
+          w.put_int(col[vidx+2]);
+        }
+        w.put('\n');
+      }
+
+      #ifdef LIBFS_DBG_DEBUG
+      fs::util::log("Writing " + std::to_string(this->faces.size()/3) + " PLY format faces.", "INFO");
+      #endif
+
+      for(size_t fidx=0; fidx<this->faces.size();fidx+=3) { // faces: vertex indices, 0-based
+        w.write("3 ", 2);
+        w.put_int(faces[fidx]);
+        w.put(' ');
+        w.put_int(faces[fidx+1]);
+        w.put(' ');
+        w.put_int(faces[fidx+2]);
+        w.put('\n');
+      }
+      w.flush();
+    }
+
+    /// @brief Write the mesh in binary PLY format to a stream, which must be in binary mode.
+    /// @details The data is written in the byte order of the host, i.e., as `binary_little_endian` on most systems, so no conversion is needed. The format is much faster to write and read than ASCII PLY, and the coordinates are stored exactly.
+    /// @param os the stream to which to write.
+    /// @param col u_char vector of RGB color values, 3 per vertex. They must appear by vertex, i.e. in order v0_red, v0_green, v0_blue, v1_red, v1_green, v1_blue. Leave empty if you do not want colors.
+    /// @throws std::invalid_argument if the number of vertex colors does not match the number of vertices.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::ofstream ofs("mesh.ply", std::ios::binary);
+    /// surface.to_ply_binary(ofs);
+    /// @endcode
+    void to_ply_binary(std::ostream& os, const std::vector<uint8_t>& col = std::vector<uint8_t>()) const {
+      const bool use_vertex_colors = col.size() != 0;
+      fs::util::_BufferedWriter w(os);
+      this->_write_ply_header(&w, LIBFS_HOST_BIG_ENDIAN != 0 ? "binary_big_endian" : "binary_little_endian", use_vertex_colors, col.size());
+      if(use_vertex_colors) {
+        for(size_t vidx=0; vidx<this->vertices.size();vidx+=3) {
+          w.write(reinterpret_cast<const char*>(&vertices[vidx]), 3 * sizeof(float));
+          w.write(reinterpret_cast<const char*>(&col[vidx]), 3);
+        }
+      } else if(! this->vertices.empty()) {
+        w.write(reinterpret_cast<const char*>(this->vertices.data()), this->vertices.size() * sizeof(float));
+      }
+      // Each face record is the list length (uchar) followed by the 3 vertex indices (int).
+      char face_record[1 + 3 * sizeof(int32_t)];
+      face_record[0] = 3;
+      for(size_t fidx=0; fidx<this->faces.size();fidx+=3) {
+        const int32_t fv[3] = { int32_t(faces[fidx]), int32_t(faces[fidx+1]), int32_t(faces[fidx+2]) };
+        std::memcpy(face_record + 1, fv, sizeof(fv));
+        w.write(face_record, sizeof(face_record));
+      }
+      w.flush();
+    }
+
+    /// @brief Write the PLY header for this mesh.
+    /// @throws std::invalid_argument if the number of vertex colors does not match the number of vertices.
+    ///
+    /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+    /// @private
+    void _write_ply_header(fs::util::_BufferedWriter* w, const char* format, bool use_vertex_colors, size_t num_colors) const {
+      if(use_vertex_colors && num_colors != this->vertices.size()) {
+        throw std::invalid_argument("Number of vertex coordinates and vertex colors must match when writing PLY file, but got " + std::to_string(this->vertices.size()) + " and " + std::to_string(num_colors) + ".");
+      }
+      w->write("ply\nformat ");
+      w->write(format);
+      w->write(" 1.0\nelement vertex ");
+      w->put_int(int64_t(this->num_vertices()));
+      w->write("\nproperty float x\nproperty float y\nproperty float z\n");
+      if(use_vertex_colors) {
+        w->write("property uchar red\nproperty uchar green\nproperty uchar blue\n");
+      }
+      w->write("element face ");
+      w->put_int(int64_t(this->num_faces()));
+      w->write("\nproperty list uchar int vertex_index\nend_header\n");
+    }
+
+    /// @brief Export this mesh to a file in Stanford PLY format.
+    /// @throws std::runtime_error if the target file cannot be opened.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// surface.to_ply_file("mesh.ply");
+    /// @endcode
+    void to_ply_file(const std::string& filename) const {
+      #ifdef LIBFS_DBG_INFO
+      fs::util::log("Writing mesh to PLY file '" + filename + "'.", "INFO");
+      #endif
+      fs::util::_write_to_file(filename, false, [this](std::ostream& os) { this->to_ply(os); });
+    }
+
+    /// @brief Export this mesh to a file in Stanford PLY format with vertex colors.
+    /// @throws std::runtime_error if the target file cannot be opened, std::invalid_argument if the number of vertex colors does not match the number of vertices.
+    void to_ply_file(const std::string& filename, const std::vector<uint8_t> col) const {
+      this->_check_vertex_colors(col, "PLY");  // Before opening the file, which would truncate it.
+      fs::util::_write_to_file(filename, false, [this, &col](std::ostream& os) { this->to_ply(os, col); });
+    }
+
+    /// @brief Export this mesh to a file in binary Stanford PLY format, optionally with vertex colors.
+    /// @see fs::Mesh::to_ply_binary
+    /// @throws std::runtime_error if the target file cannot be opened, std::invalid_argument if the number of vertex colors does not match the number of vertices.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// surface.to_ply_binary_file("mesh.ply");
+    /// @endcode
+    void to_ply_binary_file(const std::string& filename, const std::vector<uint8_t>& col = std::vector<uint8_t>()) const {
+      this->_check_vertex_colors(col, "PLY");
+      fs::util::_write_to_file(filename, true, [this, &col](std::ostream& os) { this->to_ply_binary(os, col); });
+    }
+
+    /// @brief Return string representing the mesh in OFF format. Overload that works without passing a color vector.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// std::string off_rep = surface.to_off();
+    /// @endcode
+    std::string to_off() const {
+      std::vector<uint8_t> empty_col;
+      return(this->to_off(empty_col));
+    }
+
+    /// @brief Return string representing the mesh in PLY format.
+    /// @param col u_char vector of RGB color values, 3 per vertex. They must appear by vertex, i.e. in order v0_red, v0_green, v0_blue, v1_red, v1_green, v1_blue. Leave empty if you do not want colors.
+    /// @throws std::invalid_argument if the number of vertex colors does not match the number of vertices.
+    std::string to_off(const std::vector<uint8_t> col) const {
+      std::ostringstream offs;
+      this->to_off(offs, col);
+      return(offs.str());
+    }
+
+    /// @brief Write the mesh in OFF format to a stream. Overload that works without passing a color vector.
+    /// @param os the stream to which to write.
+    void to_off(std::ostream& os) const {
+      this->to_off(os, std::vector<uint8_t>());
+    }
+
+    /// @brief Write the mesh in OFF format to a stream, or COFF format if vertex colors are given.
+    /// @details The text is formatted into a fixed size buffer that is written to the stream whenever it is full, so no copy of the whole output is held in memory.
+    /// @param os the stream to which to write.
+    /// @param col u_char vector of RGB color values, 3 per vertex. They must appear by vertex, i.e. in order v0_red, v0_green, v0_blue, v1_red, v1_green, v1_blue. Leave empty if you do not want colors.
+    /// @throws std::invalid_argument if the number of vertex colors does not match the number of vertices.
+    void to_off(std::ostream& os, const std::vector<uint8_t>& col) const {
+      const bool use_vertex_colors = col.size() != 0;
+      fs::util::_BufferedWriter w(os);
+      if(use_vertex_colors) {
+        #ifdef LIBFS_DBG_INFO
+        fs::util::log("Writing OFF representation of mesh with vertex colors.", "INFO");
+        #endif
+        if(col.size() != this->vertices.size()) {
+          throw std::invalid_argument("Number of vertex coordinates and vertex colors must match when writing OFF file but got " + std::to_string(this->vertices.size()) + " and " + std::to_string(col.size()) + ".");
+        }
+        w.write("COFF\n");
+      } else {
+        #ifdef LIBFS_DBG_INFO
+        fs::util::log("Writing OFF representation of mesh without vertex colors.", "INFO");
+        #endif
+        w.write("OFF\n");
+      }
+      w.put_int(int64_t(this->num_vertices()));
+      w.put(' ');
+      w.put_int(int64_t(this->num_faces()));
+      w.write(" 0\n");
+
+      for(size_t vidx=0; vidx<this->vertices.size();vidx+=3) {  // vertex coords
+        w.put_float(vertices[vidx]);
+        w.put(' ');
+        w.put_float(vertices[vidx+1]);
+        w.put(' ');
+        w.put_float(vertices[vidx+2]);
+        if(use_vertex_colors) {
+          w.put(' ');
+          w.put_int(col[vidx]);
+          w.put(' ');
+          w.put_int(col[vidx+1]);
+          w.put(' ');
+          w.put_int(col[vidx+2]);
+          w.write(" 255");
+        }
+        w.put('\n');
+      }
+
+      for(size_t fidx=0; fidx<this->faces.size();fidx+=3) { // faces: vertex indices, 0-based
+        w.write("3 ", 2);
+        w.put_int(faces[fidx]);
+        w.put(' ');
+        w.put_int(faces[fidx+1]);
+        w.put(' ');
+        w.put_int(faces[fidx+2]);
+        w.put('\n');
+      }
+      w.flush();
+    }
+
+    /// @brief Export this mesh to a file in OFF format.
+    /// @throws std::runtime_error if the target file cannot be opened.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Mesh surface = fs::Mesh::construct_cube();
+    /// surface.to_off_file("mesh.off");
+    /// @endcode
+    void to_off_file(const std::string& filename) const {
+      fs::util::_write_to_file(filename, false, [this](std::ostream& os) { this->to_off(os); });
+    }
+
+    /// @brief Export this mesh to a file in OFF format with vertex colors (COFF).
+    /// @throws std::runtime_error if the target file cannot be opened, std::invalid_argument if the number of vertex colors does not match the number of vertices.
+    void to_off_file(const std::string& filename, const std::vector<uint8_t> col) const {
+      this->_check_vertex_colors(col, "OFF");
+      fs::util::_write_to_file(filename, false, [this, &col](std::ostream& os) { this->to_off(os, col); });
+    }
+
+    private:
+    /// @brief Check that the vertex colors, if any, contain 3 values per vertex.
+    /// @throws std::invalid_argument if the number of vertex colors does not match the number of vertices.
+    void _check_vertex_colors(const std::vector<uint8_t>& col, const std::string& format) const {
+      if(col.size() != 0 && col.size() != this->vertices.size()) {
+        throw std::invalid_argument("Number of vertex coordinates and vertex colors must match when writing " + format + " file, but got " + std::to_string(this->vertices.size()) + " and " + std::to_string(col.size()) + ".");
+      }
+    }
+
+    mutable fs::_MeshDerivedCache _cache;  ///< Lazily computed adjacency, edges, vertex-face incidence and normals.
+  };
+
+
+  /// Models a FreeSurfer curv file that contains per-vertex float data.
+  struct Curv {
+
+    /// Construct a Curv instance from the given per-vertex data.
+    Curv(std::vector<float> curv_data) :
+      num_faces(100000), num_vertices(0), num_values_per_vertex(1) { data = std::move(curv_data); num_vertices = int(data.size()); }
+
+    /// Construct an empty Curv instance.
+    Curv() :
+      num_faces(100000), num_vertices(0), num_values_per_vertex(1) {}
+
+    /// The number of faces of the mesh to which this belongs, typically irrelevant and ignored.
+    int32_t num_faces;
+
+    /// The curvature data, one value per vertex. Something like the cortical thickness at each vertex.
+    std::vector<float> data;
+
+    /// The number of vertices of the mesh to which this belongs. Can be deduced from length of 'data'.
+    int32_t num_vertices;
+
+    /// The number of values per vertex, stored in this file. Almost all apps (including FreeSurfer itself) only support a value of 1 here. Ignored by most apps, and assumed to be 1.
+    int32_t num_values_per_vertex;
+  };
+
+  /// The colortable from an Annot file, can be used for parcellations and integer labels. Typically each index (in all fields) describes a brain region.
+  struct Colortable {
+    std::vector<int32_t> id;  ///< internal region index
+    std::vector<std::string> name;   ///< region name
+    std::vector<int32_t> r;   ///< red channel of RGBA color
+    std::vector<int32_t> g;   ///< blue channel of RGBA color
+    std::vector<int32_t> b;   ///< green channel of RGBA color
+    std::vector<int32_t> a;   ///< alpha channel of RGBA color
+    std::vector<int32_t> label;   ///< label integer computed from rgba values. Maps to the Annot.vertex_label field.
+
+    /// @brief Get the number of enties (regions) in this Colortable.
+    size_t num_entries() const {
+      size_t num_ids = this->id.size();
+      if(this->name.size() != num_ids || this->r.size() != num_ids || this->g.size() != num_ids || this->b.size() != num_ids || this->a.size() != num_ids || this->label.size() != num_ids) {
+        std::cerr << "Inconsistent Colortable, vector sizes do not match.\n";
+      }
+      return num_ids;
+    }
+
+    /// @brief Get the index of a region in the Colortable by region name. Returns a negative value if the region is not found.
+    /// @details Uses the hash index built by `fs::Colortable::build_index` if it is current, and a linear scan otherwise. If several regions have the same name, the first one is returned.
+    int32_t get_region_idx(const std::string& query_name) const {
+      if(this->has_index()) {
+        std::unordered_map<std::string, size_t>::const_iterator it = this->_index->name_first.find(query_name);
+        return it == this->_index->name_first.end() ? -1 : (int32_t)it->second;
+      }
+      for(size_t i = 0; i < this->name.size(); i++) {
+        if(this->name[i] == query_name) {
+          return (int32_t)i;
+        }
+      }
+      return -1;
+    }
+
+    /// @brief Get the index of a region in the Colortable by label. Returns a negative value if the region is not found.
+    /// @details Uses the hash index built by `fs::Colortable::build_index` if it is current, and a linear scan otherwise. If several regions have the same label, the first one is returned.
+    int32_t get_region_idx(int32_t query_label) const {
+      if(this->has_index()) {
+        std::unordered_map<int32_t, size_t>::const_iterator it = this->_index->label_first.find(query_label);
+        return it == this->_index->label_first.end() ? -1 : (int32_t)it->second;
+      }
+      for(size_t i = 0; i < this->label.size(); i++) {
+        if(this->label[i] == query_label) {
+          return (int32_t)i;
+        }
+      }
+      return -1;
+    }
+
+    /// @brief Build the hash indices used by `fs::Colortable::get_region_idx`, `fs::Colortable::label_index` and `fs::Colortable::name_index`.
+    /// @details Functions like `fs::read_annot` call this after filling the Colortable. The index keeps a copy of the labels and names it was built from, and is only used while they are unchanged: after any change to the `label` or `name` entries, lookups fall back to a linear scan until the index is rebuilt, so they never return stale results. Checking costs O(number of entries), which is small compared to the per-vertex work of `fs::Annot::vertex_regions`. All `const` lookups only read the index, so they are safe to call concurrently.
+    void build_index() {
+      std::shared_ptr<_Index> idx = std::make_shared<_Index>();
+      idx->names = this->name;
+      idx->labels = this->label;
+      idx->label_first.reserve(this->label.size());
+      idx->label_last.reserve(this->label.size());
+      for(size_t i = 0; i < this->label.size(); i++) {
+        idx->label_first.insert(std::make_pair(this->label[i], i));  // Does not overwrite, so the first entry wins.
+        idx->label_last[this->label[i]] = i;  // Overwrites, so the last entry wins.
+      }
+      idx->name_first.reserve(this->name.size());
+      for(size_t i = 0; i < this->name.size(); i++) {
+        idx->name_first.insert(std::make_pair(this->name[i], i));
+      }
+      this->_index = idx;
+    }
+
+    /// @brief Whether the index built by `fs::Colortable::build_index` exists and was built from the current labels and names.
+    bool has_index() const {
+      return this->_index && this->_index->labels == this->label && this->_index->names == this->name;
+    }
+
+    /// @brief Get a map from region label to region index in this Colortable.
+    /// @details If several regions have the same label, the map contains the first one.
+    /// @return reference to the map built by `fs::Colortable::build_index`. It stays valid until the index is rebuilt.
+    /// @throws std::logic_error if the index has not been built or is stale, see `fs::Colortable::has_index`.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Annot annot;
+    /// fs::read_annot(&annot, "lh.aparc.annot");
+    /// size_t region_idx = annot.colortable.label_index().at(annot.vertex_labels[0]);
+    /// @endcode
+    const std::unordered_map<int32_t, size_t>& label_index() const {
+      this->_require_index();
+      return this->_index->label_first;
+    }
+
+    /// @brief Get a map from region name to region index in this Colortable.
+    /// @details If several regions have the same name, the map contains the first one.
+    /// @return reference to the map built by `fs::Colortable::build_index`. It stays valid until the index is rebuilt.
+    /// @throws std::logic_error if the index has not been built or is stale, see `fs::Colortable::has_index`.
+    const std::unordered_map<std::string, size_t>& name_index() const {
+      this->_require_index();
+      return this->_index->name_first;
+    }
+
+    private:
+    friend struct Annot;
+
+    /// @brief The hash indices of a Colortable, immutable once built so copies of a Colortable can share them.
+    struct _Index {
+      std::vector<int32_t> labels;  ///< The labels the index was built from.
+      std::vector<std::string> names;  ///< The names the index was built from.
+      std::unordered_map<int32_t, size_t> label_first;  ///< Label to the first region with that label.
+      std::unordered_map<int32_t, size_t> label_last;  ///< Label to the last region with that label, used by `fs::Annot::vertex_regions`.
+      std::unordered_map<std::string, size_t> name_first;  ///< Name to the first region with that name.
+    };
+
+    void _require_index() const {
+      if(! this->has_index()) {
+        throw std::logic_error("The Colortable index is not built or stale, call build_index() first.\n");
+      }
+    }
+
+    /// @brief Get the label to last region map, from the index if it is current or else built into `tmp`.
+    const std::unordered_map<int32_t, size_t>& _label_last_index(std::unordered_map<int32_t, size_t>& tmp) const {
+      if(this->has_index()) {
+        return this->_index->label_last;
+      }
+      tmp.reserve(this->label.size());
+      for(size_t i = 0; i < this->label.size(); i++) {
+        tmp[this->label[i]] = i;
+      }
+      return tmp;
+    }
+
+    std::shared_ptr<const _Index> _index;  ///< The index built by `build_index`, shared between copies.
+  };
+
+
+  /// An annotation, also known as a brain surface parcellation. Assigns to each vertex a region, identified by the region_label. The region name and color for each region can be found in the Colortable.
+  struct Annot {
+    std::vector<int32_t> vertex_indices;  ///< Indices of the vertices, these always go from 0 to N-1 (where N is the number of vertices in the respective surface/annotation). Not really needed.
+    std::vector<int32_t> vertex_labels;   ///< The label code for each vertex, defining the region it belongs to. Check in the Colortable for a region that has this label.
+    Colortable colortable;  ///< A Colortable defining the regions (most importantly, the region name and visualization color).
+
+    /// @brief Get all vertices of a region given by name in the brain surface parcellation. Returns an integer vector, the vertex indices.
+    std::vector<int32_t> region_vertices(const std::string& region_name) const {
+      int32_t region_idx = this->colortable.get_region_idx(region_name);
+      if(region_idx >= 0) {
+        return(this->region_vertices(this->colortable.label[region_idx]));
+      } else {
+        std::cerr << "No such region in annot, returning empty vector.\n";
+        std::vector<int32_t> empty;
+        return(empty);
+      }
+    }
+
+    /// @brief Get all vertices of a region given by label in the brain surface parcellation. Returns an integer vector, the vertex indices.
+    std::vector<int32_t> region_vertices(int32_t region_label) const {
+      std::vector<int32_t> reg_verts;
+      for(size_t i=0; i<this->vertex_labels.size(); i++) {
+        if(this->vertex_labels[i] == region_label) {
+          reg_verts.push_back(int(i));
+        }
+      }
+      return(reg_verts);
+    }
+
+    /// @brief Get the vertex colors as an array of uchar values, 3 consecutive values are the red, green and blue channel values for a single vertex.
+    /// @param alpha whether to include the alpha channel and return 4 values per vertex instead of 3.
+    std::vector<uint8_t> vertex_colors(bool alpha = false) const {
+      const size_t num_channels = alpha ? 4 : 3;
+      const size_t nv = this->num_vertices();
+      const size_t num_regions = this->colortable.num_entries();
+      // Pack the colors per region first, then a single pass over the vertices copies them.
+      std::vector<uint8_t> region_col(num_regions * num_channels);
+      for(size_t r = 0; r < num_regions; r++) {
+        region_col[r * num_channels] = uint8_t(this->colortable.r[r]);
+        region_col[r * num_channels + 1] = uint8_t(this->colortable.g[r]);
+        region_col[r * num_channels + 2] = uint8_t(this->colortable.b[r]);
+        if(alpha) {
+          region_col[r * num_channels + 3] = uint8_t(this->colortable.a[r]);
+        }
+      }
+      std::vector<uint8_t> col(nv * num_channels);
+      const std::vector<size_t> vertex_region_indices = this->vertex_regions();
+      for(size_t i = 0; i < nv; i++) {
+        std::memcpy(&col[i * num_channels], &region_col[vertex_region_indices[i] * num_channels], num_channels);
+      }
+      return(col);
+    }
+
+    /// @brief Get the number of vertices of this parcellation (or the associated surface).
+    /// @throws std::runtime_error on invalid annot
+    size_t num_vertices() const {
+      size_t nv = this->vertex_indices.size();
+      if(this->vertex_labels.size() != nv) {
+        throw std::runtime_error("Inconsistent annot, number of vertex indices and labels does not match.\n");
+      }
+      return nv;
+    }
+
+    /// @brief Compute the region indices in the Colortable for all vertices in this brain surface parcellation. With the region indices, it becomes very easy to obtain all region names, labels, and color channel values from the Colortable.
+    /// @see The function `vertex_region_names` uses this function to get the region names for all vertices.
+    /// @note Vertices whose label does not occur in the Colortable get region index 0. If several regions share a label, the last one is used.
+    std::vector<size_t> vertex_regions() const {
+      const size_t nv = this->num_vertices();
+      std::unordered_map<int32_t, size_t> tmp_index;
+      const std::unordered_map<int32_t, size_t>& label_to_region = this->colortable._label_last_index(tmp_index);
+      std::vector<size_t> vert_reg(nv, 0);
+      int32_t prev_label = 0;
+      size_t prev_region = 0;
+      bool have_prev = false;
+      for(size_t i = 0; i < nv; i++) {
+        const int32_t lab = this->vertex_labels[i];
+        if(! have_prev || lab != prev_label) {  // Neighboring vertices often share a label, skip the lookup for them.
+          std::unordered_map<int32_t, size_t>::const_iterator it = label_to_region.find(lab);
+          prev_region = it == label_to_region.end() ? 0 : it->second;
+          prev_label = lab;
+          have_prev = true;
+        }
+        vert_reg[i] = prev_region;
+      }
+      return vert_reg;
+    }
+
+    /// @brief Compute the vertices of all regions at once, as buckets in CSR layout.
+    /// @details Row `r` of the result contains the vertices of the region with index `r` in the Colortable, sorted ascending. This is computed in a single pass over the vertices, while calling `fs::Annot::region_vertices` for every region needs one pass per region. Vertices whose label does not occur in the Colortable are not part of any row.
+    /// @return the region buckets, the `neighbors` field holds the vertex indices. The number of rows is the number of Colortable entries.
+    ///
+    /// #### Examples
+    ///
+    /// @code
+    /// fs::Annot annot;
+    /// fs::read_annot(&annot, "lh.aparc.annot");
+    /// fs::AdjacencyCSR buckets = annot.region_vertices_csr();
+    /// size_t num_verts_region0 = buckets.degree(0);
+    /// @endcode
+    fs::AdjacencyCSR region_vertices_csr() const {
+      const size_t nv = this->num_vertices();
+      const size_t num_regions = this->colortable.num_entries();
+      std::unordered_map<int32_t, size_t> tmp_index;
+      const std::unordered_map<int32_t, size_t>& label_to_region = this->colortable._label_last_index(tmp_index);
+      const size_t NO_REGION = num_regions;
+      std::vector<size_t> vert_reg(nv, NO_REGION);
+      for(size_t i = 0; i < nv; i++) {
+        std::unordered_map<int32_t, size_t>::const_iterator it = label_to_region.find(this->vertex_labels[i]);
+        if(it != label_to_region.end()) {
+          vert_reg[i] = it->second;
+        }
+      }
+      fs::AdjacencyCSR buckets;
+      buckets.offsets.assign(num_regions + 1, 0);
+      for(size_t i = 0; i < nv; i++) {
+        if(vert_reg[i] != NO_REGION) {
+          buckets.offsets[vert_reg[i] + 1]++;
+        }
+      }
+      for(size_t r = 0; r < num_regions; r++) {
+        buckets.offsets[r + 1] += buckets.offsets[r];
+      }
+      buckets.neighbors.resize(buckets.offsets.back());
+      std::vector<uint32_t> fill_pos(buckets.offsets.begin(), buckets.offsets.end() - 1);
+      for(size_t i = 0; i < nv; i++) {
+        if(vert_reg[i] != NO_REGION) {
+          buckets.neighbors[fill_pos[vert_reg[i]]++] = uint32_t(i);
+        }
+      }
+      return buckets;
+    }
+
+    /// @brief Compute the region names in the Colortable for all vertices in this brain surface parcellation.
+    std::vector<std::string> vertex_region_names() const {
+      const std::vector<size_t> vertex_region_indices = this->vertex_regions();
+      std::vector<std::string> region_names;
+      region_names.reserve(vertex_region_indices.size());
+      for(size_t i=0; i<vertex_region_indices.size(); i++) {
+        region_names.push_back(this->colortable.name[vertex_region_indices[i]]);
+      }
+      return(region_names);
+    }
+  };
+
+
+  /// Models the header of an MGH file.
+  struct MghHeader {
+    MghHeader() {}  ///< Empty default constuctor.
+    MghHeader(const Curv& curv) {  ///< Constuctor to fill header from a Curv instance.
+      dim1length = curv.data.size();
+      dim2length = 1;
+      dim3length = 1;
+      dim4length = 1;
+      dtype = fs::MRI_FLOAT;
+    }
+    MghHeader(const std::vector<float>& curv_data) { ///< Constuctor to fill header from a 1D float array (curv data).
+      dim1length = curv_data.size();
+      dim2length = 1;
+      dim3length = 1;
+      dim4length = 1;
+      dtype = fs::MRI_FLOAT;
+    }
+    int32_t dim1length = 0;  ///< size of data along 1st dimension
+    int32_t dim2length = 0;  ///< size of data along 2nd dimension
+    int32_t dim3length = 0;  ///< size of data along 3rd dimension
+    int32_t dim4length = 0;  ///< size of data along 4th dimension
+
+    int32_t dtype = 0;  ///< the MRI data type
+    int32_t dof = 0;  ///< typically ignored
+    int16_t ras_good_flag = 0; ///< flag indicating whether the data in the RAS fields (Mdc, Pxyz_c) are valid. 1 means valid, everything else means invalid.
+
+    /// @brief Compute the number of values based on the dim*length header fields.
+    size_t num_values() const {
+      return((size_t) dim1length * dim2length * dim3length * dim4length);
+    }
+
+    float xsize = 0.0;  ///< size of voxels along 1st axis (x or r)
+    float ysize = 0.0;  ///< size of voxels along 2nd axis (y or a)
+    float zsize = 0.0;  ///< size of voxels along 3rd axis (z or s)
+    std::vector<float> Mdc;  ///< matrix
+    std::vector<float> Pxyz_c;  ///< x,y,z coordinates of central vertex
+  };
+
+  template <typename T> struct _MghDataMember;
+
+  /// Models the data of an MGH file. Currently these are 1D vectors, but one can compute the 4D array using the dimXlength fields of the respective MghHeader.
+  struct MghData {
+    MghData() {}
+    MghData(std::vector<int32_t> curv_data) { data_mri_int = std::move(curv_data); }  ///< constructor to create MghData from MRI_INT (int32_t) data.
+    explicit MghData(std::vector<uint8_t> curv_data) { data_mri_uchar = std::move(curv_data); }  ///< constructor to create MghData from MRI_UCHAR (uint8_t) data.
+    explicit MghData(std::vector<short> curv_data) { data_mri_short = std::move(curv_data); }  ///< constructor to create MghData from MRI_SHORT (short) data.
+    MghData(std::vector<float> curv_data) { data_mri_float = std::move(curv_data); }  ///< constructor to create MghData from MRI_FLOAT (float) data.
+    MghData(const Curv& curv) { data_mri_float = curv.data; }  ///< constructor to create MghData from a Curv instance
+    std::vector<int32_t> data_mri_int;  ///< data of type MRI_INT, check the dtype to see whether this is relevant for this instance.
+    std::vector<uint8_t> data_mri_uchar;  ///< data of type MRI_UCHAR, check the dtype to see whether this is relevant for this instance.
+    std::vector<float> data_mri_float;  ///< data of type MRI_FLOAT, check the dtype to see whether this is relevant for this instance.
+    std::vector<short> data_mri_short;  ///< data of type MRI_SHORT, check the dtype to see whether this is relevant for this instance.
+
+    /// @brief Get the data vector for the value type `T`, e.g., `data_mri_float` for `float`. Allows code that is generic over the MRI data types, see `fs::mri_dtype_of`.
+    template <typename T>
+    std::vector<T>& values() {
+      return _MghDataMember<T>::get(*this);
+    }
+
+    /// @brief Get the data vector for the value type `T`, e.g., `data_mri_float` for `float`.
+    template <typename T>
+    const std::vector<T>& values() const {
+      return _MghDataMember<T>::get(*this);
+    }
+  };
+
+  /// @brief Maps a value type to the respective data vector of an fs::MghData instance, see `fs::MghData::values`.
+  ///
+  /// THIS STRUCT IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+  /// @private
+  template <> struct _MghDataMember<uint8_t> {
+    static std::vector<uint8_t>& get(MghData& d) { return d.data_mri_uchar; }
+    static const std::vector<uint8_t>& get(const MghData& d) { return d.data_mri_uchar; }
+  };
+  /// @private
+  template <> struct _MghDataMember<int32_t> {
+    static std::vector<int32_t>& get(MghData& d) { return d.data_mri_int; }
+    static const std::vector<int32_t>& get(const MghData& d) { return d.data_mri_int; }
+  };
+  /// @private
+  template <> struct _MghDataMember<float> {
+    static std::vector<float>& get(MghData& d) { return d.data_mri_float; }
+    static const std::vector<float>& get(const MghData& d) { return d.data_mri_float; }
+  };
+  /// @private
+  template <> struct _MghDataMember<short> {
+    static std::vector<short>& get(MghData& d) { return d.data_mri_short; }
+    static const std::vector<short>& get(const MghData& d) { return d.data_mri_short; }
+  };
+
+  /// Models a whole MGH file.
+  struct Mgh {
+    MghHeader header;  ///< Header for this MGH instance.
+    MghData data;  ///< 4D data for this MGH instance.
+    Mgh() {}  ///< Empty default constuctor.
+    Mgh(const Curv& curv) {  ///< Constuctor to create MGH instance from Curv instance.
+      header = MghHeader(curv);
+      data = MghData(curv);
+    }
+    Mgh(std::vector<float> curv_data) {  ///< Constuctor to create MGH instance from a 1D float array (curv data).
+      header = MghHeader(curv_data);
+      data = MghData(std::move(curv_data));
+    }
+  };
+
+  /// @brief A simple 4D array datastructure, useful for representing volume data.
+  /// @details By convention, for FreeSurfer data, the order of the 4 dimensions is: *time*, *x*, *y*, *z*. The values are stored in a single vector in which the 4th index varies fastest. All sizes and indices are `size_t`, so volumes with more than 4G voxels are supported. Use `at` for checked access (in debug builds), `operator()` for unchecked access in hot loops, and `row` or `slab` to get pointers to contiguous runs of values that voxel kernels can vectorize over.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::Mgh mgh;
+  /// fs::read_mgh(&mgh, "brain.mgh");
+  /// fs::Array4D<uint8_t> ar(mgh.header, std::move(mgh.data.data_mri_uchar));  // Takes the data, no copy.
+  /// uint8_t val = ar(99, 99, 99, 0);
+  /// @endcode
+  template<class T>
+  struct Array4D {
+    /// Constructor for creating an empty 4D array of the given dimensions.
+    Array4D(size_t d1, size_t d2, size_t d3, size_t d4) :
+      d1(d1), d2(d2), d3(d3), d4(d4), data(d1*d2*d3*d4) {}
+
+    /// @brief Constructor for creating a 4D array of the given dimensions that takes ownership of the given data, without copying it.
+    /// @throws std::invalid_argument if the data size does not match the dimensions.
+    Array4D(size_t d1, size_t d2, size_t d3, size_t d4, std::vector<T>&& values) :
+      d1(d1), d2(d2), d3(d3), d4(d4), data(std::move(values)) {
+      this->_check_size();
+    }
+
+    /// Constructor for creating an empty 4D array based on dimensions specified in an fs::MghHeader.
+    Array4D(MghHeader *mgh_header) :
+      d1(size_t(mgh_header->dim1length)), d2(size_t(mgh_header->dim2length)), d3(size_t(mgh_header->dim3length)), d4(size_t(mgh_header->dim4length)), data(d1*d2*d3*d4) {}
+
+    /// @brief Constructor for creating a 4D array with the dimensions specified in an fs::MghHeader that takes ownership of the given data, e.g., one of the vectors of an fs::MghData instance, without copying it.
+    /// @throws std::invalid_argument if the data size does not match the dimensions.
+    Array4D(const MghHeader& mgh_header, std::vector<T>&& values) :
+      d1(size_t(mgh_header.dim1length)), d2(size_t(mgh_header.dim2length)), d3(size_t(mgh_header.dim3length)), d4(size_t(mgh_header.dim4length)), data(std::move(values)) {
+      this->_check_size();
+    }
+
+    /// Constructor for creating an empty 4D array based on dimensions specified in the header of an fs::Mgh. Does not init the data.
+    Array4D(Mgh *mgh) : // This does NOT init the data atm.
+      d1(size_t(mgh->header.dim1length)), d2(size_t(mgh->header.dim2length)), d3(size_t(mgh->header.dim3length)), d4(size_t(mgh->header.dim4length)), data(d1*d2*d3*d4) {}
+
+    /// Get the value at the given 4D position. The indices are checked with asserts.
+    const T& at(const size_t i1, const size_t i2, const size_t i3, const size_t i4) const {
+      return data[get_index(i1, i2, i3, i4)];
+    }
+
+    /// Get a reference to the value at the given 4D position. The indices are checked with asserts.
+    T& at(const size_t i1, const size_t i2, const size_t i3, const size_t i4) {
+      return data[get_index(i1, i2, i3, i4)];
+    }
+
+    /// Get the value at the given 4D position, without any checks.
+    const T& operator()(const size_t i1, const size_t i2, const size_t i3, const size_t i4) const {
+      return data[((i1*d2 + i2)*d3 + i3)*d4 + i4];
+    }
+
+    /// Get a reference to the value at the given 4D position, without any checks.
+    T& operator()(const size_t i1, const size_t i2, const size_t i3, const size_t i4) {
+      return data[((i1*d2 + i2)*d3 + i3)*d4 + i4];
+    }
+
+    /// Get the index in the vector for the given 4D position. The indices are checked with asserts.
+    size_t get_index(const size_t i1, const size_t i2, const size_t i3, const size_t i4) const {
+      assert(i1 < d1 && i2 < d2 && i3 < d3 && i4 < d4);
+      return (((i1*d2 + i2)*d3 + i3)*d4 + i4);
+    }
+
+    /// Get the distance in the vector between consecutive values along each of the 4 dimensions.
+    std::array<size_t, 4> strides() const {
+      return {{ d2*d3*d4, d3*d4, d4, 1 }};
+    }
+
+    /// Get a pointer to the `d4` consecutive values at the given position in the first 3 dimensions.
+    T* row(const size_t i1, const size_t i2, const size_t i3) {
+      return data.data() + ((i1*d2 + i2)*d3 + i3)*d4;
+    }
+
+    /// Get a pointer to the `d4` consecutive values at the given position in the first 3 dimensions.
+    const T* row(const size_t i1, const size_t i2, const size_t i3) const {
+      return data.data() + ((i1*d2 + i2)*d3 + i3)*d4;
+    }
+
+    /// Get a pointer to the `d2 * d3 * d4` consecutive values with the given index in the first dimension.
+    T* slab(const size_t i1) {
+      return data.data() + i1*d2*d3*d4;
+    }
+
+    /// Get a pointer to the `d2 * d3 * d4` consecutive values with the given index in the first dimension.
+    const T* slab(const size_t i1) const {
+      return data.data() + i1*d2*d3*d4;
+    }
+
+    /// Get number of values/voxels.
+    size_t num_values() const {
+      return(d1*d2*d3*d4);
+    }
+
+    size_t d1;  ///< size of data along 1st dimension
+    size_t d2;  ///< size of data along 2nd dimension
+    size_t d3;  ///< size of data along 3rd dimension
+    size_t d4;  ///< size of data along 4th dimension
+    std::vector<T> data;  ///< the data, as a 1D vector. Use fs::Array4D::at for easy access in 4D.
+
+    private:
+    void _check_size() const {
+      if(data.size() != this->num_values()) {
+        throw std::invalid_argument("Data size " + std::to_string(data.size()) + " does not match the 4D array dimensions, which require " + std::to_string(this->num_values()) + " values.\n");
+      }
+    }
+  };
+
+  /// @brief An MGH volume that stores its values in a single buffer of value type `T`, e.g., `float` for processing pipelines.
+  /// @details Unlike fs::Mgh, which has one data vector per MRI data type, this owns exactly one buffer. Use `fs::read_mgh_volume` to read any MGH or MGZ file into it, which converts the values to `T` while reading, and `fs::write_mgh` to write it. The `dtype` of the header always matches `T`, see `fs::mri_dtype_of`.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::MghVolume<float> vol;
+  /// fs::read_mgh_volume(&vol, "brain.mgz");  // MRI_UCHAR data, converted to float.
+  /// float val = vol.data(99, 99, 99, 0);
+  /// @endcode
+  template <typename T>
+  struct MghVolume {
+    MghHeader header;  ///< Header for this volume. The `dtype` matches `T`.
+    Array4D<T> data;  ///< The values.
+
+    /// Construct an empty volume.
+    MghVolume() : data(0, 0, 0, 0) {
+      header.dtype = mri_dtype_of<T>::value;
+    }
+
+    /// @brief Construct a volume from an fs::Mgh instance with data of type `T`, taking ownership of its data without copying it.
+    /// @throws std::domain_error if the MRI data type of `mgh` does not match `T`, use `fs::read_mgh_volume` to convert while reading instead. std::invalid_argument if the data size does not match the header.
+    explicit MghVolume(Mgh&& mgh) : header(mgh.header), data(0, 0, 0, 0) {
+      if(mgh.header.dtype != mri_dtype_of<T>::value) {
+        throw std::domain_error("MGH data type " + std::to_string(mgh.header.dtype) + " does not match the volume data type " + std::to_string(mri_dtype_of<T>::value) + ".\n");
+      }
+      data = Array4D<T>(mgh.header, std::move(mgh.data.values<T>()));
+    }
+  };
+
+  // More declarations, should also go to separate header.
+  void read_mgh_header(MghHeader*, const std::string&);
+  void read_mgh_header(MghHeader*, std::istream*);
+  void read_mgh(Mgh*, std::istream*);
+  template <typename T> std::vector<T> _read_mgh_data(MghHeader*, const std::string&);
+  template <typename T> std::vector<T> _read_mgh_data(MghHeader*, std::istream*);
+  template <typename T> void _read_mgh_data_into(const MghHeader&, std::istream*, std::vector<T>*);
+  std::unique_ptr<std::istream> _open_mgh_stream(const std::string&);
+  std::vector<int32_t> _read_mgh_data_int(MghHeader*, const std::string&);
+  std::vector<int32_t> _read_mgh_data_int(MghHeader*, std::istream*);
+  std::vector<uint8_t> _read_mgh_data_uchar(MghHeader*, const std::string&);
+  std::vector<uint8_t> _read_mgh_data_uchar(MghHeader*, std::istream*);
+  std::vector<short> _read_mgh_data_short(MghHeader*, const std::string&);
+  std::vector<short> _read_mgh_data_short(MghHeader*, std::istream*);
+  std::vector<float> _read_mgh_data_float(MghHeader*, const std::string&);
+  std::vector<float> _read_mgh_data_float(MghHeader*, std::istream*);
+
+
+  /// @brief Read a FreeSurfer volume file in MGH format into the given Mgh struct.
+  /// @param mgh An Mgh instance that should be filled with the data from the filename.
+  /// @param filename Path to the input MGH file. If the name ends with '.mgz', '.MGZ' or '.mgh.gz', the file is decompressed while reading. This requires that libfs is compiled with `LIBFS_WITH_ZLIB` defined.
+  /// @see There exists an overloaded version that reads from a stream.
+  /// @throws runtime_error if the file uses an unsupported MRI data type, or if it is an MGZ file and zlib support is not enabled.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::Mgh mgh;
+  /// fs::read_mgh(&mgh, "somebrain.mgh");
+  /// fs::read_mgh(&mgh, "somebrain.mgz");  // Requires LIBFS_WITH_ZLIB.
+  /// @endcode
+  void read_mgh(Mgh* mgh, const std::string& filename) {
+    LIBFS_INSTRUMENT_SCOPE("read_mgh");
+    std::unique_ptr<std::istream> is = _open_mgh_stream(filename);
+    read_mgh(mgh, is.get());
+  }
+
+  /// @brief Read a vector of subject identifiers from a FreeSurfer subjects file.
+  /// @param filename a text file that contains one subject identifier per line.
+  /// @throws runtime_error if the file cannot be read
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// std::vector<std::string> subjects = fs::read_subjectsfile("subjects.txt");
+  /// @endcode
+  std::vector<std::string> read_subjectsfile(const std::string& filename) {
+    std::vector<std::string> subjects;
+    std::ifstream input(filename, std::fstream::in);
+    std::string line;
+
+    if(! input.is_open()) {
+      throw std::runtime_error("Could not open subjects file '" + filename + "'.\n");
+    }
+
+    while( std::getline( input, line ) ) {
+        subjects.push_back(line);
+    }
+    return(subjects);
+  }
+
+  /// @brief Reads MGH data of the value type given to `apply` into the respective vector of an fs::MghData instance, see `fs::_dispatch_mri_dtype`.
+  /// @details The data is read into a temporary that takes over the memory of the target vector, and is only swapped into the target if reading succeeds.
+  ///
+  /// THIS STRUCT IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+  /// @throws domain_error if the stream ends before all values were read.
+  /// @private
+  struct _MghDataReader {
+    const MghHeader& header;
+    std::istream* is;
+    MghData* data;
+
+    template <typename T>
+    void apply() {
+      std::vector<T> values;
+      values.swap(data->values<T>());  // Reuse the memory of the target.
+      _read_mgh_data_into<T>(header, is, &values);
+      if(is->fail()) {
+        throw std::domain_error("MGH stream ended before all " + std::to_string(header.num_values()) + " values were read.\n");
+      }
+      data->values<T>().swap(values);
+    }
+  };
+
+  /// @brief Read MGH data from a stream.
+  /// @param mgh An Mgh instance that should be filled with the data from the stream.
+  /// @param is Pointer to an open istream from which to read the MGH data.
+  /// @see There exists an overloaded version that reads from a file.
+  /// @throws runtime_error if the file uses an unsupported MRI data type. domain_error if the stream ends before all values were read. The header of `mgh` is only changed if reading succeeds, but the data vector of the file's MRI data type is left empty on failure, as its memory is reused for reading.
+  void read_mgh(Mgh* mgh, std::istream* is) {
+    LIBFS_INSTRUMENT_SCOPE("read_mgh.stream");
+    MghHeader mgh_header;
+    read_mgh_header(&mgh_header, is);
+    // Read into a temporary that takes over the memory of the data vector of the Mgh instance, so reusing an instance does not allocate.
+    _MghDataReader reader = { mgh_header, is, &mgh->data };
+    if(! _dispatch_mri_dtype(mgh_header.dtype, reader)) {
+      throw std::runtime_error("Not reading data from MGH stream, data type " + std::to_string(mgh_header.dtype) + " not supported yet.\n");
+    }
+    mgh->header = mgh_header;
+    LIBFS_INSTRUMENT_COUNT("read_mgh.values", mgh_header.num_values());
+    LIBFS_INSTRUMENT_COUNT("read_mgh.bytes", mgh_header.num_values() * mri_dtype_size(mgh_header.dtype));
+  }
+
+  /// @brief Convert a value to the floating point type `T`. All MRI data types are exactly representable or rounded to the nearest float.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename T, typename S>
+  inline typename std::enable_if<std::is_floating_point<T>::value, T>::type _saturate_cast(const S value) {
+    return static_cast<T>(value);
+  }
+
+  /// @brief Convert a floating point value to the integer type `T`, with saturation: values are rounded toward zero, values outside the range of `T` are clamped to its limits, and NaN becomes 0.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename T, typename S>
+  inline typename std::enable_if<std::is_integral<T>::value && std::is_floating_point<S>::value, T>::type _saturate_cast(const S value) {
+    if(value != value) {  // NaN
+      return T(0);
+    }
+    if(value <= S(std::numeric_limits<T>::min())) {
+      return std::numeric_limits<T>::min();
+    }
+    if(value >= S(std::numeric_limits<T>::max())) {
+      return std::numeric_limits<T>::max();
+    }
+    return static_cast<T>(value);
+  }
+
+  /// @brief Convert an integer value to the integer type `T`, with saturation: values outside the range of `T` are clamped to its limits.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename T, typename S>
+  inline typename std::enable_if<std::is_integral<T>::value && std::is_integral<S>::value, T>::type _saturate_cast(const S value) {
+    const int64_t v = int64_t(value);  // All MRI data types fit into int64_t.
+    if(v < int64_t(std::numeric_limits<T>::min())) {
+      return std::numeric_limits<T>::min();
+    }
+    if(v > int64_t(std::numeric_limits<T>::max())) {
+      return std::numeric_limits<T>::max();
+    }
+    return static_cast<T>(value);
+  }
+
+  /// @brief Read `num_values` big endian values of type `S` from a stream and convert them to `T` while reading, see `fs::_saturate_cast` for the conversion.
+  /// @details If the types match, the values are read directly into `dest`. Otherwise they are read in small chunks into a buffer that stays in the cache, byte swapped with the SIMD endian kernels and converted in a loop that the compiler vectorizes. This avoids an intermediate copy of the whole data.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename S, typename T>
+  void _read_converted(std::istream* is, T* dest, const size_t num_values) {
+    if(std::is_same<S, T>::value) {
+      _freadt_bulk<T>(*is, dest, num_values);
+      return;
+    }
+    const size_t chunk_size = 16384;
+    std::vector<S> chunk(std::min(num_values, chunk_size));
+    for(size_t done = 0; done < num_values; done += chunk.size()) {
+      const std::ptrdiff_t n = std::ptrdiff_t(std::min(chunk.size(), num_values - done));
+      _freadt_bulk<S>(*is, chunk.data(), size_t(n));
+      const S* src = chunk.data();
+      T* out = dest + done;
+      #ifdef _OPENMP
+      #pragma omp simd
+      #endif
+      for(std::ptrdiff_t i = 0; i < n; i++) {
+        out[i] = _saturate_cast<T>(src[i]);
+      }
+    }
+  }
+
+  /// @brief Reads MGH data of the value type given to `apply` and converts it to `T`, see `fs::_dispatch_mri_dtype`.
+  ///
+  /// THIS STRUCT IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+  /// @private
+  template <typename T>
+  struct _MghConvertingReader {
+    std::istream* is;
+    T* dest;
+    size_t num_values;
+
+    template <typename S>
+    void apply() {
+      _read_converted<S, T>(is, dest, num_values);
+    }
+  };
+
+  /// @brief Read an MGH volume from a stream into a single buffer of value type `T`, converting the values while reading.
+  /// @details Conversions to a narrower type saturate: integer values outside the range of `T` are clamped to its limits, floating point values are rounded toward zero and clamped, and NaN becomes 0. The volume is only changed if reading succeeds.
+  /// @param volume the volume to fill.
+  /// @param is Pointer to an open istream from which to read the MGH data.
+  /// @see There exists an overloaded version that reads from a file.
+  /// @throws runtime_error if the file uses an unsupported MRI data type. domain_error if the stream ends before all values were read.
+  template <typename T>
+  void read_mgh_volume(MghVolume<T>* volume, std::istream* is) {
+    LIBFS_INSTRUMENT_SCOPE("read_mgh_volume");
+    MghHeader header;
+    read_mgh_header(&header, is);
+    const size_t num_values = header.num_values();
+    // Read into a local buffer, so a truncated file leaves the volume untouched.
+    std::vector<T> buffer(num_values);
+    _MghConvertingReader<T> reader = { is, buffer.data(), num_values };
+    if(! _dispatch_mri_dtype(header.dtype, reader)) {
+      throw std::runtime_error("Not reading data from MGH stream, data type " + std::to_string(header.dtype) + " not supported yet.\n");
+    }
+    if(is->fail()) {
+      throw std::domain_error("MGH stream ended before all " + std::to_string(num_values) + " values were read.\n");
+    }
+    LIBFS_INSTRUMENT_COUNT("read_mgh_volume.values", num_values);
+    LIBFS_INSTRUMENT_COUNT("read_mgh_volume.bytes", num_values * mri_dtype_size(header.dtype));
+    volume->data.data.swap(buffer);
+    volume->data.d1 = size_t(header.dim1length);
+    volume->data.d2 = size_t(header.dim2length);
+    volume->data.d3 = size_t(header.dim3length);
+    volume->data.d4 = size_t(header.dim4length);
+    header.dtype = mri_dtype_of<T>::value;
+    volume->header = header;
+  }
+
+  /// @brief Read a FreeSurfer volume file in MGH format into a single buffer of value type `T`, converting the values while reading.
+  /// @details This is the fastest way to get the data of volumes that are not stored as `T` into a pipeline working with `T`, e.g., to read MRI_UCHAR brain volumes as `float`: there is no intermediate copy of the data in the stored type, as with `fs::read_mgh` followed by a conversion.
+  /// @param volume the volume to fill. Conversions to a narrower type saturate, see the overload that reads from a stream.
+  /// @param filename Path to the input MGH file. If the name ends with '.mgz', '.MGZ' or '.mgh.gz', the file is decompressed while reading. This requires that libfs is compiled with `LIBFS_WITH_ZLIB` defined.
+  /// @see There exists an overloaded version that reads from a stream.
+  /// @throws runtime_error if the file cannot be opened, uses an unsupported MRI data type, or if it is an MGZ file and zlib support is not enabled. domain_error if the file is truncated.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::MghVolume<float> vol;
+  /// fs::read_mgh_volume(&vol, "brain.mgz");
+  /// @endcode
+  template <typename T>
+  void read_mgh_volume(MghVolume<T>* volume, const std::string& filename) {
+    std::unique_ptr<std::istream> is = _open_mgh_stream(filename);
+    read_mgh_volume(volume, is.get());
+  }
+
+  /// @brief Read up to `capacity` bytes from the beginning of a file with a single read call, without constructing a file stream. Used by the header probes.
+  /// @param num_read set to the number of bytes read, which is smaller than `capacity` if the file is shorter.
+  /// @return false if the file cannot be opened.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  inline bool _read_file_prefix(const std::string& filename, char* buffer, const size_t capacity, size_t* num_read) {
+    FILE* f = std::fopen(filename.c_str(), "rb");
+    if(f == nullptr) {
+      return false;
+    }
+    *num_read = std::fread(buffer, 1, capacity, f);
+    std::fclose(f);
+    return true;
+  }
+
+  /// @brief Read an MGH header from a stream.
+  /// @param mgh_header An MghHeader instance that should be filled with the data from the stream.
+  /// @param is Pointer to an open istream from which to read the MGH data.
+  /// @see There exists an overloaded version that reads from a file.
+  /// @throws runtime_error if the file uses an unsupported MRI file format version. Only version 1 is supported (the only existing version to my knowledge). std::domain_error if a dimension length is negative.
+  void read_mgh_header(MghHeader* mgh_header, std::istream* is) {
+    const int MGH_VERSION = 1;
+
+    int format_version = _freadt<int32_t>(*is);
+    if(format_version != MGH_VERSION) {
+      throw std::runtime_error("Invalid MGH file or unsupported file format version: expected version " + std::to_string(MGH_VERSION) + ", found " + std::to_string(format_version) + ".\n");
+    }
+    mgh_header->dim1length =  _freadt<int32_t>(*is);
+    mgh_header->dim2length =  _freadt<int32_t>(*is);
+    mgh_header->dim3length =  _freadt<int32_t>(*is);
+    mgh_header->dim4length =  _freadt<int32_t>(*is);
+    if(mgh_header->dim1length < 0 || mgh_header->dim2length < 0 || mgh_header->dim3length < 0 || mgh_header->dim4length < 0) {
+      throw std::domain_error("Invalid MGH header: negative dimension length (" + std::to_string(mgh_header->dim1length) + ", " + std::to_string(mgh_header->dim2length) + ", " + std::to_string(mgh_header->dim3length) + ", " + std::to_string(mgh_header->dim4length) + ").\n");
+    }
+
+    mgh_header->dtype =  _freadt<int32_t>(*is);
+    mgh_header->dof =  _freadt<int32_t>(*is);
+
+    int unused_header_space_size_left = 256;  // in bytes
+    mgh_header->ras_good_flag =  _freadt<int16_t>(*is);
+    unused_header_space_size_left -= 2; // for the ras_good_flag
+
+    // Read the RAS part of the header.
+    if(mgh_header->ras_good_flag == 1) {
+      mgh_header->xsize =  _freadt<float>(*is);
+      mgh_header->ysize =  _freadt<float>(*is);
+      mgh_header->zsize =  _freadt<float>(*is);
+
+      for(int i=0; i<9; i++) {
+        mgh_header->Mdc.push_back( _freadt<float>(*is));
+      }
+      for(int i=0; i<3; i++) {
+        mgh_header->Pxyz_c.push_back( _freadt<float>(*is));
+      }
+      unused_header_space_size_left -= 60;
+    }
+
+    // Advance to data part. We do not seek here because that is not
+    // possible if the stream is gzip-wrapped, as in the read_mgz example.
+    is->ignore(unused_header_space_size_left);
+  }
+
+  /// @brief Read MRI_INT data from MGH file
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  std::vector<int32_t> _read_mgh_data_int(MghHeader* mgh_header, const std::string& filename) {
+    if(mgh_header->dtype != MRI_INT) {
+      std::cerr << "Expected MRI data type " << MRI_INT << ", but found " << mgh_header->dtype << ".\n";
+    }
+    return(_read_mgh_data<int32_t>(mgh_header, filename));
+  }
+
+  /// @brief Read MRI_INT data from a stream.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  std::vector<int32_t> _read_mgh_data_int(MghHeader* mgh_header, std::istream* is) {
+    if(mgh_header->dtype != MRI_INT) {
+      std::cerr << "Expected MRI data type " << MRI_INT << ", but found " << mgh_header->dtype << ".\n";
+    }
+    return(_read_mgh_data<int32_t>(mgh_header, is));
+  }
+
+  /// @brief Read MRI_SHORT data from MGH file
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  std::vector<short> _read_mgh_data_short(MghHeader* mgh_header, const std::string& filename) {
+    if(mgh_header->dtype != MRI_SHORT) {
+      std::cerr << "Expected MRI data type " << MRI_SHORT << ", but found " << mgh_header->dtype << ".\n";
+    }
+    return(_read_mgh_data<short>(mgh_header, filename));
+  }
+
+  /// @brief Read MRI_SHORT data from a stream.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  std::vector<short> _read_mgh_data_short(MghHeader* mgh_header, std::istream* is) {
+    if(mgh_header->dtype != MRI_SHORT) {
+      std::cerr << "Expected MRI data type " << MRI_SHORT << ", but found " << mgh_header->dtype << ".\n";
+    }
+    return(_read_mgh_data<short>(mgh_header, is));
+  }
+
+
+  /// @brief Read the header of a FreeSurfer volume file in MGH format into the given MghHeader struct.
+  ///
+  /// @param mgh_header An MghHeader instance that should be filled with the data from the file.
+  /// @param filename Path to the file from which to read the MGH data.
+  /// @details For uncompressed files, the fixed-size header is read with a single read call, without decoding or even touching the voxel data. This makes it suitable for indexing many files, see also `fs::probe_files`.
+  /// @see There exists an overloaded version that reads from a stream.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the file is too short to contain an MGH header.
+  void read_mgh_header(MghHeader* mgh_header, const std::string& filename) {
+    if(fs::util::is_mgz_filename(filename)) {
+      #ifdef LIBFS_WITH_ZLIB
+      fs::util::GzIfstream is(filename);
+      read_mgh_header(mgh_header, &is);
+      return;
+      #else
+      throw std::runtime_error("Cannot read MGZ file '" + filename + "': libfs was compiled without zlib support, define LIBFS_WITH_ZLIB to enable it.\n");
+      #endif
+    }
+    char buffer[284];  // The MGH header has a fixed size, the data starts at byte 284.
+    size_t num_read = 0;
+    if(! _read_file_prefix(filename, buffer, sizeof(buffer), &num_read)) {
+      throw std::runtime_error("Unable to open MGH file '" + filename + "'.\n");
+    }
+    fs::util::MemInBuf buf(buffer, num_read);
+    std::istream is(&buf);
+    read_mgh_header(mgh_header, &is);
+    if(is.fail()) {
+      throw std::domain_error("MGH file '" + filename + "' is too short to contain an MGH header.\n");
+    }
+  }
+
+
+  /// @brief Read arbitrary MGH data from a file.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @throws runtime_error if the file cannot be opened
+  /// @private
+  template <typename T>
+  std::vector<T> _read_mgh_data(MghHeader* mgh_header, const std::string& filename) {
+    std::ifstream ifs;
+    ifs.open(filename, std::ios_base::in | std::ios::binary);
+    if(ifs.is_open()) {
+      ifs.seekg(284, ifs.beg); // skip to end of header and beginning of data
+
+      std::vector<T> data(mgh_header->num_values());
+      _freadt_bulk<T>(ifs, data.data(), data.size());
+      ifs.close();
+      return(data);
+    } else {
+      throw std::runtime_error("Unable to open MGH file '" + filename + "'.\n");
+    }
+  }
+
+
+  /// @brief Read arbitrary MGH data from a stream. The stream must be open and at the beginning of the MGH data.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename T>
+  std::vector<T> _read_mgh_data(MghHeader* mgh_header, std::istream* is) {
+    std::vector<T> data;
+    _read_mgh_data_into<T>(*mgh_header, is, &data);
+    return(data);
+  }
+
+  /// @brief Read arbitrary MGH data from a stream into the given vector, reusing its memory. The stream must be open and at the beginning of the MGH data.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename T>
+  void _read_mgh_data_into(const MghHeader& mgh_header, std::istream* is, std::vector<T>* data) {
+    data->resize(mgh_header.num_values());
+    _freadt_bulk<T>(*is, data->data(), data->size());
+  }
+
+  /// @brief Open an MGH or MGZ file for reading, based on the file name, see `fs::util::is_mgz_filename`.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @throws runtime_error if the file cannot be opened, or it is an MGZ file and libfs was compiled without zlib support.
+  /// @private
+  std::unique_ptr<std::istream> _open_mgh_stream(const std::string& filename) {
+    if(fs::util::is_mgz_filename(filename)) {
+      #ifdef LIBFS_WITH_ZLIB
+      return std::unique_ptr<std::istream>(new fs::util::GzIfstream(filename));
+      #else
+      throw std::runtime_error("Cannot read MGZ file '" + filename + "': libfs was compiled without zlib support, define LIBFS_WITH_ZLIB to enable it.\n");
+      #endif
+    }
+    std::unique_ptr<std::ifstream> ifs(new std::ifstream(filename, std::ios_base::in | std::ios::binary));
+    if(! ifs->is_open()) {
+      throw std::runtime_error("Unable to open MGH file '" + filename + "'.\n");
+    }
+    return std::unique_ptr<std::istream>(std::move(ifs));
+  }
+
+
+  /// @brief Read MRI_FLOAT data from MGH file
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  std::vector<float> _read_mgh_data_float(MghHeader* mgh_header, const std::string& filename) {
+    if(mgh_header->dtype != MRI_FLOAT) {
+      std::cerr << "Expected MRI data type " << MRI_FLOAT << ", but found " << mgh_header->dtype << ".\n";
+    }
+    return(_read_mgh_data<float>(mgh_header, filename));
+  }
+
+  /// @brief Read MRI_FLOAT data from an MGH stream
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  std::vector<float> _read_mgh_data_float(MghHeader* mgh_header, std::istream* is) {
+    if(mgh_header->dtype != MRI_FLOAT) {
+      std::cerr << "Expected MRI data type " << MRI_FLOAT << ", but found " << mgh_header->dtype << ".\n";
+    }
+    return(_read_mgh_data<float>(mgh_header, is));
+  }
+
+  /// @brief Read MRI_UCHAR data from MGH file
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  std::vector<uint8_t> _read_mgh_data_uchar(MghHeader* mgh_header, const std::string& filename) {
+    if(mgh_header->dtype != MRI_UCHAR) {
+      std::cerr << "Expected MRI data type " << MRI_UCHAR << ", but found " << mgh_header->dtype << ".\n";
+    }
+    return(_read_mgh_data<uint8_t>(mgh_header, filename));
+  }
+
+  /// @brief Read MRI_UCHAR data from an MGH stream
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  std::vector<uint8_t> _read_mgh_data_uchar(MghHeader* mgh_header, std::istream* is) {
+    if(mgh_header->dtype != MRI_UCHAR) {
+      std::cerr << "Expected MRI data type " << MRI_UCHAR << ", but found " << mgh_header->dtype << ".\n";
+    }
+    return(_read_mgh_data<uint8_t>(mgh_header, is));
+  }
+
+  /// @brief The header of a FreeSurfer binary surf file, see `fs::read_surf_header`.
+  struct SurfHeader {
+    int32_t num_vertices = 0;  ///< The number of vertices of the mesh.
+    int32_t num_faces = 0;  ///< The number of triangular faces of the mesh.
+    std::string created_line;  ///< The first text line of the file, typically something like `created by <user> on <date>`.
+  };
+
+  /// @brief Read the header of a surf file from a stream. Leaves the stream at the beginning of the vertex coordinates.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @throws domain_error if the surf file magic mismatches, the header is truncated or claims a negative number of vertices or faces.
+  /// @private
+  void _read_surf_header(SurfHeader* header, std::istream* is, const std::string& source_filename) {
+    const std::string msg_source_file_part = source_filename.empty() ? "" : "'" + source_filename + "' ";
+    const int SURF_TRIS_MAGIC = 16777214;
+    int magic = _fread3(*is);
+    if(magic != SURF_TRIS_MAGIC) {
+      throw std::domain_error("Surf file " + msg_source_file_part + "magic code in header did not match: expected " + std::to_string(SURF_TRIS_MAGIC) + ", found " + std::to_string(magic) + ".\n");
+    }
+    header->created_line = _freadstringnewline(*is);
+    std::string comment_line = _freadstringnewline(*is);
+    header->num_vertices =  _freadt<int32_t>(*is);
+    header->num_faces =  _freadt<int32_t>(*is);
+    #ifdef LIBFS_DBG_INFO
+    std::cout << LIBFS_APPTAG << "Read surface file with " << header->num_vertices << " vertices, " << header->num_faces << " faces.\n";
+    #endif
+    if(is->fail()) {
+      throw std::domain_error("Surf file " + msg_source_file_part + "is too short to contain a surf header.\n");
+    }
+    if(header->num_vertices < 0 || header->num_faces < 0) {
+      throw std::domain_error("Surf file " + msg_source_file_part + "header claims a negative number of vertices or faces.\n");
+    }
+  }
+
+  /// @brief Read a brain mesh from a stream in binary FreeSurfer 'surf' format into the given Mesh instance.
+  ///
+  /// @param surface a Mesh instance representing a vertex-indexed tri-mesh. This will be filled.
+  /// @param is An open istream from which to read the surf data.
+  /// @param source_filename optional, used in error messages only. The source file name, if any.
+  /// @see There exists an overloaded version that reads from a file.
+  /// @throws domain_error if the surf file magic mismatches, the header claims a negative number of vertices or faces, or the stream ends before all vertices and faces were read. The mesh is only filled if reading succeeds, but its vertices and faces are left empty on failure, as their memory is reused for reading.
+  void read_surf(Mesh* surface, std::istream* is, const std::string& source_filename="") {
+    LIBFS_INSTRUMENT_SCOPE("read_surf");
+    SurfHeader header;
+    _read_surf_header(&header, is, source_filename);
+    const int32_t num_verts = header.num_vertices;
+    const int32_t num_faces = header.num_faces;
+    // Read into temporaries that take over the memory of the mesh buffers, so reusing a mesh does not allocate.
+    std::vector<float> vertices;
+    std::vector<int32_t> faces;
+    vertices.swap(surface->vertices);
+    faces.swap(surface->faces);
+    vertices.resize(size_t(num_verts) * 3);
+    _freadt_bulk<float>(*is, vertices.data(), vertices.size());
+    faces.resize(size_t(num_faces) * 3);
+    _freadt_bulk<int32_t>(*is, faces.data(), faces.size());
+    if(is->fail()) {
+      const std::string msg_source_file_part = source_filename.empty() ? "" : "'" + source_filename + "' ";
+      throw std::domain_error("Surf file " + msg_source_file_part + "ended before all " + std::to_string(num_verts) + " vertices and " + std::to_string(num_faces) + " faces were read.\n");
+    }
+    surface->vertices.swap(vertices);
+    surface->faces.swap(faces);
+    surface->invalidate_cache();
+    LIBFS_INSTRUMENT_COUNT("read_surf.vertices", num_verts);
+    LIBFS_INSTRUMENT_COUNT("read_surf.bytes", (surface->vertices.size() + surface->faces.size()) * 4);
+  }
+
+  /// @brief Read a brain mesh from a file in binary FreeSurfer 'surf' format into the given Mesh instance.
+  ///
+  /// @param surface a Mesh instance representing a vertex-indexed tri-mesh. This will be filled.
+  /// @param filename The path to the file from which to read the mesh. Must be in binary FreeSurfer surf format. An example file is `surf/lh.white`.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the surf file magic mismatches.
+  /// @see fs::read_mesh, a generalized version that supports other mesh file formats as well.
+  /// @see There exists an overloaded version that reads from a stream.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::Mesh surface;
+  /// fs::read_surf(&surface, "lh.white");
+  /// @endcode
+  void read_surf(Mesh* surface, const std::string& filename) {
+    std::ifstream is;
+    is.open(filename, std::ios_base::in | std::ios::binary);
+    if(is.is_open()) {
+      read_surf(surface, &is, filename);
+      is.close();
+    } else {
+      throw std::runtime_error("Unable to open surface file '" + filename + "'.\n");
+    }
+  }
+
+  /// @brief Parse a surf header from the first bytes of a file, see `fs::read_surf_header`. Falls back to reading the file with a stream if the buffer is full but does not contain the complete header.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  void _read_surf_header_prefix(SurfHeader* header, const char* buffer, const size_t num_read, const size_t capacity, const std::string& filename) {
+    // The header is complete if the buffer contains the magic, both text lines and the two counts.
+    const char* end = buffer + num_read;
+    const char* eol = num_read > 3 ? static_cast<const char*>(std::memchr(buffer + 3, '\n', num_read - 3)) : nullptr;
+    if(eol != nullptr) {
+      eol = static_cast<const char*>(std::memchr(eol + 1, '\n', size_t(end - eol - 1)));
+    }
+    if((eol == nullptr || end - eol - 1 < 8) && num_read == capacity) {  // Unusually long text lines, fall back to a file stream.
+      std::ifstream ifs(filename, std::ios_base::in | std::ios::binary);
+      if(! ifs.is_open()) {
+        throw std::runtime_error("Unable to open surface file '" + filename + "'.\n");
+      }
+      _read_surf_header(header, &ifs, filename);
+      return;
+    }
+    fs::util::MemInBuf buf(buffer, num_read);
+    std::istream is(&buf);
+    _read_surf_header(header, &is, filename);
+  }
+
+  /// @brief Read only the header of a FreeSurfer binary surf file, without reading the mesh.
+  /// @details The header is read with a single small read call into a stack buffer. This is a lot faster than `fs::read_surf` if only the vertex and face counts are needed, e.g., when indexing many files, see also `fs::probe_files`.
+  /// @param header the SurfHeader instance to fill.
+  /// @param filename The path to the file in binary FreeSurfer surf format, e.g., `surf/lh.white`.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the surf file magic mismatches, the header is truncated or claims a negative number of vertices or faces.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::SurfHeader header;
+  /// fs::read_surf_header(&header, "lh.white");
+  /// std::cout << header.num_vertices << " vertices.\n";
+  /// @endcode
+  void read_surf_header(SurfHeader* header, const std::string& filename) {
+    char buffer[1024];  // The text lines are typically less than 100 bytes.
+    size_t num_read = 0;
+    if(! _read_file_prefix(filename, buffer, sizeof(buffer), &num_read)) {
+      throw std::runtime_error("Unable to open surface file '" + filename + "'.\n");
+    }
+    _read_surf_header_prefix(header, buffer, num_read, sizeof(buffer), filename);
+  }
+
+
+  /// Cache entry value type: 32 bit float.
+  const uint32_t CACHE_FLOAT32 = 1;
+
+  /// Cache entry value type: 32 bit signed integer.
+  const uint32_t CACHE_INT32 = 2;
+
+  /// Cache entry value type: 32 bit unsigned integer.
+  const uint32_t CACHE_UINT32 = 3;
+
+  /// Cache entry value type: 8 bit character, used for strings.
+  const uint32_t CACHE_CHAR = 4;
+
+  /// @brief Get the size and modification time of a file, used to check whether cache entries are up to date.
+  /// @details The modification time has nanosecond resolution under Linux and macOS and 100 ns resolution under Windows. On other systems, only whole seconds are available, so a change to a source file within the same second as the cache entry was written, and without changing its size, is not detected.
+  /// @return whether the file exists and could be queried.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  inline bool _file_stamp(const std::string& filename, uint64_t* size, int64_t* mtime_ns) {
+    #if (defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+    WIN32_FILE_ATTRIBUTE_DATA attr;
+    if(! ::GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &attr)) {
+      return false;
+    }
+    *size = (uint64_t(attr.nFileSizeHigh) << 32) | uint64_t(attr.nFileSizeLow);
+    *mtime_ns = int64_t((uint64_t(attr.ftLastWriteTime.dwHighDateTime) << 32) | uint64_t(attr.ftLastWriteTime.dwLowDateTime)) * 100;
+    #else
+    struct stat st;
+    if(::stat(filename.c_str(), &st) != 0) {
+      return false;
+    }
+    *size = uint64_t(st.st_size);
+    #if defined(__linux__)
+    *mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + int64_t(st.st_mtim.tv_nsec);
+    #elif defined(__APPLE__)
+    *mtime_ns = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + int64_t(st.st_mtimespec.tv_nsec);
+    #else
+    *mtime_ns = int64_t(st.st_mtime) * 1000000000;
+    #endif
+    #endif
+    return true;
+  }
+
+  /// @brief An exclusive advisory lock on a lock file, held from construction to destruction. Serializes updates of a cache file between threads and processes.
+  /// @details The lock file is created if needed and never removed, removing it would allow two processes to lock different files.
+  ///
+  /// THIS CLASS IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+  /// @private
+  class _FileLock {
+    public:
+    /// @throws std::runtime_error if the lock file cannot be created or locked.
+    explicit _FileLock(const std::string& lock_filename) : _thread_lock(_mutex()) {
+      #if (defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+      _handle = ::CreateFileA(lock_filename.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+      if(_handle == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Unable to open lock file '" + lock_filename + "'.\n");
+      }
+      OVERLAPPED ov = {};
+      if(! ::LockFileEx(_handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &ov)) {
+        ::CloseHandle(_handle);
+        throw std::runtime_error("Unable to lock file '" + lock_filename + "'.\n");
+      }
+      #else
+      _fd = ::open(lock_filename.c_str(), O_RDWR | O_CREAT, 0644);
+      if(_fd < 0) {
+        throw std::runtime_error("Unable to open lock file '" + lock_filename + "'.\n");
+      }
+      struct flock fl = {};
+      fl.l_type = F_WRLCK;
+      fl.l_whence = SEEK_SET;
+      int res;
+      do {
+        res = ::fcntl(_fd, F_SETLKW, &fl);
+      } while(res != 0 && errno == EINTR);
+      if(res != 0) {
+        ::close(_fd);
+        throw std::runtime_error("Unable to lock file '" + lock_filename + "'.\n");
+      }
+      #endif
+    }
+
+    _FileLock(const _FileLock&) = delete;
+    _FileLock& operator=(const _FileLock&) = delete;
+
+    ~_FileLock() {
+      #if (defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+      OVERLAPPED ov = {};
+      ::UnlockFileEx(_handle, 0, 1, 0, &ov);
+      ::CloseHandle(_handle);
+      #else
+      ::close(_fd);  // Releases the lock.
+      #endif
+    }
+
+    private:
+    /// File locks are per process, so the threads of a process are serialized with a mutex.
+    static std::mutex& _mutex() {
+      static std::mutex m;
+      return m;
+    }
+
+    std::lock_guard<std::mutex> _thread_lock;
+    #if (defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+    HANDLE _handle;
+    #else
+    int _fd;
+    #endif
+  };
+
+  /// @brief Store an integer in little endian byte order.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename T>
+  void _encode_le(unsigned char* dst, T t) {
+    for(size_t i = 0; i < sizeof(T); i++) {
+      dst[i] = static_cast<unsigned char>((uint64_t(t) >> (8 * i)) & 255);
+    }
+  }
+
+  /// @brief Load an integer stored in little endian byte order.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename T>
+  T _decode_le(const unsigned char* src) {
+    uint64_t v = 0;
+    for(size_t i = 0; i < sizeof(T); i++) {
+      v |= uint64_t(src[i]) << (8 * i);
+    }
+    return static_cast<T>(v);
+  }
+
+  /// The layout of the libfs cache file format, see `fs::CacheWriter`.
+  /// @private
+  struct _CacheLayout {
+    static const size_t HEADER_SIZE = 64;  ///< magic, version, entry count, directory offset, file size.
+    static const size_t ENTRY_SIZE = 128;  ///< name, type, data offset, value count, source size and mtime.
+    static const size_t NAME_SIZE = 64;  ///< Maximal entry name length plus terminating zero.
+    static const size_t ALIGNMENT = 64;  ///< All data blocks start at multiples of this.
+    static const uint32_t VERSION = 1;
+
+    static const char* magic() { return "LIBFSCCH"; }
+
+    static size_t type_size(uint32_t type) {
+      return type == CACHE_CHAR ? 1 : (type >= CACHE_FLOAT32 && type <= CACHE_UINT32 ? 4 : 0);
+    }
+
+    static size_t align(size_t n) {
+      return (n + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+  };
+
+  /// @brief Map the C++ type of cached values to the cache type codes.
+  /// @private
+  template <typename T> struct _CacheType;
+  /// @private
+  template <> struct _CacheType<float> { static const uint32_t code = CACHE_FLOAT32; };
+  /// @private
+  template <> struct _CacheType<int32_t> { static const uint32_t code = CACHE_INT32; };
+  /// @private
+  template <> struct _CacheType<uint32_t> { static const uint32_t code = CACHE_UINT32; };
+  /// @private
+  template <> struct _CacheType<char> { static const uint32_t code = CACHE_CHAR; };
+
+  /// @brief Collects named arrays, meshes, per-vertex overlays and annotations, and writes them to a libfs cache file.
+  /// @details The cache file format is little endian and versioned. A 64 byte header is followed by a directory with one 128 byte record per entry (name, value type, offset, count, and size and modification time of the source file), and the data blocks, each aligned to 64 bytes. Read such files with `fs::CacheFile`, which memory maps them, so reading a cached mesh needs no parsing.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::Mesh surface;
+  /// fs::read_surf(&surface, "subject1/surf/lh.white");
+  /// fs::CacheWriter cw;
+  /// cw.add_mesh("surf/lh.white", surface, "subject1/surf/lh.white");
+  /// cw.add_overlay("surf/lh.thickness", fs::read_desc_data("subject1/surf/lh.thickness"), "subject1/surf/lh.thickness");
+  /// cw.write("subject1.fscache");
+  /// @endcode
+  class CacheWriter {
+    public:
+
+    /// @brief Add a named array. An existing entry with the same name is replaced.
+    /// @param name the entry name, at most 63 characters.
+    /// @param data pointer to the values.
+    /// @param count the number of values.
+    /// @param source_filename optional file the data was computed from. Its size and modification time are recorded, see `fs::CacheFile::is_fresh`.
+    /// @throws std::invalid_argument if the name is too long or empty.
+    template <typename T>
+    void add(const std::string& name, const T* data, size_t count, const std::string& source_filename = "") {
+      _Entry e;
+      e.name = name;
+      e.type = _CacheType<T>::code;
+      e.count = count;
+      e.source_size = 0;
+      e.source_mtime = 0;
+      if(! source_filename.empty()) {
+        _file_stamp(source_filename, &e.source_size, &e.source_mtime);
+      }
+      e.bytes.resize(count * sizeof(T));
+      if(count > 0) {
+        std::memcpy(&e.bytes[0], data, count * sizeof(T));
+      }
+      if(sizeof(T) > 1 && LIBFS_HOST_BIG_ENDIAN != 0) {
+        T* values = reinterpret_cast<T*>(&e.bytes[0]);
+        for(size_t i = 0; i < count; i++) {
+          values[i] = _swap_endian<T>(values[i]);
+        }
+      }
+      this->_add_entry(std::move(e));
+    }
+
+    /// Add a named array from a vector, see the pointer version.
+    template <typename T>
+    void add(const std::string& name, const std::vector<T>& data, const std::string& source_filename = "") {
+      this->add(name, data.data(), data.size(), source_filename);
+    }
+
+    /// @brief Add a mesh, stored as the entries `<key>:vertices` and `<key>:faces`, and optionally its CSR adjacency as `<key>:adj_offsets` and `<key>:adj_neighbors`.
+    void add_mesh(const std::string& key, const Mesh& mesh, const std::string& source_filename = "", bool with_adjacency = true) {
+      this->add(key + ":vertices", mesh.vertices, source_filename);
+      this->add(key + ":faces", mesh.faces, source_filename);
+      if(with_adjacency) {
+        const AdjacencyCSR& adj = mesh.cached_adjcsr();
+        this->add(key + ":adj_offsets", adj.offsets, source_filename);
+        this->add(key + ":adj_neighbors", adj.neighbors, source_filename);
+      }
+    }
+
+    /// Add per-vertex data, stored as the entry `<key>:overlay`.
+    void add_overlay(const std::string& key, const std::vector<float>& data, const std::string& source_filename = "") {
+      this->add(key + ":overlay", data, source_filename);
+    }
+
+    /// Add a smoothing operator, stored as entries `<key>:smooth_*`, see `fs::Mesh::gaussian_smoothing_operator`.
+    void add_smoothing_operator(const std::string& key, const SmoothingOperator& op, const std::string& source_filename = "") {
+      this->add(key + ":smooth_offsets", op.offsets, source_filename);
+      this->add(key + ":smooth_columns", op.columns, source_filename);
+      this->add(key + ":smooth_weights", op.weights, source_filename);
+      this->add(key + ":smooth_fwhm", &op.fwhm, 1, source_filename);
+    }
+
+    /// Add an annotation, stored as entries `<key>:annot_*`. Region names are stored zero-separated.
+    void add_annot(const std::string& key, const Annot& annot, const std::string& source_filename = "") {
+      const Colortable& ct = annot.colortable;
+      std::string names;
+      for(size_t i = 0; i < ct.name.size(); i++) {
+        names += ct.name[i];
+        names.push_back('\0');
+      }
+      this->add(key + ":annot_vertex_labels", annot.vertex_labels, source_filename);
+      this->add(key + ":annot_ct_id", ct.id, source_filename);
+      this->add(key + ":annot_ct_r", ct.r, source_filename);
+      this->add(key + ":annot_ct_g", ct.g, source_filename);
+      this->add(key + ":annot_ct_b", ct.b, source_filename);
+      this->add(key + ":annot_ct_a", ct.a, source_filename);
+      this->add(key + ":annot_ct_label", ct.label, source_filename);
+      this->add(key + ":annot_ct_names", names.data(), names.size(), source_filename);
+    }
+
+    /// Return the number of entries.
+    size_t num_entries() const {
+      return entries.size();
+    }
+
+    /// @brief Write the cache file. The file is first written under a temporary name and then renamed, so readers never see a partial file.
+    /// @throws std::runtime_error if the file cannot be written.
+    void write(const std::string& filename) const {
+      const size_t dir_end = _CacheLayout::HEADER_SIZE + entries.size() * _CacheLayout::ENTRY_SIZE;
+      std::vector<uint64_t> offsets(entries.size());
+      size_t pos = _CacheLayout::align(dir_end);
+      for(size_t i = 0; i < entries.size(); i++) {
+        offsets[i] = pos;
+        pos = _CacheLayout::align(pos + entries[i].bytes.size());
+      }
+      const size_t file_size = pos;
+
+      std::vector<unsigned char> head(_CacheLayout::align(dir_end), 0);
+      std::memcpy(&head[0], _CacheLayout::magic(), 8);
+      _encode_le<uint32_t>(&head[8], _CacheLayout::VERSION);
+      _encode_le<uint32_t>(&head[12], uint32_t(entries.size()));
+      _encode_le<uint64_t>(&head[16], uint64_t(_CacheLayout::HEADER_SIZE));
+      _encode_le<uint64_t>(&head[24], uint64_t(file_size));
+      for(size_t i = 0; i < entries.size(); i++) {
+        unsigned char* rec = &head[_CacheLayout::HEADER_SIZE + i * _CacheLayout::ENTRY_SIZE];
+        std::memcpy(rec, entries[i].name.data(), entries[i].name.size());
+        _encode_le<uint32_t>(rec + 64, entries[i].type);
+        _encode_le<uint64_t>(rec + 72, offsets[i]);
+        _encode_le<uint64_t>(rec + 80, uint64_t(entries[i].count));
+        _encode_le<uint64_t>(rec + 88, entries[i].source_size);
+        _encode_le<int64_t>(rec + 96, entries[i].source_mtime);
+      }
+
+      const std::string tmp_filename = filename + ".tmp" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count());
+      {
+        std::ofstream ofs(tmp_filename, std::ofstream::out | std::ofstream::binary);
+        if(! ofs.is_open()) {
+          throw std::runtime_error("Unable to open cache file '" + tmp_filename + "' for writing.\n");
+        }
+        ofs.write(reinterpret_cast<const char*>(head.data()), std::streamsize(head.size()));
+        const char padding[_CacheLayout::ALIGNMENT] = {};
+        for(size_t i = 0; i < entries.size(); i++) {
+          const std::vector<char>& b = entries[i].bytes;
+          ofs.write(b.data(), std::streamsize(b.size()));
+          ofs.write(padding, std::streamsize(_CacheLayout::align(b.size()) - b.size()));
+        }
+        ofs.close();
+        if(! ofs) {
+          std::remove(tmp_filename.c_str());
+          throw std::runtime_error("Failed to write cache file '" + tmp_filename + "'.\n");
+        }
+      }
+      #if (defined(WIN32) || defined(_WIN32) || defined(__WIN32__))
+      std::remove(filename.c_str());  // std::rename does not replace existing files under Windows.
+      #endif
+      if(std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmp_filename.c_str());
+        throw std::runtime_error("Unable to rename temporary cache file to '" + filename + "'.\n");
+      }
+    }
+
+    /// One entry, with the values already in little endian byte order.
+    /// @private
+    struct _Entry {
+      std::string name;
+      uint32_t type;
+      size_t count;
+      uint64_t source_size;
+      int64_t source_mtime;
+      std::vector<char> bytes;
+    };
+
+    std::vector<_Entry> entries;  ///< The entries, in the order in which they will be written.
+
+    /// @private
+    void _add_entry(_Entry&& e) {
+      if(e.name.empty() || e.name.size() >= _CacheLayout::NAME_SIZE) {
+        throw std::invalid_argument("Cache entry name '" + e.name + "' must have between 1 and " + std::to_string(_CacheLayout::NAME_SIZE - 1) + " characters.\n");
+      }
+      for(size_t i = 0; i < entries.size(); i++) {
+        if(entries[i].name == e.name) {
+          entries[i] = std::move(e);
+          return;
+        }
+      }
+      entries.push_back(std::move(e));
+    }
+  };
+
+  /// @brief A read-only, memory mapped libfs cache file, see `fs::CacheWriter` for the format.
+  /// @details Opening the file maps it and reads the directory, the data is only touched when it is accessed. On little endian hosts, `fs::CacheFile::view` gives direct pointers into the mapping.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::CacheFile cf("subject1.fscache");
+  /// fs::Mesh surface;
+  /// fs::AdjacencyCSR adj;
+  /// if(cf.get_mesh("surf/lh.white", &surface, &adj)) {
+  ///   std::vector<float> smoothed = fs::Mesh::smooth_pvd_nn(adj, surface.vertices, 1);  // No adjacency to rebuild.
+  /// }
+  /// @endcode
+  class CacheFile {
+    public:
+
+    /// @brief Map a cache file and validate its header and directory.
+    /// @throws std::runtime_error if the file cannot be opened, std::domain_error if it is not a valid cache file of a supported version.
+    explicit CacheFile(const std::string& filename) : _mf(filename) {
+      const unsigned char* d = _mf.data();
+      const size_t n = _mf.size();
+      if(n < _CacheLayout::HEADER_SIZE || std::memcmp(d, _CacheLayout::magic(), 8) != 0) {
+        throw std::domain_error("File '" + filename + "' is not a libfs cache file.\n");
+      }
+      const uint32_t version = _decode_le<uint32_t>(d + 8);
+      if(version != _CacheLayout::VERSION) {
+        throw std::domain_error("Cache file '" + filename + "' has unsupported version " + std::to_string(version) + ".\n");
+      }
+      const uint64_t num_entries = _decode_le<uint32_t>(d + 12);
+      const uint64_t dir_offset = _decode_le<uint64_t>(d + 16);
+      if(_decode_le<uint64_t>(d + 24) != uint64_t(n) || dir_offset < _CacheLayout::HEADER_SIZE || dir_offset > n || num_entries > (n - dir_offset) / _CacheLayout::ENTRY_SIZE) {
+        throw std::domain_error("Cache file '" + filename + "' is truncated or corrupt.\n");
+      }
+      _entries.resize(size_t(num_entries));
+      for(size_t i = 0; i < _entries.size(); i++) {
+        const unsigned char* rec = d + dir_offset + i * _CacheLayout::ENTRY_SIZE;
+        Entry& e = _entries[i];
+        const char* name = reinterpret_cast<const char*>(rec);
+        e.name = std::string(name, std::find(name, name + _CacheLayout::NAME_SIZE - 1, '\0'));
+        e.type = _decode_le<uint32_t>(rec + 64);
+        e.offset = _decode_le<uint64_t>(rec + 72);
+        e.count = _decode_le<uint64_t>(rec + 80);
+        e.source_size = _decode_le<uint64_t>(rec + 88);
+        e.source_mtime = _decode_le<int64_t>(rec + 96);
+        const uint64_t tsize = _CacheLayout::type_size(e.type);
+        if(tsize == 0 || e.offset % _CacheLayout::ALIGNMENT != 0 || e.offset > n || e.count > (n - e.offset) / tsize) {
+          throw std::domain_error("Cache file '" + filename + "' has invalid entry '" + e.name + "'.\n");
+        }
+        _index[e.name] = i;
+      }
+    }
+
+    /// Directory information for one entry.
+    struct Entry {
+      std::string name;  ///< the entry name
+      uint32_t type;  ///< the value type, one of `fs::CACHE_FLOAT32`, `fs::CACHE_INT32`, `fs::CACHE_UINT32` or `fs::CACHE_CHAR`.
+      uint64_t offset;  ///< byte offset of the data in the file
+      uint64_t count;  ///< number of values
+      uint64_t source_size;  ///< size of the source file when the entry was written, 0 if there was none.
+      int64_t source_mtime;  ///< modification time of the source file, in nanoseconds.
+    };
+
+    /// Get the directory of the file.
+    const std::vector<Entry>& entries() const {
+      return _entries;
+    }
+
+    /// Get a pointer to the first byte of the mapped file.
+    const unsigned char* raw_data() const {
+      return _mf.data();
+    }
+
+    /// Whether the file contains an entry with the given name.
+    bool has(const std::string& name) const {
+      return _index.find(name) != _index.end();
+    }
+
+    /// @brief Whether the entry exists and was written from the given source file in its current state, i.e., with the same size and modification time.
+    bool is_fresh(const std::string& name, const std::string& source_filename) const {
+      std::unordered_map<std::string, size_t>::const_iterator it = _index.find(name);
+      uint64_t size;
+      int64_t mtime;
+      if(it == _index.end() || ! _file_stamp(source_filename, &size, &mtime)) {
+        return false;
+      }
+      return _entries[it->second].source_size == size && _entries[it->second].source_mtime == mtime;
+    }
+
+    /// @brief Get a pointer to the values of an entry inside the mapping, without copying. Only possible on little endian hosts, use `fs::CacheFile::get` otherwise.
+    /// @param name the entry name.
+    /// @param count output, set to the number of values.
+    /// @throws std::out_of_range if there is no such entry, std::domain_error if the value type does not match or the host is big endian.
+    template <typename T>
+    const T* view(const std::string& name, size_t* count) const {
+      if(LIBFS_HOST_BIG_ENDIAN != 0 && sizeof(T) > 1) {
+        throw std::domain_error("Cache entries cannot be viewed in place on big endian hosts, use CacheFile::get.\n");
+      }
+      const Entry& e = this->_entry<T>(name);
+      *count = size_t(e.count);
+      return reinterpret_cast<const T*>(_mf.data() + e.offset);
+    }
+
+    /// @brief Copy the values of an entry into a vector, converting them to host byte order.
+    /// @throws std::out_of_range if there is no such entry, std::domain_error if the value type does not match.
+    template <typename T>
+    void get(const std::string& name, std::vector<T>* values) const {
+      const Entry& e = this->_entry<T>(name);
+      values->resize(size_t(e.count));
+      if(e.count > 0) {
+        std::memcpy(&(*values)[0], _mf.data() + e.offset, size_t(e.count) * sizeof(T));
+      }
+      if(sizeof(T) > 1 && LIBFS_HOST_BIG_ENDIAN != 0) {
+        for(size_t i = 0; i < values->size(); i++) {
+          (*values)[i] = _swap_endian<T>((*values)[i]);
+        }
+      }
+    }
+
+    /// @brief Read a mesh stored with `fs::CacheWriter::add_mesh`.
+    /// @param key the mesh key.
+    /// @param mesh output mesh.
+    /// @param adj optional output for the adjacency, may be `nullptr`. If it is given, but the cache has no adjacency for the mesh, it is computed. A cached adjacency is also stored in the derived data cache of the mesh, see `fs::Mesh::cached_adjcsr`.
+    /// @return whether the mesh was found.
+    /// @throws std::domain_error if the stored adjacency is not a valid CSR adjacency of the mesh vertices.
+    bool get_mesh(const std::string& key, Mesh* mesh, AdjacencyCSR* adj = nullptr) const {
+      if(! this->has(key + ":vertices") || ! this->has(key + ":faces")) {
+        return false;
+      }
+      this->get(key + ":vertices", &mesh->vertices);
+      this->get(key + ":faces", &mesh->faces);
+      mesh->invalidate_cache();
+      if(this->has(key + ":adj_offsets") && this->has(key + ":adj_neighbors")) {
+        AdjacencyCSR cached;
+        this->get(key + ":adj_offsets", &cached.offsets);
+        this->get(key + ":adj_neighbors", &cached.neighbors);
+        const size_t nv = mesh->num_vertices();
+        bool valid = cached.offsets.size() == nv + 1 && cached.offsets[0] == 0 && cached.offsets.back() == cached.neighbors.size();
+        for(size_t i = 1; valid && i < cached.offsets.size(); i++) {
+          valid = cached.offsets[i - 1] <= cached.offsets[i];
+        }
+        for(size_t k = 0; valid && k < cached.neighbors.size(); k++) {
+          valid = cached.neighbors[k] < nv;
+        }
+        if(! valid) {
+          throw std::domain_error("Cache entries '" + key + ":adj_*' do not form a valid adjacency for the " + std::to_string(nv) + " vertices of the mesh.\n");
+        }
+        if(adj != nullptr) {
+          *adj = cached;
+        }
+        mesh->_set_cached_adjcsr(std::move(cached));  // So fs::Mesh::cached_adjcsr does not need to rebuild it.
+      } else if(adj != nullptr) {
+        *adj = mesh->cached_adjcsr();
+      }
+      return true;
+    }
+
+    /// @brief Read per-vertex data stored with `fs::CacheWriter::add_overlay`.
+    /// @return whether the data was found.
+    bool get_overlay(const std::string& key, std::vector<float>* data) const {
+      if(! this->has(key + ":overlay")) {
+        return false;
+      }
+      this->get(key + ":overlay", data);
+      return true;
+    }
+
+    /// @brief Read a smoothing operator stored with `fs::CacheWriter::add_smoothing_operator`.
+    /// @return whether the operator was found.
+    /// @throws std::domain_error if the stored arrays do not form a valid operator.
+    bool get_smoothing_operator(const std::string& key, SmoothingOperator* op) const {
+      if(! this->has(key + ":smooth_offsets") || ! this->has(key + ":smooth_columns") || ! this->has(key + ":smooth_weights")) {
+        return false;
+      }
+      this->get(key + ":smooth_offsets", &op->offsets);
+      this->get(key + ":smooth_columns", &op->columns);
+      this->get(key + ":smooth_weights", &op->weights);
+      std::vector<float> fwhm;
+      if(this->has(key + ":smooth_fwhm")) {
+        this->get(key + ":smooth_fwhm", &fwhm);
+      }
+      op->fwhm = fwhm.empty() ? 0.0f : fwhm[0];
+      const size_t nnz = op->weights.size();
+      bool valid = ! op->offsets.empty() && op->offsets[0] == 0 && op->offsets.back() == nnz && op->columns.size() == nnz;
+      for(size_t i = 1; valid && i < op->offsets.size(); i++) {
+        valid = op->offsets[i - 1] <= op->offsets[i];
+      }
+      const size_t nv = op->num_vertices();
+      for(size_t k = 0; valid && k < nnz; k++) {
+        valid = op->columns[k] < nv;
+      }
+      if(! valid) {
+        throw std::domain_error("Cache entries '" + key + ":smooth_*' do not form a valid smoothing operator.\n");
+      }
+      return true;
+    }
+
+    /// @brief Read an annotation stored with `fs::CacheWriter::add_annot`. The `vertex_indices` are recreated as 0 to N-1.
+    /// @return whether the annotation was found.
+    bool get_annot(const std::string& key, Annot* annot) const {
+      if(! this->has(key + ":annot_vertex_labels") || ! this->has(key + ":annot_ct_names")) {
+        return false;
+      }
+      Colortable& ct = annot->colortable;
+      this->get(key + ":annot_vertex_labels", &annot->vertex_labels);
+      annot->vertex_indices.resize(annot->vertex_labels.size());
+      for(size_t i = 0; i < annot->vertex_indices.size(); i++) {
+        annot->vertex_indices[i] = int32_t(i);
+      }
+      this->get(key + ":annot_ct_id", &ct.id);
+      this->get(key + ":annot_ct_r", &ct.r);
+      this->get(key + ":annot_ct_g", &ct.g);
+      this->get(key + ":annot_ct_b", &ct.b);
+      this->get(key + ":annot_ct_a", &ct.a);
+      this->get(key + ":annot_ct_label", &ct.label);
+      std::vector<char> names;
+      this->get(key + ":annot_ct_names", &names);
+      ct.name.clear();
+      size_t start = 0;
+      for(size_t i = 0; i < names.size(); i++) {
+        if(names[i] == '\0') {
+          ct.name.push_back(std::string(names.data() + start, i - start));
+          start = i + 1;
+        }
+      }
+      ct.build_index();
+      return true;
+    }
+
+    private:
+    util::MappedFile _mf;
+    std::vector<Entry> _entries;
+    std::unordered_map<std::string, size_t> _index;
+
+    template <typename T>
+    const Entry& _entry(const std::string& name) const {
+      std::unordered_map<std::string, size_t>::const_iterator it = _index.find(name);
+      if(it == _index.end()) {
+        throw std::out_of_range("No entry '" + name + "' in cache file.\n");
+      }
+      const Entry& e = _entries[it->second];
+      if(e.type != _CacheType<T>::code) {
+        throw std::domain_error("Cache entry '" + name + "' has value type " + std::to_string(e.type) + ", which does not match the requested type.\n");
+      }
+      return e;
+    }
+  };
+
+  /// @brief Whether `fs::read_mesh` and `fs::read_desc_data` use subject cache files, see `fs::set_subject_cache_enabled`.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  inline std::atomic<bool>& _subject_cache_flag() {
+    static std::atomic<bool> enabled(false);
+    return enabled;
+  }
+
+  /// @brief Enable or disable the transparent subject cache. It is disabled by default.
+  /// @details If enabled, `fs::read_mesh` and `fs::read_desc_data` first look for the requested file in the cache file of the subject, see `fs::subject_cache_filename`. If the cache has an entry for the file, and the size and modification time of the file have not changed since the entry was written, the data is read from the cache. Otherwise the file is read as usual, and the entry is added to the cache file. Files outside of a subject directory are never cached. Problems with the cache file, like a read-only SUBJECTS_DIR, are ignored: the data is then read from the source file.
+  /// Adding an entry rewrites the whole cache file, under a lock file `<subject>.fscache.lock` that serializes concurrent writers, so the cache is meant for data that is read many times. On systems other than Linux, macOS and Windows, modification times only have a resolution of one second, so changes to a source file that keep its size and happen in the same second as the cache entry was written are not detected.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::set_subject_cache_enabled(true);
+  /// fs::Mesh surface;
+  /// fs::read_mesh(&surface, "subjects_dir/subject1/surf/lh.white");  // Creates 'subjects_dir/subject1.fscache' on first use.
+  /// @endcode
+  inline void set_subject_cache_enabled(bool enabled) {
+    _subject_cache_flag().store(enabled);
+  }
+
+  /// Whether the transparent subject cache is enabled, see `fs::set_subject_cache_enabled`.
+  inline bool subject_cache_enabled() {
+    return _subject_cache_flag().load();
+  }
+
+  /// @brief Get the cache file and entry key for a file in a FreeSurfer subject directory.
+  /// @details For a file `<SUBJECTS_DIR>/<subject>/<dir>/<name>`, where `dir` is one of `surf`, `label`, `mri` or `stats`, the cache file is `<SUBJECTS_DIR>/<subject>.fscache`, next to the subject directory, and the key is `<dir>/<name>`.
+  /// @param source_filename path to the file.
+  /// @param key optional output for the entry key, may be `nullptr`.
+  /// @return the cache file name, or the empty string if the file is not in a subject directory.
+  std::string subject_cache_filename(const std::string& source_filename, std::string* key = nullptr) {
+    const size_t name_sep = source_filename.find_last_of("/\\");
+    if(name_sep == std::string::npos || name_sep == 0) {
+      return "";
+    }
+    const size_t dir_sep = source_filename.find_last_of("/\\", name_sep - 1);
+    const size_t dir_start = dir_sep == std::string::npos ? 0 : dir_sep + 1;
+    const std::string dir = source_filename.substr(dir_start, name_sep - dir_start);
+    if(dir_start == 0 || (dir != "surf" && dir != "label" && dir != "mri" && dir != "stats")) {
+      return "";  // The subject directory itself must be part of the path.
+    }
+    std::string subject_dir = source_filename.substr(0, dir_start - 1);
+    while(subject_dir.size() > 1 && (subject_dir.back() == '/' || subject_dir.back() == '\\')) {
+      subject_dir.pop_back();
+    }
+    if(subject_dir.empty() || subject_dir == "." || subject_dir == ".." || subject_dir.back() == '/' || subject_dir.back() == '\\') {
+      return "";
+    }
+    if(key != nullptr) {
+      *key = source_filename.substr(dir_start);
+    }
+    return subject_dir + ".fscache";
+  }
+
+  /// @brief Look up a source file in its subject cache and, on a hit, read it with `load_fn(const fs::CacheFile&, const std::string& key)`.
+  /// @return whether the data was loaded from the cache.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename F>
+  bool _subject_cache_load(const std::string& source_filename, const std::string& entry_suffix, F load_fn) {
+    std::string key;
+    const std::string cache_filename = subject_cache_filename(source_filename, &key);
+    uint64_t size;
+    int64_t mtime;
+    if(cache_filename.empty() || ! _file_stamp(cache_filename, &size, &mtime)) {
+      return false;
+    }
+    try {
+      CacheFile cf(cache_filename);
+      if(! cf.is_fresh(key + entry_suffix, source_filename)) {
+        return false;
+      }
+      return load_fn(cf, key);
+    } catch(const std::exception&) {
+      return false;  // An unreadable cache is treated like a missing one.
+    }
+  }
+
+  /// @brief Add data to the subject cache of a source file with `add_fn(fs::CacheWriter*, const std::string& key)`, keeping the other entries of the cache.
+  /// @details The cache file is rewritten with all entries, under an advisory lock on `<cache file>.lock`. The lock serializes the read-merge-write cycle between threads and processes, so concurrent stores into the same cache do not lose each other's entries.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename F>
+  void _subject_cache_store(const std::string& source_filename, F add_fn) {
+    std::string key;
+    const std::string cache_filename = subject_cache_filename(source_filename, &key);
+    if(cache_filename.empty()) {
+      return;
+    }
+    try {
+      _FileLock lock(cache_filename + ".lock");
+      CacheWriter cw;
+      uint64_t size;
+      int64_t mtime;
+      if(_file_stamp(cache_filename, &size, &mtime)) {
+        try {
+          CacheFile cf(cache_filename);
+          for(const CacheFile::Entry& e : cf.entries()) {
+            if(e.name.compare(0, key.size() + 1, key + ":") == 0) {
+              continue;  // Replaced below.
+            }
+            CacheWriter::_Entry copy;
+            copy.name = e.name;
+            copy.type = e.type;
+            copy.count = size_t(e.count);
+            copy.source_size = e.source_size;
+            copy.source_mtime = e.source_mtime;
+            const char* bytes = reinterpret_cast<const char*>(cf.raw_data()) + e.offset;  // Copied as is, the values are already little endian.
+            copy.bytes.assign(bytes, bytes + size_t(e.count) * _CacheLayout::type_size(e.type));
+            cw._add_entry(std::move(copy));
+          }
+        } catch(const std::exception&) {
+          // Replace a broken cache file.
+        }
+      }
+      add_fn(&cw, key);
+      cw.write(cache_filename);
+    } catch(const std::exception&) {
+      // The cache is optional, e.g., the SUBJECTS_DIR may be read-only.
+    }
+  }
+
+  /// @brief Read a triangular mesh from a surf, obj, or ply file into the given Mesh instance.
+  ///
+  /// @param surface a Mesh instance representing a vertex-indexed tri-mesh. This will be filled.
+  /// @param filename The path to the file from which to read the mesh. The format will be determined from the file extension as follows. File names ending with '.obj' are loaded as Wavefront OBJ files. File names ending with '.ply' are loaded as Stanford PLY files in format version 'ascii 1.0'. All other files are loaded as FreeSurfer binary surf files.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the surf file magic mismatches.
+  /// @see `fs::set_subject_cache_enabled` to read meshes from a cache file.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::mesh surface;
+  /// fs::read_mesh(&surface, "subject1/surf/lh.thickness");
+  /// @endcode
+  void read_mesh(Mesh* surface, const std::string& filename) {
+    const bool use_cache = subject_cache_enabled();
+    if(use_cache && _subject_cache_load(filename, ":faces", [surface](const CacheFile& cf, const std::string& key) { return cf.get_mesh(key, surface); })) {
+      return;
+    }
+    if(fs::util::ends_with(filename, ".obj")) {
+      fs::Mesh::from_obj(surface, filename);
+    } else if(fs::util::ends_with(filename, ".ply")) {
+      fs::Mesh::from_ply(surface, filename);
+    } else if(fs::util::ends_with(filename, ".off")) {
+      fs::Mesh::from_off(surface, filename);
+    } else {
+      read_surf(surface, filename);
+    }
+    if(use_cache) {
+      _subject_cache_store(filename, [surface, &filename](CacheWriter* cw, const std::string& key) { cw->add_mesh(key, *surface, filename); });
+    }
+  }
+
+
+  /// @brief Determine the endianness of the system.
+  /// @details This is resolved at compile time, see the `LIBFS_HOST_BIG_ENDIAN` define.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @return boolean, whether the current system is big endian.
+  /// @private
+  constexpr bool _is_bigendian() {
+    return LIBFS_HOST_BIG_ENDIAN != 0;
+  }
+
+  /// @brief Read the header of a curv file from a stream into the header fields of the given Curv instance. Leaves the stream at the beginning of the data.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @throws domain_error if the curv file magic mismatches, the header is truncated, or the file claims to contain more than 1 value per vertex, or a negative number of vertices.
+  /// @private
+  void _read_curv_header(Curv* curv, std::istream *is, const std::string& source_filename) {
+    const std::string msg_source_file_part = source_filename.empty() ? "" : "'" + source_filename + "' ";
+    const int CURV_MAGIC = 16777215;
+    int magic = _fread3(*is);
+    if(magic != CURV_MAGIC) {
+      throw std::domain_error("Curv file " + msg_source_file_part + "header magic did not match: expected " + std::to_string(CURV_MAGIC) + ", found " + std::to_string(magic) + ".\n");
+    }
+    curv->num_vertices = _freadt<int32_t>(*is);
+    curv->num_faces =  _freadt<int32_t>(*is);
+    curv->num_values_per_vertex = _freadt<int32_t>(*is);
+    #ifdef LIBFS_DBG_INFO
+    std::cout << LIBFS_APPTAG << "Read curv file with " << curv->num_vertices << " vertices, " << curv->num_faces << " faces and " << curv->num_values_per_vertex << " values per vertex.\n";
+    #endif
+    if(is->fail()) {
+      throw std::domain_error("Curv file " + msg_source_file_part + "is too short to contain a curv header.\n");
+    }
+    if(curv->num_values_per_vertex != 1) { // Not supported, I know no case where this is used. Please submit a PR with a demo file if you have one, and let me know where it came from.
+      throw std::domain_error("Curv file " + msg_source_file_part + "must contain exactly 1 value per vertex, found " + std::to_string(curv->num_values_per_vertex) + ".\n");
+    }
+    if(curv->num_vertices < 0) {
+      throw std::domain_error("Curv file " + msg_source_file_part + "header claims a negative number of vertices: " + std::to_string(curv->num_vertices) + ".\n");
+    }
+  }
+
+  /// @brief Read per-vertex brain morphometry data from a FreeSurfer curv stream.
+  /// @details The curv format is a simple binary format that stores one floating point value per vertex of a related brain surface.
+  /// @param curv A Curv instance to be filled.
+  /// @param is An open istream from which to read the curv data.
+  /// @throws domain_error if the curv file magic mismatches, the curv file header claims that the file contains more than 1 value per vertex, or the stream ends before all values were read. The header fields of `curv` are only changed if reading succeeds, but its data is left empty on failure, as its memory is reused for reading.
+  void read_curv(Curv* curv, std::istream *is, const std::string& source_filename="") {
+    LIBFS_INSTRUMENT_SCOPE("read_curv");
+    Curv result;
+    _read_curv_header(&result, is, source_filename);
+    // Read into a temporary that takes over the memory of the data vector of the Curv instance, so reusing an instance does not allocate.
+    result.data.swap(curv->data);
+    result.data.resize(size_t(result.num_vertices));
+    _freadt_bulk<float>(*is, result.data.data(), result.data.size());
+    if(is->fail()) {
+      const std::string msg_source_file_part = source_filename.empty() ? "" : "'" + source_filename + "' ";
+      throw std::domain_error("Curv file " + msg_source_file_part + "ended before all " + std::to_string(result.num_vertices) + " values were read.\n");
+    }
+    curv->num_vertices = result.num_vertices;
+    curv->num_faces = result.num_faces;
+    curv->num_values_per_vertex = result.num_values_per_vertex;
+    curv->data.swap(result.data);
+    LIBFS_INSTRUMENT_COUNT("read_curv.values", curv->data.size());
+  }
+
+
+  /// @brief Read Curv instance from a FreeSurfer curv format file.
+  /// @details The curv format is a simple binary format that stores one floating point value per vertex of a related brain surface.
+  /// @param curv A Curv instance to be filled.
+  /// @param filename Path to a file from which to read the curv data.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the curv file magic mismatches or the curv file header claims that the file contains more than 1 value per vertex.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::Curv curv;
+  /// fs::read_curv(&curv, "examples/read_curv/lh.thickness");
+  /// @endcode
+  void read_curv(Curv* curv, const std::string& filename) {
+    std::ifstream is(filename, std::fstream::in | std::fstream::binary);
+    if(is.is_open()) {
+      read_curv(curv, &is, filename);
+      is.close();
+    } else {
+      throw std::runtime_error("Could not open curv file '" + filename + "' for reading.\n");
+    }
+  }
+
+  /// @brief Read only the header of a FreeSurfer curv format file into the given Curv instance, without reading the per-vertex data.
+  /// @details The 15 header bytes are read with a single read call. This is a lot faster than `fs::read_curv` if only the number of vertices is needed, e.g., when indexing many files, see also `fs::probe_files`.
+  /// @param curv A Curv instance, its header fields (`num_vertices`, `num_faces`, `num_values_per_vertex`) are filled, and its `data` is cleared.
+  /// @param filename Path to a file from which to read the curv header.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the curv file magic mismatches, the header is truncated, or the file claims to contain more than 1 value per vertex.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::Curv curv;
+  /// fs::read_curv_header(&curv, "lh.thickness");
+  /// std::cout << curv.num_vertices << " vertices.\n";
+  /// @endcode
+  void read_curv_header(Curv* curv, const std::string& filename) {
+    char buffer[15];
+    size_t num_read = 0;
+    if(! _read_file_prefix(filename, buffer, sizeof(buffer), &num_read)) {
+      throw std::runtime_error("Could not open curv file '" + filename + "' for reading.\n");
+    }
+    fs::util::MemInBuf buf(buffer, num_read);
+    std::istream is(&buf);
+    _read_curv_header(curv, &is, filename);
+    curv->data.clear();
+  }
+
+  /// Read an Annot Colortable from a stream.
+  /// @private
+  void _read_annot_colortable(Colortable* colortable, std::istream *is, int32_t num_entries) {
+    int32_t num_chars_orig_filename = _freadt<int32_t>(*is);  // The number of characters of the file this annot was built from.
+
+    // It follows the name of the file this annot was built from. This is development metadata and irrelevant afaik. We skip it.
+    uint8_t discarded;
+    for(int32_t i=0; i<num_chars_orig_filename; i++) {
+      discarded = _freadt<uint8_t>(*is);
+    }
+    (void)discarded; // Suppress warnings about unused variable.
+
+    int32_t num_entries_duplicated = _freadt<int32_t>(*is); // Yes, once more.
+    if(num_entries != num_entries_duplicated) {
+      std::cerr << "Warning: the two num_entries header fields of this annotation do not match. Use with care.\n";
+    }
+
+    int32_t entry_num_chars;
+    for(int32_t i=0; i<num_entries; i++) {
+      colortable->id.push_back(_freadt<int32_t>(*is));
+      entry_num_chars = _freadt<int32_t>(*is);
+      colortable->name.push_back(_freadfixedlengthstring(*is, entry_num_chars, true));
+      colortable->r.push_back(_freadt<int32_t>(*is));
+      colortable->g.push_back(_freadt<int32_t>(*is));
+      colortable->b.push_back(_freadt<int32_t>(*is));
+      colortable->a.push_back(_freadt<int32_t>(*is));
+      colortable->label.push_back(colortable->r[i] + colortable->g[i]*256 + colortable->b[i]*65536 + colortable->a[i]*16777216);
+    }
+    colortable->build_index();
+  }
+
+  /// Compute the vector index for treating a vector of length n*m as a matrix with n rows and m columns.
+  /// @private
+  size_t _vidx_2d(size_t row, size_t column, size_t row_length=3) {
+    return (row+1)*row_length -row_length + column;
+  }
+
+  /// @brief Read the colortable section that follows the vertex labels in an annot stream.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @throws domain_error if the stream ends before the color table, the file format version is not supported or the file is missing the color table.
+  /// @private
+  void _read_annot_colortable_section(Colortable* colortable, std::istream *is) {
+    int32_t has_colortable = _freadt<int32_t>(*is);
+    if(is->fail()) {
+      throw std::domain_error("Annotation ended before the color table. Maybe invalid annotation file?\n");
+    }
+    if(has_colortable == 1) {
+      int32_t num_colortable_entries_old_format = _freadt<int32_t>(*is);
+      if(num_colortable_entries_old_format > 0) {
+        throw std::domain_error("Reading annotation in old format not supported. Please open an issue and supply an example file if you need this.\n");
+      } else {
+        int32_t colortable_format_version = -num_colortable_entries_old_format; // If the value is negative, we are in new format and its absolute value is the format version.
+        if(colortable_format_version == 2) {
+          int32_t num_colortable_entries = _freadt<int32_t>(*is); // This time for real.
+          _read_annot_colortable(colortable, is, num_colortable_entries);
+        } else {
+          throw std::domain_error("Reading annotation in new format version !=2 not supported. Please open an issue and supply an example file if you need this.\n");
+        }
+
+      }
+
+    } else {
+      throw std::domain_error("Reading annotation without colortable not supported. Maybe invalid annotation file?\n");
+    }
+  }
+
+  /// @brief Read a FreeSurfer annotation or brain surface parcellation from an annot stream.
+  /// @details A brain parcellations contains a region table and assigns to each vertex of a surface a region.
+  /// @param annot An Annot instance to be filled.
+  /// @param is An open istream from which to read the annot data.
+  /// @throws domain_error if the header claims a negative number of vertices, the file format version is not supported or the file is missing the color table.
+  void read_annot(Annot* annot, std::istream *is) {
+    LIBFS_INSTRUMENT_SCOPE("read_annot");
+    int32_t num_vertices = _freadt<int32_t>(*is);
+    if(is->fail() || num_vertices < 0) {
+      throw std::domain_error("Annot data has an invalid header.\n");
+    }
+    std::vector<int32_t> vertices_and_labels(size_t(num_vertices) * 2);
+    _freadt_bulk<int32_t>(*is, vertices_and_labels.data(), vertices_and_labels.size());
+    std::vector<int32_t> vertices(static_cast<size_t>(num_vertices));
+    std::vector<int32_t> labels(static_cast<size_t>(num_vertices));
+    for(size_t i=0; i<size_t(num_vertices); i++) { // The vertices and their labels are stored directly after one another: v1,v1_label,v2,v2_label,...
+        vertices[i] = vertices_and_labels[i*2];
+        labels[i] = vertices_and_labels[i*2+1];
+    }
+    LIBFS_INSTRUMENT_COUNT("read_annot.vertices", num_vertices);
+    annot->vertex_indices = std::move(vertices);
+    annot->vertex_labels = std::move(labels);
+    _read_annot_colortable_section(&annot->colortable, is);
+  }
+
+
+  /// @brief Read a FreeSurfer annotation from a file.
+  /// @param annot An Annot instance that should be filled.
+  /// @param filename Path to the label file that should be read.
+  /// @see There exists an overload to read from a stream instead.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the file format version is not supported or the file is missing the color table.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// std::string annot_fname = "lh.aparc.annot";
+  /// fs::Annot annot;
+  /// fs::read_annot(&annot, annot_fname);
+  /// @endcode
+  void read_annot(Annot* annot, const std::string& filename) {
+    std::ifstream is(filename, std::fstream::in | std::fstream::binary);
+    if(is.is_open()) {
+      read_annot(annot, &is);
+      is.close();
+    } else {
+      throw std::runtime_error("Could not open annot file '" + filename + "' for reading.\n");
+    }
+  }
+
+  /// @brief The header of a FreeSurfer annotation file, i.e., everything but the per-vertex labels. See `fs::read_annot_header`.
+  struct AnnotHeader {
+    int32_t num_vertices = 0;  ///< The number of vertices of the annotation.
+    Colortable colortable;  ///< The region table of the annotation.
+  };
+
+  /// @brief Read the vertex count and the color table of a FreeSurfer annotation file, without reading the per-vertex labels.
+  /// @details The color table is stored after the labels, so this seeks over the label block instead of reading and decoding it.
+  /// @param header the AnnotHeader instance to fill.
+  /// @param filename Path to the annot file.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the file is truncated, the file format version is not supported or the file is missing the color table.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::AnnotHeader header;
+  /// fs::read_annot_header(&header, "lh.aparc.annot");
+  /// std::cout << header.colortable.num_entries() << " regions.\n";
+  /// @endcode
+  void read_annot_header(AnnotHeader* header, const std::string& filename) {
+    std::ifstream is(filename, std::fstream::in | std::fstream::binary);
+    if(! is.is_open()) {
+      throw std::runtime_error("Could not open annot file '" + filename + "' for reading.\n");
+    }
+    header->num_vertices = _freadt<int32_t>(is);
+    if(is.fail() || header->num_vertices < 0) {
+      throw std::domain_error("Annot file '" + filename + "' has an invalid header.\n");
+    }
+    is.seekg(std::streamoff(header->num_vertices) * 8, std::ios_base::cur);  // Skip the vertex index and label pairs.
+    Colortable colortable;
+    _read_annot_colortable_section(&colortable, &is);
+    if(is.fail()) {
+      throw std::domain_error("Annot file '" + filename + "' is truncated.\n");
+    }
+    header->colortable = std::move(colortable);
+  }
+
+
+  /// @brief Read per-vertex brain morphometry data from a FreeSurfer curv format file.
+  /// @details The curv format is a simple binary format that stores one floating point value per vertex of a related brain surface.
+  /// @param filename Path to a file from which to read the curv data.
+  /// @return a vector of float values, one per vertex.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the curv file magic mismatches or the curv file header claims that the file contains more than 1 value per vertex.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// std::string curv_fname = "lh.thickness";
+  /// std::vector<float> data = fs::read_curv_data(curv_fname);
+  /// @endcode
+  std::vector<float> read_curv_data(const std::string& filename) {
+    Curv curv;
+    read_curv(&curv, filename);
+    return(std::move(curv.data));
+  }
+
+  /// @brief Read per-vertex brain morphometry data from a FreeSurfer curv format file into a caller-provided vector.
+  /// @details The vector is resized to the number of values, and its memory is reused: reading many files of the same size into the same vector, e.g., in a worker loop over subjects, does not allocate after the first file.
+  /// @param filename Path to a file from which to read the curv data.
+  /// @param data the vector to fill, one value per vertex. Existing contents are overwritten.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the curv file magic mismatches or the curv file header claims that the file contains more than 1 value per vertex.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// std::vector<float> data;
+  /// for(const std::string& subject : subjects) {
+  ///   fs::read_curv_data(subject + "/surf/lh.thickness", &data);
+  /// }
+  /// @endcode
+  void read_curv_data(const std::string& filename, std::vector<float>* data) {
+    Curv curv;
+    curv.data.swap(*data);
+    try {
+      read_curv(&curv, filename);
+    } catch(...) {
+      data->swap(curv.data);
+      throw;
+    }
+    data->swap(curv.data);
+  }
+
+  /// @brief Read per-vertex brain morphometry data from a FreeSurfer curv format file into a caller-provided buffer, e.g., a row of a preallocated matrix.
+  /// @param filename Path to a file from which to read the curv data.
+  /// @param buffer pointer to memory for at least `capacity` values.
+  /// @param capacity the number of values the buffer can hold.
+  /// @return the number of values read, i.e., the number of vertices.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the curv file magic mismatches or the curv file header claims that the file contains more than 1 value per vertex or the file is truncated, invalid_argument if the file contains more than `capacity` values. Nothing is written to the buffer in the latter case, the contents of the buffer are unspecified if the file is truncated.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// std::vector<float> matrix(num_subjects * num_vertices);
+  /// size_t n = fs::read_curv_data("lh.thickness", &matrix[0], num_vertices);
+  /// @endcode
+  size_t read_curv_data(const std::string& filename, float* buffer, const size_t capacity) {
+    std::ifstream is(filename, std::fstream::in | std::fstream::binary);
+    if(! is.is_open()) {
+      throw std::runtime_error("Could not open curv file '" + filename + "' for reading.\n");
+    }
+    LIBFS_INSTRUMENT_SCOPE("read_curv");
+    Curv curv;
+    _read_curv_header(&curv, &is, filename);
+    const size_t num_values = size_t(curv.num_vertices);
+    if(num_values > capacity) {
+      throw std::invalid_argument("Curv file '" + filename + "' contains " + std::to_string(num_values) + " values, but the buffer can only hold " + std::to_string(capacity) + ".\n");
+    }
+    _freadt_bulk<float>(is, buffer, num_values);
+    if(is.fail()) {
+      throw std::domain_error("Curv file '" + filename + "' ended before all " + std::to_string(num_values) + " values were read.\n");
+    }
+    LIBFS_INSTRUMENT_COUNT("read_curv.values", num_values);
+    return num_values;
+  }
+
+  /// @brief Read per-vertex brain morphometry data from a FreeSurfer curv format or MGH format file into a caller-provided vector.
+  /// @details Like `fs::read_desc_data`, but the vector is resized to the number of values and its memory is reused: reading many files of the same size into the same vector, e.g., in a worker loop over subjects, does not allocate after the first file.
+  /// @param filename Path to a file from which to read the data, see `fs::read_desc_data`.
+  /// @param data the vector to fill, one value per vertex. Existing contents are overwritten.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the curv file magic mismatches, the curv file header claims that the file contains more than 1 value per vertex, or the MGH file does not contain MRI_FLOAT data.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// std::vector<float> data;
+  /// for(const std::string& subject : subjects) {
+  ///   fs::read_desc_data(subject + "/surf/lh.thickness.mgh", &data);
+  /// }
+  /// @endcode
+  void read_desc_data(const std::string& filename, std::vector<float>* data) {
+    const bool use_cache = subject_cache_enabled();
+    if(use_cache && _subject_cache_load(filename, ":overlay", [data](const CacheFile& cf, const std::string& key) { return cf.get_overlay(key, data); })) {
+      return;
+    }
+    if(fs::util::ends_with(filename, {".MGH", ".mgh"}) || fs::util::is_mgz_filename(filename)) {
+      LIBFS_INSTRUMENT_SCOPE("read_mgh");
+      std::unique_ptr<std::istream> is = _open_mgh_stream(filename);
+      MghHeader header;
+      read_mgh_header(&header, is.get());
+      if(header.dtype != fs::MRI_FLOAT) {
+        throw std::domain_error("MGH file '" + filename + "' contains data of type " + std::to_string(header.dtype) + ", expected MRI_FLOAT (" + std::to_string(fs::MRI_FLOAT) + ") for per-vertex data.\n");
+      }
+      int num_gt_1 = 0;
+      std::vector<int> dims = { header.dim1length, header.dim2length, header.dim3length, header.dim4length };
+      for(size_t i = 0; i < dims.size(); i++) {
+        if(dims[i] > 1) {
+          num_gt_1++;
+        }
+      }
+      if(num_gt_1 > 1) {
+        std::cerr << "MGH file '" << filename << "' contains more than one non-empty dimension. Returning concatinated data.\n";
+      }
+      _read_mgh_data_into<float>(header, is.get(), data);
+      LIBFS_INSTRUMENT_COUNT("read_mgh.values", data->size());
+      LIBFS_INSTRUMENT_COUNT("read_mgh.bytes", data->size() * sizeof(float));
+    } else {
+      read_curv_data(filename, data);
+    }
+    if(use_cache) {
+      _subject_cache_store(filename, [data, &filename](CacheWriter* cw, const std::string& key) { cw->add_overlay(key, *data, filename); });
+    }
+  }
+
+  /// @brief Read per-vertex brain morphometry data from a FreeSurfer curv format or MGH format file.
+  /// @param filename Path to a file from which to read the data. If the name ends with '.mgh' or '.MGH', this function assumes it is an MGH file. If it ends with '.mgz', '.MGZ' or '.mgh.gz', it is read as a compressed MGH file, which requires zlib support (see `LIBFS_WITH_ZLIB`). Otherwise it assumes it is a curv file. If it is an MGH file, it must contain data of type MRI_FLOAT, and it must only contain data for one subject, i.e., all dimensions with the exception of the first one should have size 1.
+  /// @return a vector of float values, one per vertex.
+  /// @throws runtime_error if the file cannot be opened, domain_error if the curv file magic mismatches, the curv file header claims that the file contains more than 1 value per vertex, or the MGH file does not contain MRI_FLOAT data.
+  /// @see `fs::set_subject_cache_enabled` to read the data from a cache file.
+  /// @see There is an overload that fills a caller-provided vector, to reuse its memory.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// std::string curv_fname = "lh.thickness";
+  /// std::vector<float> data1 = fs::read_desc_data(curv_fname);
+  /// std::string mgh_fname = "lh.thickness.mgh";
+  /// std::vector<float> data2 = fs::read_desc_data(mgh_fname);
+  /// @endcode
+  std::vector<float> read_desc_data(const std::string& filename) {
     std::vector<float> data;
+    read_desc_data(filename, &data);
+    return data;
+  }
 
-    /// The number of vertices of the mesh to which this belongs. Can be deduced from length of 'data'.
-    int32_t num_vertices;
 
-    /// The number of values per vertex, stored in this file. Almost all apps (including FreeSurfer itself) only support a value of 1 here. Ignored by most apps, and assumed to be 1.
-    int32_t num_values_per_vertex;
-  };
+  /// @brief Models per-vertex data for a group of subjects, as a contiguous subjects x vertices matrix.
+  /// @see `fs::read_group_data`
+  struct GroupData {
+    std::vector<std::string> subjects;  ///< The subject identifiers, one per row.
+    size_t num_vertices = 0;  ///< The number of vertices, i.e., the number of columns.
+    std::vector<float> data;  ///< The values in row-major order, i.e., all values of the first subject come first. The rows of subjects that failed to load are filled with NAN.
+    std::vector<std::string> errors;  ///< One error message per subject, empty if the data of the subject was loaded successfully.
 
-  /// The colortable from an Annot file, can be used for parcellations and integer labels. Typically each index (in all fields) describes a brain region.
-  struct Colortable {
-    std::vector<int32_t> id;  ///< internal region index
-    std::vector<std::string> name;   ///< region name
-    std::vector<int32_t> r;   ///< red channel of RGBA color
-    std::vector<int32_t> g;   ///< blue channel of RGBA color
-    std::vector<int32_t> b;   ///< green channel of RGBA color
-    std::vector<int32_t> a;   ///< alpha channel of RGBA color
-    std::vector<int32_t> label;   ///< label integer computed from rgba values. Maps to the Annot.vertex_label field.
+    /// Return the number of subjects, i.e., the number of rows.
+    size_t num_subjects() const {
+      return this->subjects.size();
+    }
 
-    /// @brief Get the number of enties (regions) in this Colortable.
-    size_t num_entries() const {
-      size_t num_ids = this->id.size();
-      if(this->name.size() != num_ids || this->r.size() != num_ids || this->g.size() != num_ids || this->b.size() != num_ids || this->a.size() != num_ids || this->label.size() != num_ids) {
-        std::cerr << "Inconsistent Colortable, vector sizes do not match.\n";
-      }
-      return num_ids;
+    /// Return the value for the given subject and vertex.
+    float at(size_t subject_idx, size_t vertex_idx) const {
+      return this->data[subject_idx * this->num_vertices + vertex_idx];
     }
 
-    /// @brief Get the index of a region in the Colortable by region name. Returns a negative value if the region is not found.
-    int32_t get_region_idx(const std::string& query_name) const {
-      for(size_t i = 0; i<this->num_entries(); i++) {
-        if(this->name[i] == query_name) {
-          return (int32_t)i;
-        }
-      }
-      return(-1);
+    /// Return a pointer to the first value of the given subject.
+    const float* row(size_t subject_idx) const {
+      return this->data.data() + subject_idx * this->num_vertices;
     }
 
-    /// @brief Get the index of a region in the Colortable by label. Returns a negative value if the region is not found.
-    int32_t get_region_idx(int32_t query_label) const {
-      for(size_t i = 0; i<this->num_entries(); i++) {
-        if(this->label[i] == query_label) {
-          return (int32_t)i;
-        }
-      }
-      return(-1);
+    /// Whether the data of the given subject was loaded successfully.
+    bool ok(size_t subject_idx) const {
+      return this->errors[subject_idx].empty();
     }
 
+    /// Return the number of subjects which failed to load.
+    size_t num_failed() const {
+      return size_t(std::count_if(this->errors.begin(), this->errors.end(), [](const std::string& e) { return ! e.empty(); }));
+    }
   };
 
-
-  /// An annotation, also known as a brain surface parcellation. Assigns to each vertex a region, identified by the region_label. The region name and color for each region can be found in the Colortable.
-  struct Annot {
-    std::vector<int32_t> vertex_indices;  ///< Indices of the vertices, these always go from 0 to N-1 (where N is the number of vertices in the respective surface/annotation). Not really needed.
-    std::vector<int32_t> vertex_labels;   ///< The label code for each vertex, defining the region it belongs to. Check in the Colortable for a region that has this label.
-    Colortable colortable;  ///< A Colortable defining the regions (most importantly, the region name and visualization color).
-
-    /// @brief Get all vertices of a region given by name in the brain surface parcellation. Returns an integer vector, the vertex indices.
-    std::vector<int32_t> region_vertices(const std::string& region_name) const {
-      int32_t region_idx = this->colortable.get_region_idx(region_name);
-      if(region_idx >= 0) {
-        return(this->region_vertices(this->colortable.label[region_idx]));
-      } else {
-        std::cerr << "No such region in annot, returning empty vector.\n";
-        std::vector<int32_t> empty;
-        return(empty);
-      }
+  /// @brief Ask the operating system to start reading a file into the page cache in the background, if supported.
+  /// @details Uses `posix_fadvise` with `POSIX_FADV_WILLNEED`. Does nothing on systems that do not support it, or if the file cannot be opened.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  inline void _prefetch_file(const std::string& filename) {
+    #if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+    const int fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd >= 0) {
+      ::posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+      ::close(fd);
     }
+    #else
+    (void)filename;
+    #endif
+  }
 
-    /// @brief Get all vertices of a region given by label in the brain surface parcellation. Returns an integer vector, the vertex indices.
-    std::vector<int32_t> region_vertices(int32_t region_label) const {
-      std::vector<int32_t> reg_verts;
-      for(size_t i=0; i<this->vertex_labels.size(); i++) {
-        if(this->vertex_labels[i] == region_label) {
-          reg_verts.push_back(int(i));
-        }
-      }
-      return(reg_verts);
-    }
+  /// @brief Get the path of a per-vertex data file or surface of a subject in a FreeSurfer SUBJECTS_DIR.
+  /// @return the path `<subjects_dir>/<subject>/surf/<hemi>.<measure>`
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  inline std::string _subject_surf_file(const std::string& subjects_dir, const std::string& subject, const std::string& hemi, const std::string& measure) {
+    return fs::util::fullpath({subjects_dir, subject, "surf", hemi + "." + measure});
+  }
 
-    /// @brief Get the vertex colors as an array of uchar values, 3 consecutive values are the red, green and blue channel values for a single vertex.
-    /// @param alpha whether to include the alpha channel and return 4 values per vertex instead of 3.
-    std::vector<uint8_t> vertex_colors(bool alpha = false) const {
-      int num_channels = alpha ? 4 : 3;
-      std::vector<uint8_t> col;
-      col.reserve(this->num_vertices() * num_channels);
-      std::vector<size_t> vertex_region_indices = this->vertex_regions();
-      for(size_t i=0; i<this->num_vertices(); i++) {
-        col.push_back(this->colortable.r[vertex_region_indices[i]]);
-        col.push_back(this->colortable.g[vertex_region_indices[i]]);
-        col.push_back(this->colortable.b[vertex_region_indices[i]]);
-        if(alpha) {
-          col.push_back(this->colortable.a[vertex_region_indices[i]]);
-        }
+  /// @brief Read per-vertex data for a group of subjects from a FreeSurfer SUBJECTS_DIR into a single, contiguous matrix.
+  /// @details The file for a subject is `<subjects_dir>/<subject>/surf/<hemi>.<measure>`, and it is read with `fs::read_desc_data`, so curv, MGH and MGZ files are supported. The subjects are read in parallel if compiled with OpenMP. While reading a file, each thread asks the operating system to prefetch the file it will read next. A subject that fails to load (a missing file, an invalid format, or a vertex count different from the other subjects) does not abort the batch: its row is filled with NAN and its error message is stored in `fs::GroupData::errors`. The vertex count is taken from the first subject which can be loaded.
+  /// @param subjects the subject identifiers, e.g., from `fs::read_subjectsfile`.
+  /// @param subjects_dir path to the FreeSurfer SUBJECTS_DIR.
+  /// @param measure the file name part after the hemisphere, e.g., `thickness` or `thickness.fwhm10.fsaverage.mgh`.
+  /// @param hemi the hemisphere, `lh` or `rh`.
+  /// @param num_threads the number of threads to use if compiled with OpenMP. 0 means the OpenMP default. More threads than cores can help on network file systems, as the threads mostly wait for I/O.
+  /// @return the group data. If no subject could be loaded, `num_vertices` is 0 and `data` is empty.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// std::vector<std::string> subjects = fs::read_subjectsfile("subjects.txt");
+  /// fs::GroupData group = fs::read_group_data(subjects, "/data/study1/subjects_dir", "thickness");
+  /// if(group.num_failed() > 0) {
+  ///   // Check group.errors
+  /// }
+  /// float v = group.at(0, 1000);  // value of the first subject at vertex 1000
+  /// @endcode
+  GroupData read_group_data(const std::vector<std::string>& subjects, const std::string& subjects_dir, const std::string& measure, const std::string& hemi = "lh", int num_threads = 0) {
+    LIBFS_INSTRUMENT_SCOPE("read_group_data");
+    GroupData group;
+    group.subjects = subjects;
+    group.errors.resize(subjects.size());
+    const std::ptrdiff_t num_subjects = std::ptrdiff_t(subjects.size());
+
+    // Read subjects until the first one succeeds to determine the vertex count.
+    std::ptrdiff_t first_ok = 0;
+    std::vector<float> first_data;
+    for(; first_ok < num_subjects; first_ok++) {
+      try {
+        first_data = read_desc_data(_subject_surf_file(subjects_dir, subjects[size_t(first_ok)], hemi, measure));
+        break;
+      } catch(const std::exception& e) {
+        group.errors[size_t(first_ok)] = e.what();
       }
-      return(col);
     }
-
-    /// @brief Get the number of vertices of this parcellation (or the associated surface).
-    /// @throws std::runtime_error on invalid annot
-    size_t num_vertices() const {
-      size_t nv = this->vertex_indices.size();
-      if(this->vertex_labels.size() != nv) {
-        throw std::runtime_error("Inconsistent annot, number of vertex indices and labels does not match.\n");
-      }
-      return nv;
+    if(first_ok == num_subjects) {
+      return group;
     }
-
-    /// @brief Compute the region indices in the Colortable for all vertices in this brain surface parcellation. With the region indices, it becomes very easy to obtain all region names, labels, and color channel values from the Colortable.
-    /// @see The function `vertex_region_names` uses this function to get the region names for all vertices.
-    std::vector<size_t> vertex_regions() const {
-      std::vector<size_t> vert_reg;
-      for(size_t i=0; i<this->num_vertices(); i++) {
-        vert_reg.push_back(0);  // init with zeros.
+    group.num_vertices = first_data.size();
+    const size_t nv = group.num_vertices;
+    group.data.assign(subjects.size() * nv, std::numeric_limits<float>::quiet_NaN());
+    std::copy(first_data.begin(), first_data.end(), group.data.begin() + first_ok * std::ptrdiff_t(nv));
+    first_data = std::vector<float>();
+
+    #ifdef _OPENMP
+    if(num_threads <= 0) {
+      num_threads = omp_get_max_threads();
+    }
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads)
+    #else
+    (void)num_threads;
+    #endif
+    for(std::ptrdiff_t i = first_ok + 1; i < num_subjects; i++) {
+      int stride = 1;
+      #ifdef _OPENMP
+      stride = omp_get_num_threads();
+      #endif
+      if(i + stride < num_subjects) {
+        _prefetch_file(_subject_surf_file(subjects_dir, subjects[size_t(i + stride)], hemi, measure));
       }
-      for(size_t region_idx=0; region_idx<this->colortable.num_entries(); region_idx++) {
-        std::vector<int32_t> reg_vertices = this->region_vertices(this->colortable.label[region_idx]);
-        for(size_t region_vert_local_idx=0;  region_vert_local_idx<reg_vertices.size(); region_vert_local_idx++) {
-          int32_t region_vert_idx = reg_vertices[region_vert_local_idx];
-          vert_reg[region_vert_idx] = region_idx;
+      try {
+        std::vector<float> values = read_desc_data(_subject_surf_file(subjects_dir, subjects[size_t(i)], hemi, measure));
+        if(values.size() != nv) {
+          group.errors[size_t(i)] = "Vertex count mismatch: expected " + std::to_string(nv) + " values, but file contains " + std::to_string(values.size()) + ".";
+        } else {
+          std::copy(values.begin(), values.end(), group.data.begin() + i * std::ptrdiff_t(nv));
         }
+      } catch(const std::exception& e) {
+        group.errors[size_t(i)] = e.what();
       }
-      return vert_reg;
     }
+    return group;
+  }
 
-    /// @brief Compute the region names in the Colortable for all vertices in this brain surface parcellation.
-    std::vector<std::string> vertex_region_names() const {
-      std::vector<std::string> region_names;
-      std::vector<size_t> vertex_region_indices = this->vertex_regions();
-      for(size_t i=0; i<this->num_vertices(); i++) {
-        region_names.push_back(this->colortable.name[vertex_region_indices[i]]);
-      }
-      return(region_names);
+  /// @brief Read a surface mesh for each subject of a group from a FreeSurfer SUBJECTS_DIR, in parallel if compiled with OpenMP.
+  /// @details The file for a subject is `<subjects_dir>/<subject>/surf/<hemi>.<surface>`. Failures do not abort the batch, see `fs::read_group_data`.
+  /// @param subjects the subject identifiers, e.g., from `fs::read_subjectsfile`.
+  /// @param subjects_dir path to the FreeSurfer SUBJECTS_DIR.
+  /// @param surface the surface name, e.g., `white` or `pial`.
+  /// @param hemi the hemisphere, `lh` or `rh`.
+  /// @param errors optional output, may be `nullptr`. One error message per subject, empty if the mesh was loaded successfully.
+  /// @param num_threads the number of threads to use if compiled with OpenMP. 0 means the OpenMP default.
+  /// @return one mesh per subject. The meshes of subjects which failed to load are empty.
+  std::vector<Mesh> read_group_surfaces(const std::vector<std::string>& subjects, const std::string& subjects_dir, const std::string& surface, const std::string& hemi = "lh", std::vector<std::string>* errors = nullptr, int num_threads = 0) {
+    std::vector<Mesh> meshes(subjects.size());
+    std::vector<std::string> errs(subjects.size());
+    const std::ptrdiff_t num_subjects = std::ptrdiff_t(subjects.size());
+    #ifdef _OPENMP
+    if(num_threads <= 0) {
+      num_threads = omp_get_max_threads();
     }
-  };
-
-
-  /// Models the header of an MGH file.
-  struct MghHeader {
-    MghHeader() {}  ///< Empty default constuctor.
-    MghHeader(Curv curv) {  ///< Constuctor to fill header from a Curv instance.
-      dim1length = curv.data.size();
-      dim2length = 1;
-      dim3length = 1;
-      dim4length = 1;
-      dtype = fs::MRI_FLOAT;
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads)
+    #else
+    (void)num_threads;
+    #endif
+    for(std::ptrdiff_t i = 0; i < num_subjects; i++) {
+      try {
+        read_surf(&meshes[size_t(i)], _subject_surf_file(subjects_dir, subjects[size_t(i)], hemi, surface));
+      } catch(const std::exception& e) {
+        meshes[size_t(i)] = Mesh();
+        errs[size_t(i)] = e.what();
+      }
     }
-    MghHeader(std::vector<float> curv_data) { ///< Constuctor to fill header from a 1D float array (curv data).
-      dim1length = curv_data.size();
-      dim2length = 1;
-      dim3length = 1;
-      dim4length = 1;
-      dtype = fs::MRI_FLOAT;
+    if(errors != nullptr) {
+      errors->swap(errs);
     }
-    int32_t dim1length = 0;  ///< size of data along 1st dimension
-    int32_t dim2length = 0;  ///< size of data along 2nd dimension
-    int32_t dim3length = 0;  ///< size of data along 3rd dimension
-    int32_t dim4length = 0;  ///< size of data along 4th dimension
-
-    int32_t dtype = 0;  ///< the MRI data type
-    int32_t dof = 0;  ///< typically ignored
-    int16_t ras_good_flag = 0; ///< flag indicating whether the data in the RAS fields (Mdc, Pxyz_c) are valid. 1 means valid, everything else means invalid.
+    return meshes;
+  }
 
-    /// @brief Compute the number of values based on the dim*length header fields.
-    size_t num_values() const {
-      return((size_t) dim1length * dim2length * dim3length * dim4length);
+  /// @brief Metadata of a FreeSurfer file, read from its header only. See `fs::probe_file`.
+  struct FileInfo {
+    std::string filename;  ///< The path of the file.
+    int format = FILEFORMAT_UNKNOWN;  ///< The file format, one of `fs::FILEFORMAT_CURV`, `fs::FILEFORMAT_SURF`, `fs::FILEFORMAT_ANNOT`, `fs::FILEFORMAT_MGH` or `fs::FILEFORMAT_UNKNOWN`.
+    int32_t num_vertices = -1;  ///< The number of vertices, for curv, surf and annot files. -1 for other formats.
+    int32_t num_faces = -1;  ///< The number of faces, for surf files and the (unreliable) num_faces field of curv files. -1 for other formats.
+    MghHeader mgh_header;  ///< The header, for MGH and MGZ files.
+    Colortable colortable;  ///< The color table, for annot files.
+    std::string error;  ///< The error message if the header could not be read, empty otherwise.
+
+    /// @brief Whether the file is in a known format and its header was read successfully.
+    bool ok() const {
+      return this->format != FILEFORMAT_UNKNOWN && this->error.empty();
     }
-
-    float xsize = 0.0;  ///< size of voxels along 1st axis (x or r)
-    float ysize = 0.0;  ///< size of voxels along 2nd axis (y or a)
-    float zsize = 0.0;  ///< size of voxels along 3rd axis (z or s)
-    std::vector<float> Mdc;  ///< matrix
-    std::vector<float> Pxyz_c;  ///< x,y,z coordinates of central vertex
-  };
-
-  /// Models the data of an MGH file. Currently these are 1D vectors, but one can compute the 4D array using the dimXlength fields of the respective MghHeader.
-  struct MghData {
-    MghData() {}
-    MghData(std::vector<int32_t> curv_data) { data_mri_int = curv_data; }  ///< constructor to create MghData from MRI_INT (int32_t) data.
-    explicit MghData(std::vector<uint8_t> curv_data) { data_mri_uchar = curv_data; }  ///< constructor to create MghData from MRI_UCHAR (uint8_t) data.
-    explicit MghData(std::vector<short> curv_data) { data_mri_short = curv_data; }  ///< constructor to create MghData from MRI_SHORT (short) data.
-    MghData(std::vector<float> curv_data) { data_mri_float = curv_data; }  ///< constructor to create MghData from MRI_FLOAT (float) data.
-    MghData(Curv curv) { data_mri_float = curv.data; }  ///< constructor to create MghData from a Curv instance
-    std::vector<int32_t> data_mri_int;  ///< data of type MRI_INT, check the dtype to see whether this is relevant for this instance.
-    std::vector<uint8_t> data_mri_uchar;  ///< data of type MRI_UCHAR, check the dtype to see whether this is relevant for this instance.
-    std::vector<float> data_mri_float;  ///< data of type MRI_FLOAT, check the dtype to see whether this is relevant for this instance.
-    std::vector<short> data_mri_short;  ///< data of type MRI_SHORT, check the dtype to see whether this is relevant for this instance.
   };
 
-  /// Models a whole MGH file.
-  struct Mgh {
-    MghHeader header;  ///< Header for this MGH instance.
-    MghData data;  ///< 4D data for this MGH instance.
-    Mgh() {}  ///< Empty default constuctor.
-    Mgh(Curv curv) {  ///< Constuctor to create MGH instance from Curv instance.
-      header = MghHeader(curv);
-      data = MghData(curv);
-    }
-    Mgh(std::vector<float> curv_data) {  ///< Constuctor to create MGH instance from a 1D float array (curv data).
-      header = MghHeader(curv_data);
-      data = MghData(curv_data);
+  /// @brief Read the metadata of a FreeSurfer file from its header, without reading the data.
+  /// @details Files with names ending in `.mgh`, `.MGH` or an MGZ extension (see `fs::util::is_mgz_filename`) are read as MGH files with `fs::read_mgh_header`, and files ending in `.annot` as annotations with `fs::read_annot_header`. For all other files, the format is detected from the magic number, as curv and surf files typically have no file extension, and the header is parsed from the same single read. Other files, e.g., labels or text files, get format `fs::FILEFORMAT_UNKNOWN`.
+  /// @param filename the file to probe.
+  /// @return the metadata. This function does not throw: if the file cannot be read or its header is invalid, the error message is stored in `fs::FileInfo::error`.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::FileInfo info = fs::probe_file("subject1/surf/lh.white");
+  /// if(info.ok() && info.format == fs::FILEFORMAT_SURF) {
+  ///   std::cout << info.num_vertices << " vertices.\n";
+  /// }
+  /// @endcode
+  FileInfo probe_file(const std::string& filename) {
+    FileInfo info;
+    info.filename = filename;
+    try {
+      if(fs::util::ends_with(filename, {".MGH", ".mgh"}) || fs::util::is_mgz_filename(filename)) {
+        info.format = FILEFORMAT_MGH;
+        read_mgh_header(&info.mgh_header, filename);
+      } else if(fs::util::ends_with(filename, ".annot")) {
+        info.format = FILEFORMAT_ANNOT;
+        AnnotHeader header;
+        read_annot_header(&header, filename);
+        info.num_vertices = header.num_vertices;
+        info.colortable = std::move(header.colortable);
+      } else {
+        char buffer[1024];
+        size_t num_read = 0;
+        if(! _read_file_prefix(filename, buffer, sizeof(buffer), &num_read)) {
+          throw std::runtime_error("Unable to open file '" + filename + "'.\n");
+        }
+        const unsigned char* ubuf = reinterpret_cast<const unsigned char*>(buffer);
+        const int magic = num_read >= 3 ? (int(ubuf[0]) << 16) | (int(ubuf[1]) << 8) | int(ubuf[2]) : -1;
+        if(magic == 16777215) {
+          info.format = FILEFORMAT_CURV;
+          Curv curv;
+          fs::util::MemInBuf buf(buffer, num_read);
+          std::istream is(&buf);
+          _read_curv_header(&curv, &is, filename);
+          info.num_vertices = curv.num_vertices;
+          info.num_faces = curv.num_faces;
+        } else if(magic == 16777214) {
+          info.format = FILEFORMAT_SURF;
+          SurfHeader header;
+          _read_surf_header_prefix(&header, buffer, num_read, sizeof(buffer), filename);
+          info.num_vertices = header.num_vertices;
+          info.num_faces = header.num_faces;
+        }
+      }
+    } catch(const std::exception& e) {
+      info.error = e.what();
     }
-  };
-
-  /// @brief A simple 4D array datastructure, useful for representing volume data.
-  /// @details By convention, for FreeSurfer data, the order of the 4 dimensions is: *time*, *x*, *y*, *z*.
-  template<class T>
-  struct Array4D {
-    /// Constructor for creating an empty 4D array of the given dimensions.
-    Array4D(unsigned int d1, unsigned int d2, unsigned int d3, unsigned int d4) :
-      d1(d1), d2(d2), d3(d3), d4(d4), data(d1*d2*d3*d4) {}
-
-    /// Constructor for creating an empty 4D array based on dimensions specified in an fs::MghHeader.
-    Array4D(MghHeader *mgh_header) :
-      d1(mgh_header->dim1length), d2(mgh_header->dim2length), d3(mgh_header->dim3length), d4(mgh_header->dim4length), data(d1*d2*d3*d4) {}
-
-    /// Constructor for creating an empty 4D array based on dimensions specified in the header of an fs::Mgh. Does not init the data.
-    Array4D(Mgh *mgh) : // This does NOT init the data atm.
-      d1(mgh->header.dim1length), d2(mgh->header.dim2length), d3(mgh->header.dim3length), d4(mgh->header.dim4length), data(d1*d2*d3*d4) {}
+    return info;
+  }
 
-    /// Get the value at the given 4D position.
-    const T& at(const unsigned int i1, const unsigned int i2, const unsigned int i3, const unsigned int i4) const {
-      return data[get_index(i1, i2, i3, i4)];
+  /// @brief Read the metadata of many FreeSurfer files from their headers, in parallel if compiled with OpenMP.
+  /// @details See `fs::probe_file`. Only the headers are read, so this is bound by the file open and seek latency of the file system rather than by parsing, and a few times more threads than cores can help on network file systems.
+  /// @param filenames the files to probe.
+  /// @param num_threads the number of threads to use, ignored without OpenMP. If zero or negative, the OpenMP default is used.
+  /// @return the metadata, in the order of `filenames`. Errors do not abort the batch, check `fs::FileInfo::error`.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// std::vector<fs::FileInfo> infos = fs::probe_files({"lh.white", "lh.thickness", "brain.mgz"});
+  /// @endcode
+  std::vector<FileInfo> probe_files(const std::vector<std::string>& filenames, int num_threads = 0) {
+    LIBFS_INSTRUMENT_SCOPE("probe_files");
+    const std::ptrdiff_t num_files = std::ptrdiff_t(filenames.size());
+    std::vector<FileInfo> infos(filenames.size());
+    #ifdef _OPENMP
+    if(num_threads <= 0) {
+      num_threads = omp_get_max_threads();
     }
-
-    /// Get the index in the vector for the given 4D position.
-    unsigned int get_index(const unsigned int i1, const unsigned int i2, const unsigned int i3, const unsigned int i4) const {
-      assert(i1 >= 0 && i1 < d1);
-      assert(i2 >= 0 && i2 < d2);
-      assert(i3 >= 0 && i3 < d3);
-      assert(i4 >= 0 && i4 < d4);
-      return (((i1*d2 + i2)*d3 + i3)*d4 + i4);
+    #pragma omp parallel for schedule(dynamic, 16) num_threads(num_threads)
+    #else
+    (void)num_threads;
+    #endif
+    for(std::ptrdiff_t i = 0; i < num_files; i++) {
+      infos[size_t(i)] = probe_file(filenames[size_t(i)]);
     }
+    LIBFS_INSTRUMENT_COUNT("probe_files.files", filenames.size());
+    return infos;
+  }
 
-    /// Get number of values/voxels.
-    unsigned int num_values() const {
-      return(d1*d2*d3*d4);
+  /// @brief Read the metadata of all FreeSurfer files in a directory tree, e.g., a whole SUBJECTS_DIR, in parallel if compiled with OpenMP.
+  /// @details The subdirectories of `dir` (e.g., the subjects) are walked in parallel, and then all files are probed in parallel with `fs::probe_files`. Files of unknown format, e.g., labels, text files or files that could not be opened to detect their format, are not included in the result.
+  /// @param dir the root directory.
+  /// @param recursive whether to descend into subdirectories.
+  /// @param num_threads the number of threads to use, ignored without OpenMP. If zero or negative, the OpenMP default is used.
+  /// @return the metadata, in the order of `fs::util::list_files`.
+  /// @throws runtime_error if `dir` cannot be opened.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// std::vector<fs::FileInfo> infos = fs::probe_dir("/data/study1/subjects");
+  /// for(const fs::FileInfo& info : infos) {
+  ///   if(info.format == fs::FILEFORMAT_MGH) {
+  ///     std::cout << info.filename << ": " << info.mgh_header.dim1length << " x " << info.mgh_header.dim2length << "\n";
+  ///   }
+  /// }
+  /// @endcode
+  std::vector<FileInfo> probe_dir(const std::string& dir, const bool recursive = true, int num_threads = 0) {
+    std::vector<std::string> files;
+    std::vector<std::string> subdirs;
+    if(! fs::util::_list_dir(dir, &files, &subdirs)) {
+      throw std::runtime_error("Unable to open directory '" + dir + "'.\n");
+    }
+    if(recursive) {
+      std::vector<std::vector<std::string>> subdir_files(subdirs.size());
+      const std::ptrdiff_t num_subdirs = std::ptrdiff_t(subdirs.size());
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(dynamic, 1) num_threads(num_threads > 0 ? num_threads : omp_get_max_threads())
+      #endif
+      for(std::ptrdiff_t i = 0; i < num_subdirs; i++) {
+        fs::util::_walk_dir(subdirs[size_t(i)], &subdir_files[size_t(i)]);
+      }
+      for(size_t i = 0; i < subdir_files.size(); i++) {
+        files.insert(files.end(), subdir_files[i].begin(), subdir_files[i].end());
+      }
     }
+    std::vector<FileInfo> infos = probe_files(files, num_threads);
+    infos.erase(std::remove_if(infos.begin(), infos.end(), [](const FileInfo& info) { return info.format == FILEFORMAT_UNKNOWN; }), infos.end());
+    return infos;
+  }
 
-    unsigned int d1;  ///< size of data along 1st dimension
-    unsigned int d2;  ///< size of data along 2nd dimension
-    unsigned int d3;  ///< size of data along 3rd dimension
-    unsigned int d4;  ///< size of data along 4th dimension
-    std::vector<T> data;  ///< the data, as a 1D vector. Use fs::Array4D::at for easy access in 4D.
-  };
 
-  // More declarations, should also go to separate header.
-  void read_mgh_header(MghHeader*, const std::string&);
-  void read_mgh_header(MghHeader*, std::istream*);
-  template <typename T> std::vector<T> _read_mgh_data(MghHeader*, const std::string&);
-  template <typename T> std::vector<T> _read_mgh_data(MghHeader*, std::istream*);
-  std::vector<int32_t> _read_mgh_data_int(MghHeader*, const std::string&);
-  std::vector<int32_t> _read_mgh_data_int(MghHeader*, std::istream*);
-  std::vector<uint8_t> _read_mgh_data_uchar(MghHeader*, const std::string&);
-  std::vector<uint8_t> _read_mgh_data_uchar(MghHeader*, std::istream*);
-  std::vector<short> _read_mgh_data_short(MghHeader*, const std::string&);
-  std::vector<short> _read_mgh_data_short(MghHeader*, std::istream*);
-  std::vector<float> _read_mgh_data_float(MghHeader*, const std::string&);
-  std::vector<float> _read_mgh_data_float(MghHeader*, std::istream*);
+  /// @brief Per-vertex statistics across subjects, see `fs::GroupMatrix::vertex_stats` and `fs::VertexWelford`.
+  /// @details NAN values are ignored. For vertices without any valid value, all statistics are NAN. The standard deviation is the sample standard deviation (divisor n - 1), which is NAN for vertices with less than 2 values.
+  struct VertexStats {
+    std::vector<int32_t> count;  ///< The number of non-NAN values per vertex.
+    std::vector<float> mean;  ///< The mean per vertex.
+    std::vector<float> stddev;  ///< The sample standard deviation per vertex.
+    std::vector<float> min;  ///< The minimum per vertex.
+    std::vector<float> max;  ///< The maximum per vertex.
 
+    /// Return the number of vertices.
+    size_t num_vertices() const {
+      return this->count.size();
+    }
+  };
 
-  /// @brief Read a FreeSurfer volume file in MGH format into the given Mgh struct.
-  /// @param mgh An Mgh instance that should be filled with the data from the filename.
-  /// @param filename Path to the input MGH file.
-  /// @see There exists an overloaded version that reads from a stream.
-  /// @throws runtime_error if the file uses an unsupported MRI data type.
+  /// @brief Add one value per vertex for a range of vertices to running Welford accumulators, ignoring NAN values.
+  /// @details The loop is branchless, so the compiler can vectorize it over the vertices.
   ///
-  /// #### Examples
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  inline void _welford_update(const float* x, size_t n, int32_t* count, double* mean, double* m2, float* vmin, float* vmax) {
+    const std::ptrdiff_t len = std::ptrdiff_t(n);
+    #ifdef _OPENMP
+    #pragma omp simd
+    #endif
+    for(std::ptrdiff_t i = 0; i < len; i++) {
+      const float xi = x[i];
+      const bool valid = xi == xi;  // false for NAN
+      const int32_t c = count[i] + (valid ? 1 : 0);
+      const double xd = valid ? double(xi) : mean[i];
+      const double delta = xd - mean[i];
+      const double new_mean = mean[i] + delta / double(c > 0 ? c : 1);
+      m2[i] += delta * (xd - new_mean);
+      mean[i] = new_mean;
+      count[i] = c;
+      vmin[i] = (valid && xi < vmin[i]) ? xi : vmin[i];
+      vmax[i] = (valid && xi > vmax[i]) ? xi : vmax[i];
+    }
+  }
+
+  /// @brief Write the statistics for a range of vertices from Welford accumulators.
   ///
-  /// @code
-  /// fs::Mgh mgh;
-  /// fs::read_mgh(&mgh, "somebrain.mgh");
-  /// @endcode
-  void read_mgh(Mgh* mgh, const std::string& filename) {
-    MghHeader mgh_header;
-    read_mgh_header(&mgh_header, filename);
-    mgh->header = mgh_header;
-    if(mgh->header.dtype == MRI_INT) {
-      std::vector<int32_t> data = _read_mgh_data_int(&mgh_header, filename);
-      mgh->data.data_mri_int = data;
-    } else if(mgh->header.dtype == MRI_UCHAR) {
-      std::vector<uint8_t> data = _read_mgh_data_uchar(&mgh_header, filename);
-      mgh->data.data_mri_uchar = data;
-    } else if(mgh->header.dtype == MRI_FLOAT) {
-      std::vector<float> data = _read_mgh_data_float(&mgh_header, filename);
-      mgh->data.data_mri_float = data;
-    } else if(mgh->header.dtype == MRI_SHORT) {
-      std::vector<short> data = _read_mgh_data_short(&mgh_header, filename);
-      mgh->data.data_mri_short = data;
-    } else {
-      #ifdef LIBFS_DBG_INFO
-      if(fs::util::ends_with(filename, ".mgz")) {
-        std::cout << LIBFS_APPTAG << "Note: your MGH filename ends with '.mgz'. Keep in mind that MGZ format is not supported directly. You can ignore this message if you wrapped a gz stream.\n";
-      }
-      #endif
-      throw std::runtime_error("Not reading MGH data from file '" + filename + "', data type " + std::to_string(mgh->header.dtype) + " not supported yet.\n");
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  inline void _welford_finalize(size_t n, const int32_t* count, const double* mean, const double* m2, const float* vmin, const float* vmax, VertexStats* stats, size_t offset) {
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    for(size_t i = 0; i < n; i++) {
+      const size_t o = offset + i;
+      stats->count[o] = count[i];
+      stats->mean[o] = count[i] > 0 ? float(mean[i]) : nan;
+      stats->stddev[o] = count[i] > 1 ? float(std::sqrt(m2[i] / double(count[i] - 1))) : nan;
+      stats->min[o] = count[i] > 0 ? vmin[i] : nan;
+      stats->max[o] = count[i] > 0 ? vmax[i] : nan;
     }
   }
 
-  /// @brief Read a vector of subject identifiers from a FreeSurfer subjects file.
-  /// @param filename a text file that contains one subject identifier per line.
-  /// @throws runtime_error if the file cannot be read
+  /// @brief Running per-vertex statistics, updated one subject at a time with Welford's algorithm.
+  /// @details Use this to compute group statistics without holding the data of all subjects in memory. NAN values are ignored. Accumulators for disjoint sets of subjects can be combined with `merge`, e.g., when several threads or processes each handle a part of the subjects.
   ///
   /// #### Examples
   ///
   /// @code
-  /// std::vector<std::string> subjects = fs::read_subjectsfile("subjects.txt");
+  /// fs::VertexWelford acc(149244);
+  /// for(const std::string& subject : subjects) {
+  ///   acc.update(fs::read_desc_data(subjects_dir + "/" + subject + "/surf/lh.thickness"));
+  /// }
+  /// fs::VertexStats stats = acc.stats();
   /// @endcode
-  std::vector<std::string> read_subjectsfile(const std::string& filename) {
-    std::vector<std::string> subjects;
-    std::ifstream input(filename, std::fstream::in);
-    std::string line;
+  struct VertexWelford {
+    std::vector<int32_t> count;  ///< The number of non-NAN values seen so far, per vertex.
+    std::vector<double> mean;  ///< The running mean per vertex.
+    std::vector<double> m2;  ///< The running sum of squared differences from the mean per vertex.
+    std::vector<float> min;  ///< The running minimum per vertex.
+    std::vector<float> max;  ///< The running maximum per vertex.
+
+    /// Construct accumulators for the given number of vertices.
+    explicit VertexWelford(size_t num_vertices) : count(num_vertices, 0), mean(num_vertices, 0.0), m2(num_vertices, 0.0),
+      min(num_vertices, std::numeric_limits<float>::infinity()), max(num_vertices, -std::numeric_limits<float>::infinity()) {}
+
+    /// Return the number of vertices.
+    size_t num_vertices() const {
+      return this->count.size();
+    }
 
-    if(! input.is_open()) {
-      throw std::runtime_error("Could not open subjects file '" + filename + "'.\n");
+    /// @brief Add the values of one subject, one value per vertex.
+    void update(const float* values) {
+      _welford_update(values, this->num_vertices(), this->count.data(), this->mean.data(), this->m2.data(), this->min.data(), this->max.data());
     }
 
-    while( std::getline( input, line ) ) {
-        subjects.push_back(line);
+    /// @brief Add the values of one subject, one value per vertex.
+    /// @throws std::invalid_argument if the number of values does not match the number of vertices.
+    void update(const std::vector<float>& values) {
+      if(values.size() != this->num_vertices()) {
+        throw std::invalid_argument("Expected " + std::to_string(this->num_vertices()) + " values, but got " + std::to_string(values.size()) + ".\n");
+      }
+      this->update(values.data());
     }
-    return(subjects);
-  }
 
-  /// @brief Read MGH data from a stream.
-  /// @param mgh An Mgh instance that should be filled with the data from the stream.
-  /// @param is Pointer to an open istream from which to read the MGH data.
-  /// @see There exists an overloaded version that reads from a file.
-  /// @throws runtime_error if the file uses an unsupported MRI data type.
-  void read_mgh(Mgh* mgh, std::istream* is) {
-    MghHeader mgh_header;
-    read_mgh_header(&mgh_header, is);
-    mgh->header = mgh_header;
-    if(mgh->header.dtype == MRI_INT) {
-      std::vector<int32_t> data = _read_mgh_data_int(&mgh_header, is);
-      mgh->data.data_mri_int = data;
-    } else if(mgh->header.dtype == MRI_UCHAR) {
-      std::vector<uint8_t> data = _read_mgh_data_uchar(&mgh_header, is);
-      mgh->data.data_mri_uchar = data;
-    } else if(mgh->header.dtype == MRI_FLOAT) {
-      std::vector<float> data = _read_mgh_data_float(&mgh_header, is);
-      mgh->data.data_mri_float = data;
-    } else if(mgh->header.dtype == MRI_SHORT) {
-      std::vector<short> data = _read_mgh_data_short(&mgh_header, is);
-      mgh->data.data_mri_short = data;
-    } else {
-      throw std::runtime_error("Not reading data from MGH stream, data type " + std::to_string(mgh->header.dtype) + " not supported yet.\n");
+    /// @brief Combine with accumulators computed for another, disjoint set of subjects (Chan et al.).
+    /// @throws std::invalid_argument if the numbers of vertices differ.
+    void merge(const VertexWelford& other) {
+      if(other.num_vertices() != this->num_vertices()) {
+        throw std::invalid_argument("Cannot merge accumulators for " + std::to_string(other.num_vertices()) + " and " + std::to_string(this->num_vertices()) + " vertices.\n");
+      }
+      for(size_t i = 0; i < this->num_vertices(); i++) {
+        const int32_t n = this->count[i] + other.count[i];
+        if(n == 0) {
+          continue;
+        }
+        const double delta = other.mean[i] - this->mean[i];
+        const double na = double(this->count[i]), nb = double(other.count[i]);
+        this->mean[i] += delta * nb / double(n);
+        this->m2[i] += other.m2[i] + delta * delta * na * nb / double(n);
+        this->count[i] = n;
+        this->min[i] = std::min(this->min[i], other.min[i]);
+        this->max[i] = std::max(this->max[i], other.max[i]);
+      }
     }
-  }
 
-  /// @brief Read an MGH header from a stream.
-  /// @param mgh_header An MghHeader instance that should be filled with the data from the stream.
-  /// @param is Pointer to an open istream from which to read the MGH data.
-  /// @see There exists an overloaded version that reads from a file.
-  /// @throws runtime_error if the file uses an unsupported MRI file format version. Only version 1 is supported (the only existing version to my knowledge).
-  void read_mgh_header(MghHeader* mgh_header, std::istream* is) {
-    const int MGH_VERSION = 1;
+    /// @brief Compute the statistics for the subjects added so far.
+    VertexStats stats() const {
+      const size_t nv = this->num_vertices();
+      VertexStats st;
+      st.count.resize(nv);
+      st.mean.resize(nv);
+      st.stddev.resize(nv);
+      st.min.resize(nv);
+      st.max.resize(nv);
+      _welford_finalize(nv, this->count.data(), this->mean.data(), this->m2.data(), this->min.data(), this->max.data(), &st, 0);
+      return st;
+    }
+  };
 
-    int format_version = _freadt<int32_t>(*is);
-    if(format_version != MGH_VERSION) {
-      throw std::runtime_error("Invalid MGH file or unsupported file format version: expected version " + std::to_string(MGH_VERSION) + ", found " + std::to_string(format_version) + ".\n");
+  /// @brief A dense subjects x vertices float matrix for group level per-vertex data, with 64 byte aligned rows.
+  /// @details Each row holds the values of one subject for all vertices. Rows are padded to a multiple of 16 floats (64 bytes), so every row starts on a cache line, and reductions over the subjects can process adjacent vertices in SIMD registers. The padding is filled with NAN.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::GroupData group = fs::read_group_data(subjects, "/data/study1/subjects_dir", "thickness");
+  /// fs::GroupMatrix m = fs::GroupMatrix::from_group_data(group);
+  /// fs::VertexStats stats = m.vertex_stats();
+  /// float mean_thickness_at_vertex_1000 = stats.mean[1000];
+  /// @endcode
+  struct GroupMatrix {
+    /// The aligned storage type.
+    typedef std::vector<float, fs::util::AlignedAllocator<float, 64> > storage_type;
+
+    size_t num_subjects = 0;  ///< The number of rows.
+    size_t num_vertices = 0;  ///< The number of columns that hold data.
+    size_t stride = 0;  ///< The distance between the starts of two rows, in floats. At least `num_vertices`, and a multiple of 16.
+    storage_type data;  ///< The values, row-major with row length `stride`.
+
+    /// Construct an empty matrix.
+    GroupMatrix() {}
+
+    /// Construct a matrix of the given size, filled with `fill_value`.
+    GroupMatrix(size_t num_subjects, size_t num_vertices, float fill_value = std::numeric_limits<float>::quiet_NaN()) :
+      num_subjects(num_subjects), num_vertices(num_vertices), stride((num_vertices + 15) / 16 * 16), data(num_subjects * ((num_vertices + 15) / 16 * 16), fill_value) {}
+
+    /// @brief Construct a matrix from group data. The rows of subjects which failed to load are NAN.
+    static GroupMatrix from_group_data(const GroupData& group) {
+      GroupMatrix m(group.num_subjects(), group.num_vertices);
+      if(m.num_vertices == 0) {
+        return m;  // Nothing to copy, and memcpy must not be called with the NULL data pointers of empty vectors.
+      }
+      for(size_t s = 0; s < m.num_subjects; s++) {
+        std::memcpy(m.row(s), group.row(s), m.num_vertices * sizeof(float));
+      }
+      return m;
     }
-    mgh_header->dim1length =  _freadt<int32_t>(*is);
-    mgh_header->dim2length =  _freadt<int32_t>(*is);
-    mgh_header->dim3length =  _freadt<int32_t>(*is);
-    mgh_header->dim4length =  _freadt<int32_t>(*is);
 
-    mgh_header->dtype =  _freadt<int32_t>(*is);
-    mgh_header->dof =  _freadt<int32_t>(*is);
+    /// Return a pointer to the first value of the given subject. The pointer is 64 byte aligned.
+    float* row(size_t subject_idx) {
+      return this->data.data() + subject_idx * this->stride;
+    }
 
-    int unused_header_space_size_left = 256;  // in bytes
-    mgh_header->ras_good_flag =  _freadt<int16_t>(*is);
-    unused_header_space_size_left -= 2; // for the ras_good_flag
+    /// Return a pointer to the first value of the given subject. The pointer is 64 byte aligned.
+    const float* row(size_t subject_idx) const {
+      return this->data.data() + subject_idx * this->stride;
+    }
 
-    // Read the RAS part of the header.
-    if(mgh_header->ras_good_flag == 1) {
-      mgh_header->xsize =  _freadt<float>(*is);
-      mgh_header->ysize =  _freadt<float>(*is);
-      mgh_header->zsize =  _freadt<float>(*is);
+    /// Return the value for the given subject and vertex.
+    float& at(size_t subject_idx, size_t vertex_idx) {
+      return this->data[subject_idx * this->stride + vertex_idx];
+    }
 
-      for(int i=0; i<9; i++) {
-        mgh_header->Mdc.push_back( _freadt<float>(*is));
+    /// Return the value for the given subject and vertex.
+    const float& at(size_t subject_idx, size_t vertex_idx) const {
+      return this->data[subject_idx * this->stride + vertex_idx];
+    }
+
+    /// @brief Set the values of one subject.
+    /// @throws std::invalid_argument if the number of values does not match the number of vertices.
+    void set_row(size_t subject_idx, const std::vector<float>& values) {
+      if(values.size() != this->num_vertices) {
+        throw std::invalid_argument("Expected " + std::to_string(this->num_vertices) + " values, but got " + std::to_string(values.size()) + ".\n");
       }
-      for(int i=0; i<3; i++) {
-        mgh_header->Pxyz_c.push_back( _freadt<float>(*is));
+      if(! values.empty()) {
+        std::memcpy(this->row(subject_idx), values.data(), values.size() * sizeof(float));
       }
-      unused_header_space_size_left -= 60;
     }
 
-    // Advance to data part. We do not seek here because that is not
-    // possible if the stream is gzip-wrapped with zstr, as in the read_mgz example.
-    uint8_t discarded;
-    while(unused_header_space_size_left > 0) {
-      discarded = _freadt<uint8_t>(*is);
-      unused_header_space_size_left -= 1;
+    /// @brief Compute NAN-aware per-vertex statistics across all subjects.
+    /// @details The vertices are processed in blocks of 512, in parallel across blocks if compiled with OpenMP. The accumulators of a block stay in the L1 cache while the rows of all subjects are streamed through them. The results do not depend on the number of threads.
+    VertexStats vertex_stats() const {
+      const size_t nv = this->num_vertices;
+      VertexStats st;
+      st.count.resize(nv);
+      st.mean.resize(nv);
+      st.stddev.resize(nv);
+      st.min.resize(nv);
+      st.max.resize(nv);
+      const size_t block_size = 512;
+      const std::ptrdiff_t num_blocks = std::ptrdiff_t((nv + block_size - 1) / block_size);
+      #ifdef _OPENMP
+      #pragma omp parallel for schedule(static)
+      #endif
+      for(std::ptrdiff_t b = 0; b < num_blocks; b++) {
+        const size_t start = size_t(b) * block_size;
+        const size_t len = std::min(block_size, nv - start);
+        int32_t count[block_size];
+        double mean[block_size];
+        double m2[block_size];
+        float vmin[block_size];
+        float vmax[block_size];
+        std::fill(count, count + len, 0);
+        std::fill(mean, mean + len, 0.0);
+        std::fill(m2, m2 + len, 0.0);
+        std::fill(vmin, vmin + len, std::numeric_limits<float>::infinity());
+        std::fill(vmax, vmax + len, -std::numeric_limits<float>::infinity());
+        for(size_t s = 0; s < this->num_subjects; s++) {
+          _welford_update(this->row(s) + start, len, count, mean, m2, vmin, vmax);
+        }
+        _welford_finalize(len, count, mean, m2, vmin, vmax, &st, start);
+      }
+      return st;
     }
-    (void)discarded; // Suppress warnings about unused variable.
-  }
 
-  /// @brief Read MRI_INT data from MGH file
+  };
+
+
+  /// Reverse the byte order of a 16 bit value, using compiler builtins where available.
   ///
   /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
   /// @private
-  std::vector<int32_t> _read_mgh_data_int(MghHeader* mgh_header, const std::string& filename) {
-    if(mgh_header->dtype != MRI_INT) {
-      std::cerr << "Expected MRI data type " << MRI_INT << ", but found " << mgh_header->dtype << ".\n";
-    }
-    return(_read_mgh_data<int32_t>(mgh_header, filename));
+  inline uint16_t _bswap16(uint16_t x) {
+    #if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap16(x);
+    #elif defined(_MSC_VER)
+    return _byteswap_ushort(x);
+    #else
+    return uint16_t((x >> 8) | (x << 8));
+    #endif
   }
 
-  /// @brief Read MRI_INT data from a stream.
+  /// Reverse the byte order of a 32 bit value, using compiler builtins where available.
   ///
   /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
   /// @private
-  std::vector<int32_t> _read_mgh_data_int(MghHeader* mgh_header, std::istream* is) {
-    if(mgh_header->dtype != MRI_INT) {
-      std::cerr << "Expected MRI data type " << MRI_INT << ", but found " << mgh_header->dtype << ".\n";
-    }
-    return(_read_mgh_data<int32_t>(mgh_header, is));
+  inline uint32_t _bswap32(uint32_t x) {
+    #if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap32(x);
+    #elif defined(_MSC_VER)
+    return _byteswap_ulong(x);
+    #else
+    return ((x >> 24) & 0xff) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+    #endif
   }
 
-  /// @brief Read MRI_SHORT data from MGH file
+  /// Reverse the byte order of a 64 bit value, using compiler builtins where available.
   ///
   /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
   /// @private
-  std::vector<short> _read_mgh_data_short(MghHeader* mgh_header, const std::string& filename) {
-    if(mgh_header->dtype != MRI_SHORT) {
-      std::cerr << "Expected MRI data type " << MRI_SHORT << ", but found " << mgh_header->dtype << ".\n";
-    }
-    return(_read_mgh_data<short>(mgh_header, filename));
+  inline uint64_t _bswap64(uint64_t x) {
+    #if defined(__GNUC__) || defined(__clang__)
+    return __builtin_bswap64(x);
+    #elif defined(_MSC_VER)
+    return _byteswap_uint64(x);
+    #else
+    return (uint64_t(_bswap32(uint32_t(x))) << 32) | _bswap32(uint32_t(x >> 32));
+    #endif
   }
 
-  /// @brief Read MRI_SHORT data from a stream.
+  /// @brief Endianness conversion kernel for spans of values of size `N` bytes.
+  /// @details The generic version reverses the bytes of each value in a loop. There are specializations for the sizes used in FreeSurfer files (1, 2, 4 and 8 bytes), which use SIMD byte shuffles (AVX2, SSSE3 or NEON, depending on the instruction sets the compiler targets) and byte swap builtins for the remainder. Source and destination may be identical, but must not overlap otherwise.
   ///
-  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// THIS STRUCT IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
   /// @private
-  std::vector<short> _read_mgh_data_short(MghHeader* mgh_header, std::istream* is) {
-    if(mgh_header->dtype != MRI_SHORT) {
-      std::cerr << "Expected MRI data type " << MRI_SHORT << ", but found " << mgh_header->dtype << ".\n";
+  template <size_t N>
+  struct _endian_kernel {
+    static void swap(const unsigned char* src, unsigned char* dst, size_t num_values) {
+      unsigned char tmp[N];
+      for(size_t i=0; i<num_values; i++) {
+        for(size_t k=0; k<N; k++) {
+          tmp[k] = src[i*N + N - k - 1];
+        }
+        std::memcpy(dst + i*N, tmp, N);
+      }
     }
-    return(_read_mgh_data<short>(mgh_header, is));
-  }
+  };
 
+  /// @private
+  template <>
+  struct _endian_kernel<1> {
+    static void swap(const unsigned char* src, unsigned char* dst, size_t num_values) {
+      if(src != dst && num_values > 0) {
+        std::memcpy(dst, src, num_values);
+      }
+    }
+  };
 
-  /// @brief Read the header of a FreeSurfer volume file in MGH format into the given MghHeader struct.
-  ///
-  /// @param mgh_header An MghHeader instance that should be filled with the data from the file.
-  /// @param filename Path to the file from which to read the MGH data.
-  /// @see There exists an overloaded version that reads from a stream.
-  /// @throws runtime_error if the file cannot be opened
-  void read_mgh_header(MghHeader* mgh_header, const std::string& filename) {
-    std::ifstream ifs;
-    ifs.open(filename, std::ios_base::in | std::ios::binary);
-    if(ifs.is_open()) {
-      read_mgh_header(mgh_header, &ifs);
-      ifs.close();
-    } else {
-      throw std::runtime_error("Unable to open MGH file '" + filename + "'.\n");
+  /// @private
+  template <>
+  struct _endian_kernel<2> {
+    static void swap(const unsigned char* src, unsigned char* dst, size_t num_values) {
+      const size_t num_bytes = num_values * 2;
+      size_t i = 0;
+      #if defined(__AVX2__)
+      const __m256i mask256 = _mm256_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+      for(; i + 32 <= num_bytes; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(v, mask256));
+      }
+      #endif
+      #if defined(__SSSE3__)
+      const __m128i mask128 = _mm_setr_epi8(1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+      for(; i + 16 <= num_bytes; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(v, mask128));
+      }
+      #elif defined(__ARM_NEON)
+      for(; i + 16 <= num_bytes; i += 16) {
+        vst1q_u8(dst + i, vrev16q_u8(vld1q_u8(src + i)));
+      }
+      #endif
+      uint16_t tmp;
+      for(; i < num_bytes; i += 2) {
+        std::memcpy(&tmp, src + i, 2);
+        tmp = _bswap16(tmp);
+        std::memcpy(dst + i, &tmp, 2);
+      }
+    }
+  };
+
+  /// @private
+  template <>
+  struct _endian_kernel<4> {
+    static void swap(const unsigned char* src, unsigned char* dst, size_t num_values) {
+      const size_t num_bytes = num_values * 4;
+      size_t i = 0;
+      #if defined(__AVX2__)
+      const __m256i mask256 = _mm256_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+      for(; i + 32 <= num_bytes; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_shuffle_epi8(v, mask256));
+      }
+      #endif
+      #if defined(__SSSE3__)
+      const __m128i mask128 = _mm_setr_epi8(3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+      for(; i + 16 <= num_bytes; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_shuffle_epi8(v, mask128));
+      }
+      #elif defined(__ARM_NEON)
+      for(; i + 16 <= num_bytes; i += 16) {
+        vst1q_u8(dst + i, vrev32q_u8(vld1q_u8(src + i)));
+      }
+      #endif
+      uint32_t tmp;
+      for(; i < num_bytes; i += 4) {
+        std::memcpy(&tmp, src + i, 4);
+        tmp = _bswap32(tmp);
+        std::memcpy(dst + i, &tmp, 4);
+      }
+    }
+  };
+
+  /// @private
+  template <>
+  struct _endian_kernel<8> {
+    static void swap(const unsigned char* src, unsigned char* dst, size_t num_values) {
+      uint64_t tmp;
+      for(size_t i = 0; i < num_values * 8; i += 8) {
+        std::memcpy(&tmp, src + i, 8);
+        tmp = _bswap64(tmp);
+        std::memcpy(dst + i, &tmp, 8);
+      }
     }
+  };
+
+  /// Swap endianness of a value.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename T>
+  T _swap_endian(T u) {
+      static_assert (CHAR_BIT == 8, "CHAR_BIT != 8");
+      T dest;
+      _endian_kernel<sizeof(T)>::swap(reinterpret_cast<const unsigned char*>(&u), reinterpret_cast<unsigned char*>(&dest), 1);
+      return(dest);
   }
 
+  /// Swap endianness of all values in the source buffer and store the results in the destination buffer. The buffers may be identical, but must not overlap otherwise.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename T>
+  void _swap_endian_copy(const T* src, T* dst, size_t num_values) {
+      static_assert (CHAR_BIT == 8, "CHAR_BIT != 8");
+      _endian_kernel<sizeof(T)>::swap(reinterpret_cast<const unsigned char*>(src), reinterpret_cast<unsigned char*>(dst), num_values);
+  }
 
-  /// @brief Read arbitrary MGH data from a file.
+  /// Swap endianness of all values in a buffer in place.
   ///
   /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
-  /// @throws runtime_error if the file cannot be opened
   /// @private
   template <typename T>
-  std::vector<T> _read_mgh_data(MghHeader* mgh_header, const std::string& filename) {
-    std::ifstream ifs;
-    ifs.open(filename, std::ios_base::in | std::ios::binary);
-    if(ifs.is_open()) {
-      ifs.seekg(284, ifs.beg); // skip to end of header and beginning of data
+  void _swap_endian_span(T* values, size_t num_values) {
+      _swap_endian_copy<T>(values, values, num_values);
+  }
 
-      int num_values = int(mgh_header->num_values());
-      std::vector<T> data;
-      for(int i=0; i<num_values; i++) {
-        data.push_back( _freadt<T>(ifs));
-      }
-      ifs.close();
-      return(data);
-    } else {
-      throw std::runtime_error("Unable to open MGH file '" + filename + "'.\n");
+  /// Read a big endian value from a stream.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename T>
+  T _freadt(std::istream& is) {
+    T t;
+    is.read(reinterpret_cast<char*>(&t), sizeof(t));
+    if(! _is_bigendian()) {
+      t = _swap_endian<T>(t);
     }
+    return(t);
   }
 
-
-  /// @brief Read arbitrary MGH data from a stream. The stream must be open and at the beginning of the MGH data.
+  /// Read `num_values` consecutive big endian values from a stream into a presized buffer.
+  /// @details All values are read with a single read call and then converted to host byte order in place. This is a lot faster than calling `_freadt` once per value for large payloads like mesh coordinates or volume data. If the stream ends early, the remaining values are left untouched.
   ///
   /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
   /// @private
   template <typename T>
-  std::vector<T> _read_mgh_data(MghHeader* mgh_header, std::istream* is) {
-    int num_values = int(mgh_header->num_values());
-    std::vector<T> data;
-    for(int i=0; i<num_values; i++) {
-      data.push_back( _freadt<T>(*is));
+  void _freadt_bulk(std::istream& is, T* dest, size_t num_values) {
+    if(num_values == 0) {
+      return;
+    }
+    is.read(reinterpret_cast<char*>(dest), std::streamsize(num_values * sizeof(T)));
+    size_t num_values_read = size_t(is.gcount()) / sizeof(T);
+    #ifdef LIBFS_DBG_WARNING
+    if(num_values_read < num_values) {
+      std::cout << LIBFS_APPTAG << "Stream ended early: expected " << num_values << " values, but could only read " << num_values_read << ".\n";
+    }
+    #endif
+    if(! _is_bigendian()) {
+      _swap_endian_span<T>(dest, num_values_read);
     }
-    return(data);
   }
 
+  /// Read 3 big endian bytes as a single integer from a stream.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  int _fread3(std::istream& is) {
+    uint32_t i;
+    is.read(reinterpret_cast<char*>(&i), 3);
+    if(! _is_bigendian()) {
+      i = _swap_endian<std::uint32_t>(i);
+    }
+    i = ((i >> 8) & 0xffffff);
+    return(i);
+  }
 
-  /// @brief Read MRI_FLOAT data from MGH file
+  /// Write a value to a stream as big endian.
   ///
   /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
   /// @private
-  std::vector<float> _read_mgh_data_float(MghHeader* mgh_header, const std::string& filename) {
-    if(mgh_header->dtype != MRI_FLOAT) {
-      std::cerr << "Expected MRI data type " << MRI_FLOAT << ", but found " << mgh_header->dtype << ".\n";
+  template <typename T>
+  void _fwritet(std::ostream& os, T t) {
+    if(! _is_bigendian()) {
+      t = _swap_endian<T>(t);
     }
-    return(_read_mgh_data<float>(mgh_header, filename));
+    os.write( reinterpret_cast<const char*>( &t ), sizeof(t));
   }
 
-  /// @brief Read MRI_FLOAT data from an MGH stream
+  /// Write `num_values` consecutive values to a stream as big endian.
+  /// @details The values are converted in chunks, and each chunk is written with a single write call.
   ///
   /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
   /// @private
-  std::vector<float> _read_mgh_data_float(MghHeader* mgh_header, std::istream* is) {
-    if(mgh_header->dtype != MRI_FLOAT) {
-      std::cerr << "Expected MRI data type " << MRI_FLOAT << ", but found " << mgh_header->dtype << ".\n";
+  template <typename T>
+  void _fwritet_span(std::ostream& os, const T* values, size_t num_values) {
+    if(_is_bigendian() || sizeof(T) == 1) {
+      os.write(reinterpret_cast<const char*>(values), std::streamsize(num_values * sizeof(T)));
+      return;
+    }
+    const size_t chunk_size = 65536 / sizeof(T);  // 64 KiB per write call.
+    T chunk[chunk_size];
+    for(size_t start = 0; start < num_values; start += chunk_size) {
+      const size_t num_values_chunk = std::min(chunk_size, num_values - start);
+      _swap_endian_copy<T>(values + start, chunk, num_values_chunk);
+      os.write(reinterpret_cast<const char*>(chunk), std::streamsize(num_values_chunk * sizeof(T)));
     }
-    return(_read_mgh_data<float>(mgh_header, is));
   }
 
-  /// @brief Read MRI_UCHAR data from MGH file
+
+  /// Encode a single value of type T as big endian into memory, which need not be aligned. The counterpart of `fs::_decode_be`.
   ///
   /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
   /// @private
-  std::vector<uint8_t> _read_mgh_data_uchar(MghHeader* mgh_header, const std::string& filename) {
-    if(mgh_header->dtype != MRI_UCHAR) {
-      std::cerr << "Expected MRI data type " << MRI_UCHAR << ", but found " << mgh_header->dtype << ".\n";
+  template <typename T>
+  void _encode_be(unsigned char* dst, T t) {
+    if(! _is_bigendian()) {
+      t = _swap_endian<T>(t);
     }
-    return(_read_mgh_data<uint8_t>(mgh_header, filename));
+    std::memcpy(dst, &t, sizeof(T));
+  }
+
+  // Write big endian 24 bit integer to a stream, extracted from the first 3 bytes of an unsigned 32 bit integer.
+  //
+  // THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  void _fwritei3(std::ostream& os, uint32_t i) {
+    unsigned char b1 = ( i >> 16) & 255;
+    unsigned char b2 = ( i >> 8) & 255;
+    unsigned char b3 =  i & 255;
+
+    if(!_is_bigendian()) {
+      b1 = _swap_endian<unsigned char>(b1);
+      b2 = _swap_endian<unsigned char>(b2);
+      b3 = _swap_endian<unsigned char>(b3);
+    }
+
+    os.write( reinterpret_cast<const char*>( &b1 ), sizeof(b1));
+    os.write( reinterpret_cast<const char*>( &b2 ), sizeof(b2));
+    os.write( reinterpret_cast<const char*>( &b3 ), sizeof(b3));
   }
 
-  /// @brief Read MRI_UCHAR data from an MGH stream
+  /// Read a '\n'-terminated ASCII string from a stream.
   ///
   /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
   /// @private
-  std::vector<uint8_t> _read_mgh_data_uchar(MghHeader* mgh_header, std::istream* is) {
-    if(mgh_header->dtype != MRI_UCHAR) {
-      std::cerr << "Expected MRI data type " << MRI_UCHAR << ", but found " << mgh_header->dtype << ".\n";
-    }
-    return(_read_mgh_data<uint8_t>(mgh_header, is));
+  std::string _freadstringnewline(std::istream &is) {
+    std::string s;
+    std::getline(is, s, '\n');
+    return s;
   }
 
-  /// @brief Read a brain mesh from a file in binary FreeSurfer 'surf' format into the given Mesh instance.
-  ///
-  /// @param surface a Mesh instance representing a vertex-indexed tri-mesh. This will be filled.
-  /// @param filename The path to the file from which to read the mesh. Must be in binary FreeSurfer surf format. An example file is `surf/lh.white`.
-  /// @throws runtime_error if the file cannot be opened, domain_error if the surf file magic mismatches.
-  /// @see fs::read_mesh, a generalized version that supports other mesh file formats as well.
-  ///
-  /// #### Examples
-  ///
-  /// @code
-  /// fs::Mesh surface;
-  /// fs::read_surf(&surface, "lh.white");
-  /// @endcode
-  void read_surf(Mesh* surface, const std::string& filename) {
-    const int SURF_TRIS_MAGIC = 16777214;
-    std::ifstream is;
-    is.open(filename, std::ios_base::in | std::ios::binary);
-    if(is.is_open()) {
-      int magic = _fread3(is);
-      if(magic != SURF_TRIS_MAGIC) {
-        throw std::domain_error("Surf file '" + filename + "' magic code in header did not match: expected " + std::to_string(SURF_TRIS_MAGIC) + ", found " + std::to_string(magic) + ".\n");
-      }
-      std::string created_line = _freadstringnewline(is);
-      std::string comment_line = _freadstringnewline(is);
-      int num_verts =  _freadt<int32_t>(is);
-      int num_faces =  _freadt<int32_t>(is);
-      #ifdef LIBFS_DBG_INFO
-      std::cout << LIBFS_APPTAG << "Read surface file with " << num_verts << " vertices, " << num_faces << " faces.\n";
-      #endif
-      std::vector<float> vdata;
-      for(int i=0; i<(num_verts*3); i++) {
-        vdata.push_back( _freadt<float>(is));
-      }
-      std::vector<int> fdata;
-      for(int i=0; i<(num_faces*3); i++) {
-        fdata.push_back( _freadt<int32_t>(is));
-      }
-      is.close();
-      surface->vertices = vdata;
-      surface->faces = fdata;
-    } else {
-      throw std::runtime_error("Unable to open surface file '" + filename + "'.\n");
+  /// Read a fixed length C-style string from an open binary stream. This does not care about trailing NULL bytes or anything, it just reads the given length of bytes.
+  /// @throws std::out_of_range if length is not positive
+  /// @private
+  std::string _freadfixedlengthstring(std::istream &is, size_t length, bool strip_last_char=true) {
+    std::string str;
+    str.resize(length);
+    is.read(&str[0], length);
+    if(strip_last_char) {
+      str = str.substr(0, length-1);
     }
+    return str;
   }
 
 
-  /// @brief Read a triangular mesh from a surf, obj, or ply file into the given Mesh instance.
-  ///
-  /// @param surface a Mesh instance representing a vertex-indexed tri-mesh. This will be filled.
-  /// @param filename The path to the file from which to read the mesh. The format will be determined from the file extension as follows. File names ending with '.obj' are loaded as Wavefront OBJ files. File names ending with '.ply' are loaded as Stanford PLY files in format version 'ascii 1.0'. All other files are loaded as FreeSurfer binary surf files.
-  /// @throws runtime_error if the file cannot be opened, domain_error if the surf file magic mismatches.
+  /// @brief Get the number of bytes used to store a single value of the given MRI data type in an MGH file.
+  /// @param dtype one of `fs::MRI_UCHAR`, `fs::MRI_INT`, `fs::MRI_FLOAT` or `fs::MRI_SHORT`.
+  /// @return the size in bytes, or 0 for unknown or unsupported data types.
   ///
   /// #### Examples
   ///
   /// @code
-  /// fs::mesh surface;
-  /// fs::read_mesh(&surface, "subject1/surf/lh.thickness");
+  /// size_t nb = fs::mri_dtype_size(fs::MRI_FLOAT);  // 4
   /// @endcode
-  void read_mesh(Mesh* surface, const std::string& filename) {
-    if(fs::util::ends_with(filename, ".obj")) {
-      fs::Mesh::from_obj(surface, filename);
-    } else if(fs::util::ends_with(filename, ".ply")) {
-      fs::Mesh::from_ply(surface, filename);
-    } else if(fs::util::ends_with(filename, ".off")) {
-      fs::Mesh::from_off(surface, filename);
-    } else {
-      read_surf(surface, filename);
+  size_t mri_dtype_size(const int32_t dtype) {
+    if(dtype == MRI_UCHAR) {
+      return 1;
+    } else if(dtype == MRI_INT || dtype == MRI_FLOAT) {
+      return 4;
+    } else if(dtype == MRI_SHORT) {
+      return 2;
     }
+    return 0;
   }
 
-
-  /// @brief Determine the endianness of the system.
+  /// Decode a single big endian value of type T from memory, which need not be aligned.
   ///
   /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
-  /// @return boolean, whether the current system is big endian.
   /// @private
-  bool _is_bigendian() {
-    short int number = 0x1;
-    char *numPtr = (char*)&number;
-    //std::cout << "Platform is big endian: " << (numPtr[0] != 1) << ".\n";
-    return (numPtr[0] != 1);
-  }
-
-  /// @brief Read per-vertex brain morphometry data from a FreeSurfer curv stream.
-  /// @details The curv format is a simple binary format that stores one floating point value per vertex of a related brain surface.
-  /// @param curv A Curv instance to be filled.
-  /// @param is An open istream from which to read the curv data.
-  /// @throws domain_error if the curv file magic mismatches or the curv file header claims that the file contains more than 1 value per vertex.
-  void read_curv(Curv* curv, std::istream *is, const std::string& source_filename="") {
-    const std::string msg_source_file_part = source_filename.empty() ? "" : "'" + source_filename + "' ";
-    const int CURV_MAGIC = 16777215;
-    int magic = _fread3(*is);
-    if(magic != CURV_MAGIC) {
-      throw std::domain_error("Curv file " + msg_source_file_part + "header magic did not match: expected " + std::to_string(CURV_MAGIC) + ", found " + std::to_string(magic) + ".\n");
-    }
-    curv->num_vertices = _freadt<int32_t>(*is);
-    curv->num_faces =  _freadt<int32_t>(*is);
-    curv->num_values_per_vertex = _freadt<int32_t>(*is);
-    #ifdef LIBFS_DBG_INFO
-    std::cout << LIBFS_APPTAG << "Read curv file with " << curv->num_vertices << " vertices, " << curv->num_faces << " faces and " << curv->num_values_per_vertex << " values per vertex.\n";
-    #endif
-    if(curv->num_values_per_vertex != 1) { // Not supported, I know no case where this is used. Please submit a PR with a demo file if you have one, and let me know where it came from.
-      throw std::domain_error("Curv file " + msg_source_file_part + "must contain exactly 1 value per vertex, found " + std::to_string(curv->num_values_per_vertex) + ".\n");
-    }
-    std::vector<float> data;
-    for(int i=0; i<curv->num_vertices; i++) {
-      data.push_back( _freadt<float>(*is));
+  template <typename T>
+  T _decode_be(const unsigned char* src) {
+    T t;
+    std::memcpy(&t, src, sizeof(T));
+    if(! _is_bigendian()) {
+      t = _swap_endian<T>(t);
     }
-    curv->data = data;
+    return t;
   }
 
-
-  /// @brief Read Curv instance from a FreeSurfer curv format file.
-  /// @details The curv format is a simple binary format that stores one floating point value per vertex of a related brain surface.
-  /// @param curv A Curv instance to be filled.
-  /// @param filename Path to a file from which to read the curv data.
-  /// @throws runtime_error if the file cannot be opened, domain_error if the curv file magic mismatches or the curv file header claims that the file contains more than 1 value per vertex.
+  /// @brief A lazy, read-only view of an MGH file, backed by a memory mapping of the file.
+  /// @details Opening a view only parses the header. Values are decoded from the mapped file on access, and nothing is copied unless requested via `fs::MghView::values`. Several processes viewing the same file share the page cache. Use `fs::read_mgh_view` to open a view. The 4D index order of `fs::MghView::at` is the same as for `fs::Array4D`.
   ///
   /// #### Examples
   ///
   /// @code
-  /// fs::Curv curv;
-  /// fs::read_curv(&curv, "examples/read_curv/lh.thickness");
+  /// fs::MghView view;
+  /// fs::read_mgh_view(&view, "brain.mgh");
+  /// uint8_t val = view.at<uint8_t>(99, 99, 99, 0);
   /// @endcode
-  void read_curv(Curv* curv, const std::string& filename) {
-    std::ifstream is(filename, std::fstream::in | std::fstream::binary);
-    if(is.is_open()) {
-      read_curv(curv, &is, filename);
-      is.close();
-    } else {
-      throw std::runtime_error("Could not open curv file '" + filename + "' for reading.\n");
-    }
-  }
+  struct MghView {
+    MghHeader header;  ///< The header of the viewed MGH file.
+    util::MappedFile file;  ///< The memory mapping of the whole file.
 
-  /// Read an Annot Colortable from a stream.
-  /// @private
-  void _read_annot_colortable(Colortable* colortable, std::istream *is, int32_t num_entries) {
-    int32_t num_chars_orig_filename = _freadt<int32_t>(*is);  // The number of characters of the file this annot was built from.
+    /// Offset of the first data value in the file, in bytes.
+    static const size_t DATA_OFFSET = 284;
 
-    // It follows the name of the file this annot was built from. This is development metadata and irrelevant afaik. We skip it.
-    uint8_t discarded;
-    for(int32_t i=0; i<num_chars_orig_filename; i++) {
-      discarded = _freadt<uint8_t>(*is);
+    /// Get the number of values/voxels.
+    size_t num_values() const {
+      return header.num_values();
     }
-    (void)discarded; // Suppress warnings about unused variable.
 
-    int32_t num_entries_duplicated = _freadt<int32_t>(*is); // Yes, once more.
-    if(num_entries != num_entries_duplicated) {
-      std::cerr << "Warning: the two num_entries header fields of this annotation do not match. Use with care.\n";
+    /// @brief Get the value at the given flat index, in file order.
+    /// @throws std::domain_error if `T` does not match the MRI data type of the file.
+    template <typename T>
+    T value(const size_t idx) const {
+      _check_type<T>();
+      assert(idx < num_values());
+      return _decode_be<T>(file.data() + DATA_OFFSET + idx * sizeof(T));
     }
 
-    int32_t entry_num_chars;
-    for(int32_t i=0; i<num_entries; i++) {
-      colortable->id.push_back(_freadt<int32_t>(*is));
-      entry_num_chars = _freadt<int32_t>(*is);
-      colortable->name.push_back(_freadfixedlengthstring(*is, entry_num_chars, true));
-      colortable->r.push_back(_freadt<int32_t>(*is));
-      colortable->g.push_back(_freadt<int32_t>(*is));
-      colortable->b.push_back(_freadt<int32_t>(*is));
-      colortable->a.push_back(_freadt<int32_t>(*is));
-      colortable->label.push_back(colortable->r[i] + colortable->g[i]*256 + colortable->b[i]*65536 + colortable->a[i]*16777216);
+    /// @brief Get the value at the given 4D position.
+    /// @throws std::domain_error if `T` does not match the MRI data type of the file.
+    template <typename T>
+    T at(const size_t i1, const size_t i2, const size_t i3, const size_t i4) const {
+      assert(i1 < size_t(header.dim1length));
+      assert(i2 < size_t(header.dim2length));
+      assert(i3 < size_t(header.dim3length));
+      assert(i4 < size_t(header.dim4length));
+      return value<T>(((i1 * size_t(header.dim2length) + i2) * size_t(header.dim3length) + i3) * size_t(header.dim4length) + i4);
     }
 
-  }
-
-  /// Compute the vector index for treating a vector of length n*m as a matrix with n rows and m columns.
-  /// @private
-  size_t _vidx_2d(size_t row, size_t column, size_t row_length=3) {
-    return (row+1)*row_length -row_length + column;
-  }
-
-  /// @brief Read a FreeSurfer annotation or brain surface parcellation from an annot stream.
-  /// @details A brain parcellations contains a region table and assigns to each vertex of a surface a region.
-  /// @param annot An Annot instance to be filled.
-  /// @param is An open istream from which to read the annot data.
-  /// @throws domain_error if the file format version is not supported or the file is missing the color table.
-  void read_annot(Annot* annot, std::istream *is) {
-
-    int32_t num_vertices = _freadt<int32_t>(*is);
-    std::vector<int32_t> vertices;
-    std::vector<int32_t> labels;
-    for(int32_t i=0; i<(num_vertices*2); i++) { // The vertices and their labels are stored directly after one another: v1,v1_label,v2,v2_label,...
-        if(i % 2 == 0) {
-          vertices.push_back(_freadt<int32_t>(*is));
-        } else {
-          labels.push_back(_freadt<int32_t>(*is));
+    /// @brief Copy and decode all values into a new vector.
+    /// @throws std::domain_error if `T` does not match the MRI data type of the file.
+    template <typename T>
+    std::vector<T> values() const {
+      _check_type<T>();
+      std::vector<T> data(num_values());
+      if(! data.empty()) {
+        std::memcpy(data.data(), file.data() + DATA_OFFSET, data.size() * sizeof(T));
+        if(! _is_bigendian()) {
+          _swap_endian_span<T>(data.data(), data.size());
         }
+      }
+      return data;
     }
-    annot->vertex_indices = vertices;
-    annot->vertex_labels = labels;
-    int32_t has_colortable = _freadt<int32_t>(*is);
-    if(has_colortable == 1) {
-      int32_t num_colortable_entries_old_format = _freadt<int32_t>(*is);
-      if(num_colortable_entries_old_format > 0) {
-        throw std::domain_error("Reading annotation in old format not supported. Please open an issue and supply an example file if you need this.\n");
-      } else {
-        int32_t colortable_format_version = -num_colortable_entries_old_format; // If the value is negative, we are in new format and its absolute value is the format version.
-        if(colortable_format_version == 2) {
-          int32_t num_colortable_entries = _freadt<int32_t>(*is); // This time for real.
-          _read_annot_colortable(&annot->colortable, is, num_colortable_entries);
-        } else {
-          throw std::domain_error("Reading annotation in new format version !=2 not supported. Please open an issue and supply an example file if you need this.\n");
-        }
 
+    private:
+    template <typename T>
+    void _check_type() const {
+      if(mri_dtype_of<T>::value != header.dtype) {
+        throw std::domain_error("Requested value type for MRI data type " + std::to_string(mri_dtype_of<T>::value) + " does not match MGH data type " + std::to_string(header.dtype) + ".\n");
       }
-
-    } else {
-      throw std::domain_error("Reading annotation without colortable not supported. Maybe invalid annotation file?\n");
     }
-  }
-
+  };
 
-  /// @brief Read a FreeSurfer annotation from a file.
-  /// @param annot An Annot instance that should be filled.
-  /// @param filename Path to the label file that should be read.
-  /// @see There exists an overload to read from a stream instead.
-  /// @throws runtime_error if the file cannot be opened, domain_error if the file format version is not supported or the file is missing the color table.
+  /// @brief Open a lazy, memory mapped view of an MGH file.
+  /// @param view An MghView instance that should be filled. Its header is parsed, the data is only mapped.
+  /// @param filename Path to the input MGH file. Compressed MGZ files are not supported.
+  /// @throws std::runtime_error if the file cannot be mapped, is too small for the data described in its header, or uses an unsupported MGH format version. std::domain_error if the header uses an unsupported MRI data type or a negative dimension length.
   ///
   /// #### Examples
   ///
   /// @code
-  /// std::string annot_fname = "lh.aparc.annot";
-  /// fs::Annot annot;
-  /// fs::read_annot(&annot, annot_fname);
+  /// fs::MghView view;
+  /// fs::read_mgh_view(&view, "brain.mgh");
+  /// std::cout << "Volume has " << view.num_values() << " voxels.\n";
   /// @endcode
-  void read_annot(Annot* annot, const std::string& filename) {
-    std::ifstream is(filename, std::fstream::in | std::fstream::binary);
-    if(is.is_open()) {
-      read_annot(annot, &is);
-      is.close();
-    } else {
-      throw std::runtime_error("Could not open annot file '" + filename + "' for reading.\n");
+  void read_mgh_view(MghView* view, const std::string& filename) {
+    util::MappedFile mf(filename);
+    if(mf.size() < MghView::DATA_OFFSET) {
+      throw std::runtime_error("File '" + filename + "' is too small to be an MGH file.\n");
     }
+    std::istringstream header_is(std::string(reinterpret_cast<const char*>(mf.data()), MghView::DATA_OFFSET));
+    MghHeader header;
+    read_mgh_header(&header, &header_is);
+    const size_t value_size = mri_dtype_size(header.dtype);
+    if(value_size == 0) {
+      throw std::domain_error("Not viewing MGH data from file '" + filename + "', data type " + std::to_string(header.dtype) + " not supported.\n");
+    }
+    // Check dimension by dimension, so that neither the product of the dimensions nor the byte size can overflow.
+    const size_t max_values = (mf.size() - MghView::DATA_OFFSET) / value_size;
+    const size_t dims[4] = { size_t(header.dim1length), size_t(header.dim2length), size_t(header.dim3length), size_t(header.dim4length) };
+    if(std::find(dims, dims + 4, size_t(0)) == dims + 4) {
+      size_t num_values = 1;
+      for(size_t d = 0; d < 4; d++) {
+        if(num_values > max_values / dims[d]) {
+          throw std::runtime_error("MGH file '" + filename + "' is too small for the data described in its header.\n");
+        }
+        num_values *= dims[d];
+      }
+    }
+    view->header = header;
+    view->file = std::move(mf);
   }
 
-
-  /// @brief Read per-vertex brain morphometry data from a FreeSurfer curv format file.
-  /// @details The curv format is a simple binary format that stores one floating point value per vertex of a related brain surface.
-  /// @param filename Path to a file from which to read the curv data.
-  /// @return a vector of float values, one per vertex.
-  /// @throws runtime_error if the file cannot be opened, domain_error if the curv file magic mismatches or the curv file header claims that the file contains more than 1 value per vertex.
-  ///
-  /// #### Examples
-  ///
-  /// @code
-  /// std::string curv_fname = "lh.thickness";
-  /// std::vector<float> data = fs::read_curv_data(curv_fname);
-  /// @endcode
-  std::vector<float> read_curv_data(const std::string& filename) {
-    Curv curv;
-    read_curv(&curv, filename);
-    return(curv.data);
-  }
-
-  /// @brief Read per-vertex brain morphometry data from a FreeSurfer curv format or MGH format file.
-  /// @param filename Path to a file from which to read the data. If the name ends with '.mgh' or '.MGH', this function assumes it is an MGH file. Otherwise it assumes it is a curv file. If it is an MGH file, it must contain data of type MRI_FLOAT, and it must only contain data for one subject, i.e., all dimensions with the exception of the first one should have size 1.
-  /// @return a vector of float values, one per vertex.
-  /// @throws runtime_error if the file cannot be opened, domain_error if the curv file magic mismatches or the curv file header claims that the file contains more than 1 value per vertex.
+  /// @brief Reads a 4D MGH or MGZ file one frame, or a range of frames (a slab), at a time, into a buffer supplied by the caller.
+  /// @details In MGH files, the first dimension varies fastest and the fourth dimension, the frames (e.g., the time points of an fMRI series), slowest. Frame `f` therefore consists of the `dim1length * dim2length * dim3length` consecutive values that start at flat index `f * frame_size()` in file order, and it can be read without touching the other frames. All sizes and offsets are 64 bit, so volumes with more than 4G voxels are supported. For MGH files, frames can be read in any order, each read seeks to the frame. MGZ files are best read in ascending frame order: reading forward skips the frames in between by decompressing them, and reading backwards restarts decompression at the beginning of the file. Reading MGZ files requires that libfs is compiled with `LIBFS_WITH_ZLIB` defined.
   ///
   /// #### Examples
   ///
   /// @code
-  /// std::string curv_fname = "lh.thickness";
-  /// std::vector<float> data1 = fs::read_desc_data(curv_fname);
-  /// std::string mgh_fname = "lh.thickness.mgh";
-  /// std::vector<float> data2 = fs::read_desc_data(mgh_fname);
+  /// fs::MghFrameReader reader("bold.mgh");
+  /// std::vector<float> frame;  // Reused for all frames, so memory is allocated only once.
+  /// while(reader.read_next_frame(&frame)) {
+  ///   // Process the frame.
+  /// }
   /// @endcode
-  std::vector<float> read_desc_data(const std::string& filename) {
-    if(fs::util::ends_with(filename, {".MGH", ".mgh"})) {
-      fs::Mgh mgh;
-      fs::read_mgh(&mgh, filename);
-      assert(mgh.header.dtype == fs::MRI_FLOAT);
-      int num_gt_1 = 0;
-      std::vector<int> dims = { mgh.header.dim1length, mgh.header.dim2length, mgh.header.dim3length, mgh.header.dim4length };
-      for(size_t i = 0; i < dims.size(); i++) {
-        if(dims[i] > 1) {
-          num_gt_1++;
+  class MghFrameReader {
+    public:
+    /// Offset of the first data value in an MGH file, in bytes.
+    static const size_t DATA_OFFSET = 284;
+
+    /// @brief Open the given MGH or MGZ file and read its header.
+    /// @throws std::runtime_error if the file cannot be opened, or if it is an MGZ file and zlib support is not enabled. std::domain_error if the header uses an unsupported MRI data type.
+    explicit MghFrameReader(const std::string& filename) : _filename(filename), _next_frame(0) {
+      if(fs::util::is_mgz_filename(filename)) {
+        #ifdef LIBFS_WITH_ZLIB
+        _is.reset(new fs::util::GzIfstream(filename));
+        #else
+        throw std::runtime_error("Cannot read MGZ file '" + filename + "': libfs was compiled without zlib support, define LIBFS_WITH_ZLIB to enable it.\n");
+        #endif
+      } else {
+        std::unique_ptr<std::ifstream> ifs(new std::ifstream(filename, std::ios::in | std::ios::binary));
+        if(! ifs->is_open()) {
+          throw std::runtime_error("Unable to open MGH file '" + filename + "'.\n");
         }
+        _is.reset(ifs.release());
       }
-      if(num_gt_1 > 1) {
-        std::cerr << "MGH file '" << filename << "' contains more than one non-empty dimension. Returning concatinated data.\n";
+      read_mgh_header(&_header, _is.get());
+      if(mri_dtype_size(_header.dtype) == 0) {
+        throw std::domain_error("Not reading MGH data from file '" + filename + "', data type " + std::to_string(_header.dtype) + " not supported.\n");
       }
-      return mgh.data.data_mri_float;
+      if(! _is->seekg(std::streamoff(DATA_OFFSET))) {
+        throw std::runtime_error("MGH file '" + filename + "' is too small to contain a header.\n");
+      }
+    }
 
-    } else {
-      Curv curv;
-      read_curv(&curv, filename);
-      return(curv.data);
+    /// Get the header of the file.
+    const MghHeader& header() const {
+      return _header;
     }
-  }
 
+    /// Get the number of frames, i.e., the size of the 4th dimension.
+    size_t num_frames() const {
+      return size_t(_header.dim4length);
+    }
 
-  /// Swap endianness of a value.
-  ///
-  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
-  /// @private
-  template <typename T>
-  T _swap_endian(T u) {
+    /// Get the number of values per frame.
+    size_t frame_size() const {
+      return size_t(_header.dim1length) * size_t(_header.dim2length) * size_t(_header.dim3length);
+    }
 
-      static_assert (CHAR_BIT == 8, "CHAR_BIT != 8");
+    /// Get the index of the frame which `read_next_frame` will read.
+    size_t next_frame() const {
+      return _next_frame;
+    }
+
+    /// @brief Read `num_frames` consecutive frames, starting at `first_frame`, into `dest`, which must have space for `num_frames * frame_size()` values.
+    /// @throws std::domain_error if `T` does not match the MRI data type of the file, or if the file ends early. std::out_of_range if the frames do not exist.
+    template <typename T>
+    void read_frames(size_t first_frame, size_t num_frames, T* dest) {
+      if(mri_dtype_of<T>::value != _header.dtype) {
+        throw std::domain_error("Requested value type for MRI data type " + std::to_string(mri_dtype_of<T>::value) + " does not match MGH data type " + std::to_string(_header.dtype) + " of file '" + _filename + "'.\n");
+      }
+      if(first_frame > this->num_frames() || num_frames > this->num_frames() - first_frame) {
+        throw std::out_of_range("Cannot read frames " + std::to_string(first_frame) + " to " + std::to_string(first_frame + num_frames) + ", MGH file '" + _filename + "' has " + std::to_string(this->num_frames()) + " frames.\n");
+      }
+      const uint64_t num_values = uint64_t(num_frames) * uint64_t(this->frame_size());
+      if(first_frame != _next_frame) {
+        const uint64_t offset = uint64_t(DATA_OFFSET) + uint64_t(first_frame) * uint64_t(this->frame_size()) * sizeof(T);
+        _is->clear();
+        if(! _is->seekg(std::streamoff(offset))) {
+          throw std::domain_error("Cannot seek to frame " + std::to_string(first_frame) + " in MGH file '" + _filename + "'.\n");
+        }
+      }
+      // Read in chunks of at most 1 GiB, the std::streamsize of some platforms is 32 bit.
+      const uint64_t chunk_values = (uint64_t(1) << 30) / sizeof(T);
+      for(uint64_t done = 0; done < num_values; ) {
+        const uint64_t n = std::min(chunk_values, num_values - done);
+        _is->read(reinterpret_cast<char*>(dest + done), std::streamsize(n * sizeof(T)));
+        if(uint64_t(_is->gcount()) != n * sizeof(T)) {
+          _next_frame = SIZE_MAX;  // Force a seek on the next read.
+          throw std::domain_error("MGH file '" + _filename + "' ended early while reading frame " + std::to_string(first_frame + size_t(done / this->frame_size())) + ".\n");
+        }
+        if(! _is_bigendian()) {
+          _swap_endian_span<T>(dest + done, size_t(n));
+        }
+        done += n;
+      }
+      _next_frame = first_frame + num_frames;
+    }
+
+    /// @brief Read `num_frames` consecutive frames, starting at `first_frame`, into `buffer`, which is resized as needed. Reusing the same buffer for all reads avoids allocations.
+    /// @throws std::domain_error if `T` does not match the MRI data type of the file, or if the file ends early. std::out_of_range if the frames do not exist.
+    template <typename T>
+    void read_frames(size_t first_frame, size_t num_frames, std::vector<T>* buffer) {
+      buffer->resize(num_frames * this->frame_size());
+      this->read_frames<T>(first_frame, num_frames, buffer->data());
+    }
 
-      union
-      {
-          T u;
-          unsigned char u8[sizeof(T)];
-      } source, dest;
+    /// @brief Read a single frame into `buffer`, which is resized to `frame_size()`.
+    /// @throws std::domain_error if `T` does not match the MRI data type of the file, or if the file ends early. std::out_of_range if the frame does not exist.
+    template <typename T>
+    void read_frame(size_t frame, std::vector<T>* buffer) {
+      this->read_frames<T>(frame, 1, buffer);
+    }
 
-      source.u = u;
+    /// @brief Read the next frame into `buffer`, which is resized to `frame_size()`.
+    /// @return false if all frames have been read, in which case `buffer` is not changed.
+    /// @throws std::domain_error if `T` does not match the MRI data type of the file, or if the file ends early.
+    template <typename T>
+    bool read_next_frame(std::vector<T>* buffer) {
+      if(_next_frame >= this->num_frames()) {
+        return false;
+      }
+      this->read_frame<T>(_next_frame, buffer);
+      return true;
+    }
 
-      for (size_t k = 0; k < sizeof(T); k++)
-          dest.u8[k] = source.u8[sizeof(T) - k - 1];
+    private:
+    std::string _filename;
+    std::unique_ptr<std::istream> _is;
+    MghHeader _header;
+    size_t _next_frame;
+  };
 
-      return(dest.u);
-  }
 
-  /// Read a big endian value from a stream.
+  /// @brief A lazy, read-only view of a FreeSurfer curv file, backed by a memory mapping of the file.
+  /// @details Opening a view only parses the header, values are decoded on access. Use `fs::read_curv_view` to open a view.
   ///
-  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
-  /// @private
-  template <typename T>
-  T _freadt(std::istream& is) {
-    T t;
-    is.read(reinterpret_cast<char*>(&t), sizeof(t));
-    if(! _is_bigendian()) {
-      t = _swap_endian<T>(t);
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::CurvView view;
+  /// fs::read_curv_view(&view, "lh.thickness");
+  /// float th = view.at(100);
+  /// @endcode
+  struct CurvView {
+    int32_t num_vertices = 0;  ///< The number of vertices, i.e., values in the file.
+    int32_t num_faces = 0;  ///< The number of faces of the mesh to which this belongs, typically irrelevant and ignored.
+    util::MappedFile file;  ///< The memory mapping of the whole file.
+
+    /// Offset of the first data value in the file, in bytes.
+    static const size_t DATA_OFFSET = 15;
+
+    /// Get the value for the given vertex.
+    float at(const size_t vertex) const {
+      assert(vertex < size_t(num_vertices));
+      return _decode_be<float>(file.data() + DATA_OFFSET + vertex * sizeof(float));
     }
-    return(t);
-  }
 
-  /// Read 3 big endian bytes as a single integer from a stream.
-  ///
-  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
-  /// @private
-  int _fread3(std::istream& is) {
-    uint32_t i;
-    is.read(reinterpret_cast<char*>(&i), 3);
-    if(! _is_bigendian()) {
-      i = _swap_endian<std::uint32_t>(i);
+    /// Copy and decode all values into a new vector.
+    std::vector<float> values() const {
+      std::vector<float> data(static_cast<size_t>(num_vertices));
+      if(! data.empty()) {
+        std::memcpy(data.data(), file.data() + DATA_OFFSET, data.size() * sizeof(float));
+        if(! _is_bigendian()) {
+          _swap_endian_span<float>(data.data(), data.size());
+        }
+      }
+      return data;
     }
-    i = ((i >> 8) & 0xffffff);
-    return(i);
-  }
+  };
 
-  /// Write a value to a stream as big endian.
+  /// @brief Open a lazy, memory mapped view of a FreeSurfer curv file.
+  /// @param view A CurvView instance that should be filled.
+  /// @param filename Path to the input curv file.
+  /// @throws std::runtime_error if the file cannot be mapped or is too small for the data described in its header, domain_error if the curv file magic mismatches or the file contains more than 1 value per vertex.
   ///
-  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
-  /// @private
-  template <typename T>
-  void _fwritet(std::ostream& os, T t) {
-    if(! _is_bigendian()) {
-      t = _swap_endian<T>(t);
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::CurvView view;
+  /// fs::read_curv_view(&view, "lh.thickness");
+  /// @endcode
+  void read_curv_view(CurvView* view, const std::string& filename) {
+    const uint32_t CURV_MAGIC = 16777215;
+    util::MappedFile mf(filename);
+    if(mf.size() < CurvView::DATA_OFFSET) {
+      throw std::runtime_error("File '" + filename + "' is too small to be a curv file.\n");
     }
-    os.write( reinterpret_cast<const char*>( &t ), sizeof(t));
-  }
-
-
-  // Write big endian 24 bit integer to a stream, extracted from the first 3 bytes of an unsigned 32 bit integer.
-  //
-  // THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
-  /// @private
-  void _fwritei3(std::ostream& os, uint32_t i) {
-    unsigned char b1 = ( i >> 16) & 255;
-    unsigned char b2 = ( i >> 8) & 255;
-    unsigned char b3 =  i & 255;
-
-    if(!_is_bigendian()) {
-      b1 = _swap_endian<unsigned char>(b1);
-      b2 = _swap_endian<unsigned char>(b2);
-      b3 = _swap_endian<unsigned char>(b3);
+    const unsigned char* d = mf.data();
+    const uint32_t magic = (uint32_t(d[0]) << 16) | (uint32_t(d[1]) << 8) | uint32_t(d[2]);
+    if(magic != CURV_MAGIC) {
+      throw std::domain_error("Curv file '" + filename + "' header magic did not match: expected " + std::to_string(CURV_MAGIC) + ", found " + std::to_string(magic) + ".\n");
     }
-
-    os.write( reinterpret_cast<const char*>( &b1 ), sizeof(b1));
-    os.write( reinterpret_cast<const char*>( &b2 ), sizeof(b2));
-    os.write( reinterpret_cast<const char*>( &b3 ), sizeof(b3));
+    const int32_t num_vertices = _decode_be<int32_t>(d + 3);
+    const int32_t num_faces = _decode_be<int32_t>(d + 7);
+    const int32_t num_values_per_vertex = _decode_be<int32_t>(d + 11);
+    if(num_values_per_vertex != 1) {
+      throw std::domain_error("Curv file '" + filename + "' must contain exactly 1 value per vertex, found " + std::to_string(num_values_per_vertex) + ".\n");
+    }
+    if(num_vertices < 0 || mf.size() < CurvView::DATA_OFFSET + size_t(num_vertices) * sizeof(float)) {
+      throw std::runtime_error("Curv file '" + filename + "' is too small for the data described in its header.\n");
+    }
+    view->num_vertices = num_vertices;
+    view->num_faces = num_faces;
+    view->file = std::move(mf);
   }
 
-  /// Read a '\n'-terminated ASCII string from a stream.
-  ///
-  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
-  /// @private
-  std::string _freadstringnewline(std::istream &is) {
-    std::string s;
-    std::getline(is, s, '\n');
-    return s;
-  }
 
-  /// Read a fixed length C-style string from an open binary stream. This does not care about trailing NULL bytes or anything, it just reads the given length of bytes.
-  /// @throws std::out_of_range if length is not positive
-  /// @private
-  std::string _freadfixedlengthstring(std::istream &is, size_t length, bool strip_last_char=true) {
-    std::string str;
-    str.resize(length);
-    is.read(&str[0], length);
-    if(strip_last_char) {
-      str = str.substr(0, length-1);
-    }
-    return str;
+  /// @brief Write curv data from a memory range to a stream.
+  /// @details A curv file contains one floating point value per vertex (or a related mesh). The header is written with a single write call, and the data in large byte-swapped chunks.
+  /// @param os An output stream to which to write the data. The stream must be open, and this function will not close it after writing to it.
+  /// @param curv_data pointer to the first value to write.
+  /// @param num_values the number of values to write, i.e., the number of vertices.
+  /// @param num_faces the value for the header field `num_faces`. This is not needed afaik and typically ignored.
+  void write_curv(std::ostream& os, const float* curv_data, size_t num_values, int32_t num_faces = 100000) {
+    LIBFS_INSTRUMENT_SCOPE("write_curv");
+    LIBFS_INSTRUMENT_COUNT("write_curv.values", num_values);
+    const uint32_t CURV_MAGIC = 16777215;
+    unsigned char header[15];
+    header[0] = (CURV_MAGIC >> 16) & 255;
+    header[1] = (CURV_MAGIC >> 8) & 255;
+    header[2] = CURV_MAGIC & 255;
+    _encode_be<int32_t>(header + 3, int32_t(num_values));
+    _encode_be<int32_t>(header + 7, num_faces);
+    _encode_be<int32_t>(header + 11, 1); // Number of values per vertex.
+    os.write(reinterpret_cast<const char*>(header), sizeof(header));
+    _fwritet_span<float>(os, curv_data, num_values);
   }
 
-
   /// @brief Write curv data to a stream.
   /// @details A curv file contains one floating point value per vertex (or a related mesh).
   /// @param os An output stream to which to write the data. The stream must be open, and this function will not close it after writing to it.
   /// @param curv_data the data to write.
   /// @param num_faces the value for the header field `num_faces`. This is not needed afaik and typically ignored.
-  void write_curv(std::ostream& os, std::vector<float> curv_data, int32_t num_faces = 100000) {
-    const uint32_t CURV_MAGIC = 16777215;
-    _fwritei3(os, CURV_MAGIC);
-    _fwritet<int32_t>(os, int(curv_data.size()));
-    _fwritet<int32_t>(os, num_faces);
-    _fwritet<int32_t>(os, 1); // Number of values per vertex.
-    for(size_t i=0; i<curv_data.size(); i++) {
-       _fwritet<float>(os, curv_data[i]);
-    }
+  void write_curv(std::ostream& os, const std::vector<float>& curv_data, int32_t num_faces = 100000) {
+    write_curv(os, curv_data.data(), curv_data.size(), num_faces);
   }
 
 
@@ -2576,7 +8931,7 @@ namespace fs {
   /// // Do something with 'data' here, maybe?
   /// fs::write_curv("output.curv", data);
   /// @endcode
-  void write_curv(const std::string& filename, std::vector<float> curv_data, const int32_t num_faces = 100000) {
+  void write_curv(const std::string& filename, const std::vector<float>& curv_data, const int32_t num_faces = 100000) {
     std::ofstream ofs;
     ofs.open(filename, std::ofstream::out | std::ofstream::binary);
     if(ofs.is_open()) {
@@ -2587,87 +8942,135 @@ namespace fs {
     }
   }
 
-  /// @brief Write MGH data to a stream.
-  /// @details The MGH format is a binary, big-endian FreeSurfer file format for storing 4D data. Several data types are supported, and one has to check the header to see which one is contained in a file.
-  /// @param mgh An Mgh instance that should be written.
-  /// @param os An output stream to which to write the data. The stream must be open, and this function will not close it after writing to it.
-  /// @throws std::logic_error if the mgh header and data are inconsistent, std::domain_error if the given MRI data type is unknown or unsupported.
-  void write_mgh(const Mgh& mgh, std::ostream& os) {
-     _fwritet<int32_t>(os, 1); // MGH file format version
-     _fwritet<int32_t>(os, mgh.header.dim1length);
-     _fwritet<int32_t>(os, mgh.header.dim2length);
-     _fwritet<int32_t>(os, mgh.header.dim3length);
-     _fwritet<int32_t>(os, mgh.header.dim4length);
-
-     _fwritet<int32_t>(os, mgh.header.dtype);
-     _fwritet<int32_t>(os, mgh.header.dof);
-
-    size_t unused_header_space_size_left = 256;  // in bytes
-     _fwritet<int16_t>(os, mgh.header.ras_good_flag);
-    unused_header_space_size_left -= 2; // for RAS flag
+  /// @brief Write the fixed size header of an MGH file to a stream, with a single write call. Unused header space stays zero.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  void _write_mgh_header(const MghHeader& mgh_header, std::ostream& os) {
+    unsigned char header[MghView::DATA_OFFSET];
+    std::memset(header, 0, sizeof(header));
+    _encode_be<int32_t>(header, 1); // MGH file format version
+    _encode_be<int32_t>(header + 4, mgh_header.dim1length);
+    _encode_be<int32_t>(header + 8, mgh_header.dim2length);
+    _encode_be<int32_t>(header + 12, mgh_header.dim3length);
+    _encode_be<int32_t>(header + 16, mgh_header.dim4length);
+
+    _encode_be<int32_t>(header + 20, mgh_header.dtype);
+    _encode_be<int32_t>(header + 24, mgh_header.dof);
+    _encode_be<int16_t>(header + 28, mgh_header.ras_good_flag);
 
     // Write RAS part of of header if flag is 1.
-    if(mgh.header.ras_good_flag == 1) {
-       _fwritet<float>(os, mgh.header.xsize);
-       _fwritet<float>(os, mgh.header.ysize);
-       _fwritet<float>(os, mgh.header.zsize);
+    if(mgh_header.ras_good_flag == 1) {
+      unsigned char* ras = header + 30;
+      _encode_be<float>(ras, mgh_header.xsize);
+      _encode_be<float>(ras + 4, mgh_header.ysize);
+      _encode_be<float>(ras + 8, mgh_header.zsize);
 
       for(int i=0; i<9; i++) {
-         _fwritet<float>(os, mgh.header.Mdc[i]);
+        _encode_be<float>(ras + 12 + 4 * i, mgh_header.Mdc[i]);
       }
       for(int i=0; i<3; i++) {
-         _fwritet<float>(os, mgh.header.Pxyz_c[i]);
+        _encode_be<float>(ras + 48 + 4 * i, mgh_header.Pxyz_c[i]);
+      }
+    }
+    os.write(reinterpret_cast<const char*>(header), sizeof(header));
+  }
+
+  /// @brief Writes the data vector of an fs::MghData instance for the value type given to `apply`, see `fs::_dispatch_mri_dtype`.
+  ///
+  /// THIS STRUCT IS INTERNAL AND SHOULD NOT BE USED BY API CLIENTS.
+  /// @private
+  struct _MghDataWriter {
+    const Mgh& mgh;
+    std::ostream& os;
+
+    template <typename T>
+    void apply() {
+      const std::vector<T>& values = mgh.data.values<T>();
+      if(values.size() != mgh.header.num_values()) {
+        throw std::logic_error("Detected mismatch of MRI data type " + std::to_string(mgh.header.dtype) + " data size " + std::to_string(values.size()) + " and MGH header dim length values, which require " + std::to_string(mgh.header.num_values()) + " values.\n");
       }
+      _fwritet_span<T>(os, values.data(), values.size());
+    }
+  };
 
-      unused_header_space_size_left -= 60;
+  /// @brief Write MGH data to a stream.
+  /// @details The MGH format is a binary, big-endian FreeSurfer file format for storing 4D data. Several data types are supported, and one has to check the header to see which one is contained in a file.
+  /// @param mgh An Mgh instance that should be written.
+  /// @param os An output stream to which to write the data. The stream must be open, and this function will not close it after writing to it.
+  /// @throws std::logic_error if the mgh header and data are inconsistent, std::domain_error if the given MRI data type is unknown or unsupported.
+  void write_mgh(const Mgh& mgh, std::ostream& os) {
+    LIBFS_INSTRUMENT_SCOPE("write_mgh");
+    if(mri_dtype_size(mgh.header.dtype) == 0) {
+      throw std::domain_error("Unsupported MRI data type " + std::to_string(mgh.header.dtype) + ", cannot write MGH data.\n");
     }
+    _write_mgh_header(mgh.header, os);
+    _MghDataWriter writer = { mgh, os };
+    _dispatch_mri_dtype(mgh.header.dtype, writer);
+  }
 
-    for(size_t i=0; i<unused_header_space_size_left; i++) {  // Fill rest of header space.
-       _fwritet<uint8_t>(os, 0);
+  /// @brief Write an MGH volume with values of type `T` to a stream.
+  /// @details The MRI data type of the file is the one of `T`, the dimensions are taken from `volume.data`, and all other header fields from `volume.header`.
+  /// @param volume the volume to write.
+  /// @param os An output stream to which to write the data. The stream must be open, and this function will not close it after writing to it.
+  /// @throws std::logic_error if the data size does not match the dimensions.
+  template <typename T>
+  void write_mgh(const MghVolume<T>& volume, std::ostream& os) {
+    LIBFS_INSTRUMENT_SCOPE("write_mgh");
+    const Array4D<T>& data = volume.data;
+    if(data.data.size() != data.num_values()) {
+      throw std::logic_error("Detected mismatch of volume data size " + std::to_string(data.data.size()) + " and dimensions, which require " + std::to_string(data.num_values()) + " values.\n");
     }
+    MghHeader header = volume.header;
+    header.dim1length = int32_t(data.d1);
+    header.dim2length = int32_t(data.d2);
+    header.dim3length = int32_t(data.d3);
+    header.dim4length = int32_t(data.d4);
+    header.dtype = mri_dtype_of<T>::value;
+    _write_mgh_header(header, os);
+    _fwritet_span<T>(os, data.data.data(), data.data.size());
+  }
 
-    // Write data
-    size_t num_values = mgh.header.num_values();
-    if(mgh.header.dtype == MRI_INT) {
-      if(mgh.data.data_mri_int.size() != num_values) {
-        throw std::logic_error("Detected mismatch of MRI_INT data size and MGH header dim length values.\n");
-      }
-      for(size_t i=0; i<num_values; i++) {
-         _fwritet<int32_t>(os, mgh.data.data_mri_int[i]);
-      }
-    } else if(mgh.header.dtype == MRI_FLOAT) {
-      if(mgh.data.data_mri_float.size() != num_values) {
-        throw std::logic_error("Detected mismatch of MRI_FLOAT data size and MGH header dim length values.\n");
-      }
-      for(size_t i=0; i<num_values; i++) {
-         _fwritet<float>(os, mgh.data.data_mri_float[i]);
-      }
-    } else if(mgh.header.dtype == MRI_UCHAR) {
-      if(mgh.data.data_mri_uchar.size() != num_values) {
-        throw std::logic_error("Detected mismatch of MRI_UCHAR data size and MGH header dim length values.\n");
-      }
-      for(size_t i=0; i<num_values; i++) {
-         _fwritet<uint8_t>(os, mgh.data.data_mri_uchar[i]);
-      }
-    } else if(mgh.header.dtype == MRI_SHORT) {
-      if(mgh.data.data_mri_short.size() != num_values) {
-        throw std::logic_error("Detected mismatch of MRI_SHORT data size and MGH header dim length values.\n");
+  /// @brief Write an MGH instance or volume to a file, see `fs::write_mgh`.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename M>
+  void _write_mgh_file(const M& mgh, const std::string& filename) {
+    if(fs::util::is_mgz_filename(filename)) {
+      #ifdef LIBFS_WITH_ZLIB
+      fs::util::GzOfstream os(filename);
+      write_mgh(mgh, os);
+      os.flush();
+      if(! os.good()) {
+        throw std::runtime_error("Failed to write MGZ file '" + filename + "'.\n");
       }
-      for(size_t i=0; i<num_values; i++) {
-         _fwritet<short>(os, mgh.data.data_mri_short[i]);
+      try {
+        os.close();  // The final deflate block is written on close.
+      } catch(const std::runtime_error& err) {
+        throw std::runtime_error("Failed to write MGZ file '" + filename + "': " + err.what());
       }
+      return;
+      #else
+      throw std::runtime_error("Cannot write MGZ file '" + filename + "': libfs was compiled without zlib support, define LIBFS_WITH_ZLIB to enable it.\n");
+      #endif
+    }
+    std::ofstream ofs;
+    ofs.open(filename, std::ofstream::out | std::ofstream::binary);
+    if(ofs.is_open()) {
+      write_mgh(mgh, ofs);
+      ofs.close();
     } else {
-      throw std::domain_error("Unsupported MRI data type " + std::to_string(mgh.header.dtype) + ", cannot write MGH data.\n");
+      throw std::runtime_error("Unable to open MGH file '" + filename + "' for writing.\n");
     }
-
   }
 
   /// @brief Write MGH data to a file.
   /// @details The MGH format is a binary, big-endian FreeSurfer file format for storing 4D data. Several data types are supported, and one has to check the header to see which one is contained in a file.
   /// @param mgh An Mgh instance that should be written.
-  /// @param filename Path to an output file to which to write.
+  /// @param filename Path to an output file to which to write. If the name ends with '.mgz', '.MGZ' or '.mgh.gz', the data is gzip-compressed. This requires that libfs is compiled with `LIBFS_WITH_ZLIB` defined.
   /// @see There exists an overload to write to a stream.
-  /// @throws std::runtime_error if the file cannot be opened, std::logic_error if the mgh header and data are inconsistent, std::domain_error if the given MRI data type is unknown or unsupported.
+  /// @throws std::runtime_error if the file cannot be opened or it is an MGZ file and zlib support is not enabled, std::logic_error if the mgh header and data are inconsistent, std::domain_error if the given MRI data type is unknown or unsupported.
   ///
   /// #### Examples
   ///
@@ -2678,14 +9081,25 @@ namespace fs {
   /// fs::write_mgh(mgh, "output.mgh");
   /// @endcode
   void write_mgh(const Mgh& mgh, const std::string& filename) {
-    std::ofstream ofs;
-    ofs.open(filename, std::ofstream::out | std::ofstream::binary);
-    if(ofs.is_open()) {
-      write_mgh(mgh, ofs);
-      ofs.close();
-    } else {
-      throw std::runtime_error("Unable to open MGH file '" + filename + "' for writing.\n");
-    }
+    _write_mgh_file(mgh, filename);
+  }
+
+  /// @brief Write an MGH volume with values of type `T` to a file, see `fs::MghVolume`.
+  /// @param volume the volume to write.
+  /// @param filename Path to an output file to which to write. If the name ends with '.mgz', '.MGZ' or '.mgh.gz', the data is gzip-compressed. This requires that libfs is compiled with `LIBFS_WITH_ZLIB` defined.
+  /// @see There exists an overload to write to a stream.
+  /// @throws std::runtime_error if the file cannot be opened or it is an MGZ file and zlib support is not enabled, std::logic_error if the data size does not match the dimensions.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::MghVolume<float> vol;
+  /// fs::read_mgh_volume(&vol, "brain.mgz");
+  /// fs::write_mgh(vol, "brain_float.mgz");
+  /// @endcode
+  template <typename T>
+  void write_mgh(const MghVolume<T>& volume, const std::string& filename) {
+    _write_mgh_file(volume, filename);
   }
 
   /// Models a FreeSurfer label.
@@ -2702,20 +9116,20 @@ namespace fs {
     /// Construct a Label from the given vertices / voxel numbers and values.
     Label(std::vector<int> vertices, std::vector<float> values) {
       assert(vertices.size() == values.size());
-      vertex = vertices;
-      value = values;
-      coord_x = std::vector<float>(vertices.size(), 0.0f);
-      coord_y = std::vector<float>(vertices.size(), 0.0f);
-      coord_z = std::vector<float>(vertices.size(), 0.0f);
+      vertex = std::move(vertices);
+      value = std::move(values);
+      coord_x = std::vector<float>(vertex.size(), 0.0f);
+      coord_y = std::vector<float>(vertex.size(), 0.0f);
+      coord_z = std::vector<float>(vertex.size(), 0.0f);
     }
 
     /// Construct a Label from the given vertices / voxel numbers.
     Label(std::vector<int> vertices) {
-      vertex = vertices;
-      value = std::vector<float>(vertices.size(), 0.0f);
-      coord_x = std::vector<float>(vertices.size(), 0.0f);
-      coord_y = std::vector<float>(vertices.size(), 0.0f);
-      coord_z = std::vector<float>(vertices.size(), 0.0f);
+      vertex = std::move(vertices);
+      value = std::vector<float>(vertex.size(), 0.0f);
+      coord_x = std::vector<float>(vertex.size(), 0.0f);
+      coord_y = std::vector<float>(vertex.size(), 0.0f);
+      coord_z = std::vector<float>(vertex.size(), 0.0f);
     }
 
 
@@ -2739,6 +9153,13 @@ namespace fs {
       return(is_in);
     }
 
+    /// @brief Compute the set of vertices of the surface that are inside the label, as a packed bitset.
+    /// @details Faster and smaller than `fs::Label::vert_in_label`, and supports set operations with other labels.
+    /// @throws std::invalid_argument if a vertex index of the label is outside of `[0, surface_num_verts)`.
+    VertexMask vertex_mask(size_t surface_num_verts) const {
+      return VertexMask::from_indices(this->vertex, surface_num_verts);
+    }
+
     /// Return the number of entries (vertices/voxels) in this label.
     size_t num_entries() const {
       size_t num_ent = this->vertex.size();
@@ -2749,25 +9170,77 @@ namespace fs {
     }
   };
 
+  /// @brief Map the per-vertex data of a Curv between vertex orders, see `fs::Mesh::reorder_vertices`.
+  /// @param curv the curv, its `data` is modified in place.
+  /// @param order the vertex order: new vertex `i` is the old vertex `order[i]`.
+  /// @param inverse whether to map from the new to the old order (`true`) instead of from the old to the new order (`false`, the default).
+  /// @throws std::invalid_argument if `order` is not a permutation of the vertices of the curv.
+  void permute_vertices(fs::Curv* curv, const std::vector<int32_t>& order, const bool inverse = false) {
+    curv->data = inverse ? fs::Mesh::unpermute_vertex_data(curv->data, order) : fs::Mesh::permute_vertex_data(curv->data, order);
+  }
+
+  /// @brief Map the vertex labels of an Annot between vertex orders, see `fs::Mesh::reorder_vertices`. The `vertex_indices` stay 0 to N-1.
+  /// @param annot the annotation, its `vertex_labels` are modified in place.
+  /// @param order the vertex order: new vertex `i` is the old vertex `order[i]`.
+  /// @param inverse whether to map from the new to the old order (`true`) instead of from the old to the new order (`false`, the default).
+  /// @throws std::invalid_argument if `order` is not a permutation of the vertices of the annotation.
+  void permute_vertices(fs::Annot* annot, const std::vector<int32_t>& order, const bool inverse = false) {
+    annot->vertex_labels = inverse ? fs::Mesh::unpermute_vertex_data(annot->vertex_labels, order) : fs::Mesh::permute_vertex_data(annot->vertex_labels, order);
+  }
+
+  /// @brief Map the vertex indices of a surface Label between vertex orders, see `fs::Mesh::reorder_vertices`. The order of the label entries does not change.
+  /// @param label the label, its `vertex` indices are modified in place.
+  /// @param order the vertex order of the whole surface: new vertex `i` is the old vertex `order[i]`.
+  /// @param inverse whether to map from the new to the old order (`true`) instead of from the old to the new order (`false`, the default).
+  /// @throws std::invalid_argument if `order` is not a permutation, or the label contains a vertex index that is out of range for it.
+  void permute_vertices(fs::Label* label, const std::vector<int32_t>& order, const bool inverse = false) {
+    const std::vector<int32_t> old2new = fs::Mesh::invert_permutation(order, order.size());
+    const std::vector<int32_t>& map = inverse ? order : old2new;
+    // Check all indices first, so the label is left untouched if one is invalid.
+    for(size_t i = 0; i < label->vertex.size(); i++) {
+      const int v = label->vertex[i];
+      if(v < 0 || size_t(v) >= map.size()) {
+        throw std::invalid_argument("Label vertex index " + std::to_string(v) + " is out of range for a vertex order of length " + std::to_string(map.size()) + ".\n");
+      }
+    }
+    for(size_t i = 0; i < label->vertex.size(); i++) {
+      label->vertex[i] = map[size_t(label->vertex[i])];
+    }
+  }
+
+  /// @brief Write a mesh given as memory ranges to a stream in FreeSurfer surf format.
+  /// @details The header is written with a single write call, and the data in large byte-swapped chunks.
+  /// @param vertices pointer to the 3n vertex coordinates for n vertices.
+  /// @param num_vertex_coords the number of vertex coordinates, i.e., 3 times the number of vertices.
+  /// @param faces pointer to the 3m vertex indices for m faces.
+  /// @param num_face_indices the number of face vertex indices, i.e., 3 times the number of faces.
+  /// @param os An output stream to which to write the data. The stream must be open, and this function will not close it after writing to it.
+  void write_surf(const float* vertices, size_t num_vertex_coords, const int32_t* faces, size_t num_face_indices, std::ostream& os) {
+    LIBFS_INSTRUMENT_SCOPE("write_surf");
+    LIBFS_INSTRUMENT_COUNT("write_surf.bytes", (num_vertex_coords + num_face_indices) * 4);
+    const uint32_t SURF_TRIS_MAGIC = 16777214;
+    const char created_and_comment_lines[] = "Created by fslib\n\n";
+    const size_t comment_len = sizeof(created_and_comment_lines) - 1;
+    unsigned char header[3 + comment_len + 8];
+    header[0] = (SURF_TRIS_MAGIC >> 16) & 255;
+    header[1] = (SURF_TRIS_MAGIC >> 8) & 255;
+    header[2] = SURF_TRIS_MAGIC & 255;
+    std::memcpy(header + 3, created_and_comment_lines, comment_len);
+    _encode_be<int32_t>(header + 3 + comment_len, int32_t(num_vertex_coords / 3));  // number of vertices
+    _encode_be<int32_t>(header + 7 + comment_len, int32_t(num_face_indices / 3));  // number of faces
+    os.write(reinterpret_cast<const char*>(header), sizeof(header));
+    _fwritet_span<float>(os, vertices, num_vertex_coords);
+    _fwritet_span<int32_t>(os, faces, num_face_indices);
+  }
+
   /// @brief Write a mesh to a stream in FreeSurfer surf format.
   /// @details A surf file contains a vertex index representation of a mesh, i.e., the vertices and faces vectors.
   /// @param vertices vector of float, length 3n for n vertices. The 3D coordinates of the vertices, typically from `<Mesh_instance>.vertices`.
   /// @param faces vector of int, length 3n for n faces. The 3 vertex indices for each face, typically from `<Mesh_instance>.faces`.
   /// @param os An output stream to which to write the data. The stream must be open, and this function will not close it after writing to it.
   /// @throws std::runtime_error if the file cannot be opened.
-  void write_surf(std::vector<float> vertices, std::vector<int32_t> faces, std::ostream& os) {
-    const uint32_t SURF_TRIS_MAGIC = 16777214;
-    _fwritei3(os, SURF_TRIS_MAGIC);
-    std::string created_and_comment_lines = "Created by fslib\n\n";
-    os << created_and_comment_lines;
-    _fwritet<int32_t>(os, int(vertices.size() / 3));  // number of vertices
-    _fwritet<int32_t>(os, int(faces.size() / 3));  // number of faces
-    for(size_t i=0; i < vertices.size(); i++) {
-       _fwritet<float>(os, vertices[i]);
-    }
-    for(size_t i=0; i < faces.size(); i++) {
-       _fwritet<int32_t>(os, faces[i]);
-    }
+  void write_surf(const std::vector<float>& vertices, const std::vector<int32_t>& faces, std::ostream& os) {
+    write_surf(vertices.data(), vertices.size(), faces.data(), faces.size(), os);
   }
 
   /// @brief Write a mesh to a binary file in FreeSurfer surf format.
@@ -2783,7 +9256,7 @@ namespace fs {
   /// fs::Mesh surface = fs::Mesh::construct_cube();
   /// fs::write_surf(surface.vertices, surface.faces, "lh.cube");
   /// @endcode
-  void write_surf(std::vector<float> vertices, std::vector<int32_t> faces, const std::string& filename) {
+  void write_surf(const std::vector<float>& vertices, const std::vector<int32_t>& faces, const std::string& filename) {
     std::ofstream ofs;
     ofs.open(filename, std::ofstream::out | std::ofstream::binary);
     if(ofs.is_open()) {
@@ -2819,39 +9292,50 @@ namespace fs {
   }
 
   /// @brief Read a FreeSurfer ASCII label from a stream.
-  /// @details A label is a list of vertices (for a surface label, given by index) or voxels (for a volume label, given by the xyz coordinates) and one floating point value per vertex/voxel. Sometimes a label is only used to define a set of vertices/voxels (like a certain brain region), and the values are irrelevant (and typically left at 0.0).
+  /// @details A label is a list of vertices (for a surface label, given by index) or voxels (for a volume label, given by the xyz coordinates) and one floating point value per vertex/voxel. Sometimes a label is only used to define a set of vertices/voxels (like a certain brain region), and the values are irrelevant (and typically left at 0.0). The stream is read into memory with a single read and parsed in place, and the label vectors are reserved from the entry count in the header.
   /// @param label A Label instance that should be filled.
   /// @param is An open std::istream or derived class stream from which to read the data, e.g., std::ifstream or std::istringstream.
   /// @see There exists an overload to read from a file instead.
   /// @throws std::domain_error if the label data format is incorrect
   void read_label(Label* label, std::istream* is) {
-    std::string line;
-    int line_idx = -1;
+    LIBFS_INSTRUMENT_SCOPE("read_label");
+    const std::string buffer = util::_read_stream_to_buffer(is);
+    LIBFS_INSTRUMENT_COUNT("read_label.bytes", buffer.size());
+    util::_TextScanner sc(buffer.data(), buffer.data() + buffer.size());
+    sc.next_line();  // skip comment.
     size_t num_entries_header = 0;  // number of vertices/voxels according to header
     size_t num_entries = 0;  // number of vertices/voxels for which the file contains label entries.
-    while (std::getline(*is, line)) {
-      line_idx += 1;
-      std::istringstream iss(line);
-      if(line_idx == 0) {
-        continue; // skip comment.
-      } else {
-        if(line_idx == 1) {
-          if (!(iss >> num_entries_header)) {
-            throw std::domain_error("Could not parse entry count from label file, invalid format.\n");
-          }
-        } else {
-          int vertex; float x, y, z, value;
-          if (!(iss >> vertex >> x >> y >> z >> value)) {
-            throw std::domain_error("Could not parse line " + std::to_string(line_idx+1) + " of label file, invalid format.\n");
-          }
-          label->vertex.push_back(vertex);
-          label->coord_x.push_back(x);
-          label->coord_y.push_back(y);
-          label->coord_z.push_back(z);
-          label->value.push_back(value);
-          num_entries++;
-        }
+    if(! sc.eof()) {
+      int32_t header_count;
+      if(! sc.parse_int(&header_count) || header_count < 0) {
+        throw std::domain_error("Could not parse entry count from label file, invalid format.\n");
+      }
+      num_entries_header = size_t(header_count);
+      sc.next_line();
+    }
+    // An entry line has at least 10 characters, so a broken header cannot make us reserve more than the buffer size.
+    const size_t num_reserve = label->vertex.size() + std::min(num_entries_header, buffer.size() / 10 + 1);
+    label->vertex.reserve(num_reserve);
+    label->coord_x.reserve(num_reserve);
+    label->coord_y.reserve(num_reserve);
+    label->coord_z.reserve(num_reserve);
+    label->value.reserve(num_reserve);
+    while(! sc.eof()) {
+      if(sc.at_eol()) {
+        sc.next_line();  // skip empty lines.
+        continue;
+      }
+      int32_t vertex; float x, y, z, value;
+      if(! (sc.parse_int(&vertex) && sc.parse_float(&x) && sc.parse_float(&y) && sc.parse_float(&z) && sc.parse_float(&value))) {
+        throw std::domain_error("Could not parse line " + std::to_string(sc.line_number()) + " of label file, invalid format.\n");
       }
+      label->vertex.push_back(vertex);
+      label->coord_x.push_back(x);
+      label->coord_y.push_back(y);
+      label->coord_z.push_back(z);
+      label->value.push_back(value);
+      num_entries++;
+      sc.next_line();
     }
     if(num_entries != num_entries_header) {
       throw std::domain_error("Expected " + std::to_string(num_entries_header) + " entries from label file header, but found " + std::to_string(num_entries) + " in file, invalid label file.\n");
@@ -2891,6 +9375,7 @@ namespace fs {
   /// @param os An open output stream.
   /// @see There exists an onverload of this function to write a label to a file.
   void write_label(const Label& label, std::ostream& os) {
+    LIBFS_INSTRUMENT_SCOPE("write_label");
     const size_t num_entries = label.num_entries();
     os << "#!ascii label from subject anonymous\n" << num_entries << "\n";
     for(size_t i=0; i<num_entries; i++) {
@@ -2950,6 +9435,253 @@ namespace fs {
     }
   }
 
+  /// @brief Compute the 4x4 matrix that transforms voxel indices (column, row, slice) of a volume to scanner RAS coordinates.
+  /// @details The matrix is computed from the direction cosines `Mdc`, the voxel sizes and the RAS coordinates of the volume center `Pxyz_c` in the header, as in FreeSurfer. If the `ras_good_flag` of the header is not 1, the FreeSurfer defaults are used: coronal (LIA) orientation, 1 mm voxels and the center at the origin.
+  /// @param header the MGH header.
+  /// @return the matrix in row-major order.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::MghHeader header;
+  /// fs::read_mgh_header(&header, "brain.mgh");
+  /// std::array<float, 16> v2r = fs::vox2ras(header);
+  /// @endcode
+  std::array<float, 16> vox2ras(const MghHeader& header) {
+    const bool ras_good = header.ras_good_flag == 1 && header.Mdc.size() == 9 && header.Pxyz_c.size() == 3;
+    // The 3 columns of the direction cosine matrix, for the x, y and z voxel axes.
+    const float lia[9] = { -1.0f, 0.0f, 0.0f,  0.0f, 0.0f, -1.0f,  0.0f, 1.0f, 0.0f };
+    const float* mdc = ras_good ? header.Mdc.data() : lia;
+    const float sizes[3] = { ras_good ? header.xsize : 1.0f, ras_good ? header.ysize : 1.0f, ras_good ? header.zsize : 1.0f };
+    const float center[3] = { ras_good ? header.Pxyz_c[0] : 0.0f, ras_good ? header.Pxyz_c[1] : 0.0f, ras_good ? header.Pxyz_c[2] : 0.0f };
+    const float half[3] = { float(header.dim1length) / 2.0f, float(header.dim2length) / 2.0f, float(header.dim3length) / 2.0f };
+
+    std::array<float, 16> m;
+    for(int r = 0; r < 3; r++) {
+      float p0 = center[r];
+      for(int c = 0; c < 3; c++) {
+        m[size_t(r * 4 + c)] = mdc[c * 3 + r] * sizes[c];
+        p0 -= m[size_t(r * 4 + c)] * half[c];
+      }
+      m[size_t(r * 4 + 3)] = p0;
+    }
+    m[12] = 0.0f; m[13] = 0.0f; m[14] = 0.0f; m[15] = 1.0f;
+    return m;
+  }
+
+  /// @brief Compute the 4x4 matrix that transforms voxel indices of a volume to tkregister RAS coordinates, also known as surface RAS.
+  /// @details FreeSurfer surfaces, like `lh.white`, store their vertex coordinates in this space. It is the space of the conformed volume, with the origin at the center of the volume, independent of the scanner position.
+  /// @param header the MGH header.
+  /// @return the matrix in row-major order.
+  std::array<float, 16> vox2ras_tkr(const MghHeader& header) {
+    const bool ras_good = header.ras_good_flag == 1;
+    MghHeader h;
+    h.dim1length = header.dim1length;
+    h.dim2length = header.dim2length;
+    h.dim3length = header.dim3length;
+    h.ras_good_flag = 1;
+    h.xsize = ras_good ? header.xsize : 1.0f;
+    h.ysize = ras_good ? header.ysize : 1.0f;
+    h.zsize = ras_good ? header.zsize : 1.0f;
+    h.Mdc = { -1.0f, 0.0f, 0.0f,  0.0f, 0.0f, -1.0f,  0.0f, 1.0f, 0.0f };
+    h.Pxyz_c = { 0.0f, 0.0f, 0.0f };
+    return vox2ras(h);
+  }
+
+  /// @brief Invert a 4x4 affine transformation matrix, e.g., to get the RAS to voxel matrix from `fs::vox2ras`.
+  /// @param m the matrix in row-major order. The last row must be (0, 0, 0, 1).
+  /// @return the inverse in row-major order.
+  /// @throws std::domain_error if the matrix is singular.
+  std::array<float, 16> affine_inverse(const std::array<float, 16>& m) {
+    // Invert the 3x3 part via its adjugate, in double precision, and then the translation.
+    const double a = m[0], b = m[1], c = m[2], d = m[4], e = m[5], f = m[6], g = m[8], h = m[9], i = m[10];
+    const double det = a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+    if(std::fabs(det) < 1e-12) {
+      throw std::domain_error("Cannot invert singular affine matrix.\n");
+    }
+    double inv[9] = { (e * i - f * h), -(b * i - c * h), (b * f - c * e),
+                      -(d * i - f * g), (a * i - c * g), -(a * f - c * d),
+                      (d * h - e * g), -(a * h - b * g), (a * e - b * d) };
+    std::array<float, 16> r;
+    for(int row = 0; row < 3; row++) {
+      double t = 0.0;
+      for(int col = 0; col < 3; col++) {
+        inv[row * 3 + col] /= det;
+        r[size_t(row * 4 + col)] = float(inv[row * 3 + col]);
+        t -= inv[row * 3 + col] * double(m[size_t(col * 4 + 3)]);
+      }
+      r[size_t(row * 4 + 3)] = float(t);
+    }
+    r[12] = 0.0f; r[13] = 0.0f; r[14] = 0.0f; r[15] = 1.0f;
+    return r;
+  }
+
+  /// @brief Sample a volume frame at points along line segments, one segment per vertex, and average the valid samples.
+  /// @details The point for sample `s` of vertex `v` is `p0[v] + t_s * dir[v]`, with `num_samples` values `t_s` evenly spaced from `t_start` to `t_end`. Points are transformed to voxel space with `ras2vox` and sampled with nearest neighbor or trilinear interpolation. Samples outside the volume are ignored, and vertices without any valid sample get `outside_value`. The data is in MGH file order, i.e., the first voxel index varies fastest. The vertices are processed in parallel if compiled with OpenMP.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  template <typename T>
+  void _vol2surf_kernel(const T* data, const int32_t dims[3], const std::array<float, 16>& ras2vox, const float* p0, const float* dir, size_t num_vertices,
+                        float t_start, float t_end, size_t num_samples, int interp, float outside_value, float* out) {
+    const float* m = ras2vox.data();
+    const std::ptrdiff_t d1 = dims[0], d2 = dims[1], d3 = dims[2];
+    const std::ptrdiff_t s2 = d1, s3 = d1 * d2;  // strides of the 2nd and 3rd voxel index
+    const std::ptrdiff_t nv = std::ptrdiff_t(num_vertices);
+    const float t_step = num_samples > 1 ? (t_end - t_start) / float(num_samples - 1) : 0.0f;
+    #ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for(std::ptrdiff_t v = 0; v < nv; v++) {
+      double sum = 0.0;
+      size_t num_valid = 0;
+      for(size_t smp = 0; smp < num_samples; smp++) {
+        const float t = t_start + float(smp) * t_step;
+        float x = p0[3*v], y = p0[3*v + 1], z = p0[3*v + 2];
+        if(dir != nullptr) {
+          x += t * dir[3*v];
+          y += t * dir[3*v + 1];
+          z += t * dir[3*v + 2];
+        }
+        const float ci = m[0] * x + m[1] * y + m[2] * z + m[3];
+        const float cj = m[4] * x + m[5] * y + m[6] * z + m[7];
+        const float ck = m[8] * x + m[9] * y + m[10] * z + m[11];
+        if(interp == INTERP_NEAREST) {
+          const float ri = std::floor(ci + 0.5f), rj = std::floor(cj + 0.5f), rk = std::floor(ck + 0.5f);
+          if(!(ri >= 0.0f && rj >= 0.0f && rk >= 0.0f && ri < float(d1) && rj < float(d2) && rk < float(d3))) {
+            continue;  // Also catches NAN coordinates.
+          }
+          sum += double(data[std::ptrdiff_t(ri) + std::ptrdiff_t(rj) * s2 + std::ptrdiff_t(rk) * s3]);
+        } else {
+          if(!(ci >= 0.0f && cj >= 0.0f && ck >= 0.0f && ci <= float(d1 - 1) && cj <= float(d2 - 1) && ck <= float(d3 - 1))) {
+            continue;
+          }
+          // Clamp the lower corner, so points on the last voxel plane are valid.
+          const std::ptrdiff_t i0 = std::min(std::ptrdiff_t(ci), std::max(d1 - 2, std::ptrdiff_t(0)));
+          const std::ptrdiff_t j0 = std::min(std::ptrdiff_t(cj), std::max(d2 - 2, std::ptrdiff_t(0)));
+          const std::ptrdiff_t k0 = std::min(std::ptrdiff_t(ck), std::max(d3 - 2, std::ptrdiff_t(0)));
+          const std::ptrdiff_t di = d1 > 1 ? 1 : 0, dj = d2 > 1 ? s2 : 0, dk = d3 > 1 ? s3 : 0;
+          const float fx = ci - float(i0), fy = cj - float(j0), fz = ck - float(k0);
+          const T* c = data + i0 + j0 * s2 + k0 * s3;
+          const float c00 = float(c[0]) * (1.0f - fx) + float(c[di]) * fx;
+          const float c10 = float(c[dj]) * (1.0f - fx) + float(c[dj + di]) * fx;
+          const float c01 = float(c[dk]) * (1.0f - fx) + float(c[dk + di]) * fx;
+          const float c11 = float(c[dk + dj]) * (1.0f - fx) + float(c[dk + dj + di]) * fx;
+          const float c0 = c00 * (1.0f - fy) + c10 * fy;
+          const float c1 = c01 * (1.0f - fy) + c11 * fy;
+          sum += double(c0 * (1.0f - fz) + c1 * fz);
+        }
+        num_valid++;
+      }
+      out[v] = num_valid > 0 ? float(sum / double(num_valid)) : outside_value;
+    }
+  }
+
+  /// @brief Dispatch `fs::_vol2surf_kernel` on the MRI data type of a volume.
+  ///
+  /// THIS FUNCTION IS INTERNAL AND SHOULD NOT BE CALLED BY API CLIENTS.
+  /// @private
+  std::vector<float> _vol2surf(const Mgh& vol, size_t frame, bool surface_ras, const float* p0, const float* dir, size_t num_vertices,
+                               float t_start, float t_end, size_t num_samples, int interp, float outside_value) {
+    LIBFS_INSTRUMENT_SCOPE("vol2surf");
+    LIBFS_INSTRUMENT_COUNT("vol2surf.samples", num_vertices * num_samples);
+    if(interp != INTERP_NEAREST && interp != INTERP_TRILINEAR) {
+      throw std::invalid_argument("Invalid interpolation method " + std::to_string(interp) + ", use fs::INTERP_NEAREST or fs::INTERP_TRILINEAR.\n");
+    }
+    if(num_samples == 0) {
+      throw std::invalid_argument("The number of samples per vertex must be at least 1.\n");
+    }
+    if(vol.header.dim1length <= 0 || vol.header.dim2length <= 0 || vol.header.dim3length <= 0 || vol.header.dim4length <= 0 || frame >= size_t(vol.header.dim4length)) {
+      throw std::invalid_argument("Invalid frame " + std::to_string(frame) + " or empty volume.\n");
+    }
+    const std::array<float, 16> ras2vox = affine_inverse(surface_ras ? vox2ras_tkr(vol.header) : vox2ras(vol.header));
+    const int32_t dims[3] = { vol.header.dim1length, vol.header.dim2length, vol.header.dim3length };
+    const size_t frame_offset = frame * size_t(dims[0]) * size_t(dims[1]) * size_t(dims[2]);
+    const size_t num_values = vol.header.num_values();
+    std::vector<float> out(num_vertices);
+    if(vol.header.dtype == MRI_FLOAT && vol.data.data_mri_float.size() == num_values) {
+      _vol2surf_kernel(vol.data.data_mri_float.data() + frame_offset, dims, ras2vox, p0, dir, num_vertices, t_start, t_end, num_samples, interp, outside_value, out.data());
+    } else if(vol.header.dtype == MRI_UCHAR && vol.data.data_mri_uchar.size() == num_values) {
+      _vol2surf_kernel(vol.data.data_mri_uchar.data() + frame_offset, dims, ras2vox, p0, dir, num_vertices, t_start, t_end, num_samples, interp, outside_value, out.data());
+    } else if(vol.header.dtype == MRI_INT && vol.data.data_mri_int.size() == num_values) {
+      _vol2surf_kernel(vol.data.data_mri_int.data() + frame_offset, dims, ras2vox, p0, dir, num_vertices, t_start, t_end, num_samples, interp, outside_value, out.data());
+    } else if(vol.header.dtype == MRI_SHORT && vol.data.data_mri_short.size() == num_values) {
+      _vol2surf_kernel(vol.data.data_mri_short.data() + frame_offset, dims, ras2vox, p0, dir, num_vertices, t_start, t_end, num_samples, interp, outside_value, out.data());
+    } else {
+      throw std::domain_error("Unsupported MRI data type " + std::to_string(vol.header.dtype) + ", or data size does not match the header.\n");
+    }
+    return out;
+  }
+
+  /// @brief Sample a volume at the vertices of a surface, i.e., project volume data onto the surface.
+  /// @details The transformation from vertex coordinates to voxels is computed once from the volume header. The vertices are processed in parallel if compiled with OpenMP.
+  /// @param vol the volume, e.g., a T1 image or an fMRI frame. Any MRI data type is supported, the result is float.
+  /// @param surface the surface mesh.
+  /// @param interp `fs::INTERP_TRILINEAR` or `fs::INTERP_NEAREST`.
+  /// @param frame the frame of a 4D volume to sample.
+  /// @param surface_ras whether the vertex coordinates are in tkregister (surface) RAS space, as for FreeSurfer surfaces like `lh.white`. If false, they are assumed to be in scanner RAS space.
+  /// @param outside_value the value for vertices outside the volume.
+  /// @return per-vertex data, one value per vertex, which can be stored in a `fs::Curv`.
+  /// @throws std::invalid_argument if the interpolation method or frame is invalid, std::domain_error if the data type is not supported.
+  ///
+  /// #### Examples
+  ///
+  /// @code
+  /// fs::Mgh vol;
+  /// fs::read_mgh(&vol, "subject1/mri/brain.mgz");
+  /// fs::Mesh white;
+  /// fs::read_surf(&white, "subject1/surf/lh.white");
+  /// std::vector<float> intensity = fs::vol2surf(vol, white);
+  /// fs::write_curv("lh.intensity", intensity);
+  /// @endcode
+  std::vector<float> vol2surf(const Mgh& vol, const Mesh& surface, int interp = INTERP_TRILINEAR, size_t frame = 0, bool surface_ras = true, float outside_value = std::numeric_limits<float>::quiet_NaN()) {
+    return _vol2surf(vol, frame, surface_ras, surface.vertices.data(), nullptr, surface.num_vertices(), 0.0f, 0.0f, 1, interp, outside_value);
+  }
+
+  /// @brief Sample a volume between the white and pial surfaces, at fractions of the cortical thickness, and average the samples per vertex.
+  /// @details For each vertex, `num_samples` points are placed evenly from `frac_start` to `frac_end` along the line from the white surface vertex (fraction 0) to the corresponding pial surface vertex (fraction 1), like the `--projfrac-avg` option of FreeSurfer's `mri_vol2surf`. Use `frac_start = frac_end = 0.5` and `num_samples = 1` to sample at mid-thickness only. Samples outside the volume are ignored.
+  /// @param vol the volume.
+  /// @param white the white surface.
+  /// @param pial the pial surface, with the same number of vertices as `white`.
+  /// @param frac_start the first fraction.
+  /// @param frac_end the last fraction.
+  /// @param num_samples the number of samples per vertex.
+  /// @param interp `fs::INTERP_TRILINEAR` or `fs::INTERP_NEAREST`.
+  /// @param frame the frame of a 4D volume to sample.
+  /// @param surface_ras whether the vertex coordinates are in tkregister (surface) RAS space, see `fs::vol2surf`.
+  /// @param outside_value the value for vertices without any sample inside the volume.
+  /// @return per-vertex data, one value per vertex.
+  /// @throws std::invalid_argument if the surfaces have different numbers of vertices, or another parameter is invalid.
+  std::vector<float> vol2surf_projfrac(const Mgh& vol, const Mesh& white, const Mesh& pial, float frac_start = 0.0f, float frac_end = 1.0f, size_t num_samples = 5,
+                                       int interp = INTERP_TRILINEAR, size_t frame = 0, bool surface_ras = true, float outside_value = std::numeric_limits<float>::quiet_NaN()) {
+    if(white.vertices.size() != pial.vertices.size()) {
+      throw std::invalid_argument("The white and pial surfaces must have the same number of vertices, but have " + std::to_string(white.num_vertices()) + " and " + std::to_string(pial.num_vertices()) + ".\n");
+    }
+    std::vector<float> dir(white.vertices.size());
+    for(size_t i = 0; i < dir.size(); i++) {
+      dir[i] = pial.vertices[i] - white.vertices[i];
+    }
+    return _vol2surf(vol, frame, surface_ras, white.vertices.data(), dir.data(), white.num_vertices(), frac_start, frac_end, num_samples, interp, outside_value);
+  }
+
+  /// @brief Sample a volume along the vertex normals of a surface, and average the samples per vertex.
+  /// @details For each vertex, `num_samples` points are placed evenly from `dist_start` to `dist_end` mm along the (outward) vertex normal, see `fs::Mesh::vertex_normals`. Negative distances sample inwards. Samples outside the volume are ignored.
+  /// @param vol the volume.
+  /// @param surface the surface.
+  /// @param dist_start the first distance, in mm.
+  /// @param dist_end the last distance, in mm.
+  /// @param num_samples the number of samples per vertex.
+  /// @param interp `fs::INTERP_TRILINEAR` or `fs::INTERP_NEAREST`.
+  /// @param frame the frame of a 4D volume to sample.
+  /// @param surface_ras whether the vertex coordinates are in tkregister (surface) RAS space, see `fs::vol2surf`.
+  /// @param outside_value the value for vertices without any sample inside the volume.
+  /// @return per-vertex data, one value per vertex.
+  std::vector<float> vol2surf_normal(const Mgh& vol, const Mesh& surface, float dist_start, float dist_end, size_t num_samples = 5,
+                                     int interp = INTERP_TRILINEAR, size_t frame = 0, bool surface_ras = true, float outside_value = std::numeric_limits<float>::quiet_NaN()) {
+    const std::vector<float>& normals = surface.cached_vertex_normals();
+    return _vol2surf(vol, frame, surface_ras, surface.vertices.data(), normals.data(), surface.num_vertices(), dist_start, dist_end, num_samples, interp, outside_value);
+  }
+
 } // End namespace fs
 
 
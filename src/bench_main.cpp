@@ -0,0 +1,298 @@
+// The main for the libfs benchmark app. Measures the throughput of I/O, topology, smoothing and export functions, and writes the results as JSON in the format of Google Benchmark.
+
+#include "libfs.h"
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <cstdio>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+    /// A single benchmark. The function runs the measured code once and returns the number of bytes it processed, or 0 if throughput in bytes makes no sense for it.
+    struct Benchmark {
+        std::string name;
+        std::function<size_t()> fn;
+        size_t items;  ///< Items (e.g., vertices) processed per run, for items_per_second. 0 if not applicable.
+    };
+
+    /// The result of a benchmark, times in nanoseconds per run.
+    struct Result {
+        std::string name;
+        size_t iterations;
+        double median_ns;
+        double mean_ns;
+        double min_ns;
+        size_t bytes;
+        size_t items;
+    };
+
+    /// Results are accumulated here, so the compiler cannot drop the measured code.
+    volatile size_t sink = 0;
+
+    size_t file_size(const std::string& filename) {
+        std::ifstream is(filename, std::ios::binary | std::ios::ate);
+        if(! is.is_open()) {
+            throw std::runtime_error("Could not open benchmark input file '" + filename + "'.\n");
+        }
+        return size_t(is.tellg());
+    }
+
+    /// Run the benchmark once to warm up, then repeatedly until both `min_time` seconds and `min_iterations` runs are reached.
+    Result run(const Benchmark& b, const double min_time, const size_t min_iterations) {
+        typedef std::chrono::steady_clock clock;
+        Result r;
+        r.name = b.name;
+        r.items = b.items;
+        r.bytes = b.fn();
+        std::vector<double> times;
+        double total = 0.0;
+        while(times.size() < min_iterations || total < min_time * 1e9) {
+            const clock::time_point start = clock::now();
+            sink += b.fn();
+            const double ns = double(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+            times.push_back(ns);
+            total += ns;
+        }
+        std::sort(times.begin(), times.end());
+        r.iterations = times.size();
+        r.median_ns = times.size() % 2 == 1 ? times[times.size() / 2] : 0.5 * (times[times.size() / 2 - 1] + times[times.size() / 2]);
+        r.mean_ns = total / double(times.size());
+        r.min_ns = times[0];
+        return r;
+    }
+
+    std::string json_escape(const std::string& s) {
+        std::string out;
+        for(size_t i = 0; i < s.size(); i++) {
+            if(s[i] == '"' || s[i] == '\\') {
+                out.push_back('\\');
+            }
+            out.push_back(s[i]);
+        }
+        return out;
+    }
+
+    void write_json(std::ostream& os, const std::vector<Result>& results) {
+        char date[64];
+        const std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+        int num_threads = 1;
+        #ifdef _OPENMP
+        num_threads = omp_get_max_threads();
+        #endif
+        #ifdef LIBFS_WITH_ZLIB
+        const bool with_zlib = true;
+        #else
+        const bool with_zlib = false;
+        #endif
+        os.precision(10);
+        os << "{\n  \"context\": {\n";
+        os << "    \"date\": \"" << date << "\",\n";
+        os << "    \"library\": \"libfs\",\n";
+        os << "    \"library_version\": \"" << LIBFS_VERSION << "\",\n";
+        os << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+        os << "    \"num_threads\": " << num_threads << ",\n";
+        os << "    \"with_zlib\": " << (with_zlib ? "true" : "false") << "\n";
+        os << "  },\n  \"benchmarks\": [\n";
+        for(size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            os << "    {\n";
+            os << "      \"name\": \"" << json_escape(r.name) << "\",\n";
+            os << "      \"iterations\": " << r.iterations << ",\n";
+            os << "      \"real_time\": " << r.median_ns << ",\n";
+            os << "      \"mean_time\": " << r.mean_ns << ",\n";
+            os << "      \"min_time\": " << r.min_ns << ",\n";
+            os << "      \"time_unit\": \"ns\"";
+            if(r.bytes > 0) {
+                os << ",\n      \"bytes_per_second\": " << double(r.bytes) / (r.median_ns * 1e-9);
+            }
+            if(r.items > 0) {
+                os << ",\n      \"items_per_second\": " << double(r.items) / (r.median_ns * 1e-9);
+            }
+            os << "\n    }" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        os << "  ]\n}\n";
+    }
+
+    void usage(const char* prog) {
+        std::cout << "===" << prog << " -- libfs benchmarks -- measure the throughput of libfs functions ===\n";
+        std::cout << "Usage: " << prog << " [--filter <substring>] [--min-time <seconds>] [--out <file.json>] [--examples-dir <dir>] [--tmp-dir <dir>] [--grid-size <n>] [--list]\n";
+        std::cout << "   --filter        : str, only run benchmarks whose name contains this string.\n";
+        std::cout << "   --min-time      : float, minimal measured time per benchmark in seconds. Defaults to 0.5.\n";
+        std::cout << "   --out           : str, file to which the JSON results are written. Defaults to stdout.\n";
+        std::cout << "   --examples-dir  : str, the 'examples' directory of the libfs repo. Defaults to 'examples'.\n";
+        std::cout << "   --tmp-dir       : str, directory for the files written by the write benchmarks. Defaults to '.'.\n";
+        std::cout << "   --grid-size     : int, the synthetic grid meshes have n x n vertices. Defaults to 1000.\n";
+        std::cout << "   --list          : list the benchmark names and exit.\n";
+        std::cout << "Example: " << prog << " --filter io/ --out bench.json\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string filter, out_file, examples_dir = "examples", tmp_dir = ".";
+    double min_time = 0.5;
+    size_t grid_size = 1000;
+    bool list_only = false;
+    for(int i = 1; i < argc; i++) {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+        if(arg == "--filter" && has_value) {
+            filter = argv[++i];
+        } else if(arg == "--min-time" && has_value) {
+            min_time = std::atof(argv[++i]);
+        } else if(arg == "--out" && has_value) {
+            out_file = argv[++i];
+        } else if(arg == "--examples-dir" && has_value) {
+            examples_dir = argv[++i];
+        } else if(arg == "--tmp-dir" && has_value) {
+            tmp_dir = argv[++i];
+        } else if(arg == "--grid-size" && has_value) {
+            grid_size = size_t(std::atol(argv[++i]));
+        } else if(arg == "--list") {
+            list_only = true;
+        } else {
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    // Input files, from the example subject and the test data.
+    const std::string sdd = fs::util::fullpath({examples_dir, "subjects_dir", "subject1"});
+    const std::string surf_file = fs::util::fullpath({sdd, "surf", "lh.white"});
+    const std::string curv_file = fs::util::fullpath({sdd, "surf", "lh.sulc"});
+    const std::string mgh_file = fs::util::fullpath({sdd, "mri", "brain.mgh"});
+    const std::string mgz_file = fs::util::fullpath({sdd, "mri", "brain.mgz"});
+    const std::string annot_file = fs::util::fullpath({sdd, "label", "lh.aparc.annot"});
+    const std::string label_file = fs::util::fullpath({sdd, "label", "lh.cortex.label"});
+    const std::string curv_out = fs::util::fullpath({tmp_dir, "libfs_bench_tmp.curv"});
+    const std::string surf_out = fs::util::fullpath({tmp_dir, "libfs_bench_tmp.white"});
+    const std::string mgh_out = fs::util::fullpath({tmp_dir, "libfs_bench_tmp.mgh"});
+    const std::string label_out = fs::util::fullpath({tmp_dir, "libfs_bench_tmp.label"});
+
+    fs::Mesh surface;
+    fs::Curv curv;
+    fs::Mgh mgh;
+    fs::Label label;
+    if(! list_only) {
+        try {
+            fs::read_surf(&surface, surf_file);
+            fs::read_curv(&curv, curv_file);
+            fs::read_mgh(&mgh, mgh_file);
+            fs::read_label(&label, label_file);
+        } catch(const std::exception& e) {
+            std::cerr << "Could not read the example data, check '--examples-dir': " << e.what() << "\n";
+            return 1;
+        }
+    }
+    const fs::Mesh grid = list_only ? fs::Mesh() : fs::Mesh::construct_grid(grid_size, grid_size);
+    const std::string grid_name = "grid" + std::to_string(grid_size) + "x" + std::to_string(grid_size);
+    const std::vector<float> grid_data(grid.num_vertices(), 1.0f);
+    const fs::AdjacencyCSR surface_adj = surface.as_adjcsr();
+    const fs::AdjacencyCSR grid_adj = grid.as_adjcsr();
+    const std::vector<std::vector<size_t>> surface_adjlist = surface.as_adjlist();
+    const size_t nv = surface.num_vertices(), grid_nv = grid.num_vertices();
+
+    std::vector<Benchmark> benchmarks;
+
+    // I/O, measured in bytes of the file read or written.
+    benchmarks.push_back({ "io/read_curv", [&]() { fs::Curv c; fs::read_curv(&c, curv_file); return file_size(curv_file); }, nv });
+    benchmarks.push_back({ "io/write_curv", [&]() { fs::write_curv(curv_out, curv.data); return file_size(curv_out); }, nv });
+    benchmarks.push_back({ "io/read_surf", [&]() { fs::Mesh m; fs::read_surf(&m, surf_file); return file_size(surf_file); }, nv });
+    benchmarks.push_back({ "io/write_surf", [&]() { fs::write_surf(surface, surf_out); return file_size(surf_out); }, nv });
+    benchmarks.push_back({ "io/read_mgh", [&]() { fs::Mgh v; fs::read_mgh(&v, mgh_file); return file_size(mgh_file); }, 0 });
+    benchmarks.push_back({ "io/read_mgh_volume_float", [&]() { fs::MghVolume<float> v; fs::read_mgh_volume(&v, mgh_file); return file_size(mgh_file); }, 0 });
+    #ifdef LIBFS_WITH_ZLIB
+    benchmarks.push_back({ "io/read_mgz", [&]() { fs::Mgh v; fs::read_mgh(&v, mgz_file); return file_size(mgz_file); }, 0 });
+    #endif
+    benchmarks.push_back({ "io/write_mgh", [&]() { fs::write_mgh(mgh, mgh_out); return file_size(mgh_out); }, 0 });
+    benchmarks.push_back({ "io/read_annot", [&]() { fs::Annot a; fs::read_annot(&a, annot_file); return file_size(annot_file); }, nv });
+    benchmarks.push_back({ "io/read_label", [&]() { fs::Label l; fs::read_label(&l, label_file); return file_size(label_file); }, label.vertex.size() });
+    benchmarks.push_back({ "io/write_label", [&]() { fs::write_label(label, label_out); return file_size(label_out); }, label.vertex.size() });
+    const std::vector<std::string> probe_input = { curv_file, surf_file, mgh_file, annot_file };
+    benchmarks.push_back({ "io/probe_files", [&]() { fs::probe_files(probe_input, 1); return size_t(0); }, probe_input.size() });
+
+    // Topology, measured in vertices per second.
+    const std::vector<std::pair<std::string, const fs::Mesh*>> meshes = { std::make_pair(std::string("lh.white"), &surface), std::make_pair(grid_name, &grid) };
+    for(size_t i = 0; i < meshes.size(); i++) {
+        const fs::Mesh* m = meshes[i].second;
+        const std::string prefix = "topology/" + meshes[i].first + "/";
+        benchmarks.push_back({ prefix + "as_adjcsr", [m]() { sink += m->as_adjcsr().neighbors.size(); return size_t(0); }, m->num_vertices() });
+        benchmarks.push_back({ prefix + "as_adjlist", [m]() { sink += m->as_adjlist().size(); return size_t(0); }, m->num_vertices() });
+        benchmarks.push_back({ prefix + "as_edges", [m]() { sink += m->as_edges().size(); return size_t(0); }, m->num_vertices() });
+        benchmarks.push_back({ prefix + "as_edgelist", [m]() { sink += m->as_edgelist().size(); return size_t(0); }, m->num_vertices() });
+    }
+    benchmarks.push_back({ "topology/lh.white/extend_adj_csr_2", [&]() { sink += fs::Mesh::extend_adj(surface_adj, 2).neighbors.size(); return size_t(0); }, nv });
+    benchmarks.push_back({ "topology/lh.white/extend_adj_list_2", [&]() { sink += fs::Mesh::extend_adj(surface_adjlist, 2).size(); return size_t(0); }, nv });
+    benchmarks.push_back({ "topology/" + grid_name + "/extend_adj_csr_2", [&]() { sink += fs::Mesh::extend_adj(grid_adj, 2).neighbors.size(); return size_t(0); }, grid_nv });
+
+    // Smoothing, measured in vertices per second over all iterations.
+    benchmarks.push_back({ "smoothing/lh.white/smooth_pvd_nn_csr_10", [&]() { sink += fs::Mesh::smooth_pvd_nn(surface_adj, curv.data, 10).size(); return size_t(0); }, 10 * nv });
+    benchmarks.push_back({ "smoothing/lh.white/smooth_pvd_nn_list_10", [&]() { sink += fs::Mesh::smooth_pvd_nn(surface_adjlist, curv.data, 10).size(); return size_t(0); }, 10 * nv });
+    benchmarks.push_back({ "smoothing/" + grid_name + "/smooth_pvd_nn_csr_10", [&]() { sink += fs::Mesh::smooth_pvd_nn(grid_adj, grid_data, 10).size(); return size_t(0); }, 10 * grid_nv });
+
+    // Export, measured in bytes of the produced representation.
+    benchmarks.push_back({ "export/lh.white/to_obj", [&]() { std::ostringstream os; surface.to_obj(os); return os.str().size(); }, nv });
+    benchmarks.push_back({ "export/lh.white/to_ply", [&]() { std::ostringstream os; surface.to_ply(os); return os.str().size(); }, nv });
+    benchmarks.push_back({ "export/lh.white/to_ply_binary", [&]() { std::ostringstream os; surface.to_ply_binary(os); return os.str().size(); }, nv });
+    benchmarks.push_back({ "export/lh.white/to_off", [&]() { std::ostringstream os; surface.to_off(os); return os.str().size(); }, nv });
+
+    std::vector<Result> results;
+    for(size_t i = 0; i < benchmarks.size(); i++) {
+        if(! filter.empty() && benchmarks[i].name.find(filter) == std::string::npos) {
+            continue;
+        }
+        if(list_only) {
+            std::cout << benchmarks[i].name << "\n";
+            continue;
+        }
+        Result r;
+        try {
+            r = run(benchmarks[i], min_time, 3);
+        } catch(const std::exception& e) {
+            std::cerr << "Benchmark '" << benchmarks[i].name << "' failed: " << e.what() << "\n";
+            std::remove(curv_out.c_str());
+            std::remove(surf_out.c_str());
+            std::remove(mgh_out.c_str());
+            std::remove(label_out.c_str());
+            return 1;
+        }
+        std::cerr << r.name << ": " << r.median_ns * 1e-6 << " ms (median of " << r.iterations << ")";
+        if(r.bytes > 0) {
+            std::cerr << ", " << double(r.bytes) / (r.median_ns * 1e-9) / 1e6 << " MB/s";
+        }
+        std::cerr << "\n";
+        results.push_back(r);
+    }
+    if(list_only) {
+        return 0;
+    }
+    std::remove(curv_out.c_str());
+    std::remove(surf_out.c_str());
+    std::remove(mgh_out.c_str());
+    std::remove(label_out.c_str());
+
+    if(out_file.empty()) {
+        write_json(std::cout, results);
+    } else {
+        std::ofstream os(out_file);
+        if(! os.is_open()) {
+            std::cerr << "Could not open output file '" << out_file << "'.\n";
+            return 1;
+        }
+        write_json(os, results);
+    }
+    return 0;
+}
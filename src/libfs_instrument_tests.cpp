@@ -0,0 +1,86 @@
+
+
+// The instrumentation tests, in their own test executable that is compiled with LIBFS_INSTRUMENT defined, see CMakeLists.txt.
+// The main test suite covers the default configuration without instrumentation.
+#ifndef LIBFS_INSTRUMENT
+#define LIBFS_INSTRUMENT
+#endif
+#define LIBFS_DBG_WARNING
+
+#include "libfs.h"
+#include "catch.hpp"
+#include <vector>
+#include <string>
+#include <atomic>
+
+
+namespace {
+    /// Instrumentation sink for the tests, counts the events it receives in the given counter.
+    void counting_sink(const fs::InstrumentEvent& event, void* counter) {
+        (void)event;
+        static_cast<std::atomic<size_t>*>(counter)->fetch_add(1);
+    }
+}
+
+TEST_CASE( "Instrumentation reports timers and counters to the sink." ) {
+
+    SECTION("The recorder aggregates timers and counters of the instrumented functions." ) {
+        fs::InstrumentRecorder recorder;
+        fs::set_instrument_sink(&fs::InstrumentRecorder::sink, &recorder);
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, "examples/read_mgh/brain.mgh");
+        fs::Mesh surface;
+        fs::read_surf(&surface, "examples/read_surf/lh.white");
+        const std::vector<float> thickness = fs::read_curv_data("examples/read_curv/lh.thickness");
+        fs::Mesh::smooth_pvd_nn(surface.cached_adjcsr(), thickness, 3);
+        fs::set_instrument_sink(nullptr);
+        fs::read_mgh(&mgh, "examples/read_mgh/brain.mgh");  // Not recorded.
+
+        const fs::InstrumentRecorder::Entry t = recorder.get("read_mgh");
+        REQUIRE(t.kind == fs::INSTRUMENT_TIMER);
+        REQUIRE(t.events == 1);
+        REQUIRE(t.total > 0);
+        REQUIRE(t.max == t.total);
+        const fs::InstrumentRecorder::Entry values = recorder.get("read_mgh.values");
+        REQUIRE(values.kind == fs::INSTRUMENT_COUNTER);
+        REQUIRE(values.total == mgh.header.num_values());
+        REQUIRE(recorder.get("read_mgh.bytes").total == mgh.header.num_values() * fs::mri_dtype_size(mgh.header.dtype));
+        REQUIRE(recorder.get("read_surf.vertices").total == surface.num_vertices());
+        REQUIRE(recorder.get("read_curv.values").total == thickness.size());
+        REQUIRE(recorder.get("smooth_pvd_nn").events == 1);
+        REQUIRE(recorder.get("smooth_pvd_nn.vertex_updates").total == 3 * surface.num_vertices());
+        REQUIRE(recorder.get("no_such_event").events == 0);
+        const std::string report = recorder.report();
+        REQUIRE(report.find("read_mgh: 1 calls") != std::string::npos);
+        REQUIRE(report.find("read_curv.values: " + std::to_string(thickness.size())) != std::string::npos);
+        recorder.clear();
+        REQUIRE(recorder.entries().empty());
+    }
+
+    SECTION("Custom sinks receive events from all threads." ) {
+        std::atomic<size_t> num_events(0);
+        fs::InstrumentRecorder recorder;
+        fs::set_instrument_sink(&counting_sink, &num_events);
+        const std::ptrdiff_t num_reads = 8;
+        #ifdef _OPENMP
+        #pragma omp parallel for
+        #endif
+        for(std::ptrdiff_t i = 0; i < num_reads; i++) {
+            fs::Curv curv;
+            fs::read_curv(&curv, "examples/read_curv/lh.thickness");
+        }
+        REQUIRE(num_events.load() == size_t(2 * num_reads));  // One timer and one counter per read.
+        fs::set_instrument_sink(&fs::InstrumentRecorder::sink, &recorder);
+        #ifdef _OPENMP
+        #pragma omp parallel for
+        #endif
+        for(std::ptrdiff_t i = 0; i < num_reads; i++) {
+            fs::Curv curv;
+            fs::read_curv(&curv, "examples/read_curv/lh.thickness");
+        }
+        fs::set_instrument_sink(nullptr);
+        REQUIRE(num_events.load() == size_t(2 * num_reads));
+        REQUIRE(recorder.get("read_curv").events == size_t(num_reads));
+        REQUIRE(recorder.get("read_curv.values").events == size_t(num_reads));
+    }
+}
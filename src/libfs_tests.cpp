@@ -9,6 +9,7 @@
 #include <iterator>
 #include <numeric>
 #include <sstream>
+#include <clocale>
 #include <iostream>
 #include <string>
 #include <cmath>
@@ -298,6 +299,237 @@ TEST_CASE( "Writing and re-reading an MGH file with MRI_SHORT data works" ) {
     }
 }
 
+TEST_CASE( "The bulk binary writers produce the same bytes as per-value writes." ) {
+
+    SECTION("Writing curv data gives the original file." ) {
+        const std::string curv_file = "examples/read_curv/lh.thickness";
+        fs::Curv curv;
+        fs::read_curv(&curv, curv_file);
+        std::ostringstream os(std::ios::out | std::ios::binary);
+        fs::write_curv(os, curv.data, curv.num_faces);
+
+        std::ifstream ifs(curv_file, std::ios::in | std::ios::binary);
+        std::ostringstream orig;
+        orig << ifs.rdbuf();
+        REQUIRE(os.str() == orig.str());
+
+        std::ostringstream os_ptr(std::ios::out | std::ios::binary);
+        fs::write_curv(os_ptr, curv.data.data(), curv.data.size(), curv.num_faces);
+        REQUIRE(os_ptr.str() == orig.str());
+    }
+
+    SECTION("Writing MGH data with and without RAS information matches per-value writes." ) {
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, "examples/read_mgh/brain.mgh");
+        for(int16_t ras_good_flag = 0; ras_good_flag <= 1; ras_good_flag++) {
+            mgh.header.ras_good_flag = ras_good_flag;
+            std::ostringstream ref(std::ios::out | std::ios::binary);
+            fs::_fwritet<int32_t>(ref, 1);
+            fs::_fwritet<int32_t>(ref, mgh.header.dim1length);
+            fs::_fwritet<int32_t>(ref, mgh.header.dim2length);
+            fs::_fwritet<int32_t>(ref, mgh.header.dim3length);
+            fs::_fwritet<int32_t>(ref, mgh.header.dim4length);
+            fs::_fwritet<int32_t>(ref, mgh.header.dtype);
+            fs::_fwritet<int32_t>(ref, mgh.header.dof);
+            fs::_fwritet<int16_t>(ref, mgh.header.ras_good_flag);
+            size_t pad = 254;
+            if(ras_good_flag == 1) {
+                fs::_fwritet<float>(ref, mgh.header.xsize);
+                fs::_fwritet<float>(ref, mgh.header.ysize);
+                fs::_fwritet<float>(ref, mgh.header.zsize);
+                for(int i = 0; i < 9; i++) fs::_fwritet<float>(ref, mgh.header.Mdc[i]);
+                for(int i = 0; i < 3; i++) fs::_fwritet<float>(ref, mgh.header.Pxyz_c[i]);
+                pad -= 60;
+            }
+            for(size_t i = 0; i < pad; i++) fs::_fwritet<uint8_t>(ref, 0);
+            for(size_t i = 0; i < mgh.data.data_mri_uchar.size(); i++) fs::_fwritet<uint8_t>(ref, mgh.data.data_mri_uchar[i]);
+
+            std::ostringstream os(std::ios::out | std::ios::binary);
+            fs::write_mgh(mgh, os);
+            REQUIRE(os.str().size() == 284 + mgh.header.num_values());
+            REQUIRE(os.str() == ref.str());
+        }
+    }
+
+    SECTION("Writing a surf file gives the same bytes as per-value writes, and can be re-read." ) {
+        fs::Mesh surface;
+        fs::read_surf(&surface, "examples/read_surf/lh.white");
+        std::ostringstream ref(std::ios::out | std::ios::binary);
+        fs::_fwritei3(ref, 16777214);
+        ref << "Created by fslib\n\n";
+        fs::_fwritet<int32_t>(ref, int32_t(surface.num_vertices()));
+        fs::_fwritet<int32_t>(ref, int32_t(surface.num_faces()));
+        for(size_t i = 0; i < surface.vertices.size(); i++) fs::_fwritet<float>(ref, surface.vertices[i]);
+        for(size_t i = 0; i < surface.faces.size(); i++) fs::_fwritet<int32_t>(ref, surface.faces[i]);
+
+        std::stringstream os(std::ios::in | std::ios::out | std::ios::binary);
+        fs::write_surf(surface.vertices, surface.faces, os);
+        REQUIRE(os.str() == ref.str());
+
+        fs::Mesh surface2;
+        fs::read_surf(&surface2, &os);
+        REQUIRE(surface2.vertices == surface.vertices);
+        REQUIRE(surface2.faces == surface.faces);
+    }
+}
+
+
+TEST_CASE( "Reading data and surfaces for a group of subjects works." ) {
+
+    const std::string subjects_dir = "examples/subjects_dir";
+    const std::vector<std::string> subjects = { "no_such_subject", "subject1", "subject1", "missing_too", "subject1" };
+
+    SECTION("Per-vertex data is loaded into one matrix, and failures are reported per subject." ) {
+        fs::GroupData group = fs::read_group_data(subjects, subjects_dir, "sulc");
+        const std::vector<float> expected = fs::read_curv_data("examples/subjects_dir/subject1/surf/lh.sulc");
+
+        REQUIRE(group.num_subjects() == 5);
+        REQUIRE(group.num_vertices == expected.size());
+        REQUIRE(group.data.size() == 5 * expected.size());
+        REQUIRE(group.num_failed() == 2);
+        REQUIRE(! group.ok(0));
+        REQUIRE(! group.ok(3));
+        REQUIRE(! group.errors[0].empty());
+        for(size_t s : { size_t(1), size_t(2), size_t(4) }) {
+            REQUIRE(group.ok(s));
+            REQUIRE(std::equal(expected.begin(), expected.end(), group.row(s)));
+        }
+        REQUIRE(std::isnan(group.at(0, 0)));
+        REQUIRE(std::isnan(group.at(3, expected.size() - 1)));
+        REQUIRE(group.at(4, 10) == expected[10]);
+    }
+
+    SECTION("If no subject can be loaded, the matrix is empty." ) {
+        // The white surface is not per-vertex data, so reading it as curv fails.
+        fs::GroupData group = fs::read_group_data({ "subject1" }, subjects_dir, "white");
+        REQUIRE(group.num_failed() == 1);
+        REQUIRE(group.num_vertices == 0);
+        REQUIRE(group.data.empty());
+    }
+
+    SECTION("Surfaces are loaded for all subjects." ) {
+        std::vector<std::string> errors;
+        std::vector<fs::Mesh> meshes = fs::read_group_surfaces(subjects, subjects_dir, "white", "lh", &errors);
+        REQUIRE(meshes.size() == 5);
+        REQUIRE(errors.size() == 5);
+        REQUIRE(meshes[1].num_vertices() == 149244);
+        REQUIRE(meshes[4].faces == meshes[1].faces);
+        REQUIRE(meshes[0].num_vertices() == 0);
+        REQUIRE(! errors[0].empty());
+        REQUIRE(errors[2].empty());
+    }
+}
+
+
+TEST_CASE( "Group matrices and NAN-aware per-vertex statistics work." ) {
+
+    const size_t ns = 37, nv = 1234;
+    fs::GroupMatrix m(ns, nv);
+    for(size_t s = 0; s < ns; s++) {
+        for(size_t v = 0; v < nv; v++) {
+            const bool missing = (s * 7 + v) % 11 == 0 || v == 5;  // vertex 5 has no data at all
+            m.at(s, v) = missing ? std::numeric_limits<float>::quiet_NaN() : float(std::sin(double(s * nv + v)) * 3.0 + 2.5);
+        }
+    }
+    m.at(0, 6) = 0.5f;  // vertex 6 gets a single value
+    for(size_t s = 1; s < ns; s++) {
+        m.at(s, 6) = std::numeric_limits<float>::quiet_NaN();
+    }
+
+    SECTION("The rows are aligned and padded." ) {
+        REQUIRE(m.stride % 16 == 0);
+        REQUIRE(m.stride >= nv);
+        for(size_t s = 0; s < ns; s++) {
+            REQUIRE(reinterpret_cast<uintptr_t>(m.row(s)) % 64 == 0);
+        }
+        REQUIRE(std::isnan(m.row(0)[nv]));  // padding
+    }
+
+    SECTION("The statistics match a naive computation." ) {
+        fs::VertexStats st = m.vertex_stats();
+        REQUIRE(st.num_vertices() == nv);
+        size_t num_mismatches = 0;
+        for(size_t v = 0; v < nv; v++) {
+            double sum = 0.0, sum_sq = 0.0;
+            int32_t n = 0;
+            float vmin = std::numeric_limits<float>::infinity(), vmax = -std::numeric_limits<float>::infinity();
+            for(size_t s = 0; s < ns; s++) {
+                const float x = m.at(s, v);
+                if(! std::isnan(x)) {
+                    sum += x;
+                    n++;
+                    vmin = std::min(vmin, x);
+                    vmax = std::max(vmax, x);
+                }
+            }
+            const double mean = sum / n;
+            for(size_t s = 0; s < ns; s++) {
+                const float x = m.at(s, v);
+                if(! std::isnan(x)) {
+                    sum_sq += (x - mean) * (x - mean);
+                }
+            }
+            if(st.count[v] != n) num_mismatches++;
+            if(n > 0 && (std::fabs(st.mean[v] - mean) > 1e-5 || st.min[v] != vmin || st.max[v] != vmax)) num_mismatches++;
+            if(n > 1 && std::fabs(st.stddev[v] - std::sqrt(sum_sq / (n - 1))) > 1e-5) num_mismatches++;
+        }
+        REQUIRE(num_mismatches == 0);
+        REQUIRE(st.count[5] == 0);
+        REQUIRE(std::isnan(st.mean[5]));
+        REQUIRE(std::isnan(st.max[5]));
+        REQUIRE(st.count[6] == 1);
+        REQUIRE(st.mean[6] == 0.5f);
+        REQUIRE(std::isnan(st.stddev[6]));
+    }
+
+    SECTION("Streaming and merged Welford accumulators agree with the matrix statistics." ) {
+        fs::VertexStats expected = m.vertex_stats();
+        fs::VertexWelford all(nv), first(nv), second(nv);
+        for(size_t s = 0; s < ns; s++) {
+            const std::vector<float> row(m.row(s), m.row(s) + nv);
+            all.update(row);
+            (s < 10 ? first : second).update(row);
+        }
+        first.merge(second);
+        fs::VertexStats st_all = all.stats();
+        fs::VertexStats st_merged = first.stats();
+        REQUIRE(st_all.count == expected.count);
+        REQUIRE(st_merged.count == expected.count);
+        size_t num_mismatches = 0;
+        for(size_t v = 0; v < nv; v++) {
+            if(expected.count[v] < 2) continue;
+            if(st_all.mean[v] != expected.mean[v] || st_all.stddev[v] != expected.stddev[v]) num_mismatches++;
+            if(std::fabs(st_merged.mean[v] - expected.mean[v]) > 1e-5 || std::fabs(st_merged.stddev[v] - expected.stddev[v]) > 1e-5) num_mismatches++;
+            if(st_merged.min[v] != expected.min[v] || st_merged.max[v] != expected.max[v]) num_mismatches++;
+        }
+        REQUIRE(num_mismatches == 0);
+        REQUIRE_THROWS(all.update(std::vector<float>(3)));
+        REQUIRE_THROWS(all.merge(fs::VertexWelford(3)));
+    }
+
+    SECTION("A matrix can be built from group data." ) {
+        fs::GroupData group = fs::read_group_data({ "subject1", "none", "subject1" }, "examples/subjects_dir", "sulc");
+        fs::GroupMatrix gm = fs::GroupMatrix::from_group_data(group);
+        REQUIRE(gm.num_subjects == 3);
+        REQUIRE(gm.num_vertices == group.num_vertices);
+        REQUIRE(gm.at(2, 100) == group.at(2, 100));
+        fs::VertexStats st = gm.vertex_stats();
+        REQUIRE(st.count[0] == 2);
+        REQUIRE(st.mean[100] == Approx(group.at(0, 100)));
+        REQUIRE(st.stddev[100] == 0.0f);
+
+        fs::GroupData empty;
+        empty.subjects = { "subject1", "subject2" };
+        empty.errors = { "", "" };
+        fs::GroupMatrix gm_empty = fs::GroupMatrix::from_group_data(empty);
+        REQUIRE(gm_empty.num_subjects == 2);
+        REQUIRE(gm_empty.num_vertices == 0);
+        gm_empty.set_row(1, std::vector<float>());
+        REQUIRE(gm_empty.vertex_stats().count.empty());
+    }
+}
+
+
 TEST_CASE( "Meshes can be constructed" ) {
 
     SECTION("Meshed can be constructed from 1D vectors." ) {
@@ -416,6 +648,46 @@ TEST_CASE( "Reading the demo surface file works" ) {
         //fs::util::str_to_file("lh.cortex.obj", patch.to_obj());  // check this mesh visually with meshlab
     }
 
+    SECTION("Using submesh_vertex_flat gives the same patch and flat index maps") {
+        fs::Label label;
+        fs::read_label(&label, "examples/read_label/lh.cortex.label");
+
+        std::vector<int32_t> full2sub, sub2full;
+        fs::Mesh patch = surface.submesh_vertex_flat(label.vertex, &full2sub, &sub2full);
+        REQUIRE(patch.num_vertices() == label.vertex.size());
+        REQUIRE(patch.num_faces() == 281410);
+        REQUIRE(sub2full == label.vertex);
+        REQUIRE(full2sub.size() == surface.num_vertices());
+
+        // Reference: filter the faces in order, without any index map.
+        std::vector<int32_t> ref_map(surface.num_vertices(), -1);
+        for(size_t i = 0; i < label.vertex.size(); i++) {
+            ref_map[size_t(label.vertex[i])] = int32_t(i);
+        }
+        REQUIRE(full2sub == ref_map);
+        std::vector<int> ref_faces;
+        for(size_t i = 0; i < surface.faces.size(); i += 3) {
+            if(ref_map[surface.faces[i]] >= 0 && ref_map[surface.faces[i+1]] >= 0 && ref_map[surface.faces[i+2]] >= 0) {
+                ref_faces.push_back(ref_map[surface.faces[i]]);
+                ref_faces.push_back(ref_map[surface.faces[i+1]]);
+                ref_faces.push_back(ref_map[surface.faces[i+2]]);
+            }
+        }
+        REQUIRE(patch.faces == ref_faces);
+        REQUIRE(surface.submesh_vertex(label.vertex).second.faces == ref_faces);
+
+        std::vector<float> pvd_submesh(patch.num_vertices(), 1.0f);
+        std::vector<float> restored = fs::Mesh::curv_data_for_orig_mesh(pvd_submesh, sub2full, int32_t(surface.num_vertices()), 0.0f);
+        REQUIRE(restored == fs::Mesh::curv_data_for_orig_mesh(pvd_submesh, surface.submesh_vertex(label.vertex).first, int32_t(surface.num_vertices()), 0.0f));
+        REQUIRE(std::count(restored.begin(), restored.end(), 1.0f) == std::ptrdiff_t(label.vertex.size()));
+
+        REQUIRE_THROWS(surface.submesh_vertex_flat({ int32_t(surface.num_vertices()) }));
+        fs::Mesh bad_faces = fs::Mesh::construct_cube();
+        bad_faces.faces[4] = int32_t(bad_faces.num_vertices());
+        REQUIRE_THROWS_AS(bad_faces.submesh_vertex_flat({ 0, 1, 2 }), std::invalid_argument);
+        REQUIRE_THROWS(fs::Mesh::curv_data_for_orig_mesh(pvd_submesh, std::vector<int32_t>(3, 0), int32_t(surface.num_vertices())));
+    }
+
     SECTION("Using curv_data_for_origmesh to stretch submesh per-vertex data to the original mesh works") {
 
         std::vector<float> pvd_full = fs::read_curv_data("examples/subjects_dir/subject1/surf/lh.sulc");
@@ -467,6 +739,419 @@ TEST_CASE( "Reading the demo surface file works" ) {
     }
 }
 
+TEST_CASE( "Reading surf and MGH data from streams works" ) {
+
+    SECTION("Reading a surface from a stream gives the same mesh as reading it from a file." ) {
+        fs::Mesh surface;
+        fs::read_surf(&surface, "examples/read_surf/lh.white");
+
+        std::ifstream is("examples/read_surf/lh.white", std::ios_base::in | std::ios::binary);
+        fs::Mesh surface2;
+        fs::read_surf(&surface2, &is);
+        REQUIRE(surface2.vertices == surface.vertices);
+        REQUIRE(surface2.faces == surface.faces);
+        REQUIRE(surface2.vertices[0] == Approx(-1.852232));
+        REQUIRE(surface2.faces[0] == 0);
+    }
+
+    SECTION("Reading MGH data from a stream gives the same data as reading it from a file." ) {
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, "examples/read_mgh/brain.mgh");
+
+        std::ifstream is("examples/read_mgh/brain.mgh", std::ios_base::in | std::ios::binary);
+        fs::Mgh mgh2;
+        fs::read_mgh(&mgh2, &is);
+        REQUIRE(mgh2.data.data_mri_uchar.size() == 256*256*256);
+        REQUIRE(mgh2.data.data_mri_uchar == mgh.data.data_mri_uchar);
+    }
+
+    SECTION("Reading MRI_FLOAT data from an MGH stream works." ) {
+        std::ifstream is("examples/read_mgh/lh.thickness.mgh", std::ios_base::in | std::ios::binary);
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, &is);
+        REQUIRE(mgh.data.data_mri_float.size() == 149244);
+        REQUIRE(mgh.data.data_mri_float[0] == Approx(2.561705));
+        REQUIRE(mgh.data.data_mri_float[100] == Approx(2.579938));
+    }
+}
+
+TEST_CASE( "Endianness conversion of whole buffers works" ) {
+
+    SECTION("Swapping spans of 2, 4 and 8 byte values gives the same results as swapping single values." ) {
+        const size_t n = 77; // Not a multiple of the SIMD block sizes, to also test the remainder handling.
+        std::vector<int16_t> v16(n);
+        std::vector<int32_t> v32(n);
+        std::vector<float> vf(n);
+        std::vector<double> vd(n);
+        for(size_t i=0; i<n; i++) {
+            v16[i] = int16_t(i * 251 - 3000);
+            v32[i] = int32_t(i * 1000003) - 12345678;
+            vf[i] = float(i) * 0.37f - 11.0f;
+            vd[i] = double(i) * 1.1 - 3.0;
+        }
+        std::vector<int16_t> v16_swapped = v16;
+        std::vector<int32_t> v32_swapped = v32;
+        std::vector<float> vf_swapped(n);
+        std::vector<double> vd_swapped = vd;
+        fs::_swap_endian_span<int16_t>(v16_swapped.data(), n);
+        fs::_swap_endian_span<int32_t>(v32_swapped.data(), n);
+        fs::_swap_endian_copy<float>(vf.data(), vf_swapped.data(), n);
+        fs::_swap_endian_span<double>(vd_swapped.data(), n);
+        for(size_t i=0; i<n; i++) {
+            REQUIRE(v16_swapped[i] == fs::_swap_endian<int16_t>(v16[i]));
+            REQUIRE(v32_swapped[i] == fs::_swap_endian<int32_t>(v32[i]));
+            REQUIRE(fs::_swap_endian<float>(vf_swapped[i]) == vf[i]);
+            REQUIRE(fs::_swap_endian<double>(vd_swapped[i]) == vd[i]);
+        }
+        REQUIRE(fs::_swap_endian<int32_t>(0x01020304) == 0x04030201);
+        REQUIRE(fs::_swap_endian<uint16_t>(0x0102) == 0x0201);
+    }
+
+    SECTION("Writing and re-reading curv data works." ) {
+        std::vector<float> data = fs::read_curv_data("examples/read_curv/lh.thickness");
+        std::stringstream ss;
+        fs::write_curv(ss, data);
+        fs::Curv curv;
+        fs::read_curv(&curv, &ss);
+        REQUIRE(curv.data == data);
+    }
+
+    SECTION("Writing and re-reading MGH data of type MRI_INT works." ) {
+        fs::Mgh mgh;
+        mgh.header.dim1length = 5001;
+        mgh.header.dim2length = 1;
+        mgh.header.dim3length = 1;
+        mgh.header.dim4length = 1;
+        mgh.header.dtype = fs::MRI_INT;
+        for(int32_t i=0; i<5001; i++) {
+            mgh.data.data_mri_int.push_back(i * 7919 - 100000);
+        }
+        std::stringstream ss;
+        fs::write_mgh(mgh, ss);
+        fs::Mgh mgh2;
+        fs::read_mgh(&mgh2, &ss);
+        REQUIRE(mgh2.data.data_mri_int == mgh.data.data_mri_int);
+    }
+}
+
+TEST_CASE( "Memory mapped views of MGH and curv files work" ) {
+
+    SECTION("An MghView of the demo brain volume matches the fully read data." ) {
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, "examples/read_mgh/brain.mgh");
+        fs::MghView view;
+        fs::read_mgh_view(&view, "examples/read_mgh/brain.mgh");
+        fs::Array4D<uint8_t> arr(&mgh.header);
+        arr.data = mgh.data.data_mri_uchar;
+        REQUIRE(view.header.dtype == fs::MRI_UCHAR);
+        REQUIRE(view.num_values() == 256 * 256 * 256);
+        REQUIRE(view.at<uint8_t>(99, 99, 99, 0) == arr.at(99, 99, 99, 0));
+        REQUIRE(view.at<uint8_t>(109, 109, 109, 0) == arr.at(109, 109, 109, 0));
+        REQUIRE(view.values<uint8_t>() == mgh.data.data_mri_uchar);
+        REQUIRE_THROWS(view.at<float>(0, 0, 0, 0));
+    }
+
+    SECTION("An MghView of float data matches the fully read data." ) {
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, "examples/read_mgh/lh.thickness.mgh");
+        std::vector<float> data = mgh.data.data_mri_float;
+        fs::MghView view;
+        fs::read_mgh_view(&view, "examples/read_mgh/lh.thickness.mgh");
+        REQUIRE(view.value<float>(0) == data[0]);
+        REQUIRE(view.value<float>(data.size() - 1) == data[data.size() - 1]);
+        REQUIRE(view.values<float>() == data);
+        REQUIRE_THROWS_AS(view.value<int32_t>(0), std::domain_error);
+    }
+
+    SECTION("A CurvView of the demo thickness file matches the fully read data." ) {
+        std::vector<float> data = fs::read_curv_data("examples/read_curv/lh.thickness");
+        fs::CurvView view;
+        fs::read_curv_view(&view, "examples/read_curv/lh.thickness");
+        REQUIRE(view.num_vertices == 149244);
+        REQUIRE(view.at(0) == data[0]);
+        REQUIRE(view.at(149243) == data[149243]);
+        REQUIRE(view.values() == data);
+    }
+
+    SECTION("Opening a view of a non-existing file throws." ) {
+        fs::MghView view;
+        REQUIRE_THROWS(fs::read_mgh_view(&view, "no/such/file.mgh"));
+    }
+
+    SECTION("Negative or overflowing dimensions in the header are rejected." ) {
+        std::ifstream in("examples/read_mgh/lh.thickness.mgh", std::ios::binary);
+        std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        const std::string corrupt_file = "examples/read_mgh/corrupt_tmp.mgh";
+        auto write_with_dims = [&](const std::vector<int32_t>& dims) {
+            std::string b = bytes;
+            for(size_t d = 0; d < 4; d++) {
+                const uint32_t u = uint32_t(dims[d]);
+                for(size_t k = 0; k < 4; k++) {
+                    b[4 + 4 * d + k] = char((u >> (8 * (3 - k))) & 0xFF);  // Big endian, after the version field.
+                }
+            }
+            std::ofstream out(corrupt_file, std::ios::binary);
+            out.write(b.data(), std::streamsize(b.size()));
+        };
+        fs::MghView view;
+        fs::Mgh mgh;
+        write_with_dims({ -1, 1, 1, 1 });
+        REQUIRE_THROWS_AS(fs::read_mgh_view(&view, corrupt_file), std::domain_error);
+        REQUIRE_THROWS_AS(fs::read_mgh(&mgh, corrupt_file), std::domain_error);
+        write_with_dims({ 65536, 65536, 65536, 65536 });  // The product wraps to 0 in 64 bit.
+        REQUIRE_THROWS_AS(fs::read_mgh_view(&view, corrupt_file), std::runtime_error);
+        write_with_dims({ 149244, 1, 1, 1 });
+        fs::read_mgh_view(&view, corrupt_file);
+        REQUIRE(view.num_values() == 149244);
+        std::remove(corrupt_file.c_str());
+    }
+}
+
+#ifdef LIBFS_WITH_ZLIB
+TEST_CASE( "Reading and writing MGZ files works" ) {
+
+    SECTION("The demo MGZ file contains the same data as the demo MGH file." ) {
+        fs::Mgh mgz;
+        fs::read_mgh(&mgz, "examples/read_mgz/brain.mgz");
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, "examples/read_mgh/brain.mgh");
+        REQUIRE(mgz.header.dtype == fs::MRI_UCHAR);
+        REQUIRE(mgz.header.dim1length == 256);
+        REQUIRE(mgz.data.data_mri_uchar == mgh.data.data_mri_uchar);
+
+        fs::MghHeader header;
+        fs::read_mgh_header(&header, "examples/read_mgz/brain.mgz");
+        REQUIRE(header.num_values() == mgh.header.num_values());
+    }
+
+    SECTION("Writing and re-reading an MGZ file works." ) {
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, "examples/read_mgh/lh.thickness.mgh");
+        const std::string mgz_out_file = "examples/read_mgh/thickness_tmp.mgz";
+        fs::write_mgh(mgh, mgz_out_file);
+        std::vector<float> data = fs::read_desc_data(mgz_out_file);
+        REQUIRE(data == mgh.data.data_mri_float);
+
+        fs::util::GzOfstream os(mgz_out_file);
+        fs::write_mgh(mgh, os);
+        os.close();
+        REQUIRE_THROWS_AS(os.close(), std::runtime_error);
+        REQUIRE(fs::read_desc_data(mgz_out_file) == mgh.data.data_mri_float);
+    }
+
+    #ifdef __linux__
+    SECTION("Errors on closing an MGZ file are reported." ) {
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, "examples/read_mgh/lh.thickness.mgh");
+        fs::util::GzOfstream os("/dev/full");  // Accepts opening, but every write fails with ENOSPC.
+        fs::write_mgh(mgh, os);
+        REQUIRE_THROWS_AS(os.close(), std::runtime_error);
+    }
+    #endif
+}
+#endif
+
+TEST_CASE( "Reading 4D MGH files frame by frame works." ) {
+
+    // A small 4D float volume, with 7 frames of 3 x 4 x 5 voxels.
+    fs::Mgh mgh;
+    mgh.header.dim1length = 3;
+    mgh.header.dim2length = 4;
+    mgh.header.dim3length = 5;
+    mgh.header.dim4length = 7;
+    mgh.header.dtype = fs::MRI_FLOAT;
+    mgh.data.data_mri_float.resize(mgh.header.num_values());
+    for(size_t i = 0; i < mgh.data.data_mri_float.size(); i++) {
+        mgh.data.data_mri_float[i] = float(i) * 0.5f - 10.0f;
+    }
+    const size_t frame_size = 3 * 4 * 5;
+    const std::vector<float>& all = mgh.data.data_mri_float;
+
+    std::vector<std::string> files = { "examples/read_mgh/frames_tmp.mgh" };
+    #ifdef LIBFS_WITH_ZLIB
+    files.push_back("examples/read_mgh/frames_tmp.mgz");
+    #endif
+
+    for(const std::string& file : files) {
+        fs::write_mgh(mgh, file);
+        fs::MghFrameReader reader(file);
+        REQUIRE(reader.num_frames() == 7);
+        REQUIRE(reader.frame_size() == frame_size);
+        REQUIRE(reader.header().dtype == fs::MRI_FLOAT);
+
+        // Sequential reading, with a reused buffer.
+        std::vector<float> frame;
+        size_t num_frames_read = 0;
+        while(reader.read_next_frame(&frame)) {
+            REQUIRE(frame.size() == frame_size);
+            REQUIRE(std::equal(frame.begin(), frame.end(), all.begin() + std::ptrdiff_t(num_frames_read * frame_size)));
+            num_frames_read++;
+        }
+        REQUIRE(num_frames_read == 7);
+
+        // Random access, backwards and forwards, and slabs.
+        reader.read_frame(2, &frame);
+        REQUIRE(std::equal(frame.begin(), frame.end(), all.begin() + std::ptrdiff_t(2 * frame_size)));
+        reader.read_frame(6, &frame);
+        REQUIRE(std::equal(frame.begin(), frame.end(), all.begin() + std::ptrdiff_t(6 * frame_size)));
+        std::vector<float> slab;
+        reader.read_frames(1, 3, &slab);
+        REQUIRE(slab.size() == 3 * frame_size);
+        REQUIRE(std::equal(slab.begin(), slab.end(), all.begin() + std::ptrdiff_t(frame_size)));
+        REQUIRE(reader.next_frame() == 4);
+
+        REQUIRE_THROWS_AS(reader.read_frame(7, &frame), std::out_of_range);
+        REQUIRE_THROWS_AS(reader.read_frames(5, 3, &frame), std::out_of_range);
+        std::vector<int16_t> wrong_type;
+        REQUIRE_THROWS_AS(reader.read_frame(0, &wrong_type), std::domain_error);
+        std::vector<int32_t> same_size_wrong_type;  // Same value size as float, but a different MRI data type.
+        REQUIRE_THROWS_AS(reader.read_frame(0, &same_size_wrong_type), std::domain_error);
+    }
+
+    REQUIRE_THROWS(fs::MghFrameReader("examples/read_mgh/no_such_file.mgh"));
+
+    #ifdef LIBFS_WITH_ZLIB
+    SECTION("Re-reading a frame of an MGZ file after a slab read larger than the stream buffer works." ) {
+        fs::Mgh big;
+        big.header.dim1length = 25000;
+        big.header.dim2length = 1;
+        big.header.dim3length = 1;
+        big.header.dim4length = 10;
+        big.header.dtype = fs::MRI_FLOAT;
+        big.data.data_mri_float.resize(big.header.num_values());
+        for(size_t i = 0; i < big.data.data_mri_float.size(); i++) {
+            big.data.data_mri_float[i] = float(i);
+        }
+        const std::string file = "examples/read_mgh/frames_tmp.mgz";
+        fs::write_mgh(big, file);
+        fs::MghFrameReader reader(file);
+        std::vector<float> slab, fr;
+        reader.read_frames(0, 10, &slab);
+        REQUIRE(slab == big.data.data_mri_float);
+        reader.read_frame(9, &fr);
+        REQUIRE(fr[0] == 225000.0f);
+        REQUIRE(std::equal(fr.begin(), fr.end(), big.data.data_mri_float.begin() + 225000));
+        reader.read_frame(8, &fr);
+        REQUIRE(fr[0] == 200000.0f);
+    }
+    #endif
+}
+
+
+TEST_CASE( "Sampling volumes at surface vertices with vol2surf works." ) {
+
+    // A small float volume with the linear function f(i, j, k) = i + 2j + 3k of the voxel indices, which trilinear interpolation reproduces exactly.
+    fs::Mgh mgh;
+    mgh.header.dim1length = 4;
+    mgh.header.dim2length = 5;
+    mgh.header.dim3length = 6;
+    mgh.header.dim4length = 2;
+    mgh.header.dtype = fs::MRI_FLOAT;
+    mgh.data.data_mri_float.resize(mgh.header.num_values());
+    for(int32_t f = 0; f < 2; f++) {
+        for(int32_t k = 0; k < 6; k++) {
+            for(int32_t j = 0; j < 5; j++) {
+                for(int32_t i = 0; i < 4; i++) {
+                    mgh.data.data_mri_float[size_t(i + 4 * (j + 5 * (k + 6 * f)))] = float(i + 2 * j + 3 * k) + float(f) * 100.0f;
+                }
+            }
+        }
+    }
+
+    // Place the vertices at known voxel coordinates.
+    const std::array<float, 16> v2r = fs::vox2ras_tkr(mgh.header);
+    const std::vector<float> voxels = { 1.25f, 2.5f, 3.75f,   3.0f, 4.0f, 5.0f,   -1.0f, 0.0f, 0.0f,   0.0f, 0.0f, 0.0f };
+    fs::Mesh mesh;
+    for(size_t v = 0; v < voxels.size() / 3; v++) {
+        for(size_t r = 0; r < 3; r++) {
+            mesh.vertices.push_back(v2r[r * 4] * voxels[v * 3] + v2r[r * 4 + 1] * voxels[v * 3 + 1] + v2r[r * 4 + 2] * voxels[v * 3 + 2] + v2r[r * 4 + 3]);
+        }
+    }
+
+    SECTION("The vox2ras matrices and their inverse match.") {
+        // Without valid RAS information, FreeSurfer uses LIA orientation, 1 mm voxels and the center at the origin.
+        REQUIRE(v2r[0] == Approx(-1.0f));
+        REQUIRE(v2r[6] == Approx(1.0f));
+        REQUIRE(v2r[9] == Approx(-1.0f));
+        REQUIRE(v2r[3] == Approx(2.0f));
+
+        fs::Mgh brain;
+        fs::read_mgh(&brain, "examples/read_mgh/brain.mgh");
+        for(const std::array<float, 16>& m : { fs::vox2ras(brain.header), fs::vox2ras_tkr(brain.header) }) {
+            const std::array<float, 16> inv = fs::affine_inverse(m);
+            for(size_t r = 0; r < 4; r++) {
+                for(size_t c = 0; c < 4; c++) {
+                    float prod = 0.0f;
+                    for(size_t x = 0; x < 4; x++) {
+                        prod += inv[r * 4 + x] * m[x * 4 + c];
+                    }
+                    REQUIRE(prod == Approx(r == c ? 1.0f : 0.0f).margin(1e-5));
+                }
+            }
+        }
+        std::array<float, 16> singular = {};
+        REQUIRE_THROWS_AS(fs::affine_inverse(singular), std::domain_error);
+    }
+
+    SECTION("Trilinear and nearest sampling give the expected values.") {
+        std::vector<float> tri = fs::vol2surf(mgh, mesh);
+        REQUIRE(tri.size() == 4);
+        REQUIRE(tri[0] == Approx(1.25f + 5.0f + 11.25f));
+        REQUIRE(tri[1] == Approx(3.0f + 8.0f + 15.0f));  // On the last voxel plane.
+        REQUIRE(std::isnan(tri[2]));  // Outside of the volume.
+        REQUIRE(tri[3] == Approx(0.0f).margin(1e-5));
+
+        std::vector<float> nearest = fs::vol2surf(mgh, mesh, fs::INTERP_NEAREST, 1, true, -1.0f);
+        REQUIRE(nearest[0] == Approx(100.0f + 1.0f + 6.0f + 12.0f));
+        REQUIRE(nearest[1] == Approx(100.0f + 26.0f));
+        REQUIRE(nearest[2] == Approx(-1.0f));
+
+        REQUIRE_THROWS_AS(fs::vol2surf(mgh, mesh, 5), std::invalid_argument);
+        REQUIRE_THROWS_AS(fs::vol2surf(mgh, mesh, fs::INTERP_TRILINEAR, 2), std::invalid_argument);
+    }
+
+    SECTION("Sampling along segments averages the samples.") {
+        // A pial surface shifted by one voxel along the first voxel axis.
+        fs::Mesh pial = mesh;
+        for(size_t v = 0; v < mesh.num_vertices(); v++) {
+            for(size_t r = 0; r < 3; r++) {
+                pial.vertices[v * 3 + r] += v2r[r * 4];
+            }
+        }
+        std::vector<float> at_white = fs::vol2surf_projfrac(mgh, mesh, pial, 0.0f, 0.0f, 1);
+        REQUIRE(at_white[0] == Approx(17.5f));
+        std::vector<float> avg = fs::vol2surf_projfrac(mgh, mesh, pial, 0.0f, 1.0f, 5);
+        REQUIRE(avg[0] == Approx(17.5f + 0.5f));
+        REQUIRE(avg[1] == Approx(26.0f));  // Only the first sample is inside.
+        REQUIRE(avg[2] == Approx(0.0f).margin(1e-5));  // Only the last sample is inside.
+
+        fs::Mesh other;
+        REQUIRE_THROWS_AS(fs::vol2surf_projfrac(mgh, mesh, other), std::invalid_argument);
+    }
+
+    SECTION("Sampling the demo brain volume at the white surface gives plausible intensities.") {
+        fs::Mgh brain;
+        fs::read_mgh(&brain, "examples/subjects_dir/subject1/mri/brain.mgh");
+        fs::Mesh white;
+        fs::read_surf(&white, "examples/subjects_dir/subject1/surf/lh.white");
+        std::vector<float> intensity = fs::vol2surf(brain, white);
+        REQUIRE(intensity.size() == white.num_vertices());
+        double sum = 0.0;
+        for(float value : intensity) {
+            REQUIRE(!std::isnan(value));
+            sum += double(value);
+        }
+        const double mean = sum / double(intensity.size());
+        REQUIRE(mean > 50.0);
+        REQUIRE(mean < 150.0);
+
+        // Zero distance along the normal samples at the vertex.
+        std::vector<float> along_normal = fs::vol2surf_normal(brain, white, 0.0f, 0.0f, 1);
+        REQUIRE(along_normal == intensity);
+    }
+}
+
+
 TEST_CASE( "Computing alternative representations for meshes works." ) {
 
     fs::Mesh surface = fs::Mesh::construct_cube();
@@ -546,6 +1231,185 @@ TEST_CASE( "Computing alternative representations for meshes works." ) {
     }
 }
 
+TEST_CASE( "The sorted flat edge list and the edge hash work." ) {
+
+    SECTION("The flat edge list of the cube is sorted and unique." ) {
+        fs::Mesh cube = fs::Mesh::construct_cube();
+        std::vector<uint32_t> edges = cube.as_edges();
+        REQUIRE(edges.size() == 36);  // 18 edges, 2 indices each.
+        for(size_t i = 0; i < edges.size(); i += 2) {
+            REQUIRE(edges[i] < edges[i+1]);
+            if(i > 0) {
+                REQUIRE(std::make_pair(edges[i-2], edges[i-1]) < std::make_pair(edges[i], edges[i+1]));
+            }
+        }
+        REQUIRE(cube.as_edgelist().size() == 36);
+    }
+
+    SECTION("The edge list of a brain mesh matches the CSR adjacency." ) {
+        fs::Mesh surface;
+        fs::read_surf(&surface, "examples/read_surf/lh.white");
+        std::vector<uint32_t> edges = surface.as_edges();
+        REQUIRE(edges.size() / 2 == 3 * surface.num_faces() / 2);  // Closed mesh: E = 3F / 2.
+        REQUIRE(surface.as_adjlist(false) == surface.as_adjlist(true));
+        fs::Mesh::edge_set edge_set = surface.as_edgelist();
+        REQUIRE(edge_set.size() == edges.size());
+        REQUIRE(edge_set.count(std::make_tuple(size_t(edges[2]), size_t(edges[3]))) == 1);
+        REQUIRE(edge_set.count(std::make_tuple(size_t(edges[3]), size_t(edges[2]))) == 1);
+    }
+
+    SECTION("Symmetric edges get different hashes." ) {
+        fs::Mesh::_tupleHashFunction hash;
+        REQUIRE(hash(std::make_tuple(size_t(1), size_t(2))) != hash(std::make_tuple(size_t(2), size_t(1))));
+        REQUIRE(hash(std::make_tuple(size_t(5), size_t(5))) != hash(std::make_tuple(size_t(6), size_t(6))));
+    }
+
+    SECTION("The radix sort works for values above 32 bit." ) {
+        std::vector<uint64_t> values = { 5ULL << 40, 3, 1ULL << 63, 0, 3, 70000, 1ULL << 33 };
+        std::vector<uint64_t> expected = values;
+        std::sort(expected.begin(), expected.end());
+        fs::util::_radix_sort_u64(&values, *std::max_element(values.begin(), values.end()));
+        REQUIRE(values == expected);
+    }
+}
+
+TEST_CASE( "Computing face normals, vertex normals and areas of meshes works." ) {
+
+    SECTION("The cube has the expected areas and normals." ) {
+        fs::Mesh cube = fs::Mesh::construct_cube();
+        std::vector<float> areas = cube.face_areas();
+        REQUIRE(areas.size() == 12);
+        for(size_t f = 0; f < areas.size(); f++) {
+            REQUIRE(areas[f] == Approx(2.0f));
+        }
+        REQUIRE(cube.total_area() == Approx(24.0));
+
+        std::vector<float> fn = cube.face_normals();
+        REQUIRE(fn.size() == 36);
+        for(size_t f = 0; f < 12; f++) {  // Each cube face normal is axis-aligned.
+            REQUIRE(std::fabs(fn[3*f]) + std::fabs(fn[3*f+1]) + std::fabs(fn[3*f+2]) == Approx(1.0f));
+        }
+
+        std::vector<float> vn = cube.vertex_normals();
+        REQUIRE(vn.size() == 24);
+        for(size_t v = 0; v < 8; v++) {
+            REQUIRE(vn[3*v] * vn[3*v] + vn[3*v+1] * vn[3*v+1] + vn[3*v+2] * vn[3*v+2] == Approx(1.0f));
+        }
+    }
+
+    SECTION("The vertex-to-face incidence is consistent with the faces and cached." ) {
+        fs::Mesh surface;
+        fs::read_surf(&surface, "examples/read_surf/lh.white");
+        const fs::AdjacencyCSR& vf = surface.vertex_faces();
+        REQUIRE(vf.num_vertices() == surface.num_vertices());
+        REQUIRE(vf.num_directed_edges() == 3 * surface.num_faces());
+        size_t num_wrong = 0;
+        for(size_t v = 0; v < vf.num_vertices(); v += 101) {
+            for(const uint32_t* it = vf.neighbors_begin(v); it != vf.neighbors_end(v); ++it) {
+                std::vector<int32_t> fverts = surface.face_vertices(*it);
+                if(std::find(fverts.begin(), fverts.end(), int32_t(v)) == fverts.end()) {
+                    num_wrong++;
+                }
+            }
+        }
+        REQUIRE(num_wrong == 0);
+        REQUIRE(&surface.vertex_faces() == &vf);  // Cached.
+
+        std::vector<float> vn = surface.vertex_normals();
+        REQUIRE(vn.size() == surface.vertices.size());
+        REQUIRE(vn[0] * vn[0] + vn[1] * vn[1] + vn[2] * vn[2] == Approx(1.0f));
+
+        std::vector<float> areas = surface.face_areas();
+        double sum = 0.0;
+        for(size_t f = 0; f < areas.size(); f++) {
+            sum += areas[f];
+        }
+        REQUIRE(surface.total_area() == Approx(sum));
+        REQUIRE(surface.total_area() > 50000.0);  // A hemisphere is roughly 80000 to 100000 mm^2.
+
+        // Changing the faces in place requires invalidating the cached incidence.
+        std::swap(surface.faces[0], surface.faces[3]);
+        std::swap(surface.faces[1], surface.faces[4]);
+        std::swap(surface.faces[2], surface.faces[5]);
+        surface.invalidate_cache();
+        const fs::AdjacencyCSR& vf2 = surface.vertex_faces();
+        REQUIRE(vf2.neighbors[vf2.offsets[size_t(surface.faces[0])]] == 0);
+    }
+}
+
+TEST_CASE( "The derived data cache of meshes is shared, thread-safe and invalidated on changes." ) {
+
+    fs::Mesh surface;
+    fs::read_surf(&surface, "examples/read_surf/lh.white");
+
+    SECTION("Cached entries are computed once and match the uncached versions." ) {
+        const fs::AdjacencyCSR& adj = surface.cached_adjcsr();
+        REQUIRE(&adj == &surface.cached_adjcsr());
+        const fs::AdjacencyCSR adj_ref = surface.as_adjcsr();
+        REQUIRE(adj.offsets == adj_ref.offsets);
+        REQUIRE(adj.neighbors == adj_ref.neighbors);
+        REQUIRE(surface.cached_edges() == surface.as_edges());
+        REQUIRE(&surface.cached_edges() == &surface.cached_edges());
+        REQUIRE(surface.cached_vertex_normals() == surface.vertex_normals());
+        REQUIRE(&surface.cached_vertex_normals() == &surface.cached_vertex_normals());
+    }
+
+    SECTION("Copies share computed entries, and changes invalidate them." ) {
+        const fs::AdjacencyCSR* adj = &surface.cached_adjcsr();
+        const std::vector<float>* normals = &surface.cached_vertex_normals();
+        fs::Mesh copy = surface;
+        REQUIRE(&copy.cached_adjcsr() == adj);
+
+        // Moving a vertex in place is only picked up after invalidating the cache.
+        copy.vertices[0] += 5.0f;
+        REQUIRE(&copy.cached_vertex_normals() == normals);
+        copy.invalidate_cache();
+        REQUIRE(copy.cached_vertex_normals() == copy.vertex_normals());
+        REQUIRE(&copy.cached_vertex_normals() != normals);
+        REQUIRE(&surface.cached_vertex_normals() == normals);  // The original is not affected.
+
+        // Changing the sizes of the vectors is detected automatically.
+        fs::Mesh cube = fs::Mesh::construct_cube();
+        copy.faces = cube.faces;
+        copy.vertices = cube.vertices;
+        REQUIRE(copy.cached_adjcsr().num_vertices() == 8);
+        REQUIRE(copy.cached_adjcsr().neighbors == cube.as_adjcsr().neighbors);
+        REQUIRE(copy.cached_edges().size() == 2 * 18);
+        REQUIRE(surface.cached_adjcsr().num_vertices() == surface.num_vertices());
+
+        copy.invalidate_cache();
+        REQUIRE(copy.cached_edges().size() == 2 * 18);
+    }
+
+    SECTION("Concurrent first access computes a single shared result." ) {
+        const std::ptrdiff_t num_tasks = 8;
+        std::vector<const fs::AdjacencyCSR*> seen(size_t(num_tasks), nullptr);
+        std::vector<const std::vector<float>*> seen_normals(size_t(num_tasks), nullptr);
+        #ifdef _OPENMP
+        #pragma omp parallel for num_threads(4)
+        #endif
+        for(std::ptrdiff_t i = 0; i < num_tasks; i++) {
+            seen[size_t(i)] = &surface.cached_adjcsr();
+            seen_normals[size_t(i)] = &surface.cached_vertex_normals();
+        }
+        for(std::ptrdiff_t i = 1; i < num_tasks; i++) {
+            REQUIRE(seen[size_t(i)] == seen[0]);
+            REQUIRE(seen_normals[size_t(i)] == seen_normals[0]);
+        }
+    }
+
+    SECTION("Smoothing with the cached adjacency gives the same results." ) {
+        std::vector<float> pvd(surface.num_vertices());
+        for(size_t i = 0; i < pvd.size(); i++) {
+            pvd[i] = float(i % 17);
+        }
+        const std::vector<float> ref = fs::Mesh::smooth_pvd_nn(surface.as_adjcsr(), pvd, 3);
+        REQUIRE(surface.smooth_pvd_nn(pvd, 3) == ref);
+        REQUIRE(surface.smooth_pvd_nn(pvd, 3) == ref);
+    }
+}
+
+
 TEST_CASE( "A mesh neighborhood can be expanded." ) {
 
     fs::Mesh surface = fs::Mesh::construct_cube();
@@ -561,6 +1425,161 @@ TEST_CASE( "A mesh neighborhood can be expanded." ) {
     }
 }
 
+TEST_CASE( "Computing k-ring neighborhoods works." ) {
+
+    fs::Mesh surface;
+    fs::read_surf(&surface, "examples/read_surf/lh.white");
+    fs::AdjacencyCSR adj = surface.as_adjcsr();
+
+    SECTION("The k-ring neighborhoods and hop distances match a reference BFS." ) {
+        std::vector<uint16_t> hops;
+        fs::AdjacencyCSR ring = fs::Mesh::kring(adj, 4, &hops);
+        REQUIRE(ring.num_vertices() == adj.num_vertices());
+        REQUIRE(hops.size() == ring.neighbors.size());
+
+        const std::vector<size_t> sources = { 0, 1000, 77777, 149243 };
+        for(size_t si = 0; si < sources.size(); si++) {
+            const size_t source = sources[si];
+            std::map<uint32_t, uint16_t> expected;  // vertex -> hop distance
+            std::vector<uint32_t> frontier = { uint32_t(source) };
+            expected[uint32_t(source)] = 0;
+            for(uint16_t hop = 1; hop <= 4; hop++) {
+                std::vector<uint32_t> next;
+                for(size_t f = 0; f < frontier.size(); f++) {
+                    for(const uint32_t* it = adj.neighbors_begin(frontier[f]); it != adj.neighbors_end(frontier[f]); ++it) {
+                        if(expected.count(*it) == 0) {
+                            expected[*it] = hop;
+                            next.push_back(*it);
+                        }
+                    }
+                }
+                frontier = next;
+            }
+            expected.erase(uint32_t(source));
+            REQUIRE(ring.degree(source) == expected.size());
+            size_t j = ring.offsets[source];
+            for(std::map<uint32_t, uint16_t>::const_iterator it = expected.begin(); it != expected.end(); ++it, ++j) {
+                REQUIRE(ring.neighbors[j] == it->first);
+                REQUIRE(hops[j] == it->second);
+            }
+        }
+    }
+
+    SECTION("The 1-ring is the adjacency, and extend_adj is a k-ring." ) {
+        REQUIRE(fs::Mesh::kring(adj, 1).neighbors == adj.neighbors);
+        REQUIRE(fs::Mesh::kring(adj, 0).num_directed_edges() == 0);
+        REQUIRE(fs::Mesh::extend_adj(adj, 2).neighbors == fs::Mesh::kring(adj, 3).neighbors);
+    }
+}
+
+TEST_CASE( "Computing geodesic distances with Dijkstra and fast marching works." ) {
+
+    // A flat 21 x 21 grid with unit spacing, where the geodesic distance is the Euclidean distance. The faces come from construct_grid, the vertex coordinates are set explicitly.
+    const size_t n = 21;
+    fs::Mesh grid = fs::Mesh::construct_grid(n, n);
+    for(size_t i = 0; i < n; i++) {
+        for(size_t j = 0; j < n; j++) {
+            grid.vertices[3 * (i * n + j)] = float(i);
+            grid.vertices[3 * (i * n + j) + 1] = float(j);
+        }
+    }
+    const int32_t center = int32_t(10 * n + 10);
+    auto euclidean = [&grid](int32_t a, size_t b) {
+        const float dx = grid.vertices[3 * size_t(a)] - grid.vertices[3 * b], dy = grid.vertices[3 * size_t(a) + 1] - grid.vertices[3 * b + 1];
+        return std::sqrt(dx * dx + dy * dy);
+    };
+
+    SECTION("Single-source distances on a flat grid are close to the Euclidean distances." ) {
+        const std::vector<float> fmm = grid.geodesic_distances({ center });
+        const std::vector<float> dijkstra = grid.geodesic_distances({ center }, std::numeric_limits<float>::infinity(), fs::GEODESIC_DIJKSTRA);
+        REQUIRE(fmm.size() == grid.num_vertices());
+        REQUIRE(fmm[size_t(center)] == 0.0f);
+        float max_err_fmm = 0.0f, max_err_dijkstra = 0.0f;
+        for(size_t v = 0; v < grid.num_vertices(); v++) {
+            const float e = euclidean(center, v);
+            REQUIRE(dijkstra[v] >= e - 1e-4f);  // Paths along edges are never shorter.
+            REQUIRE(fmm[v] <= dijkstra[v] + 1e-4f);
+            max_err_fmm = std::max(max_err_fmm, std::fabs(fmm[v] - e) / std::max(e, 1.0f));
+            max_err_dijkstra = std::max(max_err_dijkstra, std::fabs(dijkstra[v] - e) / std::max(e, 1.0f));
+        }
+        REQUIRE(max_err_dijkstra > 0.2f);  // Along the anti-diagonal, Dijkstra has to go around the corner.
+        REQUIRE(max_err_fmm < 0.05f);
+        REQUIRE(dijkstra[size_t(center + 3)] == Approx(3.0f));  // Straight along an edge line.
+    }
+
+    SECTION("Multi-source and bounded distances are consistent with single-source distances." ) {
+        const int32_t other = 3;
+        const std::vector<float> d1 = grid.geodesic_distances({ center });
+        const std::vector<float> d2 = grid.geodesic_distances({ other });
+        const std::vector<float> both = grid.geodesic_distances({ center, other }, std::numeric_limits<float>::infinity(), fs::GEODESIC_DIJKSTRA);
+        const std::vector<float> d1_dij = grid.geodesic_distances({ center }, std::numeric_limits<float>::infinity(), fs::GEODESIC_DIJKSTRA);
+        const std::vector<float> d2_dij = grid.geodesic_distances({ other }, std::numeric_limits<float>::infinity(), fs::GEODESIC_DIJKSTRA);
+        for(size_t v = 0; v < grid.num_vertices(); v++) {
+            REQUIRE(both[v] == Approx(std::min(d1_dij[v], d2_dij[v])));
+        }
+
+        const std::vector<float> bounded = grid.geodesic_distances({ center }, 4.5f);
+        for(size_t v = 0; v < grid.num_vertices(); v++) {
+            if(d1[v] <= 4.5f) {
+                REQUIRE(bounded[v] == d1[v]);
+            } else {
+                REQUIRE(std::isinf(bounded[v]));
+            }
+        }
+
+        REQUIRE_THROWS_AS(grid.geodesic_distances({ int32_t(grid.num_vertices()) }), std::invalid_argument);
+        REQUIRE_THROWS_AS(grid.geodesic_distances({ 0 }, -1.0f), std::invalid_argument);
+        REQUIRE_THROWS_AS(grid.geodesic_distances({ 0 }, 1.0f, 7), std::invalid_argument);
+    }
+
+    SECTION("Geodesic balls match the bounded single-source searches." ) {
+        std::vector<int32_t> centers(grid.num_vertices());
+        std::iota(centers.begin(), centers.end(), 0);
+        std::vector<float> dist;
+        const fs::AdjacencyCSR balls = grid.geodesic_balls(centers, 3.0f, &dist);
+        REQUIRE(balls.num_vertices() == centers.size());
+        REQUIRE(dist.size() == balls.neighbors.size());
+        for(size_t c = 0; c < centers.size(); c += 37) {
+            const std::vector<float> ref = grid.geodesic_distances({ centers[c] }, 3.0f);
+            size_t num_in = 0;
+            for(size_t v = 0; v < ref.size(); v++) {
+                num_in += std::isinf(ref[v]) ? 0 : 1;
+            }
+            REQUIRE(balls.degree(c) == num_in);
+            for(uint32_t k = balls.offsets[c]; k < balls.offsets[c + 1]; k++) {
+                REQUIRE(dist[k] == ref[balls.neighbors[k]]);
+                if(k > balls.offsets[c]) {
+                    REQUIRE(balls.neighbors[k] > balls.neighbors[k - 1]);
+                }
+            }
+        }
+    }
+
+    SECTION("Geodesic balls on a brain surface work." ) {
+        fs::Mesh surface;
+        fs::read_surf(&surface, "examples/read_surf/lh.white");
+        std::vector<int32_t> centers;
+        for(int32_t v = 0; v < int32_t(surface.num_vertices()); v += 997) {
+            centers.push_back(v);
+        }
+        std::vector<float> dist_fmm, dist_dij;
+        const fs::AdjacencyCSR balls_fmm = surface.geodesic_balls(centers, 5.0f, &dist_fmm);
+        const fs::AdjacencyCSR balls_dij = surface.geodesic_balls(centers, 5.0f, &dist_dij, fs::GEODESIC_DIJKSTRA);
+        size_t total_fmm = 0, total_dij = 0;
+        for(size_t c = 0; c < centers.size(); c++) {
+            REQUIRE(balls_fmm.degree(c) >= 1);  // Contains the center.
+            total_fmm += balls_fmm.degree(c);
+            total_dij += balls_dij.degree(c);
+        }
+        REQUIRE(total_fmm >= total_dij);  // Fast marching distances are shorter, so the balls are larger.
+        for(float d : dist_fmm) {
+            REQUIRE(d >= 0.0f);
+            REQUIRE(d <= 5.0f);
+        }
+    }
+}
+
+
 TEST_CASE( "Smoothing per-vertex data for meshes works." ) {
 
     fs::Mesh surface = fs::Mesh::construct_cube();
@@ -590,6 +1609,386 @@ TEST_CASE( "Smoothing per-vertex data for meshes works." ) {
 }
 
 
+TEST_CASE( "Smoothing per-vertex data with many iterations is stable and deterministic." ) {
+
+    fs::Mesh surface;
+    fs::read_surf(&surface, "examples/read_surf/lh.white");
+    fs::AdjacencyCSR adj = surface.as_adjcsr();
+    std::vector<float> pvd = fs::read_curv_data("examples/read_curv/lh.thickness");
+
+    SECTION("Zero iterations return the input, and constant data stays constant." ) {
+        REQUIRE(fs::Mesh::smooth_pvd_nn(adj, pvd, 0) == pvd);
+        std::vector<float> constant(pvd.size(), 2.0f);
+        std::vector<float> constant_smooth = fs::Mesh::smooth_pvd_nn(adj, constant, 50);
+        for(size_t i = 0; i < constant_smooth.size(); i += 1000) {
+            REQUIRE(constant_smooth[i] == Approx(2.0f));
+        }
+    }
+
+    SECTION("The result does not depend on the number of threads." ) {
+        std::vector<float> pvd_nan = pvd;
+        pvd_nan[100] = NAN;
+        #ifdef _OPENMP
+        const int num_threads_before = omp_get_max_threads();
+        omp_set_num_threads(1);
+        #endif
+        std::vector<float> single = fs::Mesh::smooth_pvd_nn(adj, pvd, 20);
+        std::vector<float> single_nan = fs::Mesh::smooth_pvd_nn(adj, pvd_nan, 20);
+        #ifdef _OPENMP
+        omp_set_num_threads(4);
+        #endif
+        std::vector<float> multi = fs::Mesh::smooth_pvd_nn(adj, pvd, 20);
+        std::vector<float> multi_nan = fs::Mesh::smooth_pvd_nn(adj, pvd_nan, 20);
+        #ifdef _OPENMP
+        omp_set_num_threads(num_threads_before);
+        #endif
+        REQUIRE(single == multi);
+        REQUIRE(std::isnan(multi_nan[100]));
+        single_nan[100] = multi_nan[100] = 0.0f;
+        REQUIRE(single_nan == multi_nan);
+    }
+}
+
+TEST_CASE( "Batched smoothing of several per-vertex descriptors works." ) {
+
+    fs::Mesh surface;
+    fs::read_surf(&surface, "examples/read_surf/lh.white");
+    fs::AdjacencyCSR adj = surface.as_adjcsr();
+    std::vector<float> thickness = fs::read_curv_data("examples/read_curv/lh.thickness");
+    std::vector<float> scaled(thickness.size());
+    std::vector<float> with_nan = thickness;
+    for(size_t i = 0; i < thickness.size(); i++) {
+        scaled[i] = thickness[i] * 3.5f - 1.0f;
+        if(i % 997 == 0) {
+            with_nan[i] = NAN;
+        }
+    }
+
+    SECTION("Interleaving and deinterleaving channels are inverse operations." ) {
+        std::vector<std::vector<float>> channels = { { 1.0f, 2.0f, 3.0f }, { 10.0f, 20.0f, 30.0f } };
+        std::vector<float> il = fs::util::interleave(channels);
+        REQUIRE(il == std::vector<float>({ 1.0f, 10.0f, 2.0f, 20.0f, 3.0f, 30.0f }));
+        REQUIRE(fs::util::deinterleave(il, 2) == channels);
+        REQUIRE_THROWS(fs::util::deinterleave(il, 4));
+    }
+
+    SECTION("Each smoothed channel is identical to smoothing the channel alone." ) {
+        std::vector<std::vector<float>> res = fs::Mesh::smooth_pvd_nn_batch(adj, std::vector<std::vector<float>>({ thickness, scaled, with_nan }), 10);
+        REQUIRE(res.size() == 3);
+        REQUIRE(res[0] == fs::Mesh::smooth_pvd_nn(adj, thickness, 10));
+        REQUIRE(res[1] == fs::Mesh::smooth_pvd_nn(adj, scaled, 10));
+        std::vector<float> nan_single = fs::Mesh::smooth_pvd_nn(adj, with_nan, 10);
+        size_t num_mismatches = 0;
+        for(size_t i = 0; i < nan_single.size(); i++) {
+            if(std::isnan(nan_single[i]) != std::isnan(res[2][i]) || (! std::isnan(nan_single[i]) && nan_single[i] != res[2][i])) {
+                num_mismatches++;
+            }
+        }
+        REQUIRE(num_mismatches == 0);
+    }
+
+    SECTION("Data of the wrong length is rejected." ) {
+        REQUIRE_THROWS(fs::Mesh::smooth_pvd_nn_batch(adj, thickness, 2));
+    }
+}
+
+TEST_CASE( "The sparse Gaussian smoothing operator works." ) {
+
+    // A flat 21 x 21 grid with unit spacing, see the geodesic distance test.
+    const size_t n = 21;
+    fs::Mesh grid = fs::Mesh::construct_grid(n, n);
+    for(size_t i = 0; i < n; i++) {
+        for(size_t j = 0; j < n; j++) {
+            grid.vertices[3 * (i * n + j)] = float(i);
+            grid.vertices[3 * (i * n + j) + 1] = float(j);
+        }
+    }
+    const size_t center = 10 * n + 10;
+
+    SECTION("The weights are normalized and follow a Gaussian with the requested FWHM." ) {
+        REQUIRE(fs::fwhm_to_sigma(2.3548f) == Approx(1.0f).epsilon(0.001));
+        const fs::SmoothingOperator op = grid.gaussian_smoothing_operator(4.0f);
+        REQUIRE(op.num_vertices() == grid.num_vertices());
+        REQUIRE(op.fwhm == 4.0f);
+        REQUIRE(op.columns.size() == op.num_nonzeros());
+        for(size_t i = 0; i < op.num_vertices(); i++) {
+            float sum = 0.0f;
+            for(uint32_t k = op.offsets[i]; k < op.offsets[i + 1]; k++) {
+                sum += op.weights[k];
+            }
+            REQUIRE(sum == Approx(1.0f));
+        }
+        // At half the FWHM from the center, the kernel is at half of its maximum.
+        float w_center = 0.0f, w_half = 0.0f;
+        for(uint32_t k = op.offsets[center]; k < op.offsets[center + 1]; k++) {
+            if(op.columns[k] == center) { w_center = op.weights[k]; }
+            if(op.columns[k] == center + 2) { w_half = op.weights[k]; }
+        }
+        REQUIRE(w_half / w_center == Approx(0.5f).epsilon(0.01));
+        // The kernel is truncated at 3 sigma, about 5.1 units.
+        REQUIRE(op.offsets[center + 1] - op.offsets[center] < 100);
+
+        const std::vector<float> constant(grid.num_vertices(), 2.5f);
+        const std::vector<float> smooth = op.apply(constant);
+        for(size_t i = 0; i < smooth.size(); i++) {
+            REQUIRE(smooth[i] == Approx(2.5f));
+        }
+    }
+
+    SECTION("NAN values are skipped or propagated, and the batch version matches the single channel version." ) {
+        const fs::SmoothingOperator op = grid.gaussian_smoothing_operator(3.0f, fs::GEODESIC_DIJKSTRA);
+        std::vector<float> data(grid.num_vertices());
+        for(size_t i = 0; i < data.size(); i++) {
+            data[i] = float(i % 7) + 0.25f * float(i % 3);
+        }
+        std::vector<float> with_nan = data;
+        with_nan[center] = NAN;
+        const std::vector<float> skipped = op.apply(with_nan);
+        const std::vector<float> propagated = op.apply(with_nan, false);
+        for(size_t i = 0; i < data.size(); i++) {
+            REQUIRE(! std::isnan(skipped[i]));
+            bool uses_center = false;
+            for(uint32_t k = op.offsets[i]; k < op.offsets[i + 1]; k++) {
+                uses_center = uses_center || op.columns[k] == center;
+            }
+            REQUIRE(std::isnan(propagated[i]) == uses_center);
+        }
+
+        const std::vector<float> a = op.apply(data);
+        const std::vector<float> b = op.apply(with_nan);
+        const std::vector<float> batch = op.apply_batch(fs::util::interleave(std::vector<std::vector<float>>({ data, with_nan })), 2);
+        const std::vector<std::vector<float>> res = fs::util::deinterleave(batch, 2);
+        for(size_t i = 0; i < data.size(); i++) {
+            REQUIRE(res[0][i] == Approx(a[i]));
+            REQUIRE(res[1][i] == Approx(b[i]));
+        }
+
+        REQUIRE_THROWS(op.apply(std::vector<float>(3, 1.0f)));
+        REQUIRE_THROWS(op.apply_batch(data, 2));
+        REQUIRE_THROWS(grid.gaussian_smoothing_operator(0.0f));
+        REQUIRE_THROWS(grid.gaussian_smoothing_operator(2.0f, 5));
+    }
+
+    SECTION("An operator for a brain surface smooths thickness and survives the binary cache." ) {
+        fs::Mesh surface;
+        fs::read_surf(&surface, "examples/read_surf/lh.white");
+        const std::vector<float> thickness = fs::read_desc_data("examples/read_curv/lh.thickness");
+        const fs::SmoothingOperator op = surface.gaussian_smoothing_operator(2.0f);
+        REQUIRE(op.num_vertices() == surface.num_vertices());
+        const std::vector<float> smooth = op.apply(thickness);
+        double mean_in = 0.0, mean_out = 0.0;
+        for(size_t i = 0; i < thickness.size(); i++) {
+            mean_in += thickness[i];
+            mean_out += smooth[i];
+        }
+        mean_in /= double(thickness.size());
+        mean_out /= double(thickness.size());
+        REQUIRE(mean_out == Approx(mean_in).epsilon(0.01));
+        double var_in = 0.0, var_out = 0.0;
+        for(size_t i = 0; i < thickness.size(); i++) {
+            var_in += (thickness[i] - mean_in) * (thickness[i] - mean_in);
+            var_out += (smooth[i] - mean_out) * (smooth[i] - mean_out);
+        }
+        REQUIRE(var_out < var_in);
+
+        const std::string cache_file = "examples/read_surf/lh.white.fscache_tmp";
+        fs::CacheWriter cw;
+        cw.add_smoothing_operator("surf/lh.white:fwhm2", op);
+        cw.write(cache_file);
+        {
+            fs::CacheFile cf(cache_file);
+            fs::SmoothingOperator op2;
+            REQUIRE(! cf.get_smoothing_operator("surf/lh.pial:fwhm2", &op2));
+            REQUIRE(cf.get_smoothing_operator("surf/lh.white:fwhm2", &op2));
+            REQUIRE(op2.fwhm == 2.0f);
+            REQUIRE(op2.offsets == op.offsets);
+            REQUIRE(op2.columns == op.columns);
+            REQUIRE(op2.apply(thickness) == smooth);
+        }
+        std::remove(cache_file.c_str());
+    }
+}
+
+TEST_CASE( "Reordering mesh vertices for memory locality works." ) {
+
+    fs::Mesh surface;
+    fs::read_surf(&surface, "examples/read_surf/lh.white");
+    const size_t nv = surface.num_vertices();
+    // Mean index distance between the two vertices of an edge, small if neighbors are close in memory.
+    auto mean_edge_span = [](const fs::Mesh& mesh) {
+        const std::vector<uint32_t> edges = mesh.as_edges();
+        double sum = 0.0;
+        for(size_t i = 0; i < edges.size(); i += 2) {
+            sum += double(edges[i + 1] - edges[i]);
+        }
+        return sum / double(edges.size() / 2);
+    };
+
+    SECTION("All methods compute permutations that improve the locality of a shuffled mesh." ) {
+        // Shuffle the vertices with a fixed linear congruential generator, to get a mesh without any locality.
+        std::vector<int32_t> shuffle(nv);
+        std::iota(shuffle.begin(), shuffle.end(), 0);
+        uint64_t state = 42;
+        for(size_t i = nv - 1; i > 0; i--) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            std::swap(shuffle[i], shuffle[size_t((state >> 33) % (i + 1))]);
+        }
+        fs::Mesh shuffled = surface;
+        shuffled.permute_vertices(shuffle);
+        REQUIRE(shuffled.total_area() == Approx(surface.total_area()));
+        const double span_shuffled = mean_edge_span(shuffled);
+
+        const int methods[3] = { fs::REORDER_MORTON, fs::REORDER_HILBERT, fs::REORDER_RCM };
+        for(size_t m = 0; m < 3; m++) {
+            fs::Mesh reordered = shuffled;
+            const std::vector<int32_t> order = reordered.reorder_vertices(methods[m]);
+            REQUIRE(order.size() == nv);
+            REQUIRE(fs::Mesh::invert_permutation(order, nv).size() == nv);  // Throws if it is not a permutation.
+            REQUIRE(reordered.num_faces() == surface.num_faces());
+            REQUIRE(reordered.total_area() == Approx(surface.total_area()));
+            REQUIRE(mean_edge_span(reordered) < 0.05 * span_shuffled);
+            REQUIRE(shuffled.vertex_order(methods[m]) == order);  // Deterministic.
+        }
+        REQUIRE_THROWS(surface.vertex_order(3));
+    }
+
+    SECTION("The Hilbert order of a regular lattice moves to a neighboring point in each step." ) {
+        fs::Mesh lattice;
+        const size_t n = 8;
+        for(size_t i = 0; i < n * n * n; i++) {
+            lattice.vertices.push_back(float(i % n));
+            lattice.vertices.push_back(float((i / n) % n));
+            lattice.vertices.push_back(float(i / (n * n)));
+        }
+        const std::vector<int32_t> order = lattice.vertex_order(fs::REORDER_HILBERT);
+        for(size_t i = 1; i < order.size(); i++) {
+            float dist = 0.0f;
+            for(size_t d = 0; d < 3; d++) {
+                dist += std::fabs(lattice.vertices[3 * size_t(order[i]) + d] - lattice.vertices[3 * size_t(order[i - 1]) + d]);
+            }
+            REQUIRE(dist == 1.0f);
+        }
+    }
+
+    SECTION("Results on the reordered mesh map back to the results on the original mesh." ) {
+        fs::Mesh reordered = surface;
+        const std::vector<int32_t> order = reordered.reorder_vertices(fs::REORDER_RCM);
+        const std::vector<float> thickness = fs::read_curv_data("examples/read_curv/lh.thickness");
+        const std::vector<float> smooth = fs::Mesh::smooth_pvd_nn(surface.cached_adjcsr(), thickness, 5);
+        const std::vector<float> smooth_reordered = fs::Mesh::smooth_pvd_nn(reordered.cached_adjcsr(), fs::Mesh::permute_vertex_data(thickness, order), 5);
+        const std::vector<float> smooth_back = fs::Mesh::unpermute_vertex_data(smooth_reordered, order);
+        for(size_t i = 0; i < nv; i++) {
+            REQUIRE(smooth_back[i] == Approx(smooth[i]));
+        }
+
+        fs::Curv curv(thickness);
+        fs::permute_vertices(&curv, order);
+        REQUIRE(curv.data == fs::Mesh::permute_vertex_data(thickness, order));
+        fs::permute_vertices(&curv, order, true);
+        REQUIRE(curv.data == thickness);
+
+        fs::Annot annot;
+        fs::read_annot(&annot, "examples/read_annot/lh.aparc.annot");
+        const std::vector<int32_t> labels = annot.vertex_labels;
+        fs::permute_vertices(&annot, order);
+        for(size_t i = 0; i < nv; i++) {
+            REQUIRE(annot.vertex_labels[i] == labels[size_t(order[i])]);
+        }
+        fs::permute_vertices(&annot, order, true);
+        REQUIRE(annot.vertex_labels == labels);
+
+        fs::Label label(std::vector<int>({ 0, 17, int(nv) - 1 }));
+        fs::permute_vertices(&label, order);
+        const std::vector<int32_t> old2new = fs::Mesh::invert_permutation(order, nv);
+        REQUIRE(label.vertex == std::vector<int>({ old2new[0], old2new[17], old2new[nv - 1] }));
+        REQUIRE(reordered.vertices[3 * size_t(label.vertex[1])] == surface.vertices[3 * 17]);
+        fs::permute_vertices(&label, order, true);
+        REQUIRE(label.vertex == std::vector<int>({ 0, 17, int(nv) - 1 }));
+        fs::Label bad_label(std::vector<int>({ 0, 17, int(nv) }));
+        REQUIRE_THROWS_AS(fs::permute_vertices(&bad_label, order), std::invalid_argument);
+        REQUIRE(bad_label.vertex == std::vector<int>({ 0, 17, int(nv) }));  // Untouched.
+
+        REQUIRE_THROWS(fs::Mesh::permute_vertex_data(thickness, std::vector<int32_t>({ 0, 1 })));
+        REQUIRE_THROWS(reordered.permute_vertices(std::vector<int32_t>(nv, 0)));
+    }
+}
+
+TEST_CASE( "The CSR mesh adjacency representation works." ) {
+
+    fs::Mesh surface;
+    fs::read_surf(&surface, "examples/read_surf/lh.white");
+    fs::AdjacencyCSR adj = surface.as_adjcsr();
+
+    SECTION("The CSR adjacency matches the adjacency list computed via an edge set." ) {
+        fs::Mesh cube = fs::Mesh::construct_cube();
+        std::vector<std::vector <size_t>> adjl = cube.as_adjlist(false);
+        for(size_t vi = 0; vi < adjl.size(); vi++) {
+            std::sort(adjl[vi].begin(), adjl[vi].end());
+        }
+        fs::AdjacencyCSR cube_adj = cube.as_adjcsr();
+        REQUIRE(cube_adj.num_vertices() == 8);
+        REQUIRE(cube_adj.num_directed_edges() == 36);
+        REQUIRE(cube_adj.to_adjlist() == adjl);
+        REQUIRE(cube.as_adjlist(true) == adjl);
+        REQUIRE(fs::AdjacencyCSR::from_adjlist(adjl).neighbors == cube_adj.neighbors);
+    }
+
+    SECTION("The CSR adjacency of a brain surface is symmetric and contains all face edges." ) {
+        REQUIRE(adj.num_vertices() == surface.num_vertices());
+        REQUIRE(adj.offsets.size() == surface.num_vertices() + 1);
+        REQUIRE(adj.num_directed_edges() == 3 * surface.num_faces());  // Closed mesh: E = 3F / 2, each edge is stored twice.
+        size_t num_unsorted_rows = 0;
+        size_t num_asymmetric_edges = 0;
+        for(size_t vi = 0; vi < adj.num_vertices(); vi++) {
+            if(! std::is_sorted(adj.neighbors_begin(vi), adj.neighbors_end(vi))) {
+                num_unsorted_rows++;
+            }
+            for(const uint32_t* it = adj.neighbors_begin(vi); it != adj.neighbors_end(vi); ++it) {
+                if(! std::binary_search(adj.neighbors_begin(*it), adj.neighbors_end(*it), uint32_t(vi))) {
+                    num_asymmetric_edges++;
+                }
+            }
+        }
+        REQUIRE(num_unsorted_rows == 0);
+        REQUIRE(num_asymmetric_edges == 0);
+        size_t num_missing_face_edges = 0;
+        for(size_t fi = 0; fi < surface.num_faces(); fi++) {
+            const size_t v0 = size_t(surface.fm_at(fi, 0));
+            if(! std::binary_search(adj.neighbors_begin(v0), adj.neighbors_end(v0), uint32_t(surface.fm_at(fi, 1)))) {
+                num_missing_face_edges++;
+            }
+        }
+        REQUIRE(num_missing_face_edges == 0);
+    }
+
+    SECTION("Smoothing with the CSR adjacency gives the same result as with the adjacency list." ) {
+        std::vector<float> pvd = fs::read_curv_data("examples/read_curv/lh.thickness");
+        std::vector<std::vector <size_t>> adjl = adj.to_adjlist();
+        REQUIRE(fs::Mesh::smooth_pvd_nn(adj, pvd, 3) == fs::Mesh::smooth_pvd_nn(adjl, pvd, 3));
+        pvd[5] = NAN;
+        std::vector<float> pvd_smooth = fs::Mesh::smooth_pvd_nn(adj, pvd, 3);
+        std::vector<float> pvd_smooth_list = fs::Mesh::smooth_pvd_nn(adjl, pvd, 3);
+        REQUIRE(std::isnan(pvd_smooth[5]));
+        pvd_smooth[5] = pvd_smooth_list[5] = 0.0f;
+        REQUIRE(pvd_smooth == pvd_smooth_list);
+    }
+
+    SECTION("Extending CSR neighborhoods gives the same result as for the adjacency list." ) {
+        fs::Mesh cube = fs::Mesh::construct_cube();
+        fs::AdjacencyCSR cube_adj = cube.as_adjcsr();
+        std::vector<std::vector <size_t>> cube_adjl = cube.as_adjlist();
+        REQUIRE(fs::Mesh::extend_adj(cube_adj, 1).to_adjlist() == fs::Mesh::extend_adj(cube_adjl, 1));
+        REQUIRE(fs::Mesh::extend_adj(cube_adj, 0).to_adjlist() == cube_adjl);
+    }
+
+    SECTION("Invalid face indices are detected." ) {
+        fs::Mesh broken = fs::Mesh::construct_cube();
+        broken.faces[4] = 8;
+        REQUIRE_THROWS(broken.as_adjcsr());
+    }
+}
+
+
 TEST_CASE( "Importing and exporting meshes works" ) {
 
     fs::Mesh surface;
@@ -735,6 +2134,33 @@ TEST_CASE( "Importing and exporting meshes works" ) {
     }
 
 
+    SECTION("Invalid vertex colors are rejected before the target file is truncated, and floats are written with a '.' in any locale.") {
+        fs::Mesh cube = fs::Mesh::construct_cube();
+        const std::string off_file = "examples/read_surf/lh.white_exp.off";
+        cube.to_off_file(off_file);
+        auto read_text = [](const std::string& filename) { std::ifstream ifs(filename); std::stringstream ss; ss << ifs.rdbuf(); return ss.str(); };
+        const std::string before = read_text(off_file);
+        REQUIRE_THROWS_AS(cube.to_off_file(off_file, std::vector<uint8_t>(5)), std::invalid_argument);
+        REQUIRE_THROWS_AS(cube.to_ply_file(off_file, std::vector<uint8_t>(5)), std::invalid_argument);
+        REQUIRE_THROWS_AS(cube.to_ply_binary_file(off_file, std::vector<uint8_t>(5)), std::invalid_argument);
+        REQUIRE(read_text(off_file) == before);
+
+        fs::Mesh half(std::vector<float>({ 0.5f, -1.25f, 2.0f }), std::vector<int32_t>());
+        const std::string expected = half.to_obj();
+        const char* comma_locales[] = { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8", "de_DE", "fr_FR" };
+        const std::string prev_locale = std::setlocale(LC_NUMERIC, nullptr);
+        for(const char* loc : comma_locales) {
+            if(std::setlocale(LC_NUMERIC, loc) != nullptr) {
+                const std::string written = half.to_obj();
+                std::setlocale(LC_NUMERIC, prev_locale.c_str());
+                REQUIRE(written == expected);
+                break;
+            }
+        }
+        std::setlocale(LC_NUMERIC, prev_locale.c_str());
+        REQUIRE(expected.find("0.5 -1.25 2") != std::string::npos);
+    }
+
     SECTION("Writing and re-reading OFF files works.") {
 
         const std::string off_file = "examples/read_surf/lh.white_exp.off";
@@ -884,6 +2310,240 @@ TEST_CASE( "Importing and exporting meshes works" ) {
 }
 
 
+TEST_CASE( "The buffer based mesh parsers handle binary PLY and OBJ face variants." ) {
+
+    fs::Mesh cube = fs::Mesh::construct_cube();
+
+    SECTION("The number parser agrees with strtof and rejects garbage." ) {
+        const std::vector<std::string> tokens = { "0", "-0", "1", "-1.5", "3.14159", "106.1743", "-108.6204", "0.000123", "1e-5", "2.5E+3",
+                                                   "123456789", "0.1234567890123", "1e38", "1e-40", "+7", ".5", "5.", "nan", "inf" };
+        size_t num_mismatches = 0;
+        for(size_t i = 0; i < tokens.size(); i++) {
+            const std::string& t = tokens[i];
+            fs::util::_TextScanner sc(t.data(), t.data() + t.size());
+            float parsed;
+            REQUIRE(sc.parse_float(&parsed));
+            const float expected = std::strtof(t.c_str(), nullptr);
+            if(!(parsed == expected || (std::isnan(parsed) && std::isnan(expected)))) {
+                num_mismatches++;
+            }
+        }
+        // Many short random decimals exercise the fast path.
+        for(int i = -20000; i < 20000; i += 7) {
+            std::ostringstream oss;
+            oss << (i * 0.0137f);
+            const std::string t = oss.str();
+            fs::util::_TextScanner sc(t.data(), t.data() + t.size());
+            float parsed = 0.0f;
+            if(!(sc.parse_float(&parsed) && parsed == std::strtof(t.c_str(), nullptr))) {
+                num_mismatches++;
+            }
+        }
+        REQUIRE(num_mismatches == 0);
+
+        const std::string bad = "abc";
+        fs::util::_TextScanner sc(bad.data(), bad.data() + bad.size());
+        float f;
+        REQUIRE(! sc.parse_float(&f));
+        int32_t n;
+        REQUIRE(! sc.parse_int(&n));
+
+        // The strtof fallback must not depend on LC_NUMERIC.
+        const std::string long_token = "0.1234567890123";
+        const float expected_long = std::strtof(long_token.c_str(), nullptr);
+        const char* comma_locales[] = { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8", "de_DE", "fr_FR" };
+        const std::string prev_locale = std::setlocale(LC_NUMERIC, nullptr);
+        for(const char* loc : comma_locales) {
+            if(std::setlocale(LC_NUMERIC, loc) != nullptr) {
+                fs::util::_TextScanner sc_long(long_token.data(), long_token.data() + long_token.size());
+                float parsed_long = 0.0f;
+                const bool ok_long = sc_long.parse_float(&parsed_long);
+                const std::string comma_token = "0,1234567890123";
+                fs::util::_TextScanner sc_comma(comma_token.data(), comma_token.data() + comma_token.size());
+                float parsed_comma = 0.0f;
+                const bool ok_comma = sc_comma.parse_float(&parsed_comma);
+                std::setlocale(LC_NUMERIC, prev_locale.c_str());
+                REQUIRE(ok_long);
+                REQUIRE(parsed_long == expected_long);
+                REQUIRE(! ok_comma);
+                break;
+            }
+        }
+        std::setlocale(LC_NUMERIC, prev_locale.c_str());
+    }
+
+    SECTION("Re-reading the brain mesh from OBJ, PLY and OFF strings gives identical results." ) {
+        fs::Mesh surface;
+        fs::read_surf(&surface, "examples/read_surf/lh.white");
+
+        fs::Mesh from_obj, from_ply, from_off;
+        std::istringstream obj_is(surface.to_obj());
+        fs::Mesh::from_obj(&from_obj, &obj_is);
+        std::istringstream ply_is(surface.to_ply());
+        fs::Mesh::from_ply(&from_ply, &ply_is);
+        std::istringstream off_is(surface.to_off());
+        fs::Mesh::from_off(&from_off, &off_is);
+
+        REQUIRE(from_obj.faces == surface.faces);
+        REQUIRE(from_ply.faces == surface.faces);
+        REQUIRE(from_off.faces == surface.faces);
+        REQUIRE(from_obj.vertices == from_ply.vertices);
+        REQUIRE(from_obj.vertices == from_off.vertices);
+        REQUIRE(from_obj.vertices.size() == surface.vertices.size());
+        size_t num_far_off = 0;
+        for(size_t i = 0; i < surface.vertices.size(); i++) {
+            if(std::fabs(from_obj.vertices[i] - surface.vertices[i]) > 1e-3f) {
+                num_far_off++;
+            }
+        }
+        REQUIRE(num_far_off == 0);
+    }
+
+    SECTION("OBJ faces with texture and normal indices are parsed." ) {
+        std::istringstream is("# comment\nv 0 0 0\nv 1 0 0\nv 0 1 0\nvn 0 0 1\nvt 0 0\n\nf 1/1/1 2/2/1 3/3/1\nf 3//1 2//1 1//1\nf 1/1 3/3 2/2\n");
+        fs::Mesh mesh;
+        fs::Mesh::from_obj(&mesh, &is);
+        REQUIRE(mesh.num_vertices() == 3);
+        REQUIRE(mesh.num_faces() == 3);
+        const std::vector<int> expected_faces = { 0, 1, 2,  2, 1, 0,  0, 2, 1 };
+        REQUIRE(mesh.faces == expected_faces);
+    }
+
+    SECTION("Binary PLY files in both byte orders can be read." ) {
+        for(int big_endian = 0; big_endian <= 1; big_endian++) {
+            // The vertex element gets an extra double property before x, and the face element an extra uchar property after the list, to check that they are skipped.
+            std::ostringstream os;
+            os << "ply\nformat " << (big_endian ? "binary_big_endian" : "binary_little_endian") << " 1.0\ncomment generated by libfs tests\n";
+            os << "element vertex " << cube.num_vertices() << "\nproperty double quality\nproperty float x\nproperty float y\nproperty float z\n";
+            os << "element face " << cube.num_faces() << "\nproperty list uchar int vertex_indices\nproperty uchar flags\nend_header\n";
+            const bool swap = (big_endian == 1) != fs::_is_bigendian();
+            for(size_t i = 0; i < cube.num_vertices(); i++) {
+                double quality = 42.0;
+                if(swap) quality = fs::_swap_endian<double>(quality);
+                os.write(reinterpret_cast<const char*>(&quality), sizeof(double));
+                for(size_t j = 0; j < 3; j++) {
+                    float c = cube.vertices[i * 3 + j];
+                    if(swap) c = fs::_swap_endian<float>(c);
+                    os.write(reinterpret_cast<const char*>(&c), sizeof(float));
+                }
+            }
+            for(size_t i = 0; i < cube.num_faces(); i++) {
+                const uint8_t count = 3, flags = 7;
+                os.write(reinterpret_cast<const char*>(&count), 1);
+                for(size_t j = 0; j < 3; j++) {
+                    int32_t v = cube.faces[i * 3 + j];
+                    if(swap) v = fs::_swap_endian<int32_t>(v);
+                    os.write(reinterpret_cast<const char*>(&v), sizeof(int32_t));
+                }
+                os.write(reinterpret_cast<const char*>(&flags), 1);
+            }
+            const std::string data = os.str();
+
+            fs::Mesh mesh;
+            std::istringstream is(data);
+            fs::Mesh::from_ply(&mesh, &is);
+            REQUIRE(mesh.vertices == cube.vertices);
+            REQUIRE(mesh.faces == cube.faces);
+
+            // Truncated binary data is an error.
+            std::istringstream is_short(data.substr(0, data.size() - 5));
+            REQUIRE_THROWS(fs::Mesh::from_ply(&mesh, &is_short));
+        }
+    }
+
+    SECTION("Invalid headers are rejected." ) {
+        fs::Mesh mesh;
+        std::istringstream ply_is("ply\nformat binary_middle_endian 1.0\nend_header\n");
+        REQUIRE_THROWS(fs::Mesh::from_ply(&mesh, &ply_is));
+        std::istringstream off_is("OFF\n3 1 0\n0 0 0\n1 0 0\n0 1 0\n4 0 1 2 2\n");
+        REQUIRE_THROWS(fs::Mesh::from_off(&mesh, &off_is));
+        std::istringstream obj_is("v 0 0 0\nf 1 x 2\n");
+        REQUIRE_THROWS(fs::Mesh::from_obj(&mesh, &obj_is));
+
+        // Huge element counts in the header must not cause huge allocations before the data is checked.
+        std::istringstream off_huge_is("OFF\n2000000000 2000000000 0\n0 0 0\n");
+        REQUIRE_THROWS_AS(fs::Mesh::from_off(&mesh, &off_huge_is), std::domain_error);
+        std::istringstream ply_huge_is("ply\nformat ascii 1.0\nelement vertex 2000000000\nproperty float x\nproperty float y\nproperty float z\nelement face 2000000000\nproperty list uchar int vertex_indices\nend_header\n0 0 0\n");
+        fs::Mesh::from_ply(&mesh, &ply_huge_is);  // Only warns about the count mismatch.
+        REQUIRE(mesh.num_vertices() == 1);
+    }
+}
+
+
+TEST_CASE( "The streaming mesh exporters produce the same text as before, and binary PLY." ) {
+
+    fs::Mesh surface;
+    fs::read_surf(&surface, "examples/read_surf/lh.white");
+
+    SECTION("The OBJ and OFF text is identical to iostream formatting." ) {
+        std::ostringstream ref_obj, ref_off;
+        ref_off << "OFF\n" << surface.num_vertices() << " " << surface.num_faces() << " 0\n";
+        for(size_t i = 0; i < surface.vertices.size(); i += 3) {
+            ref_obj << "v " << surface.vertices[i] << " " << surface.vertices[i+1] << " " << surface.vertices[i+2] << "\n";
+            ref_off << surface.vertices[i] << " " << surface.vertices[i+1] << " " << surface.vertices[i+2] << "\n";
+        }
+        for(size_t i = 0; i < surface.faces.size(); i += 3) {
+            ref_obj << "f " << surface.faces[i]+1 << " " << surface.faces[i+1]+1 << " " << surface.faces[i+2]+1 << "\n";
+            ref_off << 3 << " " << surface.faces[i] << " " << surface.faces[i+1] << " " << surface.faces[i+2] << "\n";
+        }
+        REQUIRE(surface.to_obj() == ref_obj.str());
+        REQUIRE(surface.to_off() == ref_off.str());
+
+        std::ostringstream os;
+        surface.to_obj(os);
+        REQUIRE(os.str() == ref_obj.str());
+    }
+
+    SECTION("Vertex colors are written as integers." ) {
+        fs::Mesh cube = fs::Mesh::construct_cube();
+        std::vector<uint8_t> col(cube.vertices.size());
+        for(size_t i = 0; i < col.size(); i++) {
+            col[i] = uint8_t(i * 37);
+        }
+        const std::string ply = cube.to_ply(col);
+        REQUIRE(ply.find("property uchar red\nproperty uchar green\nproperty uchar blue\n") != std::string::npos);
+        std::ostringstream first_vertex;
+        first_vertex << "end_header\n" << cube.vertices[0] << " " << cube.vertices[1] << " " << cube.vertices[2] << " 0 37 74\n";
+        REQUIRE(ply.find(first_vertex.str()) != std::string::npos);
+        REQUIRE(cube.to_off(col).substr(0, 5) == "COFF\n");
+        REQUIRE_THROWS(cube.to_ply(std::vector<uint8_t>(5)));
+    }
+
+    SECTION("Binary PLY output is re-read exactly." ) {
+        std::stringstream ss(std::ios::in | std::ios::out | std::ios::binary);
+        surface.to_ply_binary(ss);
+        fs::Mesh surface2;
+        fs::Mesh::from_ply(&surface2, &ss);
+        REQUIRE(surface2.vertices == surface.vertices);
+        REQUIRE(surface2.faces == surface.faces);
+
+        fs::Mesh cube = fs::Mesh::construct_cube();
+        std::vector<uint8_t> col(cube.vertices.size(), 200);
+        std::stringstream ss_col(std::ios::in | std::ios::out | std::ios::binary);
+        cube.to_ply_binary(ss_col, col);
+        const std::string data = ss_col.str();
+        const size_t header_end = data.find("end_header\n") + 11;
+        REQUIRE(data.size() - header_end == cube.num_vertices() * 15 + cube.num_faces() * 13);
+        fs::Mesh cube2;
+        fs::Mesh::from_ply(&cube2, &ss_col);
+        REQUIRE(cube2.vertices == cube.vertices);
+        REQUIRE(cube2.faces == cube.faces);
+    }
+
+    SECTION("A small write buffer gives the same result." ) {
+        std::ostringstream os;
+        fs::util::_BufferedWriter w(os, 16);
+        w.write("abcdefghijklmnopqrstuvwxyz");
+        w.put_int(-1234567890123LL);
+        w.put(' ');
+        w.put_float(0.1f);
+        w.put_int(0);
+        w.flush();
+        REQUIRE(os.str() == "abcdefghijklmnopqrstuvwxyz-1234567890123 0.10");
+    }
+}
+
+
 TEST_CASE( "Reading the demo label file works" ) {
 
     fs::Label label;
@@ -945,6 +2605,103 @@ TEST_CASE( "Reading label data from a stream works" ) {
 }
 
 
+TEST_CASE( "The label parser and vertex masks work." ) {
+
+    SECTION("The parser gives the same values as stream extraction, and rejects broken files." ) {
+        fs::Label label;
+        fs::read_label(&label, "examples/read_label/lh.cortex.label");
+        REQUIRE(label.num_entries() == 140891);
+
+        std::ifstream is("examples/read_label/lh.cortex.label");
+        std::string line;
+        std::getline(is, line);
+        std::getline(is, line);
+        for(size_t i = 0; i < label.num_entries(); i++) {
+            int vertex; float x, y, z, value;
+            is >> vertex >> x >> y >> z >> value;
+            REQUIRE(label.vertex[i] == vertex);
+            REQUIRE(label.coord_x[i] == x);
+            REQUIRE(label.coord_y[i] == y);
+            REQUIRE(label.coord_z[i] == z);
+            REQUIRE(label.value[i] == value);
+        }
+
+        fs::Label broken;
+        std::istringstream bad_line("#!ascii label\n2\n0 1.0 2.0 3.0 0.0\n1 1.0 x 3.0 0.0\n");
+        REQUIRE_THROWS_AS(fs::read_label(&broken, &bad_line), std::domain_error);
+        fs::Label short_label;
+        std::istringstream too_few("#!ascii label\n3\n0 1.0 2.0 3.0 0.0\n1 1.0 2.0 3.0 0.0\n");
+        REQUIRE_THROWS_AS(fs::read_label(&short_label, &too_few), std::domain_error);
+        fs::Label crlf;
+        std::istringstream windows_lines("#!ascii label\r\n1\r\n7 1.5 2.0 3.0 0.25\r\n");
+        fs::read_label(&crlf, &windows_lines);
+        REQUIRE(crlf.vertex == std::vector<int>{ 7 });
+        REQUIRE(crlf.value[0] == Approx(0.25f));
+    }
+
+    SECTION("Set operations on vertex masks match per-vertex logic." ) {
+        const size_t nv = 200;  // Not a multiple of 64, to test the last word.
+        fs::Label a(std::vector<int>{ 0, 3, 63, 64, 65, 150, 199 });
+        fs::Label b(std::vector<int>{ 3, 64, 100, 199, 199 });
+        const fs::VertexMask ma = a.vertex_mask(nv), mb = b.vertex_mask(nv);
+        REQUIRE(ma.count() == 7);
+        REQUIRE(mb.count() == 4);
+        REQUIRE(ma.to_bools() == a.vert_in_label(nv));
+        REQUIRE(fs::VertexMask::from_bools(a.vert_in_label(nv)) == ma);
+
+        const std::vector<bool> in_a = a.vert_in_label(nv), in_b = b.vert_in_label(nv);
+        const fs::VertexMask both = ma & mb, either = ma | mb, only_a = ma - mb, not_a = ~ma;
+        for(size_t v = 0; v < nv; v++) {
+            REQUIRE(both.test(v) == (in_a[v] && in_b[v]));
+            REQUIRE(either.test(v) == (in_a[v] || in_b[v]));
+            REQUIRE(only_a.test(v) == (in_a[v] && !in_b[v]));
+            REQUIRE(not_a.test(v) == !in_a[v]);
+        }
+        REQUIRE(not_a.count() == nv - 7);
+        REQUIRE(both.indices() == std::vector<int32_t>{ 3, 64, 199 });
+        REQUIRE((ma - ma).none());
+
+        REQUIRE_THROWS_AS(fs::VertexMask(10) | ma, std::invalid_argument);
+        REQUIRE_THROWS_AS(a.vertex_mask(100), std::invalid_argument);
+    }
+
+    SECTION("Masks can be applied to per-vertex data and used for submeshes." ) {
+        fs::Mesh surface;
+        fs::read_surf(&surface, "examples/read_surf/lh.white");
+        fs::Label cortex;
+        fs::read_label(&cortex, "examples/read_label/lh.cortex.label");
+        fs::Curv curv;
+        fs::read_curv(&curv, "examples/read_curv/lh.thickness");
+        const fs::VertexMask mask = cortex.vertex_mask(surface.num_vertices());
+        REQUIRE(mask.count() == cortex.num_entries());
+
+        std::vector<float> masked = mask.apply(curv.data);
+        std::vector<float> selected = mask.select(curv.data);
+        REQUIRE(selected.size() == mask.count());
+        size_t num_nan = 0;
+        for(size_t v = 0; v < masked.size(); v++) {
+            if(mask.test(v)) {
+                REQUIRE(masked[v] == curv.data[v]);
+            } else {
+                REQUIRE(std::isnan(masked[v]));
+                num_nan++;
+            }
+        }
+        REQUIRE(num_nan == surface.num_vertices() - mask.count());
+
+        // The cortex label vertices are sorted, so the submesh matches the one from the index vector.
+        std::vector<int32_t> sub2full;
+        fs::Mesh patch = surface.submesh_vertex_mask(mask, nullptr, &sub2full);
+        fs::Mesh patch_idx = surface.submesh_vertex_flat(cortex.vertex);
+        REQUIRE(sub2full == mask.indices());
+        REQUIRE(patch.vertices == patch_idx.vertices);
+        REQUIRE(patch.faces == patch_idx.faces);
+        std::vector<float> restored = fs::Mesh::curv_data_for_orig_mesh(selected, sub2full, int32_t(surface.num_vertices()), -1.0f);
+        REQUIRE(restored == mask.apply(curv.data, -1.0f));
+    }
+}
+
+
 TEST_CASE( "Reading the demo annot file works" ) {
 
     fs::Annot annot;
@@ -986,9 +2743,582 @@ TEST_CASE( "Reading the demo annot file works" ) {
         std::vector<uint8_t> vertex_colors_rgba = annot.vertex_colors(true);
         REQUIRE( vertex_colors_rgba.size() == surface_num_vertices * 4);
     }
+
+    SECTION("The region index lookups and region buckets match the per-region scans." ) {
+        REQUIRE(annot.colortable.get_region_idx("bankssts") == 1);
+        REQUIRE(annot.colortable.get_region_idx(annot.colortable.label[5]) == 5);
+        REQUIRE(annot.colortable.get_region_idx("no_such_region") < 0);
+        REQUIRE(annot.colortable.get_region_idx(-12345) < 0);
+
+        fs::AdjacencyCSR buckets = annot.region_vertices_csr();
+        REQUIRE(buckets.num_vertices() == annot.colortable.num_entries());
+        std::vector<size_t> vertex_regions = annot.vertex_regions();
+        std::vector<uint8_t> colors = annot.vertex_colors(true);
+        for(size_t r = 0; r < annot.colortable.num_entries(); r++) {
+            std::vector<int32_t> expected = annot.region_vertices(annot.colortable.label[r]);
+            REQUIRE(std::vector<int32_t>(buckets.neighbors_begin(r), buckets.neighbors_end(r)) == expected);
+            if(! expected.empty()) {
+                REQUIRE(vertex_regions[size_t(expected[0])] == r);
+                REQUIRE(colors[4 * size_t(expected[0]) + 1] == annot.colortable.g[r]);
+            }
+        }
+
+        // Editing entries in place makes the index stale, lookups do not use it until it is rebuilt.
+        REQUIRE(annot.colortable.has_index());
+        annot.colortable.name[1] = "renamed";
+        REQUIRE(! annot.colortable.has_index());
+        REQUIRE(annot.colortable.get_region_idx("renamed") == 1);
+        REQUIRE(annot.colortable.get_region_idx("bankssts") < 0);
+        REQUIRE_THROWS(annot.colortable.name_index());
+        const int32_t old_label = annot.colortable.label[2];
+        annot.colortable.label[2] = 424242;
+        REQUIRE(annot.colortable.get_region_idx(424242) == 2);
+        REQUIRE(annot.colortable.get_region_idx(old_label) != 2);
+        const std::vector<int32_t> old_region_vertices = annot.region_vertices(old_label);
+        if(! old_region_vertices.empty()) {
+            REQUIRE(annot.vertex_regions()[size_t(old_region_vertices[0])] != 2);
+        }
+        annot.colortable.label[2] = old_label;
+        annot.colortable.build_index();
+        REQUIRE(annot.colortable.has_index());
+        REQUIRE(annot.colortable.get_region_idx("renamed") == 1);
+        REQUIRE(annot.colortable.get_region_idx("bankssts") < 0);
+
+        // A stale index is not used, lookups fall back to a scan and vertex_regions keeps the last match.
+        fs::Colortable& ct = annot.colortable;
+        ct.id.push_back(99); ct.name.push_back("dup"); ct.r.push_back(ct.r[5]); ct.g.push_back(ct.g[5]); ct.b.push_back(ct.b[5]); ct.a.push_back(ct.a[5]); ct.label.push_back(ct.label[5]);
+        REQUIRE(! ct.has_index());
+        REQUIRE_THROWS(ct.label_index());
+        REQUIRE(ct.get_region_idx("dup") == int32_t(ct.num_entries() - 1));
+        REQUIRE(ct.get_region_idx(ct.label[5]) == 5);
+        std::vector<size_t> stale_regions = annot.vertex_regions();
+        ct.build_index();
+        REQUIRE(ct.get_region_idx(ct.label[5]) == 5);
+        REQUIRE(annot.vertex_regions() == stale_regions);
+        std::vector<int32_t> region5 = annot.region_vertices(ct.label[5]);
+        if(! region5.empty()) {
+            REQUIRE(stale_regions[size_t(region5[0])] == ct.num_entries() - 1);
+        }
+    }
+
+    SECTION("A negative vertex count in the header is rejected." ) {
+        const std::string data("\xff\xff\xff\xfe", 4);  // -2, big endian.
+        std::istringstream is(data);
+        fs::Annot bad;
+        REQUIRE_THROWS_AS(fs::read_annot(&bad, &is), std::domain_error);
+    }
+}
+
+
+TEST_CASE( "The binary cache file format and the transparent subject cache work." ) {
+
+    fs::Mesh surface;
+    fs::read_surf(&surface, "examples/read_surf/lh.white");
+    const std::vector<float> thickness = fs::read_desc_data("examples/read_curv/lh.thickness");
+    fs::Annot annot;
+    fs::read_annot(&annot, "examples/read_annot/lh.aparc.annot");
+    const std::string cache_file = "examples/read_surf/lh.white.fscache_tmp";
+
+    SECTION("Meshes, adjacency, overlays and annotations survive a write and read cycle." ) {
+        fs::CacheWriter cw;
+        cw.add_mesh("surf/lh.white", surface, "examples/read_surf/lh.white");
+        cw.add_overlay("surf/lh.thickness", thickness, "examples/read_curv/lh.thickness");
+        cw.add_annot("label/lh.aparc.annot", annot);
+        cw.add_overlay("surf/lh.thickness", thickness);  // Replaces the entry.
+        REQUIRE(cw.num_entries() == 4 + 1 + 8);
+        cw.write(cache_file);
+
+        fs::CacheFile cf(cache_file);
+        REQUIRE(cf.entries().size() == 13);
+        for(const fs::CacheFile::Entry& e : cf.entries()) {
+            REQUIRE(e.offset % 64 == 0);
+        }
+        fs::Mesh cached;
+        fs::AdjacencyCSR adj;
+        REQUIRE(cf.get_mesh("surf/lh.white", &cached, &adj));
+        REQUIRE(cached.vertices == surface.vertices);
+        REQUIRE(cached.faces == surface.faces);
+        const fs::AdjacencyCSR adj_ref = surface.as_adjcsr();
+        REQUIRE(adj.offsets == adj_ref.offsets);
+        REQUIRE(adj.neighbors == adj_ref.neighbors);
+        REQUIRE(cf.is_fresh("surf/lh.white:vertices", "examples/read_surf/lh.white"));
+        REQUIRE(! cf.is_fresh("surf/lh.thickness:overlay", "examples/read_curv/lh.thickness"));  // Replaced without source.
+
+        std::vector<float> cached_thickness;
+        REQUIRE(cf.get_overlay("surf/lh.thickness", &cached_thickness));
+        REQUIRE(cached_thickness == thickness);
+        size_t count = 0;
+        const float* view = cf.view<float>("surf/lh.thickness:overlay", &count);
+        REQUIRE(count == thickness.size());
+        REQUIRE(view[100] == thickness[100]);
+
+        fs::Annot cached_annot;
+        REQUIRE(cf.get_annot("label/lh.aparc.annot", &cached_annot));
+        REQUIRE(cached_annot.vertex_labels == annot.vertex_labels);
+        REQUIRE(cached_annot.vertex_indices == annot.vertex_indices);
+        REQUIRE(cached_annot.colortable.name == annot.colortable.name);
+        REQUIRE(cached_annot.colortable.label == annot.colortable.label);
+        REQUIRE(cached_annot.colortable.r == annot.colortable.r);
+
+        REQUIRE(! cf.get_overlay("surf/lh.sulc", &cached_thickness));
+        std::vector<int32_t> wrong_type;
+        REQUIRE_THROWS_AS(cf.get("surf/lh.thickness:overlay", &wrong_type), std::domain_error);
+        REQUIRE_THROWS_AS(cf.get("no_such_entry", &wrong_type), std::out_of_range);
+        REQUIRE_THROWS_AS(cw.add_overlay(std::string(80, 'x'), thickness), std::invalid_argument);
+    }
+
+    SECTION("Invalid and truncated cache files are rejected." ) {
+        fs::CacheWriter cw;
+        cw.add_overlay("surf/lh.thickness", thickness);
+        cw.write(cache_file);
+        std::string bytes;
+        {
+            std::ifstream is(cache_file, std::ios::binary);
+            bytes = std::string((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+        }
+        {
+            std::ofstream os(cache_file, std::ios::binary);
+            os.write(bytes.data(), std::streamsize(bytes.size() - 64));
+        }
+        REQUIRE_THROWS_AS(fs::CacheFile(cache_file), std::domain_error);
+        {
+            // A directory offset for which the end of the single entry wraps around to byte 64.
+            std::string corrupt = bytes;
+            const uint64_t dir_offset = uint64_t(0) - 128 + 64;
+            for(size_t k = 0; k < 8; k++) {
+                corrupt[16 + k] = char((dir_offset >> (8 * k)) & 0xFF);
+            }
+            std::ofstream os(cache_file, std::ios::binary);
+            os.write(corrupt.data(), std::streamsize(corrupt.size()));
+        }
+        REQUIRE_THROWS_AS(fs::CacheFile(cache_file), std::domain_error);
+        REQUIRE_THROWS_AS(fs::CacheFile("examples/read_curv/lh.thickness"), std::domain_error);
+        REQUIRE_THROWS_AS(fs::CacheFile("examples/read_surf/no_such_file"), std::runtime_error);
+
+        fs::Mesh cube = fs::Mesh::construct_cube();
+        fs::CacheWriter cw_bad;
+        cw_bad.add_mesh("surf/cube", cube);
+        std::vector<uint32_t> bad_neighbors = cube.as_adjcsr().neighbors;
+        bad_neighbors[0] = uint32_t(cube.num_vertices());
+        cw_bad.add("surf/cube:adj_neighbors", bad_neighbors);
+        cw_bad.write(cache_file);
+        fs::Mesh cached;
+        REQUIRE_THROWS_AS(fs::CacheFile(cache_file).get_mesh("surf/cube", &cached), std::domain_error);
+    }
+    std::remove(cache_file.c_str());
+
+    SECTION("The subject cache file name is derived from the subject directory." ) {
+        std::string key;
+        REQUIRE(fs::subject_cache_filename("/data/subjects/bert/surf/lh.white", &key) == "/data/subjects/bert.fscache");
+        REQUIRE(key == "surf/lh.white");
+        REQUIRE(fs::subject_cache_filename("bert/label/lh.cortex.label", &key) == "bert.fscache");
+        REQUIRE(key == "label/lh.cortex.label");
+        REQUIRE(fs::subject_cache_filename("surf/lh.white").empty());
+        REQUIRE(fs::subject_cache_filename("/data/lh.white").empty());
+    }
+
+    SECTION("read_mesh and read_desc_data use the subject cache if it is enabled." ) {
+        const std::string subject_cache = "examples/subjects_dir/subject1.fscache";
+        const std::string surf_file = "examples/subjects_dir/subject1/surf/lh.white";
+        const std::string sulc_file = "examples/subjects_dir/subject1/surf/lh.sulc";
+        std::remove(subject_cache.c_str());
+        REQUIRE(! fs::subject_cache_enabled());
+
+        fs::Mesh ref_mesh;
+        fs::read_mesh(&ref_mesh, surf_file);
+        const std::vector<float> ref_sulc = fs::read_desc_data(sulc_file);
+        REQUIRE(! std::ifstream(subject_cache).good());  // Disabled by default.
+
+        fs::set_subject_cache_enabled(true);
+        for(int pass = 0; pass < 2; pass++) {  // The first pass fills the cache, the second one reads from it.
+            fs::Mesh m;
+            fs::read_mesh(&m, surf_file);
+            REQUIRE(m.vertices == ref_mesh.vertices);
+            REQUIRE(m.faces == ref_mesh.faces);
+            REQUIRE(fs::read_desc_data(sulc_file) == ref_sulc);
+        }
+        fs::set_subject_cache_enabled(false);
+
+        fs::CacheFile cf(subject_cache);
+        REQUIRE(cf.is_fresh("surf/lh.white:faces", surf_file));
+        REQUIRE(cf.is_fresh("surf/lh.sulc:overlay", sulc_file));
+        REQUIRE(cf.has("surf/lh.white:adj_neighbors"));
+        std::remove(subject_cache.c_str());
+
+        // Concurrent stores into the same subject cache keep each other's entries.
+        fs::set_subject_cache_enabled(true);
+        #ifdef _OPENMP
+        #pragma omp parallel for num_threads(2)
+        #endif
+        for(std::ptrdiff_t i = 0; i < 2; i++) {
+            if(i == 0) {
+                fs::Mesh m;
+                fs::read_mesh(&m, surf_file);
+            } else {
+                fs::read_desc_data(sulc_file);
+            }
+        }
+        fs::set_subject_cache_enabled(false);
+        fs::CacheFile cf_concurrent(subject_cache);
+        REQUIRE(cf_concurrent.is_fresh("surf/lh.white:faces", surf_file));
+        REQUIRE(cf_concurrent.is_fresh("surf/lh.sulc:overlay", sulc_file));
+        std::remove(subject_cache.c_str());
+        std::remove((subject_cache + ".lock").c_str());
+    }
 }
 
 
+#ifndef LIBFS_INSTRUMENT
+TEST_CASE( "Without LIBFS_INSTRUMENT, no events reach the instrumentation sink." ) {
+    fs::InstrumentRecorder recorder;
+    fs::set_instrument_sink(&fs::InstrumentRecorder::sink, &recorder);
+    fs::Curv curv;
+    fs::read_curv(&curv, "examples/read_curv/lh.thickness");
+    fs::set_instrument_sink(nullptr);
+    REQUIRE(recorder.entries().empty());
+}
+#endif
+
+TEST_CASE( "Readers fill caller-provided buffers and reuse their memory." ) {
+
+    const std::string curv_file = "examples/read_curv/lh.thickness";
+    const std::vector<float> expected = fs::read_curv_data(curv_file);
+
+    SECTION("Curv data can be read into a caller-provided vector, reusing its memory." ) {
+        std::vector<float> data;
+        fs::read_curv_data(curv_file, &data);
+        REQUIRE(data == expected);
+        const float* before = data.data();
+        fs::read_curv_data(curv_file, &data);
+        REQUIRE(data.data() == before);
+        REQUIRE(data == expected);
+        REQUIRE_THROWS(fs::read_curv_data("no/such/file", &data));
+        REQUIRE(data == expected);  // Left intact on error.
+    }
+
+    SECTION("Curv data can be read into a raw buffer, e.g., a matrix row." ) {
+        std::vector<float> matrix(2 * expected.size(), 0.0f);
+        REQUIRE(fs::read_curv_data(curv_file, &matrix[expected.size()], expected.size()) == expected.size());
+        REQUIRE(matrix[0] == 0.0f);
+        REQUIRE(std::equal(expected.begin(), expected.end(), matrix.begin() + std::ptrdiff_t(expected.size())));
+        REQUIRE_THROWS_AS(fs::read_curv_data(curv_file, &matrix[0], expected.size() - 1), std::invalid_argument);
+
+        // A truncated file is an error, not a partially filled row.
+        std::ifstream in(curv_file, std::ios::binary);
+        const std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        const std::string truncated_file = "examples/read_curv/lh.thickness_truncated_tmp";
+        {
+            std::ofstream out(truncated_file, std::ios::binary);
+            out.write(bytes.data(), std::streamsize(bytes.size() / 2));
+        }
+        REQUIRE_THROWS_AS(fs::read_curv_data(truncated_file, &matrix[0], expected.size()), std::domain_error);
+        std::remove(truncated_file.c_str());
+    }
+
+    SECTION("Per-vertex data from curv and MGH files can be read into a caller-provided vector." ) {
+        std::vector<float> data;
+        fs::read_desc_data(curv_file, &data);
+        REQUIRE(data == expected);
+        fs::read_desc_data("examples/read_mgh/lh.thickness.mgh", &data);
+        REQUIRE(data == fs::read_desc_data("examples/read_mgh/lh.thickness.mgh"));
+        REQUIRE(data.size() == expected.size());
+        REQUIRE_THROWS_AS(fs::read_desc_data("examples/read_mgh/brain.mgh", &data), std::domain_error);  // Contains MRI_UCHAR data.
+    }
+
+    SECTION("Reading a surface into an existing mesh reuses its buffers." ) {
+        fs::Mesh surface;
+        fs::read_surf(&surface, "examples/read_surf/lh.white");
+        const float* vertices_before = surface.vertices.data();
+        const int32_t* faces_before = surface.faces.data();
+        const size_t nv = surface.num_vertices();
+        fs::read_surf(&surface, "examples/read_surf/lh.white");
+        REQUIRE(surface.vertices.data() == vertices_before);
+        REQUIRE(surface.faces.data() == faces_before);
+        REQUIRE(surface.num_vertices() == nv);
+    }
+
+    SECTION("Truncated files throw, and the header fields of the target stay untouched." ) {
+        auto read_prefix = [](const std::string& filename, size_t num_bytes) { std::ifstream ifs(filename, std::ios::binary); std::string bytes(num_bytes, '\0'); ifs.read(&bytes[0], std::streamsize(num_bytes)); return bytes; };
+
+        fs::Mesh surface = fs::Mesh::construct_cube();
+        std::istringstream surf_is(read_prefix("examples/read_surf/lh.white", 100000));
+        REQUIRE_THROWS_AS(fs::read_surf(&surface, &surf_is), std::domain_error);
+        REQUIRE(surface.vertices.empty());  // The buffers were moved out for reading.
+        REQUIRE(surface.faces.empty());
+
+        fs::Curv curv;
+        curv.num_vertices = 4;
+        curv.data = std::vector<float>(4, 1.0f);
+        std::istringstream curv_is(read_prefix("examples/read_curv/lh.thickness", 1000));
+        REQUIRE_THROWS_AS(fs::read_curv(&curv, &curv_is), std::domain_error);
+        REQUIRE(curv.num_vertices == 4);
+
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, "examples/read_mgh/lh.thickness.mgh");
+        const fs::Mgh orig = mgh;
+        std::istringstream mgh_is(read_prefix("examples/read_mgh/brain.mgh", 5000));
+        REQUIRE_THROWS_AS(fs::read_mgh(&mgh, &mgh_is), std::domain_error);
+        REQUIRE(mgh.header.dtype == orig.header.dtype);
+        REQUIRE(mgh.header.dim1length == orig.header.dim1length);
+        REQUIRE(mgh.data.data_mri_float == orig.data.data_mri_float);  // A different MRI data type, so untouched.
+    }
+
+    SECTION("Constructors take ownership of their data without copying." ) {
+        std::vector<float> data = expected;
+        const float* before = data.data();
+        fs::Mgh mgh(std::move(data));
+        REQUIRE(mgh.data.data_mri_float.data() == before);
+        REQUIRE(mgh.header.num_values() == expected.size());
+        fs::Curv curv(static_cast<std::vector<float>>(expected));
+        REQUIRE(curv.num_vertices == int32_t(expected.size()));
+    }
+}
+
+TEST_CASE( "Header probes read metadata without reading the data." ) {
+
+    SECTION("The per-format header readers match the full readers." ) {
+        fs::Mesh surface;
+        fs::read_surf(&surface, "examples/read_surf/lh.white");
+        fs::SurfHeader surf_header;
+        fs::read_surf_header(&surf_header, "examples/read_surf/lh.white");
+        REQUIRE(size_t(surf_header.num_vertices) == surface.num_vertices());
+        REQUIRE(size_t(surf_header.num_faces) == surface.num_faces());
+
+        fs::Curv curv;
+        fs::read_curv_header(&curv, "examples/read_curv/lh.thickness");
+        REQUIRE(size_t(curv.num_vertices) == fs::read_curv_data("examples/read_curv/lh.thickness").size());
+        REQUIRE(curv.data.empty());
+
+        fs::Annot annot;
+        fs::read_annot(&annot, "examples/read_annot/lh.aparc.annot");
+        fs::AnnotHeader annot_header;
+        fs::read_annot_header(&annot_header, "examples/read_annot/lh.aparc.annot");
+        REQUIRE(size_t(annot_header.num_vertices) == annot.num_vertices());
+        REQUIRE(annot_header.colortable.num_entries() == annot.colortable.num_entries());
+        REQUIRE(annot_header.colortable.name == annot.colortable.name);
+        REQUIRE(annot_header.colortable.label == annot.colortable.label);
+
+        fs::MghHeader mgh_header;
+        fs::read_mgh_header(&mgh_header, "examples/read_mgh/brain.mgh");
+        REQUIRE(mgh_header.dim1length == 256);
+        REQUIRE(mgh_header.dim2length == 256);
+        REQUIRE(mgh_header.dim3length == 256);
+        REQUIRE(mgh_header.dim4length == 1);
+        REQUIRE(mgh_header.dtype == fs::MRI_UCHAR);
+        REQUIRE(mgh_header.ras_good_flag == 1);
+        REQUIRE(mgh_header.xsize == Approx(1.0));
+        REQUIRE(mgh_header.Mdc.size() == 9);
+    }
+
+    SECTION("The header readers reject files of the wrong format." ) {
+        fs::SurfHeader surf_header;
+        REQUIRE_THROWS_AS(fs::read_surf_header(&surf_header, "examples/read_curv/lh.thickness"), std::domain_error);
+        REQUIRE_THROWS_AS(fs::read_surf_header(&surf_header, "no/such/file"), std::runtime_error);
+        fs::Curv curv;
+        REQUIRE_THROWS_AS(fs::read_curv_header(&curv, "examples/read_surf/lh.white"), std::domain_error);
+        REQUIRE_THROWS_AS(fs::read_curv_header(&curv, "examples/read_metadata/subjects.txt"), std::domain_error);
+        fs::AnnotHeader annot_header;
+        REQUIRE_THROWS_AS(fs::read_annot_header(&annot_header, "examples/read_curv/lh.thickness"), std::domain_error);
+        fs::MghHeader mgh_header;
+        REQUIRE_THROWS_AS(fs::read_mgh_header(&mgh_header, "no/such/file.mgh"), std::runtime_error);
+    }
+
+    SECTION("Files can be probed individually and in batches, with format detection." ) {
+        const fs::FileInfo surf_info = fs::probe_file("examples/read_surf/lh.white");
+        REQUIRE(surf_info.ok());
+        REQUIRE(surf_info.format == fs::FILEFORMAT_SURF);
+        REQUIRE(surf_info.num_vertices == 149244);
+        const fs::FileInfo curv_info = fs::probe_file("examples/read_curv/lh.thickness");
+        REQUIRE(curv_info.format == fs::FILEFORMAT_CURV);
+        REQUIRE(curv_info.num_vertices == 149244);
+        const fs::FileInfo unknown_info = fs::probe_file("examples/read_metadata/subjects.txt");
+        REQUIRE(unknown_info.format == fs::FILEFORMAT_UNKNOWN);
+        REQUIRE(! unknown_info.ok());
+        REQUIRE(unknown_info.error.empty());
+
+        const std::vector<std::string> files = { "examples/read_annot/lh.aparc.annot", "examples/read_mgh/lh.thickness.mgh", "no/such/file.mgh" };
+        const std::vector<fs::FileInfo> infos = fs::probe_files(files, 2);
+        REQUIRE(infos.size() == 3);
+        REQUIRE(infos[0].format == fs::FILEFORMAT_ANNOT);
+        REQUIRE(infos[0].num_vertices == 149244);
+        REQUIRE(infos[0].colortable.num_entries() == 36);
+        REQUIRE(infos[1].ok());
+        REQUIRE(size_t(infos[1].mgh_header.num_values()) == 149244);
+        REQUIRE(infos[1].mgh_header.dtype == fs::MRI_FLOAT);
+        REQUIRE(infos[2].format == fs::FILEFORMAT_MGH);
+        REQUIRE(! infos[2].ok());
+        REQUIRE(! infos[2].error.empty());
+    }
+
+    SECTION("A directory tree can be listed and probed." ) {
+        const std::vector<std::string> files = fs::util::list_files("examples/subjects_dir");
+        REQUIRE(files.size() == 6);
+        REQUIRE(files[0] == "examples/subjects_dir/subject1/label/lh.aparc.annot");
+        REQUIRE(fs::util::list_files("examples/subjects_dir", false).empty());
+        REQUIRE_THROWS_AS(fs::util::list_files("no/such/dir"), std::runtime_error);
+
+        const std::vector<fs::FileInfo> infos = fs::probe_dir("examples/subjects_dir");
+        REQUIRE(infos.size() == 5);  // The label file has an unknown format.
+        std::map<std::string, int> formats;
+        for(size_t i = 0; i < infos.size(); i++) {
+            #ifdef LIBFS_WITH_ZLIB
+            REQUIRE(infos[i].ok());
+            #else
+            REQUIRE((infos[i].ok() || fs::util::is_mgz_filename(infos[i].filename)));
+            #endif
+            formats[infos[i].filename] = infos[i].format;
+        }
+        REQUIRE(formats["examples/subjects_dir/subject1/label/lh.aparc.annot"] == fs::FILEFORMAT_ANNOT);
+        REQUIRE(formats["examples/subjects_dir/subject1/mri/brain.mgh"] == fs::FILEFORMAT_MGH);
+        REQUIRE(formats["examples/subjects_dir/subject1/surf/lh.sulc"] == fs::FILEFORMAT_CURV);
+        REQUIRE(formats["examples/subjects_dir/subject1/surf/lh.white"] == fs::FILEFORMAT_SURF);
+        #ifdef LIBFS_WITH_ZLIB
+        REQUIRE(formats["examples/subjects_dir/subject1/mri/brain.mgz"] == fs::FILEFORMAT_MGH);
+        #endif
+    }
+}
+
+TEST_CASE( "Single-buffer MGH volumes and the Array4D accessors work." ) {
+
+    SECTION("An Array4D can take ownership of data and offers checked, unchecked, row and slab access." ) {
+        std::vector<int32_t> values(2 * 3 * 4 * 5);
+        std::iota(values.begin(), values.end(), 0);
+        const int32_t* before = values.data();
+        fs::Array4D<int32_t> arr(2, 3, 4, 5, std::move(values));
+        REQUIRE(arr.data.data() == before);
+        REQUIRE(arr.num_values() == 120);
+        REQUIRE(arr.at(1, 2, 3, 4) == 119);
+        REQUIRE(arr(1, 2, 3, 4) == 119);
+        REQUIRE(arr(1, 0, 2, 1) == arr.at(1, 0, 2, 1));
+        const std::array<size_t, 4> strides = arr.strides();
+        REQUIRE(strides[0] == 60);
+        REQUIRE(strides[1] == 20);
+        REQUIRE(strides[2] == 5);
+        REQUIRE(strides[3] == 1);
+        REQUIRE(arr.get_index(1, 1, 1, 1) == strides[0] + strides[1] + strides[2] + strides[3]);
+        REQUIRE(arr.row(1, 2, 3) == &arr(1, 2, 3, 0));
+        REQUIRE(arr.slab(1)[0] == 60);
+        arr(0, 0, 0, 0) = -1;
+        arr.at(0, 0, 0, 1) = -2;
+        REQUIRE(arr.data[0] == -1);
+        REQUIRE(arr.data[1] == -2);
+        REQUIRE_THROWS_AS(fs::Array4D<int32_t>(2, 3, 4, 5, std::vector<int32_t>(7)), std::invalid_argument);
+
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, "examples/read_mgh/brain.mgh");
+        REQUIRE(&mgh.data.values<uint8_t>() == &mgh.data.data_mri_uchar);
+        REQUIRE(&mgh.data.values<float>() == &mgh.data.data_mri_float);
+        fs::Array4D<uint8_t> copied(&mgh.header);
+        copied.data = mgh.data.data_mri_uchar;
+        const uint8_t* mgh_before = mgh.data.data_mri_uchar.data();
+        fs::Array4D<uint8_t> brain(mgh.header, std::move(mgh.data.data_mri_uchar));
+        REQUIRE(brain.data.data() == mgh_before);
+        REQUIRE(brain.d1 == 256);
+        REQUIRE(brain(99, 99, 99, 0) == copied.at(99, 99, 99, 0));
+        REQUIRE(brain.data == copied.data);
+    }
+
+    SECTION("MGH files can be read into a single buffer of another type, converting while reading." ) {
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, "examples/read_mgh/brain.mgh");
+        fs::MghVolume<float> vol;
+        fs::read_mgh_volume(&vol, "examples/read_mgh/brain.mgh");
+        REQUIRE(vol.header.dtype == fs::MRI_FLOAT);
+        REQUIRE(vol.header.dim1length == 256);
+        REQUIRE(vol.header.ras_good_flag == mgh.header.ras_good_flag);
+        REQUIRE(vol.data.num_values() == mgh.data.data_mri_uchar.size());
+        REQUIRE(vol.data.data.size() == mgh.data.data_mri_uchar.size());
+        bool all_equal = true;
+        for(size_t i = 0; i < vol.data.data.size(); i++) {
+            all_equal = all_equal && vol.data.data[i] == float(mgh.data.data_mri_uchar[i]);
+        }
+        REQUIRE(all_equal);
+
+        fs::MghVolume<uint8_t> vol_uchar;
+        fs::read_mgh_volume(&vol_uchar, "examples/read_mgh/brain.mgh");
+        REQUIRE(vol_uchar.data.data == mgh.data.data_mri_uchar);
+
+        fs::MghVolume<float> thickness;
+        fs::read_mgh_volume(&thickness, "examples/read_mgh/lh.thickness.mgh");
+        REQUIRE(thickness.data.data == fs::read_desc_data("examples/read_mgh/lh.thickness.mgh"));
+
+        // Float data read into integer volumes is rounded toward zero and saturates.
+        fs::MghVolume<int32_t> thickness_int;
+        fs::read_mgh_volume(&thickness_int, "examples/read_mgh/lh.thickness.mgh");
+        REQUIRE(thickness_int.header.dtype == fs::MRI_INT);
+        REQUIRE(thickness_int.data.data.size() == thickness.data.data.size());
+        bool all_truncated = true;
+        for(size_t i = 0; i < thickness.data.data.size(); i++) {
+            all_truncated = all_truncated && thickness_int.data.data[i] == int32_t(thickness.data.data[i]);
+        }
+        REQUIRE(all_truncated);
+
+        std::vector<float> special = { std::numeric_limits<float>::quiet_NaN(), 1.0e10f, -1.0e10f, 3.7f, -3.7f, 300.0f, -300.0f, 40000.0f };
+        fs::Mgh special_mgh(special);
+        std::stringstream special_stream;
+        fs::write_mgh(special_mgh, special_stream);
+        const std::string special_bytes = special_stream.str();
+        std::istringstream special_in(special_bytes);
+        fs::MghVolume<uint8_t> special_uchar;
+        fs::read_mgh_volume(&special_uchar, &special_in);
+        REQUIRE(special_uchar.data.data == std::vector<uint8_t>({ 0, 255, 0, 3, 0, 255, 0, 255 }));
+        special_in.clear(); special_in.seekg(0);
+        fs::MghVolume<short> special_short;
+        fs::read_mgh_volume(&special_short, &special_in);
+        REQUIRE(special_short.data.data == std::vector<short>({ 0, 32767, -32768, 3, -3, 300, -300, 32767 }));
+        fs::Mgh int_source(std::vector<float>(3));
+        int_source.header.dtype = fs::MRI_INT;
+        int_source.data.data_mri_float.clear();
+        int_source.data.data_mri_int = { -70000, 100, 70000 };
+        std::stringstream int_stream;
+        fs::write_mgh(int_source, int_stream);
+        fs::MghVolume<short> int_short;
+        fs::read_mgh_volume(&int_short, &int_stream);
+        REQUIRE(int_short.data.data == std::vector<short>({ -32768, 100, 32767 }));
+
+        // A truncated file leaves the volume untouched.
+        std::istringstream truncated(special_bytes.substr(0, 284 + 10));  // The header and 2.5 of the 8 values.
+        REQUIRE_THROWS(fs::read_mgh_volume(&special_short, &truncated));
+        REQUIRE(special_short.data.data.size() == 8);
+        REQUIRE(special_short.data.d1 == 8);
+
+        #ifdef LIBFS_WITH_ZLIB
+        fs::MghVolume<float> vol_mgz;
+        fs::read_mgh_volume(&vol_mgz, "examples/read_mgz/brain.mgz");
+        REQUIRE(vol_mgz.data.data == vol.data.data);
+        #endif
+    }
+
+    SECTION("MGH volumes take ownership of Mgh data and can be written." ) {
+        fs::Mgh mgh;
+        fs::read_mgh(&mgh, "examples/read_mgh/brain.mgh");
+        fs::Mgh wrong_type = mgh;
+        REQUIRE_THROWS_AS(fs::MghVolume<float>(std::move(wrong_type)), std::domain_error);
+        const std::vector<uint8_t> expected = mgh.data.data_mri_uchar;
+        const uint8_t* before = mgh.data.data_mri_uchar.data();
+        fs::MghVolume<uint8_t> vol(std::move(mgh));
+        REQUIRE(vol.data.data.data() == before);
+
+        fs::MghVolume<float> vol_float;
+        fs::read_mgh_volume(&vol_float, "examples/read_mgh/brain.mgh");
+        const std::string out_file = "examples/read_mgh/brain_float_tmp.mgh";
+        fs::write_mgh(vol_float, out_file);
+        fs::Mgh reread;
+        fs::read_mgh(&reread, out_file);
+        std::remove(out_file.c_str());
+        REQUIRE(reread.header.dtype == fs::MRI_FLOAT);
+        REQUIRE(reread.header.dim1length == 256);
+        REQUIRE(reread.header.xsize == vol_float.header.xsize);
+        REQUIRE(reread.data.data_mri_float == vol_float.data.data);
+
+        fs::Mgh inconsistent;
+        inconsistent.header = reread.header;
+        inconsistent.data.data_mri_float.resize(3);
+        std::ostringstream os;
+        REQUIRE_THROWS_AS(fs::write_mgh(inconsistent, os), std::logic_error);
+    }
+}
+
 TEST_CASE( "Reading metadata works" ) {
 
 